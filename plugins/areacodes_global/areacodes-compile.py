@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# The rm project
+# Copyright (c) 2012-2017 Jan-Michael Brummer
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+#
+# Compiles globalareacodes.csv into the binary digit trie read by the
+# areacodes_global plugin (see areacodes_global.c for the format).
+#
+# Usage: areacodes-compile.py <input.csv> <output.bin>
+
+import csv
+import struct
+import sys
+
+MAGIC = b'RMAC'
+VERSION = 2
+
+NODE = struct.Struct('<III')
+
+
+class Node:
+	def __init__(self):
+		self.children = {}
+		self.value = 0
+
+
+def normalize(country_code, area_code):
+	# "(1+)264" style NANP entries carry the area code after the bracket
+	area_code = area_code.split(')')[-1]
+	country_code = ''.join(c for c in country_code if c.isdigit())
+	area_code = ''.join(c for c in area_code if c.isdigit())
+
+	# Numbers are looked up in international format, drop the trunk prefix
+	if area_code.startswith('0'):
+		area_code = area_code[1:]
+
+	return country_code, area_code
+
+
+def pack_trie(entries):
+	"""Packs key/value pairs into nodes, children of a node are stored consecutively (breadth first)"""
+	root = Node()
+
+	for key, value in entries.items():
+		node = root
+		for digit in key:
+			node = node.children.setdefault(int(digit), Node())
+		node.value = value
+
+	nodes = [root]
+	data = bytearray()
+	index = 0
+	while index < len(nodes):
+		node = nodes[index]
+		mask = 0
+		for digit in node.children:
+			mask |= 1 << digit
+		data += NODE.pack(mask, len(nodes) if mask else 0, node.value)
+		nodes.extend(node.children[digit] for digit in sorted(node.children))
+		index += 1
+
+	return len(nodes), data
+
+
+def pack_partition(areas):
+	"""Self-contained per country partition: node count, string pool size, nodes, string pool"""
+	strings = bytearray()
+	offsets = {}
+	entries = {}
+
+	for area_code, city in areas.items():
+		if city not in offsets:
+			offsets[city] = len(strings)
+			strings += city.encode('utf-8') + b'\0'
+		entries[area_code] = offsets[city] + 1
+
+	n_nodes, nodes = pack_trie(entries)
+
+	return struct.pack('<II', n_nodes, len(strings)) + nodes + strings
+
+
+def main(argv):
+	if len(argv) != 3:
+		sys.stderr.write('Usage: %s <input.csv> <output.bin>\n' % argv[0])
+		return 1
+
+	countries = {}
+
+	with open(argv[1], newline='', encoding='utf-8') as f:
+		reader = csv.reader(f)
+		next(reader)
+
+		for row in reader:
+			if len(row) != 4:
+				continue
+
+			country_code, area_code = normalize(row[1], row[3])
+			city = row[2].strip()
+			if not country_code or not area_code or not city:
+				continue
+
+			# Later entries replace earlier ones, same as the former hash table
+			countries.setdefault(country_code, {})[area_code] = city
+
+	codes = sorted(countries)
+	n_index, index = pack_trie({code: i + 1 for i, code in enumerate(codes)})
+	partitions = [pack_partition(countries[code]) for code in codes]
+
+	offset = 16 + len(index) + 8 * len(codes)
+	table = bytearray()
+	for partition in partitions:
+		table += struct.pack('<II', offset, len(partition))
+		offset += len(partition)
+
+	with open(argv[2], 'wb') as f:
+		f.write(MAGIC + struct.pack('<III', VERSION, len(codes), n_index))
+		f.write(index)
+		f.write(table)
+		for partition in partitions:
+			f.write(partition)
+
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))
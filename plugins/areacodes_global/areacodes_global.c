@@ -23,115 +23,334 @@
 #include <stdio.h>
 
 #include <glib.h>
+#include <gio/gio.h>
 
 #include <rm/rm.h>
 
-#include "csv.h"
+/*
+ * Area code data is compiled at build time by areacodes-compile.py into per country partitions (little endian):
+ *  - header: "RMAC", version, number of countries, number of index nodes
+ *  - index: digit trie of country codes, value is country index + 1
+ *  - country table: file offset and size of each partition
+ *  - partitions: number of nodes, size of string pool, digit trie of area codes (without trunk prefix),
+ *    NUL-terminated UTF-8 city names; trie values are city offset + 1 (0 if none)
+ *
+ * Children of a node are stored consecutively so the child index is first_child plus the number of
+ * lower digits within mask. Only header, index and country table are read at init, partitions are
+ * loaded on first use and at most AREACODES_MAX_COUNTRIES of them stay resident.
+ */
+#define AREACODES_MAGIC "RMAC"
+#define AREACODES_VERSION 2
+#define AREACODES_MAX_COUNTRIES 8
+
+typedef struct {
+	gchar magic[4];
+	guint32 version;
+	guint32 n_countries;
+	guint32 n_index;
+} RmAreaCodesHeader;
+
+typedef struct {
+	guint32 mask;
+	guint32 first_child;
+	guint32 value;
+} RmAreaCodesNode;
+
+typedef struct {
+	guint32 offset;
+	guint32 size;
+} RmAreaCodesCountry;
+
+typedef struct {
+	guint32 n_nodes;
+	guint32 strings_size;
+} RmAreaCodesPartitionHeader;
+
+typedef struct {
+	guint32 country;
+	gpointer data;
+	const RmAreaCodesNode *nodes;
+	guint32 n_nodes;
+	const gchar *strings;
+	guint32 strings_size;
+} RmAreaCodesPartition;
 
 typedef struct {
 	guint signal_id;
-	GHashTable *table;
+	GFileInputStream *stream;
+	RmAreaCodesNode *index;
+	guint32 n_index;
+	RmAreaCodesCountry *countries;
+	guint32 n_countries;
+	/* Resident partitions, most recently used first */
+	GQueue partitions;
+	GMutex mutex;
 } RmGlobalAreaCodesPlugin;
 
 /**
- * areacodes_get_area_code:
- * @areacodes_plugin: a #RmGlobalAreaCodesPlugin
- * @full_number: full phone number
+ * areacodes_bits:
+ * @mask: child digit mask
+ *
+ * Count set bits of @mask.
+ *
+ * Returns: number of set bits
+ */
+static inline guint areacodes_bits(guint32 mask)
+{
+	guint count = 0;
+
+	for (; mask; mask &= mask - 1) {
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * areacodes_walk:
+ * @nodes: digit trie nodes
+ * @n_nodes: number of nodes
+ * @digits: digits to look up
+ * @length: location to store number of matched digits or %NULL
  *
- * Get area code pointer based on full_number
+ * Longest-prefix walk through a digit trie.
  *
- * Returns: a #RmAreaCode
+ * Returns: value of the longest matching key or 0
  */
-RmAreaCode *areacodes_get_area_code(RmGlobalAreaCodesPlugin *areacodes_plugin, const gchar *full_number)
+static guint32 areacodes_walk(const RmAreaCodesNode *nodes, guint32 n_nodes, const gchar *digits, gsize *length)
 {
-	RmAreaCode *areacode;
-	gchar sub_string[7];
-	gint index;
-	gint len = strlen(full_number);
+	const RmAreaCodesNode *node = nodes;
+	guint32 ret = 0;
+	gsize i;
 
-	index = len > 6 ? 6 : len;
+	for (i = 0; g_ascii_isdigit(digits[i]); i++) {
+		guint32 mask = GUINT32_FROM_LE(node->mask);
+		guint digit = digits[i] - '0';
+		guint32 index;
 
-	while (index-- > 0) {
-		memset(sub_string, 0, sizeof(sub_string));
-		strncpy(sub_string, full_number + 2, index);
+		if (!(mask & (1 << digit))) {
+			break;
+		}
+
+		index = GUINT32_FROM_LE(node->first_child) + areacodes_bits(mask & ((1 << digit) - 1));
+		if (index >= n_nodes) {
+			break;
+		}
 
-		areacode = g_hash_table_lookup(areacodes_plugin->table, sub_string);
-		if (areacode) {
-			return areacode;
+		node = &nodes[index];
+		if (node->value) {
+			ret = GUINT32_FROM_LE(node->value);
+			if (length) {
+				*length = i + 1;
+			}
 		}
 	}
 
-	return NULL;
+	return ret;
 }
 
 /**
- * areacodes_get_city:
+ * areacodes_read:
  * @areacodes_plugin: a #RmGlobalAreaCodesPlugin
- * @number: remote caller number
+ * @offset: file offset
+ * @size: number of bytes to read
  *
- * Lookup city name by number
+ * Read a section of the area code data file.
  *
- * Returns: city name or empty string
+ * Returns: newly allocated data or %NULL on error
  */
-static gchar *areacodes_get_city(RmGlobalAreaCodesPlugin *areacodes_plugin, gchar *number)
+static gpointer areacodes_read(RmGlobalAreaCodesPlugin *areacodes_plugin, goffset offset, gsize size)
 {
-	RmAreaCode *areacode = NULL;
-	gchar *full_number;
-	gchar *ret = NULL;
-	gint len;
-	gchar sub_string[6];
-	gchar *local_number;
+	GError *error = NULL;
+	gpointer data;
+	gsize read = 0;
 
-	if (!areacodes_plugin->table) {
-		return g_strdup("");
+	if (!size || !g_seekable_seek(G_SEEKABLE(areacodes_plugin->stream), offset, G_SEEK_SET, NULL, &error)) {
+		g_clear_error(&error);
+		return NULL;
 	}
 
-	full_number = rm_number_full(number, TRUE);
+	data = g_try_malloc(size);
+	if (!data) {
+		return NULL;
+	}
+
+	if (!g_input_stream_read_all(G_INPUT_STREAM(areacodes_plugin->stream), data, size, &read, NULL, &error) || read != size) {
+		g_debug("%s(): Could not read areacodes: %s", __FUNCTION__, error ? error->message : "short read");
+		g_clear_error(&error);
+		g_free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+/**
+ * areacodes_partition_free:
+ * @partition: a #RmAreaCodesPartition
+ *
+ * Free partition and its data.
+ */
+static void areacodes_partition_free(RmAreaCodesPartition *partition)
+{
+	g_free(partition->data);
+	g_slice_free(RmAreaCodesPartition, partition);
+}
+
+/**
+ * areacodes_partition_load:
+ * @areacodes_plugin: a #RmGlobalAreaCodesPlugin
+ * @country: country index
+ *
+ * Load and validate partition of @country.
+ *
+ * Returns: a new #RmAreaCodesPartition or %NULL on error
+ */
+static RmAreaCodesPartition *areacodes_partition_load(RmGlobalAreaCodesPlugin *areacodes_plugin, guint32 country)
+{
+	RmAreaCodesCountry *entry = &areacodes_plugin->countries[country];
+	RmAreaCodesPartitionHeader *header;
+	RmAreaCodesPartition *partition;
+	gsize size = GUINT32_FROM_LE(entry->size);
+	gsize n_nodes;
+	gsize strings_size;
+
+	if (size < sizeof(RmAreaCodesPartitionHeader)) {
+		return NULL;
+	}
+
+	header = areacodes_read(areacodes_plugin, GUINT32_FROM_LE(entry->offset), size);
+	if (!header) {
+		return NULL;
+	}
 
-	/* Find area code */
-	areacode = areacodes_get_area_code(areacodes_plugin, full_number);
+	n_nodes = GUINT32_FROM_LE(header->n_nodes);
+	strings_size = GUINT32_FROM_LE(header->strings_size);
+	size -= sizeof(RmAreaCodesPartitionHeader);
 
-	if (!areacode) {
-		g_free(full_number);
-		return g_strdup("");
+	/* Validate section sizes, string pool must be terminated */
+	if (!n_nodes || n_nodes > size / sizeof(RmAreaCodesNode) || strings_size != size - n_nodes * sizeof(RmAreaCodesNode) ||
+	    (strings_size && ((gchar *)header)[sizeof(RmAreaCodesPartitionHeader) + size - 1] != '\0')) {
+		g_debug("%s(): Invalid partition %u", __FUNCTION__, country);
+		g_free(header);
+		return NULL;
 	}
 
-	local_number = g_strdup_printf("0%s", full_number + 2 + areacode->skip);
-	g_free(full_number);
+	partition = g_slice_new(RmAreaCodesPartition);
+	partition->country = country;
+	partition->data = header;
+	partition->nodes = (const RmAreaCodesNode *)(header + 1);
+	partition->n_nodes = n_nodes;
+	partition->strings = (const gchar *)(partition->nodes + n_nodes);
+	partition->strings_size = strings_size;
+
+	return partition;
+}
+
+/**
+ * areacodes_partition_get:
+ * @areacodes_plugin: a #RmGlobalAreaCodesPlugin
+ * @country: country index
+ *
+ * Get resident partition of @country, loading it on first use. Least recently used partitions
+ * are dropped once more than AREACODES_MAX_COUNTRIES are resident. Must be called with mutex held.
+ *
+ * Returns: a #RmAreaCodesPartition owned by @areacodes_plugin or %NULL on error
+ */
+static RmAreaCodesPartition *areacodes_partition_get(RmGlobalAreaCodesPlugin *areacodes_plugin, guint32 country)
+{
+	RmAreaCodesPartition *partition;
+	GList *list;
+
+	for (list = areacodes_plugin->partitions.head; list; list = list->next) {
+		partition = list->data;
+
+		if (partition->country == country) {
+			g_queue_unlink(&areacodes_plugin->partitions, list);
+			g_queue_push_head_link(&areacodes_plugin->partitions, list);
 
-	len = strlen(local_number);
+			return partition;
+		}
+	}
+
+	partition = areacodes_partition_load(areacodes_plugin, country);
+	if (!partition) {
+		return NULL;
+	}
 
-	/* Check for a 3 char match */
-	if (len >= 3 && !ret) {
-		memset(sub_string, 0, sizeof(sub_string));
-		strncpy(sub_string, local_number, 3);
+	g_debug("%s(): Loaded partition %u (%u nodes)", __FUNCTION__, country, partition->n_nodes);
+	g_queue_push_head(&areacodes_plugin->partitions, partition);
 
-		ret = g_hash_table_lookup(areacode->table, sub_string);
+	while (g_queue_get_length(&areacodes_plugin->partitions) > AREACODES_MAX_COUNTRIES) {
+		areacodes_partition_free(g_queue_pop_tail(&areacodes_plugin->partitions));
 	}
 
-	/* Check for a 4 char match */
-	if (len >= 4 && !ret) {
-		memset(sub_string, 0, sizeof(sub_string));
-		strncpy(sub_string, local_number, 4);
+	return partition;
+}
+
+/**
+ * areacodes_lookup:
+ * @areacodes_plugin: a #RmGlobalAreaCodesPlugin
+ * @digits: number in international format without international access code
+ *
+ * Finds the country partition by country code and walks its area codes with the remaining digits.
+ *
+ * Returns: newly allocated city name or %NULL
+ */
+static gchar *areacodes_lookup(RmGlobalAreaCodesPlugin *areacodes_plugin, const gchar *digits)
+{
+	RmAreaCodesPartition *partition;
+	gchar *city = NULL;
+	gsize length = 0;
+	guint32 country;
+
+	/* Index is freed on shutdown, walk it with the mutex held */
+	g_mutex_lock(&areacodes_plugin->mutex);
 
-		ret = g_hash_table_lookup(areacode->table, sub_string);
+	if (!areacodes_plugin->index) {
+		g_mutex_unlock(&areacodes_plugin->mutex);
+		return NULL;
 	}
 
-	/* Check for a 5 char match */
-	if (len >= 5 && !ret) {
-		memset(sub_string, 0, sizeof(sub_string));
-		strncpy(sub_string, local_number, 5);
+	country = areacodes_walk(areacodes_plugin->index, areacodes_plugin->n_index, digits, &length);
+	partition = country && country <= areacodes_plugin->n_countries ? areacodes_partition_get(areacodes_plugin, country - 1) : NULL;
+	if (partition) {
+		guint32 value = areacodes_walk(partition->nodes, partition->n_nodes, digits + length, NULL);
 
-		ret = g_hash_table_lookup(areacode->table, sub_string);
+		if (value && value <= partition->strings_size) {
+			city = g_strdup(partition->strings + value - 1);
+		}
 	}
 
-	g_free(local_number);
+	g_mutex_unlock(&areacodes_plugin->mutex);
+
+	return city;
+}
+
+/**
+ * areacodes_get_city:
+ * @areacodes_plugin: a #RmGlobalAreaCodesPlugin
+ * @number: remote caller number
+ *
+ * Lookup city name by number
+ *
+ * Returns: city name or empty string
+ */
+static gchar *areacodes_get_city(RmGlobalAreaCodesPlugin *areacodes_plugin, gchar *number)
+{
+	gchar *full_number;
+	gchar *city = NULL;
+
+	full_number = rm_number_full(number, TRUE);
 
-	if (!ret) {
-		return g_strdup("");
+	/* Skip international access code */
+	if (strlen(full_number) > 2) {
+		city = areacodes_lookup(areacodes_plugin, full_number + 2);
 	}
 
-	return rm_convert_utf8(ret, -1);
+	g_free(full_number);
+
+	return city ? city : g_strdup("");
 }
 
 /**
@@ -157,6 +376,48 @@ static void areacodes_contact_process_cb(RmObject *obj, RmContact *contact, gpoi
 	contact->city = areacodes_get_city(areacodes_plugin, contact->number);
 }
 
+/**
+ * areacodes_load_index:
+ * @areacodes_plugin: a #RmGlobalAreaCodesPlugin
+ *
+ * Read header, country code index and country table.
+ *
+ * Returns: %TRUE if data file is usable
+ */
+static gboolean areacodes_load_index(RmGlobalAreaCodesPlugin *areacodes_plugin)
+{
+	RmAreaCodesHeader *header = areacodes_read(areacodes_plugin, 0, sizeof(RmAreaCodesHeader));
+	guint32 n_countries;
+	guint32 n_index;
+
+	if (!header) {
+		return FALSE;
+	}
+
+	n_countries = GUINT32_FROM_LE(header->n_countries);
+	n_index = GUINT32_FROM_LE(header->n_index);
+
+	if (memcmp(header->magic, AREACODES_MAGIC, 4) || GUINT32_FROM_LE(header->version) != AREACODES_VERSION || !n_index) {
+		g_free(header);
+		return FALSE;
+	}
+	g_free(header);
+
+	areacodes_plugin->index = areacodes_read(areacodes_plugin, sizeof(RmAreaCodesHeader), (gsize)n_index * sizeof(RmAreaCodesNode));
+	areacodes_plugin->countries = areacodes_read(areacodes_plugin, sizeof(RmAreaCodesHeader) + (goffset)n_index * sizeof(RmAreaCodesNode), (gsize)n_countries * sizeof(RmAreaCodesCountry));
+
+	if (!areacodes_plugin->index || !areacodes_plugin->countries) {
+		g_clear_pointer(&areacodes_plugin->index, g_free);
+		g_clear_pointer(&areacodes_plugin->countries, g_free);
+		return FALSE;
+	}
+
+	areacodes_plugin->n_index = n_index;
+	areacodes_plugin->n_countries = n_countries;
+
+	return TRUE;
+}
+
 /**
  * areacodes_plugin_init:
  * @plugin: a #RmPlugin
@@ -168,32 +429,32 @@ static void areacodes_contact_process_cb(RmObject *obj, RmContact *contact, gpoi
 static gboolean areacodes_plugin_init(RmPlugin *plugin)
 {
 	RmGlobalAreaCodesPlugin *areacodes_plugin = g_slice_alloc0(sizeof(RmGlobalAreaCodesPlugin));
-	gchar *areacodes = g_build_filename(rm_get_directory(RM_PLUGINS), "areacodes_global", "globalareacodes.csv", NULL);
-	gchar *data;
-	gsize read;
+	gchar *areacodes = g_build_filename(rm_get_directory(RM_PLUGINS), "areacodes_global", "globalareacodes.bin", NULL);
+	GFile *file = g_file_new_for_path(areacodes);
+	GError *error = NULL;
 
 	g_debug("AreaCodes: '%s'", areacodes);
 
 	plugin->priv = areacodes_plugin;
+	g_mutex_init(&areacodes_plugin->mutex);
 
-	/* Load data file */
-	data = rm_file_load(areacodes, &read);
-	if (!data || read < 1) {
-		g_debug("Could not load areacodes: %s", areacodes);
-		g_free(data);
+	/* Only the country index is read now, partitions follow on demand */
+	areacodes_plugin->stream = g_file_read(file, NULL, &error);
+	g_object_unref(file);
+
+	if (!areacodes_plugin->stream || !areacodes_load_index(areacodes_plugin)) {
+		g_debug("Could not load areacodes: %s", error ? error->message : areacodes);
+		g_clear_error(&error);
+		g_clear_object(&areacodes_plugin->stream);
 		g_free(areacodes);
 
+		g_mutex_clear(&areacodes_plugin->mutex);
+		g_slice_free(RmGlobalAreaCodesPlugin, areacodes_plugin);
+		plugin->priv = NULL;
+
 		return FALSE;
 	}
 
-	/* Make sure data is terminated */
-	data[read - 1] = '\0';
-
-	/* Parse data */
-	areacodes_plugin->table = csv_parse_global_areacodes_data(data);
-
-	/* Free data */
-	g_free(data);
 	g_free(areacodes);
 
 	/* Connect to "contact-process" signal using "after" as this should come last */
@@ -219,10 +480,19 @@ static gboolean areacodes_plugin_shutdown(RmPlugin *plugin)
 		g_signal_handler_disconnect(G_OBJECT(rm_object), areacodes_plugin->signal_id);
 	}
 
-	/* Free hash table */
-	if (areacodes_plugin->table) {
-		g_hash_table_unref(areacodes_plugin->table);
+	/* Drop resident partitions and index */
+	g_mutex_lock(&areacodes_plugin->mutex);
+	while (!g_queue_is_empty(&areacodes_plugin->partitions)) {
+		areacodes_partition_free(g_queue_pop_head(&areacodes_plugin->partitions));
 	}
+	g_clear_pointer(&areacodes_plugin->index, g_free);
+	g_clear_pointer(&areacodes_plugin->countries, g_free);
+	g_clear_object(&areacodes_plugin->stream);
+	g_mutex_unlock(&areacodes_plugin->mutex);
+
+	g_mutex_clear(&areacodes_plugin->mutex);
+	g_slice_free(RmGlobalAreaCodesPlugin, areacodes_plugin);
+	plugin->priv = NULL;
 
 	return TRUE;
 }
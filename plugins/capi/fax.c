@@ -349,10 +349,8 @@ void capi_fax_data(CapiConnection *connection, _cmsg capi_message)
  * @data: a #CapiConnection
  *
  * Transfer fax
- *
- * Returns: %NULL
  */
-static gpointer capi_fax_tx_thread(gpointer data)
+static void capi_fax_tx_thread(gpointer data)
 {
 	struct session *session = capi_get_session();
 	CapiConnection *connection = data;
@@ -378,8 +376,6 @@ static gpointer capi_fax_tx_thread(gpointer data)
 			g_usleep(10);
 		}
 	}
-
-	return NULL;
 }
 
 /**
@@ -390,7 +386,7 @@ static gpointer capi_fax_tx_thread(gpointer data)
  */
 void capi_fax_init_data(CapiConnection *connection)
 {
-	g_thread_new("fax-tx-thread", capi_fax_tx_thread, connection);
+	rm_executor_run(RM_EXECUTOR_PRIORITY_STREAM, "fax-tx", capi_fax_tx_thread, connection);
 }
 
 /**
@@ -39,9 +39,8 @@ int recording_close(struct recorder *recorder);
 /**
  * \brief Input audio handler
  * \param data capi connection pointer
- * \return NULL
  */
-gpointer capi_phone_input_thread(gpointer data)
+static void capi_phone_input_thread(gpointer data)
 {
 	struct session *session = capi_get_session();
 	struct capi_connection *connection = data;
@@ -73,8 +72,6 @@ gpointer capi_phone_input_thread(gpointer data)
 	if (connection->recording) {
 		recording_close(&connection->recorder);
 	}
-
-	return NULL;
 }
 
 void capi_phone_init_data(struct capi_connection *connection)
@@ -85,7 +82,7 @@ void capi_phone_init_data(struct capi_connection *connection)
 	if (session->input_thread_state == 0) {
 		session->input_thread_state = 1;
 
-		g_thread_new("phone-input", capi_phone_input_thread, connection);
+		rm_executor_run(RM_EXECUTOR_PRIORITY_STREAM, "phone-input", capi_phone_input_thread, connection);
 	}
 }
 
@@ -283,53 +283,227 @@ gboolean firmware_tr64_dial_number(RmProfile *profile, gint port, const gchar *n
 	return TRUE;
 }
 
+#define FIRMWARE_TR64_VOIP_CONTROL "x_voip"
+#define FIRMWARE_TR64_VOIP_SERVICE "urn:dslforum-org:service:X_VoIP:1"
+
+typedef struct _FirmwareTr64Discovery FirmwareTr64Discovery;
+typedef struct _FirmwareTr64Step FirmwareTr64Step;
+
 /**
- * firmware_tr64_get_settings:
- * @profile: a #RmProfile
+ * FirmwareTr64StepFunc:
+ * @discovery: a #FirmwareTr64Discovery
+ * @step: a #FirmwareTr64Step
+ * @msg: response of the step's action, %NULL on error (see @step's error) or for local steps
  *
- * Get settings of router
+ * Processes the result of a discovery step.
  *
  * Returns: %TRUE on success
  */
-gboolean firmware_tr64_get_settings(RmProfile *profile)
+typedef gboolean (*FirmwareTr64StepFunc)(FirmwareTr64Discovery *discovery, FirmwareTr64Step *step, SoupMessage *msg);
+
+/**
+ * FirmwareTr64Step:
+ *
+ * Node of the settings discovery graph: a TR-064 action (or a local step if @action is %NULL)
+ * which is started as soon as all steps it depends on are finished.
+ */
+struct _FirmwareTr64Step {
+	FirmwareTr64Discovery *discovery;
+	const gchar *action;
+	const gchar *arg_name;
+	gchar *arg_value;
+	FirmwareTr64StepFunc func;
+	/* Failure aborts the discovery */
+	gboolean required;
+	/* Number of unfinished steps this step depends on */
+	guint n_depends;
+	GSList *dependents;
+	/* Step specific index, e.g. phone port */
+	gint index;
+	/* Reason the action failed */
+	GError *error;
+};
+
+/**
+ * FirmwareTr64Discovery:
+ *
+ * State of a settings discovery.
+ */
+struct _FirmwareTr64Discovery {
+	RmProfile *profile;
+	GMainLoop *loop;
+	GPtrArray *steps;
+	/* Steps in flight */
+	guint running;
+	gboolean failed;
+	gchar **numbers;
+};
+
+/**
+ * firmware_tr64_step_free:
+ * @data: a #FirmwareTr64Step
+ *
+ * Frees a discovery step.
+ */
+static void firmware_tr64_step_free(gpointer data)
+{
+	FirmwareTr64Step *step = data;
+
+	g_free(step->arg_value);
+	g_slist_free(step->dependents);
+	g_clear_error(&step->error);
+	g_slice_free(FirmwareTr64Step, step);
+}
+
+/**
+ * firmware_tr64_step_new:
+ * @discovery: a #FirmwareTr64Discovery
+ * @action: TR-064 action of X_VoIP service or %NULL for a local step
+ * @func: result function
+ * @required: whether failure aborts the discovery
+ *
+ * Adds a step to the discovery graph.
+ *
+ * Returns: a new #FirmwareTr64Step owned by @discovery
+ */
+static FirmwareTr64Step *firmware_tr64_step_new(FirmwareTr64Discovery *discovery, const gchar *action, FirmwareTr64StepFunc func, gboolean required)
+{
+	FirmwareTr64Step *step = g_slice_new0(FirmwareTr64Step);
+
+	step->discovery = discovery;
+	step->action = action;
+	step->func = func;
+	step->required = required;
+
+	g_ptr_array_add(discovery->steps, step);
+
+	return step;
+}
+
+/**
+ * firmware_tr64_step_depends:
+ * @step: a #FirmwareTr64Step
+ * @dependency: a #FirmwareTr64Step which has to be finished before @step
+ *
+ * Adds an edge to the discovery graph.
+ */
+static void firmware_tr64_step_depends(FirmwareTr64Step *step, FirmwareTr64Step *dependency)
+{
+	dependency->dependents = g_slist_prepend(dependency->dependents, step);
+	step->n_depends++;
+}
+
+static void firmware_tr64_step_run(FirmwareTr64Step *step);
+
+/**
+ * firmware_tr64_step_finish:
+ * @step: a #FirmwareTr64Step
+ * @success: result of @step
+ *
+ * Starts all steps waiting only for @step and ends discovery once nothing is in flight.
+ */
+static void firmware_tr64_step_finish(FirmwareTr64Step *step, gboolean success)
+{
+	FirmwareTr64Discovery *discovery = step->discovery;
+	GSList *list;
+
+	if (!success) {
+		g_debug("%s(): %s failed: %s", __FUNCTION__, step->action ? step->action : "local step", step->error ? step->error->message : "invalid data");
+		if (step->required) {
+			discovery->failed = TRUE;
+		}
+	}
+
+	for (list = step->dependents; list != NULL && !discovery->failed; list = list->next) {
+		FirmwareTr64Step *dependent = list->data;
+
+		if (--dependent->n_depends == 0) {
+			firmware_tr64_step_run(dependent);
+		}
+	}
+
+	if (--discovery->running == 0) {
+		g_main_loop_quit(discovery->loop);
+	}
+}
+
+/**
+ * firmware_tr64_step_cb:
+ * @source: unused
+ * @result: a #GAsyncResult
+ * @user_data: a #FirmwareTr64Step
+ *
+ * Action of a step finished.
+ */
+static void firmware_tr64_step_cb(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	FirmwareTr64Step *step = user_data;
+	g_autoptr(SoupMessage) msg = NULL;
+
+	msg = rm_network_tr64_request_finish(result, &step->error);
+
+	firmware_tr64_step_finish(step, step->func(step->discovery, step, msg));
+}
+
+/**
+ * firmware_tr64_step_run:
+ * @step: a #FirmwareTr64Step
+ *
+ * Sends the action of @step, local steps are processed right away.
+ */
+static void firmware_tr64_step_run(FirmwareTr64Step *step)
+{
+	FirmwareTr64Discovery *discovery = step->discovery;
+
+	discovery->running++;
+
+	if (!step->action) {
+		firmware_tr64_step_finish(step, step->func(discovery, step, NULL));
+		return;
+	}
+
+	rm_network_tr64_request_async(discovery->profile, TRUE, FIRMWARE_TR64_VOIP_CONTROL, (gchar*)step->action, FIRMWARE_TR64_VOIP_SERVICE, NULL, firmware_tr64_step_cb, step, step->arg_name, step->arg_value, NULL);
+}
+
+/**
+ * firmware_tr64_get_numbers:
+ * @discovery: a #FirmwareTr64Discovery
+ * @step: a #FirmwareTr64Step
+ * @msg: X_AVM-DE_GetNumbers response
+ *
+ * Extract numbers
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean firmware_tr64_get_numbers(FirmwareTr64Discovery *discovery, FirmwareTr64Step *step, SoupMessage *msg)
 {
 	RmXmlNode *node;
 	RmXmlNode *child;
-	g_autoptr(SoupMessage) msg = NULL;
 	GRegex *lt;
 	GRegex *gt;
-	gchar *new_number_list;
-	gchar *lt_out;
-	gchar *gt_out;
-	gchar *fax_msn;
-	gchar **numbers = NULL;
-	gchar *areacode;
-	gchar *okz_prefix;
-	gchar *countrycode;
-	gchar *lkz_prefix;
-	gsize i;
-	gsize len;
+	g_autofree gchar *new_number_list = NULL;
+	g_autofree gchar *lt_out = NULL;
+	g_autofree gchar *gt_out = NULL;
 
-	g_test_timer_start();
-	msg = rm_network_tr64_request(profile, TRUE, "x_voip", "X_AVM-DE_GetNumbers", "urn:dslforum-org:service:X_VoIP:1", NULL);
 	if (!msg) {
 		return FALSE;
 	}
 
-	if (msg->status_code != SOUP_STATUS_OK) {
-		g_debug("%s(): Received status code: %d", __FUNCTION__, msg->status_code);
-		return FALSE;
-	}
 	rm_log_save_data("tr64-getnumbers.xml", msg->response_body->data, msg->response_body->length);
 
-	/* Extract numbers */
 	new_number_list = rm_utils_xml_extract_tag(msg->response_body->data, "NewNumberList");
+	if (!new_number_list) {
+		return FALSE;
+	}
+
 	lt = g_regex_new("&lt;", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
 	lt_out = g_regex_replace_literal(lt, new_number_list, -1, 0, "<", 0, NULL);
 	gt = g_regex_new("&gt;", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
 	gt_out = g_regex_replace_literal(gt, lt_out, -1, 0, ">", 0, NULL);
+	g_regex_unref(lt);
+	g_regex_unref(gt);
 
-	node = rm_xmlnode_from_str(gt_out, msg->response_body->length);
+	node = rm_xmlnode_from_str(gt_out, -1);
 	if (node == NULL) {
 		g_debug("%s(): No node....\n", __FUNCTION__);
 		return FALSE;
@@ -340,7 +514,8 @@ gboolean firmware_tr64_get_settings(RmProfile *profile)
 		g_autofree gchar *type;
 		g_autofree gchar *index;
 		g_autofree gchar *name;
-		gchar *number;
+		g_autofree gchar *number;
+		gchar **numbers;
 
 		tmp = rm_xmlnode_get_child(child, "Number");
 		number = rm_xmlnode_get_data(tmp);
@@ -353,57 +528,109 @@ gboolean firmware_tr64_get_settings(RmProfile *profile)
 
 		g_debug("%s(): %s, %s, %s, %s", __FUNCTION__, number, index, type, name);
 
-		numbers = rm_strv_add(numbers, number);
+		/* rm_strv_add() returns a copy */
+		numbers = rm_strv_add(discovery->numbers, number);
+		g_strfreev(discovery->numbers);
+		discovery->numbers = numbers;
 	}
-	g_settings_set_strv(profile->settings, "numbers", (const gchar*const*)numbers);
+	rm_xmlnode_free(node);
 
-	/* Extract area code */
-	msg = rm_network_tr64_request(profile, TRUE, "x_voip", "GetVoIPCommonAreaCode", "urn:dslforum-org:service:X_VoIP:1", NULL);
-	if (msg == NULL) {
+	g_settings_set_strv(discovery->profile->settings, "numbers", (const gchar*const*)discovery->numbers);
+
+	return TRUE;
+}
+
+/**
+ * firmware_tr64_get_area_code:
+ * @discovery: a #FirmwareTr64Discovery
+ * @step: a #FirmwareTr64Step
+ * @msg: GetVoIPCommonAreaCode response
+ *
+ * Extract area code
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean firmware_tr64_get_area_code(FirmwareTr64Discovery *discovery, FirmwareTr64Step *step, SoupMessage *msg)
+{
+	g_autofree gchar *areacode = NULL;
+	g_autofree gchar *okz_prefix = NULL;
+
+	if (!msg) {
 		return FALSE;
 	}
 
-	if (msg->status_code != SOUP_STATUS_OK) {
-		g_debug("%s(): Received status code: %d", __FUNCTION__, msg->status_code);
+	areacode = rm_utils_xml_extract_tag(msg->response_body->data, "NewVoIPAreaCode");
+	if (RM_EMPTY_STRING(areacode)) {
 		return FALSE;
 	}
 
-	areacode = rm_utils_xml_extract_tag(msg->response_body->data, "NewVoIPAreaCode");
 	g_debug("%s(): Area code %s", __FUNCTION__, areacode);
-	g_settings_set_string(profile->settings, "area-code", areacode + 1);
+	g_settings_set_string(discovery->profile->settings, "area-code", areacode + 1);
 
 	okz_prefix = g_strdup_printf("%1.1s", areacode);
-	g_settings_set_string(profile->settings, "national-access-code", okz_prefix);
+	g_settings_set_string(discovery->profile->settings, "national-access-code", okz_prefix);
 	g_debug("%s(): OKZ prefix %s", __FUNCTION__, okz_prefix);
 
-	/* Extract country code */
-	msg = rm_network_tr64_request(profile, TRUE, "x_voip", "GetVoIPCommonCountryCode", "urn:dslforum-org:service:X_VoIP:1", NULL);
-	if (msg == NULL) {
+	return TRUE;
+}
+
+/**
+ * firmware_tr64_get_country_code:
+ * @discovery: a #FirmwareTr64Discovery
+ * @step: a #FirmwareTr64Step
+ * @msg: GetVoIPCommonCountryCode response
+ *
+ * Extract country code
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean firmware_tr64_get_country_code(FirmwareTr64Discovery *discovery, FirmwareTr64Step *step, SoupMessage *msg)
+{
+	g_autofree gchar *countrycode = NULL;
+	g_autofree gchar *lkz_prefix = NULL;
+
+	if (!msg) {
 		return FALSE;
 	}
 
-	if (msg->status_code != SOUP_STATUS_OK) {
-		g_debug("%s(): Received status code: %d", __FUNCTION__, msg->status_code);
+	countrycode = rm_utils_xml_extract_tag(msg->response_body->data, "NewVoIPCountryCode");
+	if (!countrycode || strlen(countrycode) < 2) {
 		return FALSE;
 	}
 
-	countrycode = rm_utils_xml_extract_tag(msg->response_body->data, "NewVoIPCountryCode");
 	g_debug("%s(): Country code %s", __FUNCTION__, countrycode);
-	g_settings_set_string(profile->settings, "country-code", countrycode + 2);
+	g_settings_set_string(discovery->profile->settings, "country-code", countrycode + 2);
 	lkz_prefix = g_strdup_printf("%2.2s", countrycode);
-	g_settings_set_string(profile->settings, "international-access-code", lkz_prefix);
+	g_settings_set_string(discovery->profile->settings, "international-access-code", lkz_prefix);
 	g_debug("%s(): LKZ prefix %s", __FUNCTION__, lkz_prefix);
 
-	/* Set fax information */
+	return TRUE;
+}
+
+/**
+ * firmware_tr64_set_fax:
+ * @discovery: a #FirmwareTr64Discovery
+ * @step: a #FirmwareTr64Step
+ * @msg: unused
+ *
+ * Set fax information, needs numbers and area/country code for formatting
+ *
+ * Returns: %TRUE
+ */
+static gboolean firmware_tr64_set_fax(FirmwareTr64Discovery *discovery, FirmwareTr64Step *step, SoupMessage *msg)
+{
+	RmProfile *profile = discovery->profile;
+	gsize len;
+
 	g_settings_set_string(profile->settings, "fax-header", "Roger Router");
 
 	g_settings_set_string(fritzbox_settings, "fax-number", "");
 	g_settings_set_string(profile->settings, "fax-ident", "");
 
-	if (numbers != NULL) {
-		len = g_strv_length(numbers);
+	if (discovery->numbers != NULL) {
+		len = g_strv_length(discovery->numbers);
 		if (len) {
-			fax_msn = len > 1 ? numbers[1] : numbers[0];
+			gchar *fax_msn = len > 1 ? discovery->numbers[1] : discovery->numbers[0];
 
 			g_settings_set_string(profile->settings, "fax-number", fax_msn);
 
@@ -413,31 +640,116 @@ gboolean firmware_tr64_get_settings(RmProfile *profile)
 		}
 	}
 
-	/* Extract phone names for dialer */
+	return TRUE;
+}
+
+/**
+ * firmware_tr64_get_phone_port:
+ * @discovery: a #FirmwareTr64Discovery
+ * @step: a #FirmwareTr64Step
+ * @msg: X_AVM-DE_GetPhonePort response
+ *
+ * Extract phone name for dialer
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean firmware_tr64_get_phone_port(FirmwareTr64Discovery *discovery, FirmwareTr64Step *step, SoupMessage *msg)
+{
+	const gchar *setting_name = fritzbox_phone_ports[step->index].setting_name;
+	g_autofree gchar *phone = NULL;
+
+	if (!msg) {
+		g_settings_set_string(fritzbox_settings, setting_name, "");
+
+		/* The router answers an index beyond the configured ports with a fault */
+		return g_error_matches(step->error, RM_NETWORK_TR64_ERROR, RM_NETWORK_TR64_ERROR_ARRAY_INDEX_INVALID) ||
+		       g_error_matches(step->error, RM_NETWORK_TR64_ERROR, RM_NETWORK_TR64_ERROR_INVALID_ARGS);
+	}
+
+	phone = rm_utils_xml_extract_tag(msg->response_body->data, "NewX_AVM-DE_PhoneName");
+	g_debug("%s(): Phone '%s' to '%s'", __FUNCTION__, phone, setting_name);
+	g_settings_set_string(fritzbox_settings, setting_name, phone ? phone : "");
+
+	return TRUE;
+}
+
+/**
+ * firmware_tr64_get_settings:
+ * @profile: a #RmProfile
+ *
+ * Get settings of router. The first action fetches the digest challenge, afterwards all independent
+ * actions are sent at once sharing its nonce. Steps which need results of others (fax identity) are
+ * started as soon as these are available.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean firmware_tr64_get_settings(RmProfile *profile)
+{
+	FirmwareTr64Discovery discovery = { NULL };
+	FirmwareTr64Step *numbers;
+	FirmwareTr64Step *area_code;
+	FirmwareTr64Step *country_code;
+	FirmwareTr64Step *fax;
+	GMainContext *context;
+	guint i;
+
+	g_test_timer_start();
+
+	/* Responses are dispatched within our own context, we block until all steps are done */
+	context = g_main_context_new();
+	g_main_context_push_thread_default(context);
+
+	discovery.profile = profile;
+	discovery.loop = g_main_loop_new(context, FALSE);
+	discovery.steps = g_ptr_array_new_with_free_func(firmware_tr64_step_free);
+
+	/* Authenticate once, so that the parallel actions do not race for their own challenges */
+	numbers = firmware_tr64_step_new(&discovery, "X_AVM-DE_GetNumbers", firmware_tr64_get_numbers, TRUE);
+
+	area_code = firmware_tr64_step_new(&discovery, "GetVoIPCommonAreaCode", firmware_tr64_get_area_code, TRUE);
+	firmware_tr64_step_depends(area_code, numbers);
+	country_code = firmware_tr64_step_new(&discovery, "GetVoIPCommonCountryCode", firmware_tr64_get_country_code, TRUE);
+	firmware_tr64_step_depends(country_code, numbers);
+
+	fax = firmware_tr64_step_new(&discovery, NULL, firmware_tr64_set_fax, TRUE);
+	firmware_tr64_step_depends(fax, numbers);
+	firmware_tr64_step_depends(fax, area_code);
+	firmware_tr64_step_depends(fax, country_code);
+
 	for (i = 1; i < PORT_MAX; i++) {
-		gchar *phone;
-		gchar *num = g_strdup_printf("%ld", i);
+		FirmwareTr64Step *port = firmware_tr64_step_new(&discovery, "X_AVM-DE_GetPhonePort", firmware_tr64_get_phone_port, FALSE);
 
+		port->arg_name = "NewIndex";
+		port->arg_value = g_strdup_printf("%u", i);
+		port->index = i - 1;
+		firmware_tr64_step_depends(port, numbers);
+	}
 
-		msg = rm_network_tr64_request(profile, TRUE, "x_voip", "X_AVM-DE_GetPhonePort", "urn:dslforum-org:service:X_VoIP:1", "NewIndex", num, NULL);
-		if (msg == NULL) {
-			g_settings_set_string(fritzbox_settings, fritzbox_phone_ports[i - 1].setting_name, "");
-			break;
-		}
+	for (i = 0; i < discovery.steps->len; i++) {
+		FirmwareTr64Step *step = g_ptr_array_index(discovery.steps, i);
 
-		if (msg->status_code != SOUP_STATUS_OK) {
-			g_debug("%s(): Received status code: %d", __FUNCTION__, msg->status_code);
-			g_settings_set_string(fritzbox_settings, fritzbox_phone_ports[i - 1].setting_name, "");
-			break;
+		if (!step->n_depends) {
+			firmware_tr64_step_run(step);
 		}
+	}
 
-		phone = rm_utils_xml_extract_tag(msg->response_body->data, "NewX_AVM-DE_PhoneName");
-		g_debug("%s(): Phone '%s' to '%s'", __FUNCTION__, phone, fritzbox_phone_ports[i - 1].setting_name);
-		g_settings_set_string(fritzbox_settings, fritzbox_phone_ports[i - 1].setting_name, phone);
+	if (discovery.running) {
+		g_main_loop_run(discovery.loop);
 	}
 
+	g_main_context_pop_thread_default(context);
+	g_main_loop_unref(discovery.loop);
+	g_main_context_unref(context);
+
+	g_ptr_array_free(discovery.steps, TRUE);
+	g_strfreev(discovery.numbers);
+
 	g_debug("%s(): Execution time: %f", __FUNCTION__, g_test_timer_elapsed());
 
+	if (discovery.failed) {
+		return FALSE;
+	}
+
 	/* START: Set defaults for values which aren't used with TR-064 implementation */
 	g_settings_set_string(fritzbox_settings, "fax-volume", "");
 	g_settings_set_uint(fritzbox_settings, "port", 0);
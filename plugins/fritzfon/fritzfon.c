@@ -26,7 +26,13 @@
 
 #include <rm/rm.h>
 
+/** Maximum edge length of decoded contact images */
+#define FRITZFON_IMAGE_SIZE 128
+/** Number of parallel image download workers */
+
 static GList *contacts = NULL;
+/** Sorted contacts for indexed access, same order as contacts */
+static GPtrArray *fritzfon_contacts = NULL;
 static GSettings *fritzfon_settings = NULL;
 
 static RmXmlNode *master_node = NULL;
@@ -39,11 +45,93 @@ struct fritzfon_book {
 struct fritzfon_priv {
 	gchar *unique_id;
 	gchar *image_url;
+	gchar *mod_time;
 	GList *nodes;
+	/* Serialized nodes of a contact restored from snapshot, parsed on demand */
+	gchar *nodes_xml;
+};
+
+struct fritzfon_image_job {
+	RmProfile *profile;
+	RmContact *contact;
+	gchar *url;
+	gchar *mod_time;
+	guint generation;
+	GdkPixbuf *image;
 };
 
 static GList *fritzfon_books = NULL;
 
+/** Local phonebook snapshot (unique id -> #RmContact) of the last sync */
+static GHashTable *fritzfon_snapshot = NULL;
+/** Phonebook timestamp of the last sync */
+static gchar *fritzfon_timestamp = NULL;
+/** Cancellable of the background revalidation */
+static GCancellable *fritzfon_cancellable = NULL;
+
+enum fritzfon_edit_type {
+	FRITZFON_EDIT_SAVE,
+	FRITZFON_EDIT_REMOVE
+};
+
+struct fritzfon_edit {
+	enum fritzfon_edit_type type;
+	/* Edited contact (save only), %NULL once the contact is gone */
+	RmContact *contact;
+	/* Unique id of contact on router */
+	gchar *unique_id;
+	/* Serialized contact entry (save only) */
+	gchar *data;
+	/* Unique id assigned by router for new entries */
+	gchar *new_unique_id;
+};
+
+/** Delay in ms to collect edits before they are written to the router */
+#define FRITZFON_EDIT_DELAY 500
+
+/** Pending contact edits, at most one per contact */
+static GList *fritzfon_edits = NULL;
+/** Pending flush of the contact edits */
+static guint fritzfon_edit_flush_id = 0;
+/** Whether a flush is currently running */
+static gboolean fritzfon_edit_running = FALSE;
+/** Edits of the running flush */
+static GList *fritzfon_edits_running = NULL;
+/** Cancellable of the running flush, cancelled on shutdown */
+static GCancellable *fritzfon_edit_cancellable = NULL;
+/** Per entry write support of router: -1 unknown, 0 unsupported, 1 supported */
+static gint fritzfon_entry_support = -1;
+/** Per entry action for saving: TRUE for SetPhonebookEntryUID, FALSE for SetPhonebookEntry */
+static gboolean fritzfon_entry_uid_action = TRUE;
+
+/** Snapshot file format version */
+#define FRITZFON_SNAPSHOT_VERSION 2
+/** Snapshot: (version, owner, numbering plan, timestamp, [(book id, book name)], [(uniqueid, mod_time, name, image url, nodes, [(type, label, number)])]) */
+#define FRITZFON_SNAPSHOT_TYPE "(ussssa(ss)a(sssssa(iss)))"
+
+/** Whether image jobs may be queued */
+static gboolean fritzfon_image_active = FALSE;
+/** Number of queued and running image jobs, protected by fritzfon_image_results_mutex */
+static guint fritzfon_image_jobs = 0;
+/** Signalled whenever an image job is done */
+static GCond fritzfon_image_cond;
+/** Main context used to hand loaded images back to the contact list */
+static GMainContext *fritzfon_main_context = NULL;
+/** Contact list generation, bumped whenever the list is rebuilt */
+static guint fritzfon_generation = 0;
+/** Generation for which the image workers already logged in */
+static guint fritzfon_image_login_generation = 0;
+/** Serializes router login of the image workers */
+static GMutex fritzfon_image_mutex;
+/** Pending (coalesced) contacts-changed emission */
+static guint fritzfon_image_changed_id = 0;
+/** Loaded images waiting to be set to their contacts */
+static GSList *fritzfon_image_results = NULL;
+/** Pending hand over of fritzfon_image_results to the main context */
+static guint fritzfon_image_apply_id = 0;
+/** Protects fritzfon_image_results, fritzfon_image_apply_id and fritzfon_image_jobs */
+static GMutex fritzfon_image_results_mutex;
+
 static gchar *fritzfon_load_image_ftp(RmProfile *profile, gchar *image_ptr, gsize *len)
 {
 	gchar *buffer = NULL;
@@ -75,10 +163,6 @@ static gchar *fritzfon_load_image(RmProfile *profile, gchar *image_ptr, gsize *l
 	g_autofree gchar *url = NULL;
 	g_autofree gchar *host = rm_router_get_host(profile);
 
-	if (!rm_router_login(profile)) {
-		return NULL;
-	}
-
 	/* Skip external images as they would need authentication that RM does not have */
 	if (!strncmp(image_ptr, "/download.lua?path=http", 22)) {
 		return NULL;
@@ -109,309 +193,1136 @@ static gchar *fritzfon_load_image(RmProfile *profile, gchar *image_ptr, gsize *l
 #endif
 }
 
-static void parse_person(RmContact *contact, RmXmlNode *person)
+/**
+ * fritzfon_image_job_free:
+ * @data: a fritzfon image job
+ *
+ * Frees image job data.
+ */
+static void fritzfon_image_job_free(gpointer data)
 {
-	RmXmlNode *name;
-	RmXmlNode *image;
-	gchar *image_ptr;
-	struct fritzfon_priv *priv = contact->priv;
-	RmProfile *profile = rm_profile_get_active();
+	struct fritzfon_image_job *job = data;
 
-	/* Get real name entry */
-	name = rm_xmlnode_get_child(person, "realName");
-	contact->name = name ? rm_xmlnode_get_data(name) : g_strdup("");
+	g_free(job->url);
+	g_free(job->mod_time);
+	g_clear_object(&job->image);
 
-	if (contact->name == NULL) {
-		g_debug("%s(): real name not valid, setting fallback\n", __FUNCTION__);
-		contact->name = g_strdup("");
-	}
+	g_slice_free(struct fritzfon_image_job, job);
+}
 
-	/* Get image */
-	image = rm_xmlnode_get_child(person, "imageURL");
-	if (image != NULL) {
-		image_ptr = rm_xmlnode_get_data(image);
-		priv->image_url = image_ptr;
-		if (image_ptr != NULL) {
-			gchar *buffer;
-			gsize len;
-
-			if (rm_router_need_ftp(profile)) {
-				buffer = fritzfon_load_image_ftp(profile, image_ptr, &len);
-			} else {
-				buffer = fritzfon_load_image(profile, image_ptr, &len);
-			}
+/**
+ * fritzfon_contact_free:
+ * @data: a #RmContact of this address book
+ *
+ * Frees contact including its fritzfon private data.
+ */
+static void fritzfon_contact_free(gpointer data)
+{
+	RmContact *contact = data;
+	struct fritzfon_priv *priv = contact->priv;
 
-			if (buffer) {
-				GdkPixbufLoader *loader;
+	if (priv) {
+		g_free(priv->unique_id);
+		g_free(priv->image_url);
+		g_free(priv->mod_time);
+		g_list_free_full(priv->nodes, (GDestroyNotify)rm_xmlnode_free);
+		g_free(priv->nodes_xml);
 
-				loader = gdk_pixbuf_loader_new();
-				if (gdk_pixbuf_loader_write(loader, (guchar*)buffer, len, NULL)) {
-					contact->image = gdk_pixbuf_loader_get_pixbuf(loader);
-				}
-				gdk_pixbuf_loader_close(loader, NULL);
-			}
-		}
+		g_slice_free(struct fritzfon_priv, priv);
 	}
+
+	rm_contact_free(contact);
+	g_slice_free(RmContact, contact);
 }
 
-static void parse_telephony(RmContact *contact, RmXmlNode *telephony)
+/**
+ * fritzfon_edit_forget:
+ * @contact: a #RmContact which is about to be freed or handed back to the caller
+ *
+ * Detach pending and running edits from @contact, edits of a detached contact are dropped.
+ */
+static void fritzfon_edit_forget(RmContact *contact)
 {
-	RmXmlNode *child;
-	gchar *number = NULL;
+	GList *list;
 
-	/* Check for numbers */
-	for (child = rm_xmlnode_get_child(telephony, "number"); child != NULL; child = rm_xmlnode_get_next_twin(child)) {
-		const gchar *type;
+	for (list = fritzfon_edits; list != NULL; list = list->next) {
+		struct fritzfon_edit *edit = list->data;
 
-		type = rm_xmlnode_get_attrib(child, "type");
-		if (type == NULL) {
-			continue;
+		if (edit->contact == contact) {
+			edit->contact = NULL;
 		}
+	}
 
-		number = rm_xmlnode_get_data(child);
-		if (!RM_EMPTY_STRING(number)) {
-			RmPhoneNumber *phone_number;
-
-			phone_number = g_slice_new(RmPhoneNumber);
-			if (strcmp(type, "mobile") == 0) {
-				phone_number->type = RM_PHONE_NUMBER_TYPE_MOBILE;
-			} else if (strcmp(type, "home") == 0) {
-				phone_number->type = RM_PHONE_NUMBER_TYPE_HOME;
-			} else if (strcmp(type, "work") == 0) {
-				phone_number->type = RM_PHONE_NUMBER_TYPE_WORK;
-			} else if (strcmp(type, "fax_work") == 0) {
-				phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_WORK;
-			} else if (strcmp(type, "fax_home") == 0) {
-				phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_HOME;
-			} else if (strcmp(type, "pager") == 0) {
-				phone_number->type = RM_PHONE_NUMBER_TYPE_PAGER;
-			} else if (strncmp(type, "label:", 6) == 0) {
-				phone_number->name = g_strdup (type + 6);
-				phone_number->type = RM_PHONE_NUMBER_TYPE_OTHER;
-			} else {
-				phone_number->type = -1;
-				g_debug("Unhandled phone number type: '%s' / %s", type, number);
-			}
-			phone_number->number = rm_number_full(number, FALSE);
-			contact->numbers = g_list_prepend(contact->numbers, phone_number);
-		}
+	for (list = fritzfon_edits_running; list != NULL; list = list->next) {
+		struct fritzfon_edit *edit = list->data;
 
-		g_free(number);
+		if (edit->contact == contact) {
+			edit->contact = NULL;
+		}
 	}
 }
 
-static void contact_add(RmProfile *profile, RmXmlNode *node, gint count)
+/**
+ * fritzfon_contacts_release:
+ * @old_array: contact array to release
+ * @new_array: contact array replacing @old_array, or %NULL
+ *
+ * Frees @old_array and all of its contacts which are not part of @new_array.
+ */
+static void fritzfon_contacts_release(GPtrArray *old_array, GPtrArray *new_array)
 {
-	RmXmlNode *tmp;
-	RmContact *contact;
-	struct fritzfon_priv *priv;
+	GHashTable *kept = g_hash_table_new(NULL, NULL);
+	guint i;
 
-	contact = g_slice_new0(RmContact);
-	priv = g_slice_new0(struct fritzfon_priv);
-	contact->priv = priv;
+	for (i = 0; new_array && i < new_array->len; i++) {
+		g_hash_table_add(kept, g_ptr_array_index(new_array, i));
+	}
 
-	for (tmp = node->child; tmp != NULL; tmp = tmp->next) {
-		if (tmp->name == NULL) {
-			continue;
-		}
+	for (i = 0; i < old_array->len; i++) {
+		RmContact *contact = g_ptr_array_index(old_array, i);
 
-		if (!strcmp(tmp->name, "person")) {
-			parse_person(contact, tmp);
-		} else if (!strcmp(tmp->name, "telephony")) {
-			parse_telephony(contact, tmp);
-		} else if (!strcmp(tmp->name, "uniqueid")) {
-			priv->unique_id = rm_xmlnode_get_data(tmp);
-		} else if (!strcmp(tmp->name, "mod_time")) {
-			/* empty */
-		} else {
-			/* Unhandled node, save it */
-			priv->nodes = g_list_prepend(priv->nodes, rm_xmlnode_copy(tmp));
+		if (!g_hash_table_contains(kept, contact)) {
+			fritzfon_edit_forget(contact);
+			fritzfon_contact_free(contact);
 		}
 	}
 
-	contacts = g_list_insert_sorted(contacts, contact, rm_contact_name_compare);
+	g_hash_table_destroy(kept);
+	g_ptr_array_unref(old_array);
 }
 
-static void phonebook_add(RmProfile *profile, RmXmlNode *node)
+/**
+ * fritzfon_image_cache_file:
+ * @url: image url
+ * @mod_time: contact modification time
+ *
+ * Returns: cache file name for the given image url and modification time
+ */
+static gchar *fritzfon_image_cache_file(const gchar *url, const gchar *mod_time)
 {
-	RmXmlNode *child;
-	gint count = 0;
+	g_autofree gchar *key = g_strconcat(url, "\n", mod_time ? mod_time : "", NULL);
+	g_autofree gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
 
-	for (child = rm_xmlnode_get_child(node, "contact"); child != NULL; child = rm_xmlnode_get_next_twin(child)) {
-		contact_add(profile, child, count++);
-	}
+	return g_build_filename(rm_get_user_cache_dir(), "fritzfon", hash, NULL);
 }
 
-static gint fritzfon_read_book_ftp(void)
+/**
+ * fritzfon_image_size_prepared_cb:
+ * @loader: a #GdkPixbufLoader
+ * @width: image width
+ * @height: image height
+ * @user_data: unused
+ *
+ * Scale image down to FRITZFON_IMAGE_SIZE while decoding.
+ */
+static void fritzfon_image_size_prepared_cb(GdkPixbufLoader *loader, gint width, gint height, gpointer user_data)
 {
-	gchar uri[1024];
-	RmXmlNode *node = NULL;
-	RmXmlNode *child;
-	RmProfile *profile = rm_profile_get_active();
-	gchar *owner;
-	gchar *name;
-
-	contacts = NULL;
+	if (width <= FRITZFON_IMAGE_SIZE && height <= FRITZFON_IMAGE_SIZE) {
+		return;
+	}
 
-	if (!rm_router_login(profile)) {
-		return -1;
+	if (width > height) {
+		height = MAX(1, height * FRITZFON_IMAGE_SIZE / width);
+		width = FRITZFON_IMAGE_SIZE;
+	} else {
+		width = MAX(1, width * FRITZFON_IMAGE_SIZE / height);
+		height = FRITZFON_IMAGE_SIZE;
 	}
 
-	owner = g_settings_get_string(fritzfon_settings, "book-owner");
-	name = g_settings_get_string(fritzfon_settings, "book-name");
+	gdk_pixbuf_loader_set_size(loader, width, height);
+}
 
-	snprintf(uri, sizeof(uri), "http://%s/cgi-bin/firmwarecfg", rm_router_get_host(profile));
+/**
+ * fritzfon_image_decode:
+ * @data: encoded image data
+ * @len: length of data
+ *
+ * Returns: decoded and scaled image, or %NULL on error
+ */
+static GdkPixbuf *fritzfon_image_decode(const gchar *data, gsize len)
+{
+	GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+	GdkPixbuf *image = NULL;
+	gboolean written;
 
-	SoupMultipart *multipart = soup_multipart_new(SOUP_FORM_MIME_TYPE_MULTIPART);
-	soup_multipart_append_form_string(multipart, "sid", profile->router_info->session_id);
-	soup_multipart_append_form_string(multipart, "PhonebookId", owner);
-	soup_multipart_append_form_string(multipart, "PhonebookExportName", name);
-	soup_multipart_append_form_string(multipart, "PhonebookExport", "1");
-	SoupMessage *msg = soup_form_request_new_from_multipart(uri, multipart);
+	g_signal_connect(loader, "size-prepared", G_CALLBACK(fritzfon_image_size_prepared_cb), NULL);
 
-	soup_session_send_message(rm_soup_session, msg);
+	written = gdk_pixbuf_loader_write(loader, (const guchar*)data, len, NULL);
+	if (gdk_pixbuf_loader_close(loader, NULL) && written) {
+		image = gdk_pixbuf_loader_get_pixbuf(loader);
+		if (image) {
+			g_object_ref(image);
+		}
+	}
 
-	g_free(owner);
-	g_free(name);
+	g_object_unref(loader);
 
-	if (msg->status_code != 200) {
-		g_warning("Could not get firmware file");
-		g_object_unref(msg);
-		return FALSE;
-	}
+	return image;
+}
 
-	const gchar *data = msg->response_body->data;
-	gint read = msg->response_body->length;
+/**
+ * fritzfon_image_changed_cb:
+ * @user_data: unused
+ *
+ * Emit one contacts-changed signal for a bunch of loaded images.
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean fritzfon_image_changed_cb(gpointer user_data)
+{
+	fritzfon_image_changed_id = 0;
+	rm_object_emit_contacts_changed();
 
-	g_return_val_if_fail(data != NULL, -2);
-#if FRITZFON_DEBUG
-	if (read > 0) {
-		rm_log_save_data("test-in.xml", data, read);
-	}
-#endif
+	return G_SOURCE_REMOVE;
+}
 
-	node = rm_xmlnode_from_str(data, read);
-	if (node == NULL) {
-		g_object_unref(msg);
-		return -1;
+/**
+ * fritzfon_image_apply:
+ * @user_data: unused
+ *
+ * Set loaded images to their contacts (main context).
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean fritzfon_image_apply(gpointer user_data)
+{
+	guint generation = g_atomic_int_get(&fritzfon_generation);
+	gboolean changed = FALSE;
+	GHashTable *members;
+	GSList *jobs;
+	GSList *list;
+	guint i;
+
+	g_mutex_lock(&fritzfon_image_results_mutex);
+	jobs = g_slist_reverse(g_steal_pointer(&fritzfon_image_results));
+	fritzfon_image_apply_id = 0;
+	g_mutex_unlock(&fritzfon_image_results_mutex);
+
+	/* Contacts removed since the job has been queued are gone from the list */
+	members = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (i = 0; jobs && fritzfon_contacts && i < fritzfon_contacts->len; i++) {
+		g_hash_table_add(members, g_ptr_array_index(fritzfon_contacts, i));
 	}
 
-	master_node = node;
+	for (list = jobs; list != NULL; list = list->next) {
+		struct fritzfon_image_job *job = list->data;
 
-	for (child = rm_xmlnode_get_child(node, "phonebook"); child != NULL; child = rm_xmlnode_get_next_twin(child)) {
-		phonebook_add(profile, child);
+		/* Contact list has been rebuilt or contact removed in the meantime, drop result */
+		if (job->generation != generation || !g_hash_table_contains(members, job->contact)) {
+			continue;
+		}
+
+		g_clear_object(&job->contact->image);
+		job->contact->image = g_steal_pointer(&job->image);
+		changed = TRUE;
 	}
 
-	g_object_unref(msg);
+	g_slist_free_full(jobs, fritzfon_image_job_free);
+	g_hash_table_destroy(members);
 
-	//rm_router_logout(profile);
+	if (changed && !fritzfon_image_changed_id) {
+		GSource *timeout = g_timeout_source_new(250);
 
-	return 0;
+		g_source_set_callback(timeout, fritzfon_image_changed_cb, NULL, NULL);
+		fritzfon_image_changed_id = g_source_attach(timeout, fritzfon_main_context);
+		g_source_unref(timeout);
+	}
+
+	return G_SOURCE_REMOVE;
 }
 
-static gint fritzfon_read_book_tr64(void)
+/**
+ * fritzfon_image_load:
+ * @data: a fritzfon image job
+ *
+ * Load image from disk cache or router, decode it and hand it over to the main context.
+ */
+static void fritzfon_image_load(gpointer data)
 {
-	RmXmlNode *node = NULL;
-	RmXmlNode *child;
-	RmProfile *profile = rm_profile_get_active();
-	gchar *owner;
-	gchar *name;
-	g_autoptr(SoupMessage) msg = NULL;
-	gint ret;
-
-	contacts = NULL;
+	struct fritzfon_image_job *job = data;
+	g_autofree gchar *cache_file = NULL;
+	gchar *buffer;
+	gsize len = 0;
+
+	if (job->generation != g_atomic_int_get(&fritzfon_generation)) {
+		fritzfon_image_job_free(job);
+		return;
+	}
 
-	owner = g_settings_get_string(fritzfon_settings, "book-owner");
-	name = g_settings_get_string(fritzfon_settings, "book-name");
-	g_debug("%s(): owner %s, name %s", __FUNCTION__, owner, name);
+	cache_file = fritzfon_image_cache_file(job->url, job->mod_time);
+	buffer = rm_file_load(cache_file, &len);
 
-	msg = rm_network_tr64_request(profile, TRUE, "x_contact", "GetPhonebook", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", "NewPhonebookID", owner, NULL);
-	if (msg == NULL) {
-		return -1;
-	}
+	if (!buffer) {
+		if (rm_router_need_ftp(job->profile)) {
+			buffer = fritzfon_load_image_ftp(job->profile, job->url, &len);
+		} else {
+			gboolean logged_in = TRUE;
+
+			/* Only the first worker of a generation needs to log in */
+			g_mutex_lock(&fritzfon_image_mutex);
+			if (fritzfon_image_login_generation != job->generation) {
+				logged_in = rm_router_login(job->profile);
+				if (logged_in) {
+					fritzfon_image_login_generation = job->generation;
+				}
+			}
+			g_mutex_unlock(&fritzfon_image_mutex);
 
-	gchar *url = rm_utils_xml_extract_tag(msg->response_body->data, "NewPhonebookURL");
+			buffer = logged_in ? fritzfon_load_image(job->profile, job->url, &len) : NULL;
+		}
 
-	msg = soup_message_new(SOUP_METHOD_GET, url);
-	if (msg == NULL) {
-		g_debug("%s(): Invalid message, abort (%s)...", __FUNCTION__, url);
-		return -1;
+		if (buffer && len) {
+			rm_file_save(cache_file, buffer, len);
+		}
 	}
 
-	ret = soup_session_send_message(rm_soup_session, msg);
-	if (msg == NULL || !msg->response_body->length || msg->response_body->data == NULL) {
-		g_debug("%s(): Invalid data, abort... (%d)", __FUNCTION__, ret);
-		return -1;
+	if (buffer) {
+		job->image = fritzfon_image_decode(buffer, len);
+		g_free(buffer);
 	}
 
-	rm_log_save_data("fritzfon-phonebook.html", msg->response_body->data, msg->response_body->length);
+	if (job->image) {
+		g_mutex_lock(&fritzfon_image_results_mutex);
+		fritzfon_image_results = g_slist_prepend(fritzfon_image_results, job);
+		if (!fritzfon_image_apply_id) {
+			GSource *idle = g_idle_source_new();
 
-	node = rm_xmlnode_from_str(msg->response_body->data, msg->response_body->length);
-	if (node == NULL) {
-		g_debug("%s(): Could not parse xml node, abort...", __FUNCTION__);
-		return -1;
+			g_source_set_callback(idle, fritzfon_image_apply, NULL, NULL);
+			fritzfon_image_apply_id = g_source_attach(idle, fritzfon_main_context);
+			g_source_unref(idle);
+		}
+		g_mutex_unlock(&fritzfon_image_results_mutex);
+	} else {
+		fritzfon_image_job_free(job);
 	}
+}
 
-	master_node = node;
-
-	for (child = rm_xmlnode_get_child(node, "phonebook"); child != NULL; child = rm_xmlnode_get_next_twin(child)) {
-		phonebook_add(profile, child);
-	}
+/**
+ * fritzfon_image_worker:
+ * @data: a fritzfon image job
+ *
+ * Image job on the shared worker pool, counted so that shutdown can wait for it.
+ */
+static void fritzfon_image_worker(gpointer data)
+{
+	fritzfon_image_load(data);
 
-	return 0;
+	g_mutex_lock(&fritzfon_image_results_mutex);
+	fritzfon_image_jobs--;
+	g_cond_broadcast(&fritzfon_image_cond);
+	g_mutex_unlock(&fritzfon_image_results_mutex);
 }
 
-static gint fritzfon_read_book(void)
+/**
+ * fritzfon_update_contacts:
+ * @sort: whether fritzfon_contacts need to be sorted
+ *
+ * Rebuild contact list from contact array.
+ */
+static void fritzfon_update_contacts(gboolean sort)
 {
-	RmProfile *profile = rm_profile_get_active();
+	guint i;
 
-	if (rm_router_need_ftp(profile)) {
-		return fritzfon_read_book_ftp();
+	if (sort) {
+		rm_contact_sort_by_name(fritzfon_contacts);
 	}
 
-	return fritzfon_read_book_tr64();
+	g_clear_pointer(&contacts, g_list_free);
+	for (i = fritzfon_contacts->len; i > 0; i--) {
+		contacts = g_list_prepend(contacts, g_ptr_array_index(fritzfon_contacts, i - 1));
+	}
 }
 
-GList *fritzfon_get_contacts(void)
+/**
+ * fritzfon_load_images:
+ * @profile: a #RmProfile
+ *
+ * Queue image loading of all contacts without an image. Images are filled in as they arrive.
+ */
+static void fritzfon_load_images(RmProfile *profile)
 {
-	GList *list = contacts;
+	GList *list;
+	guint generation = g_atomic_int_get(&fritzfon_generation);
 
-	return list;
-}
+	if (!fritzfon_image_active) {
+		return;
+	}
 
-static gint fritzfon_get_books_ftp(void)
-{
-	RmProfile *profile = rm_profile_get_active();
-	SoupMessage *msg;
-	struct fritzfon_book *book = NULL;
-	gchar *url;
+	for (list = contacts; list != NULL; list = list->next) {
+		RmContact *contact = list->data;
+		struct fritzfon_priv *priv = contact->priv;
+		struct fritzfon_image_job *job;
 
-	if (!rm_router_login(profile)) {
-		return -1;
-	}
+		if (!priv || RM_EMPTY_STRING(priv->image_url) || contact->image) {
+			continue;
+		}
 
-	url = g_strdup_printf("http://%s/fon_num/fonbook_select.lua", rm_router_get_host(profile));
-	msg = soup_form_request_new(SOUP_METHOD_GET, url,
-				    "sid", profile->router_info->session_id,
-				    NULL);
-	g_free(url);
+		job = g_slice_new0(struct fritzfon_image_job);
+		job->profile = profile;
+		job->contact = contact;
+		job->url = g_strdup(priv->image_url);
+		job->mod_time = g_strdup(priv->mod_time);
+		job->generation = generation;
 
-	soup_session_send_message(rm_soup_session, msg);
-	if (msg->status_code != 200) {
-		g_warning("Could not get fonbook file");
-		g_object_unref(msg);
-		goto end;
+		g_mutex_lock(&fritzfon_image_results_mutex);
+		fritzfon_image_jobs++;
+		g_mutex_unlock(&fritzfon_image_results_mutex);
+
+		rm_executor_run(RM_EXECUTOR_PRIORITY_NORMAL, "fritzfon image", fritzfon_image_worker, job);
 	}
+}
 
-	const gchar *data = msg->response_body->data;
+static void parse_person(RmContact *contact, RmXmlNode *person)
+{
+	RmXmlNode *name;
+	RmXmlNode *image;
+	struct fritzfon_priv *priv = contact->priv;
 
-#if FRITZFON_DEBUG
-	rm_log_save_data("fritzfon-getbooks.html", data, msg->response_body->length);
-#endif
+	/* Get real name entry */
+	name = rm_xmlnode_get_child(person, "realName");
+	contact->name = name ? rm_xmlnode_get_data(name) : g_strdup("");
 
-	g_return_val_if_fail(data != NULL, -2);
+	if (contact->name == NULL) {
+		g_debug("%s(): real name not valid, setting fallback\n", __FUNCTION__);
+		contact->name = g_strdup("");
+	}
 
-	gchar *pos = (gchar*)data;
+	/* Get image url, image itself is loaded in background by fritzfon_load_images() */
+	image = rm_xmlnode_get_child(person, "imageURL");
+	if (image != NULL) {
+		priv->image_url = rm_xmlnode_get_data(image);
+	}
+}
+
+static void parse_telephony(RmContact *contact, RmXmlNode *telephony)
+{
+	RmXmlNode *child;
+	GPtrArray *numbers = g_ptr_array_new_with_free_func(g_free);
+	GPtrArray *types = g_ptr_array_new();
+	gchar **full_numbers;
+	guint i;
+
+	/* Check for numbers */
+	for (child = rm_xmlnode_get_child(telephony, "number"); child != NULL; child = rm_xmlnode_get_next_twin(child)) {
+		const gchar *type;
+		gchar *number;
+
+		type = rm_xmlnode_get_attrib(child, "type");
+		if (type == NULL) {
+			continue;
+		}
+
+		number = rm_xmlnode_get_data(child);
+		if (RM_EMPTY_STRING(number)) {
+			g_free(number);
+			continue;
+		}
+
+		g_ptr_array_add(numbers, number);
+		g_ptr_array_add(types, (gpointer)type);
+	}
+
+	/* Normalize all numbers of this contact at once */
+	full_numbers = rm_number_full_many((const gchar * const *)numbers->pdata, numbers->len, FALSE);
+
+	for (i = 0; i < numbers->len; i++) {
+		const gchar *type = g_ptr_array_index(types, i);
+		RmPhoneNumber *phone_number;
+
+		phone_number = g_slice_new0(RmPhoneNumber);
+		if (strcmp(type, "mobile") == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_MOBILE;
+		} else if (strcmp(type, "home") == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_HOME;
+		} else if (strcmp(type, "work") == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_WORK;
+		} else if (strcmp(type, "fax_work") == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_WORK;
+		} else if (strcmp(type, "fax_home") == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_FAX_HOME;
+		} else if (strcmp(type, "pager") == 0) {
+			phone_number->type = RM_PHONE_NUMBER_TYPE_PAGER;
+		} else if (strncmp(type, "label:", 6) == 0) {
+			phone_number->name = g_strdup (type + 6);
+			phone_number->type = RM_PHONE_NUMBER_TYPE_OTHER;
+		} else {
+			phone_number->type = -1;
+			g_debug("Unhandled phone number type: '%s' / %s", type, (gchar*)g_ptr_array_index(numbers, i));
+		}
+		phone_number->number = g_strdup(full_numbers[i]);
+		contact->numbers = g_list_prepend(contact->numbers, phone_number);
+	}
+
+	g_free(full_numbers);
+	g_ptr_array_free(types, TRUE);
+	g_ptr_array_free(numbers, TRUE);
+}
+
+/**
+ * fritzfon_get_node_data:
+ * @node: contact xml node
+ * @name: child name
+ *
+ * Returns: newly allocated data of child @name, or %NULL if not present
+ */
+static gchar *fritzfon_get_node_data(RmXmlNode *node, const gchar *name)
+{
+	RmXmlNode *child = rm_xmlnode_get_child(node, name);
+
+	return child ? rm_xmlnode_get_data(child) : NULL;
+}
+
+/**
+ * contact_add:
+ * @profile: a #RmProfile
+ * @node: contact xml node
+ * @old_snapshot: snapshot of the previous sync (unique id -> contact), or %NULL
+ * @changed: set to %TRUE if contact is new or has been modified
+ *
+ * Convert contact node to #RmContact. In case the contact is known by @old_snapshot and
+ * its mod_time did not change, the existing contact is reused. Known contacts are removed
+ * from @old_snapshot.
+ *
+ * Returns: a #RmContact
+ */
+static RmContact *contact_add(RmProfile *profile, RmXmlNode *node, GHashTable *old_snapshot, gboolean *changed)
+{
+	RmXmlNode *tmp;
+	RmContact *contact;
+	struct fritzfon_priv *priv;
+	g_autofree gchar *unique_id = fritzfon_get_node_data(node, "uniqueid");
+
+	if (old_snapshot && !RM_EMPTY_STRING(unique_id)) {
+		contact = g_hash_table_lookup(old_snapshot, unique_id);
+
+		if (contact) {
+			g_autofree gchar *mod_time = fritzfon_get_node_data(node, "mod_time");
+
+			/* Still present on router, modified ones are freed with the old contact list */
+			g_hash_table_remove(old_snapshot, unique_id);
+
+			priv = contact->priv;
+			if (!RM_EMPTY_STRING(mod_time) && !g_strcmp0(priv->mod_time, mod_time)) {
+				/* Unchanged, keep parsed data (and image) */
+				*changed = FALSE;
+
+				return contact;
+			}
+		}
+	}
+
+	contact = g_slice_new0(RmContact);
+	priv = g_slice_new0(struct fritzfon_priv);
+	contact->priv = priv;
+
+	for (tmp = node->child; tmp != NULL; tmp = tmp->next) {
+		if (tmp->name == NULL) {
+			continue;
+		}
+
+		if (!strcmp(tmp->name, "person")) {
+			parse_person(contact, tmp);
+		} else if (!strcmp(tmp->name, "telephony")) {
+			parse_telephony(contact, tmp);
+		} else if (!strcmp(tmp->name, "uniqueid")) {
+			priv->unique_id = rm_xmlnode_get_data(tmp);
+		} else if (!strcmp(tmp->name, "mod_time")) {
+			priv->mod_time = rm_xmlnode_get_data(tmp);
+		} else {
+			/* Unhandled node, save it */
+			priv->nodes = g_list_prepend(priv->nodes, rm_xmlnode_copy(tmp));
+		}
+	}
+
+	*changed = TRUE;
+
+	return contact;
+}
+
+/**
+ * fritzfon_apply_books:
+ * @profile: a #RmProfile
+ * @node: phonebooks xml node
+ *
+ * Synchronize local snapshot with phonebooks node: unchanged contacts (same uniqueid and mod_time)
+ * are kept, new and modified contacts are parsed and removed contacts are dropped.
+ *
+ * Returns: number of new, modified and removed contacts
+ */
+static gint fritzfon_apply_books(RmProfile *profile, RmXmlNode *node)
+{
+	RmXmlNode *book;
+	RmXmlNode *child;
+	GHashTable *old_snapshot = fritzfon_snapshot;
+	GPtrArray *array;
+	gint changes = 0;
+	g_autofree gchar *timestamp = NULL;
+
+	book = rm_xmlnode_get_child(node, "phonebook");
+	if (book) {
+		timestamp = fritzfon_get_node_data(book, "timestamp");
+	}
+
+	if (!RM_EMPTY_STRING(timestamp) && !g_strcmp0(timestamp, fritzfon_timestamp)) {
+		g_debug("%s(): Phonebook unchanged since %s", __FUNCTION__, timestamp);
+		return 0;
+	}
+
+	fritzfon_snapshot = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	array = g_ptr_array_new();
+
+	for (; book != NULL; book = rm_xmlnode_get_next_twin(book)) {
+		for (child = rm_xmlnode_get_child(book, "contact"); child != NULL; child = rm_xmlnode_get_next_twin(child)) {
+			gboolean changed;
+			RmContact *contact = contact_add(profile, child, old_snapshot, &changed);
+			struct fritzfon_priv *priv = contact->priv;
+
+			if (changed) {
+				changes++;
+			}
+
+			if (!RM_EMPTY_STRING(priv->unique_id)) {
+				g_hash_table_replace(fritzfon_snapshot, g_strdup(priv->unique_id), contact);
+			}
+
+			g_ptr_array_add(array, contact);
+		}
+	}
+
+	/* Contacts still left in the old snapshot have been removed on the router */
+	if (old_snapshot) {
+		changes += g_hash_table_size(old_snapshot);
+		g_hash_table_destroy(old_snapshot);
+	}
+
+	/* Sort once using collation keys instead of sorted inserts */
+	if (fritzfon_contacts) {
+		fritzfon_contacts_release(g_steal_pointer(&fritzfon_contacts), array);
+	}
+	fritzfon_contacts = array;
+	fritzfon_update_contacts(TRUE);
+
+	g_free(fritzfon_timestamp);
+	fritzfon_timestamp = g_steal_pointer(&timestamp);
+
+	g_debug("%s(): %d contact(s) changed", __FUNCTION__, changes);
+
+	return changes;
+}
+
+/**
+ * fritzfon_reset:
+ *
+ * Drop local snapshot, e.g. in case the active sub book changes.
+ */
+static void fritzfon_reset(void)
+{
+	g_clear_pointer(&contacts, g_list_free);
+	g_clear_pointer(&fritzfon_snapshot, g_hash_table_destroy);
+	if (fritzfon_contacts) {
+		fritzfon_contacts_release(g_steal_pointer(&fritzfon_contacts), NULL);
+	}
+	g_clear_pointer(&fritzfon_timestamp, g_free);
+
+	g_atomic_int_inc(&fritzfon_generation);
+
+	/* Result of a running sync belongs to the dropped snapshot */
+	if (fritzfon_cancellable) {
+		g_cancellable_cancel(fritzfon_cancellable);
+		g_object_unref(fritzfon_cancellable);
+		fritzfon_cancellable = g_cancellable_new();
+	}
+}
+
+/**
+ * fritzfon_str:
+ * @str: string or %NULL
+ *
+ * Returns: @str or "" in case it is %NULL
+ */
+static inline const gchar *fritzfon_str(const gchar *str)
+{
+	return str ? str : "";
+}
+
+/**
+ * fritzfon_priv_get_nodes:
+ * @priv: fritzfon contact private data
+ *
+ * Get unhandled nodes of contact, parsing the serialized snapshot copy on first use.
+ *
+ * Returns: list of #RmXmlNode
+ */
+static GList *fritzfon_priv_get_nodes(struct fritzfon_priv *priv)
+{
+	if (!priv->nodes && priv->nodes_xml) {
+		RmXmlNode *node = rm_xmlnode_from_str(priv->nodes_xml, -1);
+		RmXmlNode *child;
+
+		if (node) {
+			for (child = node->child; child != NULL; child = child->next) {
+				if (child->name && child->type == RM_XMLNODE_TYPE_TAG) {
+					priv->nodes = g_list_prepend(priv->nodes, rm_xmlnode_copy(child));
+				}
+			}
+			priv->nodes = g_list_reverse(priv->nodes);
+			rm_xmlnode_free(node);
+		}
+
+		g_clear_pointer(&priv->nodes_xml, g_free);
+	}
+
+	return priv->nodes;
+}
+
+/**
+ * fritzfon_priv_nodes_to_str:
+ * @priv: fritzfon contact private data
+ *
+ * Returns: serialized unhandled nodes of contact or %NULL if there are none
+ */
+static gchar *fritzfon_priv_nodes_to_str(struct fritzfon_priv *priv)
+{
+	RmXmlNode *node;
+	GList *list;
+	gchar *str;
+
+	if (!priv->nodes) {
+		return g_strdup(priv->nodes_xml);
+	}
+
+	node = rm_xmlnode_new("contact");
+	for (list = priv->nodes; list != NULL; list = list->next) {
+		rm_xmlnode_insert_child(node, rm_xmlnode_copy(list->data));
+	}
+
+	str = rm_xmlnode_to_formatted_str(node, NULL);
+	rm_xmlnode_free(node);
+
+	return str;
+}
+
+/**
+ * fritzfon_snapshot_file:
+ * @profile: a #RmProfile
+ * @owner: phonebook owner id
+ *
+ * Returns: snapshot file name of given profile and phonebook
+ */
+static gchar *fritzfon_snapshot_file(RmProfile *profile, const gchar *owner)
+{
+	g_autofree gchar *name = g_strdup_printf("%s-%s.snapshot", rm_profile_get_name(profile), owner);
+
+	return g_build_filename(rm_get_user_cache_dir(), "fritzfon", name, NULL);
+}
+
+/**
+ * fritzfon_snapshot_plan:
+ * @profile: a #RmProfile
+ *
+ * Snapshot stores normalized numbers, so it is only valid for the numbering plan it was created with.
+ *
+ * Returns: numbering plan key
+ */
+static gchar *fritzfon_snapshot_plan(RmProfile *profile)
+{
+	g_autofree gchar *international_access_code = rm_router_get_international_access_code(profile);
+	g_autofree gchar *national_prefix = rm_router_get_national_prefix(profile);
+	g_autofree gchar *country_code = rm_router_get_country_code(profile);
+	g_autofree gchar *area_code = rm_router_get_area_code(profile);
+
+	return g_strdup_printf("%s/%s/%s/%s", fritzfon_str(international_access_code), fritzfon_str(national_prefix), fritzfon_str(country_code), fritzfon_str(area_code));
+}
+
+/**
+ * fritzfon_snapshot_save:
+ * @profile: a #RmProfile
+ *
+ * Persist current contact list including the normalized numbers.
+ */
+static void fritzfon_snapshot_save(RmProfile *profile)
+{
+	g_autofree gchar *owner = g_settings_get_string(fritzfon_settings, "book-owner");
+	g_autofree gchar *file = fritzfon_snapshot_file(profile, owner);
+	g_autofree gchar *dir = g_path_get_dirname(file);
+	g_autofree gchar *plan = fritzfon_snapshot_plan(profile);
+	g_autoptr(GError) error = NULL;
+	GVariantBuilder books;
+	GVariantBuilder builder;
+	GVariant *snapshot;
+	GList *list;
+
+	g_variant_builder_init(&books, G_VARIANT_TYPE("a(ss)"));
+	for (list = fritzfon_books; list != NULL; list = list->next) {
+		struct fritzfon_book *book = list->data;
+
+		g_variant_builder_add(&books, "(ss)", book->id, book->name);
+	}
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sssssa(iss))"));
+
+	for (list = contacts; list != NULL; list = list->next) {
+		RmContact *contact = list->data;
+		struct fritzfon_priv *priv = contact->priv;
+		g_autofree gchar *nodes = fritzfon_priv_nodes_to_str(priv);
+		GVariantBuilder numbers;
+		GList *number_list;
+
+		g_variant_builder_init(&numbers, G_VARIANT_TYPE("a(iss)"));
+		for (number_list = contact->numbers; number_list != NULL; number_list = number_list->next) {
+			RmPhoneNumber *number = number_list->data;
+
+			g_variant_builder_add(&numbers, "(iss)", number->type, fritzfon_str(number->name), fritzfon_str(number->number));
+		}
+
+		g_variant_builder_add(&builder, "(sssssa(iss))",
+		                      fritzfon_str(priv->unique_id),
+		                      fritzfon_str(priv->mod_time),
+		                      fritzfon_str(contact->name),
+		                      fritzfon_str(priv->image_url),
+		                      fritzfon_str(nodes),
+		                      &numbers);
+	}
+
+	snapshot = g_variant_ref_sink(g_variant_new(FRITZFON_SNAPSHOT_TYPE, FRITZFON_SNAPSHOT_VERSION, owner, plan, fritzfon_str(fritzfon_timestamp), &books, &builder));
+
+	g_mkdir_with_parents(dir, 0700);
+	if (!g_file_set_contents(file, g_variant_get_data(snapshot), g_variant_get_size(snapshot), &error)) {
+		g_warning("%s(): Could not save snapshot: %s", __FUNCTION__, error->message);
+	}
+
+	g_variant_unref(snapshot);
+}
+
+/**
+ * fritzfon_snapshot_load:
+ * @profile: a #RmProfile
+ *
+ * Restore contact list of active phonebook from the persisted snapshot. The list of phonebooks
+ * is restored as well unless it is already known.
+ *
+ * Returns: %TRUE if snapshot has been loaded
+ */
+static gboolean fritzfon_snapshot_load(RmProfile *profile)
+{
+	g_autofree gchar *owner = g_settings_get_string(fritzfon_settings, "book-owner");
+	g_autofree gchar *file = fritzfon_snapshot_file(profile, owner);
+	g_autofree gchar *plan = NULL;
+	g_autoptr(GMappedFile) mapped = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) snapshot = NULL;
+	g_autoptr(GVariantIter) books = NULL;
+	g_autoptr(GVariantIter) iter = NULL;
+	GVariantIter *numbers;
+	const gchar *book_id;
+	const gchar *book_name;
+	const gchar *snapshot_owner;
+	const gchar *snapshot_plan;
+	const gchar *timestamp;
+	const gchar *unique_id;
+	const gchar *mod_time;
+	const gchar *name;
+	const gchar *image_url;
+	const gchar *nodes;
+	guint32 version;
+	GPtrArray *array;
+
+	mapped = g_mapped_file_new(file, FALSE, NULL);
+	if (!mapped) {
+		return FALSE;
+	}
+
+	bytes = g_mapped_file_get_bytes(mapped);
+	snapshot = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE(FRITZFON_SNAPSHOT_TYPE), bytes, FALSE));
+
+	/* Check version first, older snapshots have a different layout */
+	g_variant_get_child(snapshot, 0, "u", &version);
+	if (version != FRITZFON_SNAPSHOT_VERSION) {
+		g_debug("%s(): Snapshot version %u unsupported, ignoring it", __FUNCTION__, version);
+		return FALSE;
+	}
+
+	g_variant_get(snapshot, "(u&s&s&sa(ss)a(sssssa(iss)))", &version, &snapshot_owner, &snapshot_plan, &timestamp, &books, &iter);
+
+	plan = fritzfon_snapshot_plan(profile);
+	if (g_strcmp0(snapshot_owner, owner) || g_strcmp0(snapshot_plan, plan)) {
+		g_debug("%s(): Snapshot outdated, ignoring it", __FUNCTION__);
+		return FALSE;
+	}
+
+	/* Phonebooks are available before the router has been asked */
+	if (!fritzfon_books) {
+		while (g_variant_iter_next(books, "(&s&s)", &book_id, &book_name)) {
+			struct fritzfon_book *book = g_slice_new(struct fritzfon_book);
+
+			book->id = g_strdup(book_id);
+			book->name = g_strdup(book_name);
+
+			fritzfon_books = g_list_prepend(fritzfon_books, book);
+		}
+		fritzfon_books = g_list_reverse(fritzfon_books);
+	}
+
+	array = g_ptr_array_sized_new(g_variant_iter_n_children(iter));
+
+	while (g_variant_iter_next(iter, "(&s&s&s&s&sa(iss))", &unique_id, &mod_time, &name, &image_url, &nodes, &numbers)) {
+		RmContact *contact = g_slice_new0(RmContact);
+		struct fritzfon_priv *priv = g_slice_new0(struct fritzfon_priv);
+		const gchar *label;
+		const gchar *number;
+		gint type;
+
+		contact->priv = priv;
+		contact->name = g_strdup(name);
+
+		priv->unique_id = *unique_id ? g_strdup(unique_id) : NULL;
+		priv->mod_time = *mod_time ? g_strdup(mod_time) : NULL;
+		priv->image_url = *image_url ? g_strdup(image_url) : NULL;
+		priv->nodes_xml = *nodes ? g_strdup(nodes) : NULL;
+
+		while (g_variant_iter_next(numbers, "(i&s&s)", &type, &label, &number)) {
+			RmPhoneNumber *phone_number = g_slice_new0(RmPhoneNumber);
+
+			phone_number->type = type;
+			phone_number->name = *label ? g_strdup(label) : NULL;
+			phone_number->number = g_strdup(number);
+
+			contact->numbers = g_list_prepend(contact->numbers, phone_number);
+		}
+		contact->numbers = g_list_reverse(contact->numbers);
+		g_variant_iter_free(numbers);
+
+		if (priv->unique_id) {
+			if (!fritzfon_snapshot) {
+				fritzfon_snapshot = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+			}
+			g_hash_table_replace(fritzfon_snapshot, g_strdup(priv->unique_id), contact);
+		}
+
+		g_ptr_array_add(array, contact);
+	}
+
+	/* Snapshot is stored sorted */
+	if (fritzfon_contacts) {
+		fritzfon_contacts_release(g_steal_pointer(&fritzfon_contacts), NULL);
+	}
+	fritzfon_contacts = array;
+	fritzfon_update_contacts(FALSE);
+
+	g_free(fritzfon_timestamp);
+	fritzfon_timestamp = *timestamp ? g_strdup(timestamp) : NULL;
+
+	g_debug("%s(): Restored %u contact(s)", __FUNCTION__, fritzfon_contacts->len);
+
+	g_atomic_int_inc(&fritzfon_generation);
+	fritzfon_load_images(profile);
+
+	return TRUE;
+}
+
+static RmXmlNode *fritzfon_download_book_ftp(RmProfile *profile, const gchar *owner, const gchar *name)
+{
+	gchar uri[1024];
+	RmXmlNode *node = NULL;
+
+	if (!rm_router_login(profile)) {
+		return NULL;
+	}
+
+	snprintf(uri, sizeof(uri), "http://%s/cgi-bin/firmwarecfg", rm_router_get_host(profile));
+
+	SoupMultipart *multipart = soup_multipart_new(SOUP_FORM_MIME_TYPE_MULTIPART);
+	soup_multipart_append_form_string(multipart, "sid", profile->router_info->session_id);
+	soup_multipart_append_form_string(multipart, "PhonebookId", owner);
+	soup_multipart_append_form_string(multipart, "PhonebookExportName", name);
+	soup_multipart_append_form_string(multipart, "PhonebookExport", "1");
+	SoupMessage *msg = soup_form_request_new_from_multipart(uri, multipart);
+
+	soup_session_send_message(rm_soup_session, msg);
+
+	if (msg->status_code != 200) {
+		g_warning("Could not get firmware file");
+		g_object_unref(msg);
+		return NULL;
+	}
+
+	const gchar *data = msg->response_body->data;
+	gint read = msg->response_body->length;
+
+	if (data == NULL) {
+		g_object_unref(msg);
+		return NULL;
+	}
+#if FRITZFON_DEBUG
+	if (read > 0) {
+		rm_log_save_data("test-in.xml", data, read);
+	}
+#endif
+
+	node = rm_xmlnode_from_str(data, read);
+
+	g_object_unref(msg);
+
+	//rm_router_logout(profile);
+
+	return node;
+}
+
+static gboolean fritzfon_download_book_tr64(RmProfile *profile, const gchar *owner, const gchar *timestamp, RmXmlNode **node)
+{
+	g_autoptr(SoupMessage) msg = NULL;
+	g_autofree gchar *url = NULL;
+
+	g_debug("%s(): owner %s", __FUNCTION__, owner);
+
+	msg = rm_network_tr64_request(profile, TRUE, "x_contact", "GetPhonebook", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", "NewPhonebookID", owner, NULL);
+	if (msg == NULL) {
+		return FALSE;
+	}
+
+	url = rm_utils_xml_extract_tag(msg->response_body->data, "NewPhonebookURL");
+	g_clear_object(&msg);
+
+	if (url && timestamp) {
+		/* Router only returns the phonebook content if it changed since timestamp */
+		gchar *tmp = url;
+
+		url = g_strdup_printf("%s&timestamp=%s", tmp, timestamp);
+		g_free(tmp);
+	}
+
+	msg = url ? soup_message_new(SOUP_METHOD_GET, url) : NULL;
+	if (msg == NULL) {
+		g_debug("%s(): Invalid message, abort (%s)...", __FUNCTION__, url);
+		return FALSE;
+	}
+
+	soup_session_send_message(rm_soup_session, msg);
+	if (msg->status_code != SOUP_STATUS_OK && msg->status_code != SOUP_STATUS_NOT_MODIFIED) {
+		g_debug("%s(): Received status code: %d", __FUNCTION__, msg->status_code);
+		return FALSE;
+	}
+
+	if (!msg->response_body->length || msg->response_body->data == NULL) {
+		if (timestamp) {
+			g_debug("%s(): Phonebook unchanged since %s", __FUNCTION__, timestamp);
+			return TRUE;
+		}
+
+		g_debug("%s(): Invalid data, abort...", __FUNCTION__);
+		return FALSE;
+	}
+
+	rm_log_save_data("fritzfon-phonebook.html", msg->response_body->data, msg->response_body->length);
+
+	*node = rm_xmlnode_from_str(msg->response_body->data, msg->response_body->length);
+	if (*node == NULL) {
+		g_debug("%s(): Could not parse xml node, abort...", __FUNCTION__);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * fritzfon_download_book:
+ * @profile: a #RmProfile
+ * @owner: phonebook owner id
+ * @name: phonebook name
+ * @timestamp: timestamp of the last sync or %NULL
+ * @node: location to store the phonebooks xml node, left %NULL if unchanged since @timestamp
+ *
+ * Download phonebook from router. Can be called from a worker thread.
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean fritzfon_download_book(RmProfile *profile, const gchar *owner, const gchar *name, const gchar *timestamp, RmXmlNode **node)
+{
+	*node = NULL;
+
+	if (rm_router_need_ftp(profile)) {
+		*node = fritzfon_download_book_ftp(profile, owner, name);
+
+		return *node != NULL;
+	}
+
+	return fritzfon_download_book_tr64(profile, owner, timestamp, node);
+}
+
+/**
+ * fritzfon_apply_download:
+ * @profile: a #RmProfile
+ * @node: downloaded phonebooks node, or %NULL if phonebook is unchanged
+ *
+ * Apply downloaded phonebooks to local snapshot and persist it in case something changed.
+ *
+ * Returns: number of changes
+ */
+static gint fritzfon_apply_download(RmProfile *profile, RmXmlNode *node)
+{
+	gint changes = 0;
+
+	if (node) {
+		changes = fritzfon_apply_books(profile, node);
+		if (changes) {
+			fritzfon_snapshot_save(profile);
+		}
+
+		g_clear_pointer(&master_node, rm_xmlnode_free);
+		master_node = node;
+	}
+
+	/* Stale image jobs are dropped and the workers log in again, the old session may be expired */
+	g_atomic_int_inc(&fritzfon_generation);
+	fritzfon_load_images(profile);
+
+	return changes;
+}
+
+GList *fritzfon_get_contacts(void)
+{
+	GList *list = contacts;
+
+	return list;
+}
+
+GPtrArray *fritzfon_get_contact_array(void)
+{
+	return fritzfon_contacts;
+}
+
+static gint fritzfon_get_books_ftp(RmProfile *profile, GList **books)
+{
+	SoupMessage *msg;
+	struct fritzfon_book *book = NULL;
+	gchar *url;
+
+	if (!rm_router_login(profile)) {
+		return -1;
+	}
+
+	url = g_strdup_printf("http://%s/fon_num/fonbook_select.lua", rm_router_get_host(profile));
+	msg = soup_form_request_new(SOUP_METHOD_GET, url,
+				    "sid", profile->router_info->session_id,
+				    NULL);
+	g_free(url);
+
+	soup_session_send_message(rm_soup_session, msg);
+	if (msg->status_code != 200) {
+		g_warning("Could not get fonbook file");
+		g_object_unref(msg);
+		goto end;
+	}
+
+	const gchar *data = msg->response_body->data;
+
+#if FRITZFON_DEBUG
+	rm_log_save_data("fritzfon-getbooks.html", data, msg->response_body->length);
+#endif
+
+	g_return_val_if_fail(data != NULL, -2);
+
+	gchar *pos = (gchar*)data;
 	do {
 		pos = strstr(pos, "<label for=\"uiBookid:");
 		if (pos) {
@@ -422,308 +1333,737 @@ static gint fritzfon_get_books_ftp(void)
 			gchar *num = g_malloc0(len + 1);
 			strncpy(num, pos + 21, len);
 
-			/* Extract Name */
-			pos = end;
-			end = strstr(pos + 2, "<");
-			g_assert(end != NULL);
-			len = end - pos - 1;
-			gchar *name = g_malloc0(len);
-			strncpy(name, pos + 2, len - 1);
-			pos = end;
+			/* Extract Name */
+			pos = end;
+			end = strstr(pos + 2, "<");
+			g_assert(end != NULL);
+			len = end - pos - 1;
+			gchar *name = g_malloc0(len);
+			strncpy(name, pos + 2, len - 1);
+			pos = end;
+
+			book = g_slice_new(struct fritzfon_book);
+			book->id = num;
+			book->name = name;
+
+			*books = g_list_prepend(*books, book);
+		} else {
+			break;
+		}
+
+		pos++;
+	} while (pos != NULL);
+
+	g_object_unref(msg);
+
+ end:
+	if (*books == NULL) {
+		book = g_slice_new(struct fritzfon_book);
+		book->id = g_strdup("0");
+		book->name = g_strdup("Telefonbuch");
+
+		*books = g_list_prepend(*books, book);
+	}
+
+	//rm_router_logout(profile);
+
+	return 0;
+}
+
+static gint fritzfon_get_books_tr64(RmProfile *profile, GList **books)
+{
+	g_autoptr(SoupMessage) msg = NULL;
+	g_autofree gchar *list = NULL;
+	g_autofree gchar **split = NULL;
+	struct fritzfon_book *book = NULL;
+	gint i;
+
+	msg = rm_network_tr64_request(profile, TRUE, "x_contact", "GetPhonebookList", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", NULL);
+	if (msg == NULL) {
+		return FALSE;
+	}
+
+	rm_log_save_data("tr64-getphonebooklist.xml", msg->response_body->data, msg->response_body->length);
+	list = rm_utils_xml_extract_tag(msg->response_body->data, "NewPhonebookList");
+	split = g_strsplit(list, ",", -1);
+
+	for (i = 0; i < g_strv_length(split); i++) {
+		g_clear_object(&msg);
+		msg = rm_network_tr64_request(profile, TRUE, "x_contact", "GetPhonebook", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", "NewPhonebookID", split[i], NULL);
+		if (msg == NULL) {
+			return FALSE;
+		}
+
+		gchar *name = rm_utils_xml_extract_tag(msg->response_body->data, "NewPhonebookName");
+
+		book = g_slice_new(struct fritzfon_book);
+		book->id = g_strdup_printf("%d", i);
+		book->name = name;
+
+		*books = g_list_prepend(*books, book);
+
+		rm_log_save_data("tr64-getphonebook.xml", msg->response_body->data, msg->response_body->length);
+	}
+
+	return TRUE;
+}
+
+/**
+ * fritzfon_get_books:
+ * @profile: a #RmProfile
+ * @books: list to prepend the available phonebooks to
+ *
+ * Get list of phonebooks on router. Can be called from a worker thread.
+ *
+ * Returns: state
+ */
+static gint fritzfon_get_books(RmProfile *profile, GList **books)
+{
+	if (rm_router_need_ftp(profile)) {
+		return fritzfon_get_books_ftp(profile, books);
+	}
+
+	return fritzfon_get_books_tr64(profile, books);
+}
+
+/**
+ * fritzfon_free_book:
+ * @data: a fritzfon book
+ *
+ * Frees book data.
+ */
+static void fritzfon_free_book(gpointer data)
+{
+	struct fritzfon_book *book = data;
+
+	g_free(book->id);
+	g_free(book->name);
+
+	g_slice_free(struct fritzfon_book, book);
+}
+
+RmXmlNode *create_phone(char *type, char *number)
+{
+	RmXmlNode *number_node;
+
+	number_node = rm_xmlnode_new("number");
+	rm_xmlnode_set_attrib(number_node, "type", type);
+
+	/* For the meantime set priority to 0, TODO */
+	rm_xmlnode_set_attrib(number_node, "prio", "0");
+	rm_xmlnode_insert_data(number_node, number, -1);
+
+	return number_node;
+}
+
+/**
+ * \brief Convert person structure to xml node
+ * \param contact person structure
+ * \return xml node
+ */
+static RmXmlNode *contact_to_xmlnode(RmContact *contact)
+{
+	RmXmlNode *node;
+	RmXmlNode *contact_node;
+	RmXmlNode *realname_node;
+	RmXmlNode *image_node;
+	RmXmlNode *telephony_node;
+	RmXmlNode *tmp_node;
+	GList *list;
+	gchar *tmp;
+	struct fritzfon_priv *priv = contact->priv;
+
+	/* Main contact entry */
+	node = rm_xmlnode_new("contact");
+
+	/* Person */
+	contact_node = rm_xmlnode_new("person");
+
+	realname_node = rm_xmlnode_new("realName");
+	rm_xmlnode_insert_data(realname_node, contact->name, -1);
+	rm_xmlnode_insert_child(contact_node, realname_node);
+
+	/* ImageURL */
+	if (priv && priv->image_url) {
+		image_node = rm_xmlnode_new("imageURL");
+		rm_xmlnode_insert_data(image_node, priv->image_url, -1);
+		rm_xmlnode_insert_child(contact_node, image_node);
+	}
+
+	/* Insert person to main node */
+	rm_xmlnode_insert_child(node, contact_node);
+
+	/* Telephony */
+	if (contact->numbers) {
+		gboolean first = TRUE;
+		gint id = 0;
+		gchar *tmp = g_strdup_printf("%d", g_list_length(contact->numbers));
+
+		telephony_node = rm_xmlnode_new("telephony");
+		rm_xmlnode_set_attrib(telephony_node, "nid", tmp);
+		g_free(tmp);
+
+		for (list = contact->numbers; list != NULL; list = list->next) {
+			RmPhoneNumber *number = list->data;
+			RmXmlNode *number_node;
+
+			number_node = rm_xmlnode_new("number");
+
+			switch (number->type) {
+			case RM_PHONE_NUMBER_TYPE_HOME:
+				rm_xmlnode_set_attrib(number_node, "type", "home");
+				break;
+			case RM_PHONE_NUMBER_TYPE_WORK:
+				rm_xmlnode_set_attrib(number_node, "type", "work");
+				break;
+			case RM_PHONE_NUMBER_TYPE_MOBILE:
+				rm_xmlnode_set_attrib(number_node, "type", "mobile");
+				break;
+			case RM_PHONE_NUMBER_TYPE_FAX_WORK:
+				rm_xmlnode_set_attrib(number_node, "type", "fax_work");
+				break;
+			case RM_PHONE_NUMBER_TYPE_FAX_HOME:
+				rm_xmlnode_set_attrib(number_node, "type", "fax_home");
+				break;
+			default:
+				continue;
+			}
+
+			if (first) {
+				/* For the meantime set priority to 1 */
+				rm_xmlnode_set_attrib(number_node, "prio", "1");
+				first = FALSE;
+			}
 
-			book = g_slice_new(struct fritzfon_book);
-			book->id = num;
-			book->name = name;
+			tmp = g_strdup_printf("%d", id++);
+			rm_xmlnode_set_attrib(number_node, "id", tmp);
+			g_free(tmp);
 
-			fritzfon_books = g_list_prepend(fritzfon_books, book);
-		} else {
-			break;
+			rm_xmlnode_insert_data(number_node, number->number, -1);
+			rm_xmlnode_insert_child(telephony_node, number_node);
 		}
+		rm_xmlnode_insert_child(node, telephony_node);
+	}
 
-		pos++;
-	} while (pos != NULL);
-
-	g_object_unref(msg);
+	tmp_node = rm_xmlnode_new("mod_time");
+	tmp = g_strdup_printf("%u", (unsigned)time(NULL));
+	rm_xmlnode_insert_data(tmp_node, tmp, -1);
+	rm_xmlnode_insert_child(node, tmp_node);
+	g_free(tmp);
 
- end:
-	if (g_list_length(fritzfon_books) == 0) {
-		book = g_slice_new(struct fritzfon_book);
-		book->id = g_strdup("0");
-		book->name = g_strdup("Telefonbuch");
+	tmp_node = rm_xmlnode_new("uniqueid");
+	if (priv && priv->unique_id) {
+		rm_xmlnode_insert_data(tmp_node, priv->unique_id, -1);
+	}
+	rm_xmlnode_insert_child(node, tmp_node);
 
-		fritzfon_books = g_list_prepend(fritzfon_books, book);
+	if (priv) {
+		for (list = fritzfon_priv_get_nodes(priv); list != NULL; list = list->next) {
+			RmXmlNode *priv_node = list->data;
+			rm_xmlnode_insert_child(node, rm_xmlnode_copy(priv_node));
+		}
 	}
 
-	//rm_router_logout(profile);
+	return node;
+}
 
-	return 0;
+/**
+ * \brief Convert phonebooks to xml node
+ * \return xml node
+ */
+RmXmlNode *phonebook_to_xmlnode(void)
+{
+	RmXmlNode *node;
+	RmXmlNode *child;
+	RmXmlNode *book;
+	GList *list;
+
+	/* Create general phonebooks node */
+	node = rm_xmlnode_new("phonebooks");
+
+	/* Currently we only support one phonebook, TODO */
+	book = rm_xmlnode_new("phonebook");
+	rm_xmlnode_set_attrib(book, "owner", g_settings_get_string(fritzfon_settings, "book-owner"));
+	rm_xmlnode_set_attrib(book, "name", g_settings_get_string(fritzfon_settings, "book-name"));
+	rm_xmlnode_insert_child(node, book);
+
+	/* Loop through persons list and add only non-deleted entries */
+	for (list = contacts; list != NULL; list = list->next) {
+		RmContact *contact = list->data;
+
+		/* Convert each contact and add it to current phone book */
+		child = contact_to_xmlnode(contact);
+		rm_xmlnode_insert_child(book, child);
+	}
+
+	return node;
 }
 
-static gint fritzfon_get_books_tr64(void)
+gboolean fritzfon_save(void)
 {
+	RmXmlNode *node;
 	RmProfile *profile = rm_profile_get_active();
-	g_autoptr(SoupMessage) msg = NULL;
-	g_autofree gchar *list = NULL;
-	g_autofree gchar **split = NULL;
-	struct fritzfon_book *book = NULL;
-	gint i;
+	gchar *data;
+	gint len;
+	SoupBuffer *buffer;
 
-	msg = rm_network_tr64_request(profile, TRUE, "x_contact", "GetPhonebookList", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", NULL);
-	if (msg == NULL) {
+	if (strlen(g_settings_get_string(fritzfon_settings, "book-owner")) > 2) {
+		g_warning("Cannot save online address books");
 		return FALSE;
 	}
 
-	rm_log_save_data("tr64-getphonebooklist.xml", msg->response_body->data, msg->response_body->length);
-	list = rm_utils_xml_extract_tag(msg->response_body->data, "NewPhonebookList");
-	split = g_strsplit(list, ",", -1);
+	if (!rm_router_login(profile)) {
+		return FALSE;
+	}
 
-	for (i = 0; i < g_strv_length(split); i++) {
-		msg = rm_network_tr64_request(profile, TRUE, "x_contact", "GetPhonebook", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", "NewPhonebookID", split[i], NULL);
-		if (msg == NULL) {
-			return FALSE;
-		}
+	node = phonebook_to_xmlnode();
 
-		gchar *name = rm_utils_xml_extract_tag(msg->response_body->data, "NewPhonebookName");
+	data = rm_xmlnode_to_formatted_str(node, &len);
+	rm_xmlnode_free(node);
+#ifdef FRITZFON_DEBUG
+	gchar *file;
+	g_debug("len: %d", len);
+	file = g_strdup("/tmp/test.xml");
+	if (len > 0) {
+		rm_file_save(file, data, len);
+	}
+	g_free(file);
+#endif
+//	return FALSE;
 
-		book = g_slice_new(struct fritzfon_book);
-		book->id = g_strdup_printf("%d", i);
-		book->name = name;
+	buffer = soup_buffer_new(SOUP_MEMORY_TAKE, data, len);
 
-		fritzfon_books = g_list_prepend(fritzfon_books, book);
+	/* Create POST message */
+	gchar *url = g_strdup_printf("http://%s/cgi-bin/firmwarecfg", rm_router_get_host(profile));
+	SoupMultipart *multipart = soup_multipart_new(SOUP_FORM_MIME_TYPE_MULTIPART);
+	soup_multipart_append_form_string(multipart, "sid", profile->router_info->session_id);
+	soup_multipart_append_form_string(multipart, "PhonebookId", g_settings_get_string(fritzfon_settings, "book-owner"));
+	soup_multipart_append_form_file(multipart, "PhonebookImportFile", "dummy", "text/xml", buffer);
+	SoupMessage *msg = soup_form_request_new_from_multipart(url, multipart);
 
-		rm_log_save_data("tr64-getphonebook.xml", msg->response_body->data, msg->response_body->length);
+	soup_session_send_message(rm_soup_session, msg);
+	soup_buffer_free(buffer);
+	g_free(url);
+
+	if (msg->status_code != 200) {
+		g_warning("Could not send phonebook");
+		g_object_unref(msg);
+		return FALSE;
 	}
+	g_object_unref(msg);
+
+	fritzfon_snapshot_save(profile);
 
 	return TRUE;
 }
 
-static gint fritzfon_get_books(void)
+/**
+ * fritzfon_edit_free:
+ * @data: a fritzfon edit
+ *
+ * Frees edit data.
+ */
+static void fritzfon_edit_free(gpointer data)
 {
-	RmProfile *profile = rm_profile_get_active();
+	struct fritzfon_edit *edit = data;
 
-	if (rm_router_need_ftp(profile)) {
-		return fritzfon_get_books_ftp();
+	g_free(edit->unique_id);
+	g_free(edit->data);
+	g_free(edit->new_unique_id);
+
+	g_slice_free(struct fritzfon_edit, edit);
+}
+
+/**
+ * fritzfon_set_entry:
+ * @profile: a #RmProfile
+ * @owner: phonebook id
+ * @edit: a fritzfon edit
+ * @error: a #GError
+ *
+ * Write a single phonebook entry using TR-064. Prefers SetPhonebookEntryUID (returns the unique id of
+ * new entries) and falls back to SetPhonebookEntry on older firmware.
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean fritzfon_set_entry(RmProfile *profile, const gchar *owner, struct fritzfon_edit *edit, GError **error)
+{
+	g_autoptr(SoupMessage) msg = NULL;
+
+	/* Entry data is escaped by the soap builder */
+	if (fritzfon_entry_uid_action) {
+		GError *uid_error = NULL;
+
+		msg = rm_network_tr64_request_full(profile, TRUE, "x_contact", "SetPhonebookEntryUID", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", &uid_error, "NewPhonebookID", owner, "NewPhonebookEntryData", edit->data, NULL);
+		if (msg) {
+			edit->new_unique_id = rm_utils_xml_extract_tag(msg->response_body->data, "NewPhonebookEntryUniqueID");
+			return TRUE;
+		}
+
+		if (!g_error_matches(uid_error, RM_NETWORK_TR64_ERROR, RM_NETWORK_TR64_ERROR_INVALID_ACTION)) {
+			g_propagate_error(error, uid_error);
+			return FALSE;
+		}
+
+		/* Firmware does not know the action */
+		g_error_free(uid_error);
+		fritzfon_entry_uid_action = FALSE;
 	}
 
-	return fritzfon_get_books_tr64 ();
+	/* Empty entry id: new entry, or the entry referenced by the uniqueid within data */
+	msg = rm_network_tr64_request_full(profile, TRUE, "x_contact", "SetPhonebookEntry", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", error, "NewPhonebookID", owner, "NewPhonebookEntryID", "", "NewPhonebookEntryData", edit->data, NULL);
+
+	return msg != NULL;
 }
 
-RmXmlNode *create_phone(char *type, char *number)
+/**
+ * fritzfon_delete_entry:
+ * @profile: a #RmProfile
+ * @owner: phonebook id
+ * @edit: a fritzfon edit
+ * @error: a #GError
+ *
+ * Delete a single phonebook entry using TR-064.
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean fritzfon_delete_entry(RmProfile *profile, const gchar *owner, struct fritzfon_edit *edit, GError **error)
 {
-	RmXmlNode *number_node;
+	g_autoptr(SoupMessage) msg = NULL;
 
-	number_node = rm_xmlnode_new("number");
-	rm_xmlnode_set_attrib(number_node, "type", type);
+	msg = rm_network_tr64_request_full(profile, TRUE, "x_contact", "DeletePhonebookEntryUID", "urn:dslforum-org:service:X_AVM-DE_OnTel:1", error, "NewPhonebookID", owner, "NewPhonebookEntryUniqueID", edit->unique_id, NULL);
 
-	/* For the meantime set priority to 0, TODO */
-	rm_xmlnode_set_attrib(number_node, "prio", "0");
-	rm_xmlnode_insert_data(number_node, number, -1);
+	return msg != NULL;
+}
 
-	return number_node;
+struct fritzfon_edit_data {
+	RmProfile *profile;
+	gchar *owner;
+	GList *edits;
+};
+
+/**
+ * fritzfon_edit_data_free:
+ * @data: fritzfon edit data
+ *
+ * Frees edit task data.
+ */
+static void fritzfon_edit_data_free(gpointer data)
+{
+	struct fritzfon_edit_data *edit_data = data;
+
+	g_free(edit_data->owner);
+	g_list_free_full(edit_data->edits, fritzfon_edit_free);
+
+	g_slice_free(struct fritzfon_edit_data, edit_data);
 }
 
 /**
- * \brief Convert person structure to xml node
- * \param contact person structure
- * \return xml node
+ * fritzfon_edit_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: fritzfon edit data
+ * @cancellable: a #GCancellable
+ *
+ * Write pending edits entry by entry.
+ */
+static void fritzfon_edit_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	struct fritzfon_edit_data *data = task_data;
+	GList *list;
+
+	for (list = data->edits; list != NULL; list = list->next) {
+		struct fritzfon_edit *edit = list->data;
+		GError *error = NULL;
+		gboolean ret;
+
+		if (g_task_return_error_if_cancelled(task)) {
+			return;
+		}
+
+		if (edit->type == FRITZFON_EDIT_SAVE) {
+			ret = fritzfon_set_entry(data->profile, data->owner, edit, &error);
+		} else {
+			ret = fritzfon_delete_entry(data->profile, data->owner, edit, &error);
+		}
+
+		if (!ret) {
+			g_task_return_error(task, error);
+			return;
+		}
+	}
+
+	g_task_return_boolean(task, TRUE);
+}
+
+static void fritzfon_edit_schedule(void);
+
+/**
+ * fritzfon_edit_failed:
+ *
+ * Tell the user that contact changes could not be written to the router.
+ */
+static void fritzfon_edit_failed(void)
+{
+	rm_object_emit_message(R_("Address book"), R_("Could not write contact changes to the router"));
+}
+
+/**
+ * fritzfon_edit_apply_ids:
+ * @data: fritzfon edit data
+ *
+ * Apply unique ids the router assigned to new entries. Edits written before a failing one
+ * have been stored on the router as well, so this is done whether the flush succeeded or not.
+ *
+ * Returns: %TRUE if a unique id changed
+ */
+static gboolean fritzfon_edit_apply_ids(struct fritzfon_edit_data *data)
+{
+	gboolean changed = FALSE;
+	GList *list;
+
+	for (list = data->edits; list != NULL; list = list->next) {
+		struct fritzfon_edit *edit = list->data;
+		struct fritzfon_priv *priv;
+
+		/* Removed entries and contacts dropped in the meantime have nothing to update */
+		if (!edit->contact) {
+			continue;
+		}
+
+		priv = edit->contact->priv;
+		if (RM_EMPTY_STRING(edit->new_unique_id) || g_strcmp0(edit->new_unique_id, priv->unique_id) == 0) {
+			continue;
+		}
+
+		g_free(priv->unique_id);
+		priv->unique_id = g_steal_pointer(&edit->new_unique_id);
+
+		if (fritzfon_snapshot) {
+			g_hash_table_replace(fritzfon_snapshot, g_strdup(priv->unique_id), edit->contact);
+		}
+
+		changed = TRUE;
+	}
+
+	return changed;
+}
+
+/**
+ * fritzfon_edit_ready_cb:
+ * @source: unused
+ * @result: a #GAsyncResult
+ * @user_data: unused
+ *
+ * Apply unique ids of new entries (main context). In case the router does not support per entry
+ * actions the whole phonebook is exported instead, other failures are reported to the user.
+ */
+static void fritzfon_edit_ready_cb(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	struct fritzfon_edit_data *data = g_task_get_task_data(G_TASK(result));
+	g_autoptr(GError) error = NULL;
+	gboolean changed;
+
+	/* Plugin shut down in the meantime, contacts and settings are gone */
+	if (g_cancellable_is_cancelled(g_task_get_cancellable(G_TASK(result)))) {
+		return;
+	}
+
+	fritzfon_edit_running = FALSE;
+	fritzfon_edits_running = NULL;
+	g_clear_object(&fritzfon_edit_cancellable);
+
+	changed = fritzfon_edit_apply_ids(data);
+
+	if (g_task_propagate_boolean(G_TASK(result), &error)) {
+		fritzfon_entry_support = 1;
+		fritzfon_snapshot_save(data->profile);
+	} else if (g_error_matches(error, RM_NETWORK_TR64_ERROR, RM_NETWORK_TR64_ERROR_INVALID_ACTION)) {
+		g_debug("%s(): %s, exporting whole phonebook", __FUNCTION__, error->message);
+
+		/* Router is reachable, but does not know the actions */
+		fritzfon_entry_support = 0;
+		if (!fritzfon_save()) {
+			fritzfon_edit_failed();
+		}
+	} else {
+		g_warning("%s(): %s", __FUNCTION__, error->message);
+		fritzfon_edit_failed();
+
+		if (changed) {
+			fritzfon_snapshot_save(data->profile);
+		}
+	}
+
+	if (fritzfon_edits) {
+		fritzfon_edit_schedule();
+	}
+}
+
+/**
+ * fritzfon_edit_flush:
+ * @user_data: unused
+ *
+ * Write all pending edits to the router.
+ *
+ * Returns: %G_SOURCE_REMOVE
  */
-static RmXmlNode *contact_to_xmlnode(RmContact *contact)
+static gboolean fritzfon_edit_flush(gpointer user_data)
 {
-	RmXmlNode *node;
-	RmXmlNode *contact_node;
-	RmXmlNode *realname_node;
-	RmXmlNode *image_node;
-	RmXmlNode *telephony_node;
-	RmXmlNode *tmp_node;
+	RmProfile *profile = rm_profile_get_active();
+	struct fritzfon_edit_data *data;
+	g_autofree gchar *owner = g_settings_get_string(fritzfon_settings, "book-owner");
 	GList *list;
-	gchar *tmp;
-	struct fritzfon_priv *priv = contact->priv;
-
-	/* Main contact entry */
-	node = rm_xmlnode_new("contact");
-
-	/* Person */
-	contact_node = rm_xmlnode_new("person");
+	GTask *task;
 
-	realname_node = rm_xmlnode_new("realName");
-	rm_xmlnode_insert_data(realname_node, contact->name, -1);
-	rm_xmlnode_insert_child(contact_node, realname_node);
+	fritzfon_edit_flush_id = 0;
 
-	/* ImageURL */
-	if (priv && priv->image_url) {
-		image_node = rm_xmlnode_new("imageURL");
-		rm_xmlnode_insert_data(image_node, priv->image_url, -1);
-		rm_xmlnode_insert_child(contact_node, image_node);
+	if (fritzfon_edit_running) {
+		/* Rescheduled once the running flush is done */
+		return G_SOURCE_REMOVE;
 	}
 
-	/* Insert person to main node */
-	rm_xmlnode_insert_child(node, contact_node);
+	if (rm_router_need_ftp(profile) || fritzfon_entry_support == 0) {
+		g_list_free_full(g_steal_pointer(&fritzfon_edits), fritzfon_edit_free);
+		if (!fritzfon_save()) {
+			fritzfon_edit_failed();
+		}
 
-	/* Telephony */
-	if (contact->numbers) {
-		gboolean first = TRUE;
-		gint id = 0;
-		gchar *tmp = g_strdup_printf("%d", g_list_length(contact->numbers));
+		return G_SOURCE_REMOVE;
+	}
 
-		telephony_node = rm_xmlnode_new("telephony");
-		rm_xmlnode_set_attrib(telephony_node, "nid", tmp);
-		g_free(tmp);
+	data = g_slice_new0(struct fritzfon_edit_data);
+	data->profile = profile;
+	data->owner = g_steal_pointer(&owner);
 
-		for (list = contact->numbers; list != NULL; list = list->next) {
-			RmPhoneNumber *number = list->data;
-			RmXmlNode *number_node;
+	/* Serialize the latest state of each contact, saves of contacts dropped in the meantime are void */
+	for (list = g_list_reverse(g_steal_pointer(&fritzfon_edits)); list != NULL; list = g_list_delete_link(list, list)) {
+		struct fritzfon_edit *edit = list->data;
 
-			number_node = rm_xmlnode_new("number");
+		if (edit->type == FRITZFON_EDIT_SAVE) {
+			RmXmlNode *node;
 
-			switch (number->type) {
-			case RM_PHONE_NUMBER_TYPE_HOME:
-				rm_xmlnode_set_attrib(number_node, "type", "home");
-				break;
-			case RM_PHONE_NUMBER_TYPE_WORK:
-				rm_xmlnode_set_attrib(number_node, "type", "work");
-				break;
-			case RM_PHONE_NUMBER_TYPE_MOBILE:
-				rm_xmlnode_set_attrib(number_node, "type", "mobile");
-				break;
-			case RM_PHONE_NUMBER_TYPE_FAX_WORK:
-				rm_xmlnode_set_attrib(number_node, "type", "fax_work");
-				break;
-			case RM_PHONE_NUMBER_TYPE_FAX_HOME:
-				rm_xmlnode_set_attrib(number_node, "type", "fax_home");
-				break;
-			default:
+			if (!edit->contact) {
+				fritzfon_edit_free(edit);
 				continue;
 			}
 
-			if (first) {
-				/* For the meantime set priority to 1 */
-				rm_xmlnode_set_attrib(number_node, "prio", "1");
-				first = FALSE;
-			}
-
-			tmp = g_strdup_printf("%d", id++);
-			rm_xmlnode_set_attrib(number_node, "id", tmp);
-			g_free(tmp);
-
-			rm_xmlnode_insert_data(number_node, number->number, -1);
-			rm_xmlnode_insert_child(telephony_node, number_node);
+			node = contact_to_xmlnode(edit->contact);
+			edit->data = rm_xmlnode_to_formatted_str(node, NULL);
+			rm_xmlnode_free(node);
 		}
-		rm_xmlnode_insert_child(node, telephony_node);
+
+		data->edits = g_list_prepend(data->edits, edit);
 	}
+	data->edits = g_list_reverse(data->edits);
 
-	tmp_node = rm_xmlnode_new("mod_time");
-	tmp = g_strdup_printf("%u", (unsigned)time(NULL));
-	rm_xmlnode_insert_data(tmp_node, tmp, -1);
-	rm_xmlnode_insert_child(node, tmp_node);
-	g_free(tmp);
+	if (!data->edits) {
+		fritzfon_edit_data_free(data);
 
-	tmp_node = rm_xmlnode_new("uniqueid");
-	if (priv && priv->unique_id) {
-		rm_xmlnode_insert_data(tmp_node, priv->unique_id, -1);
+		return G_SOURCE_REMOVE;
 	}
-	rm_xmlnode_insert_child(node, tmp_node);
 
-	if (priv) {
-		for (list = priv->nodes; list != NULL; list = list->next) {
-			RmXmlNode *priv_node = list->data;
-			rm_xmlnode_insert_child(node, priv_node);
-		}
-	}
+	fritzfon_edit_running = TRUE;
+	fritzfon_edits_running = data->edits;
 
-	return node;
+	fritzfon_edit_cancellable = g_cancellable_new();
+
+	task = g_task_new(NULL, fritzfon_edit_cancellable, fritzfon_edit_ready_cb, NULL);
+	g_task_set_source_tag(task, fritzfon_edit_flush);
+	g_task_set_task_data(task, data, fritzfon_edit_data_free);
+	rm_executor_run_task(task, RM_EXECUTOR_PRIORITY_BACKGROUND, fritzfon_edit_thread);
+	g_object_unref(task);
+
+	return G_SOURCE_REMOVE;
 }
 
 /**
- * \brief Convert phonebooks to xml node
- * \return xml node
+ * fritzfon_edit_schedule:
+ *
+ * Schedule flush of pending edits, so that edits following in quick succession are written together.
  */
-RmXmlNode *phonebook_to_xmlnode(void)
+static void fritzfon_edit_schedule(void)
 {
-	RmXmlNode *node;
-	RmXmlNode *child;
-	RmXmlNode *book;
-	GList *list;
-
-	/* Create general phonebooks node */
-	node = rm_xmlnode_new("phonebooks");
-
-	/* Currently we only support one phonebook, TODO */
-	book = rm_xmlnode_new("phonebook");
-	rm_xmlnode_set_attrib(book, "owner", g_settings_get_string(fritzfon_settings, "book-owner"));
-	rm_xmlnode_set_attrib(book, "name", g_settings_get_string(fritzfon_settings, "book-name"));
-	rm_xmlnode_insert_child(node, book);
-
-	/* Loop through persons list and add only non-deleted entries */
-	for (list = contacts; list != NULL; list = list->next) {
-		RmContact *contact = list->data;
-
-		/* Convert each contact and add it to current phone book */
-		child = contact_to_xmlnode(contact);
-		rm_xmlnode_insert_child(book, child);
+	if (!fritzfon_edit_flush_id) {
+		fritzfon_edit_flush_id = g_timeout_add(FRITZFON_EDIT_DELAY, fritzfon_edit_flush, NULL);
 	}
-
-	return node;
 }
 
-gboolean fritzfon_save(void)
+/**
+ * fritzfon_edit_queue:
+ * @type: edit type
+ * @contact: a #RmContact
+ *
+ * Queue contact edit. Multiple edits of one contact are merged. Edits are written in background,
+ * a failure is reported to the user by a message.
+ *
+ * Returns: %TRUE if edit has been queued
+ */
+static gboolean fritzfon_edit_queue(enum fritzfon_edit_type type, RmContact *contact)
 {
-	RmXmlNode *node;
-	RmProfile *profile = rm_profile_get_active();
-	gchar *data;
-	gint len;
-	SoupBuffer *buffer;
+	struct fritzfon_priv *priv = contact->priv;
+	struct fritzfon_edit *edit = NULL;
+	g_autofree gchar *owner = g_settings_get_string(fritzfon_settings, "book-owner");
+	GList *list;
 
-	if (strlen(g_settings_get_string(fritzfon_settings, "book-owner")) > 2) {
+	if (strlen(owner) > 2) {
 		g_warning("Cannot save online address books");
 		return FALSE;
 	}
 
-	if (!rm_router_login(profile)) {
-		return FALSE;
-	}
-
-	node = phonebook_to_xmlnode();
+	for (list = fritzfon_edits; list != NULL; list = list->next) {
+		struct fritzfon_edit *tmp = list->data;
 
-	data = rm_xmlnode_to_formatted_str(node, &len);
-#ifdef FRITZFON_DEBUG
-	gchar *file;
-	g_debug("len: %d", len);
-	file = g_strdup("/tmp/test.xml");
-	if (len > 0) {
-		rm_file_save(file, data, len);
+		if (tmp->contact == contact) {
+			edit = tmp;
+			break;
+		}
 	}
-	g_free(file);
-#endif
-//	return FALSE;
 
-	buffer = soup_buffer_new(SOUP_MEMORY_TAKE, data, len);
+	if (type == FRITZFON_EDIT_REMOVE) {
+		/* Removed contacts belong to the caller again, edits only keep the unique id */
+		fritzfon_edit_forget(contact);
 
-	/* Create POST message */
-	gchar *url = g_strdup_printf("http://%s/cgi-bin/firmwarecfg", rm_router_get_host(profile));
-	SoupMultipart *multipart = soup_multipart_new(SOUP_FORM_MIME_TYPE_MULTIPART);
-	soup_multipart_append_form_string(multipart, "sid", profile->router_info->session_id);
-	soup_multipart_append_form_string(multipart, "PhonebookId", g_settings_get_string(fritzfon_settings, "book-owner"));
-	soup_multipart_append_form_file(multipart, "PhonebookImportFile", "dummy", "text/xml", buffer);
-	SoupMessage *msg = soup_form_request_new_from_multipart(url, multipart);
+		if (!priv || RM_EMPTY_STRING(priv->unique_id)) {
+			/* Router does not know this contact yet, just drop pending save */
+			if (edit) {
+				fritzfon_edits = g_list_remove(fritzfon_edits, edit);
+				fritzfon_edit_free(edit);
+			}
 
-	soup_session_send_message(rm_soup_session, msg);
-	soup_buffer_free(buffer);
-	g_free(url);
+			return TRUE;
+		}
+	}
 
-	if (msg->status_code != 200) {
-		g_warning("Could not send phonebook");
-		g_object_unref(msg);
-		return FALSE;
+	if (!edit) {
+		edit = g_slice_new0(struct fritzfon_edit);
+		edit->contact = type == FRITZFON_EDIT_SAVE ? contact : NULL;
+		fritzfon_edits = g_list_prepend(fritzfon_edits, edit);
 	}
-	g_object_unref(msg);
+
+	edit->type = type;
+	g_free(edit->unique_id);
+	edit->unique_id = g_strdup(priv ? priv->unique_id : NULL);
+
+	fritzfon_edit_schedule();
 
 	return TRUE;
 }
 
 gboolean fritzfon_remove_contact(RmContact *contact)
 {
+	struct fritzfon_priv *priv = contact->priv;
+
 	contacts = g_list_remove(contacts, contact);
-	return fritzfon_save();
+	if (fritzfon_contacts) {
+		g_ptr_array_remove(fritzfon_contacts, contact);
+	}
+	if (fritzfon_snapshot && priv && priv->unique_id) {
+		g_hash_table_remove(fritzfon_snapshot, priv->unique_id);
+	}
+
+	/* A pending image job of the contact is dropped by fritzfon_image_apply() */
+	return fritzfon_edit_queue(FRITZFON_EDIT_REMOVE, contact);
 }
 
 void fritzfon_set_image(RmContact *contact)
@@ -765,13 +2105,19 @@ gboolean fritzfon_save_contact(RmContact *contact)
 		if (contact->image) {
 			fritzfon_set_image(contact);
 		}
-		contacts = g_list_insert_sorted(contacts, contact, rm_contact_name_compare);
+		contact->priv = g_slice_new0(struct fritzfon_priv);
+		if (!fritzfon_contacts) {
+			fritzfon_contacts = g_ptr_array_new();
+		}
+		g_ptr_array_add(fritzfon_contacts, contact);
+		fritzfon_update_contacts(TRUE);
 	} else {
 		if (contact->image) {
 			fritzfon_set_image(contact);
 		}
 	}
-	return fritzfon_save();
+
+	return fritzfon_edit_queue(FRITZFON_EDIT_SAVE, contact);
 }
 
 gchar *fritzfon_get_active_book_name(void)
@@ -793,6 +2139,8 @@ gchar **fritzfon_get_sub_books(void)
 	return ret;
 }
 
+static void fritzfon_revalidate(RmProfile *profile);
+
 gboolean fritzfon_set_sub_book(gchar *name)
 {
 	GList *list;
@@ -801,11 +2149,18 @@ gboolean fritzfon_set_sub_book(gchar *name)
 		struct fritzfon_book *book = list->data;
 
 		if (!strcmp(book->name, name)) {
-			g_settings_set_string(fritzfon_settings, "book-owner", book->id);
-			g_settings_set_string(fritzfon_settings, "book-name", book->name);
+			g_autofree gchar *owner = g_settings_get_string(fritzfon_settings, "book-owner");
+
+			/* Selecting the active book again just synchronizes it */
+			if (g_strcmp0(owner, book->id)) {
+				g_settings_set_string(fritzfon_settings, "book-owner", book->id);
+				g_settings_set_string(fritzfon_settings, "book-name", book->name);
+
+				fritzfon_reset();
+				fritzfon_snapshot_load(rm_profile_get_active());
+			}
 
-			contacts = NULL;
-			fritzfon_read_book();
+			fritzfon_revalidate(rm_profile_get_active());
 
 			return TRUE;
 		}
@@ -821,24 +2176,219 @@ RmAddressBook fritzfon_book = {
 	fritzfon_remove_contact,
 	fritzfon_save_contact,
 	fritzfon_get_sub_books,
-	fritzfon_set_sub_book
+	fritzfon_set_sub_book,
+	fritzfon_get_contact_array
+};
+
+struct fritzfon_sync_data {
+	RmProfile *profile;
+	gchar *owner;
+	gchar *name;
+	gchar *timestamp;
+	GList *books;
 };
 
+/**
+ * fritzfon_sync_data_free:
+ * @data: fritzfon sync data
+ *
+ * Frees sync data.
+ */
+static void fritzfon_sync_data_free(gpointer data)
+{
+	struct fritzfon_sync_data *sync_data = data;
+
+	g_free(sync_data->owner);
+	g_free(sync_data->name);
+	g_free(sync_data->timestamp);
+	g_list_free_full(sync_data->books, fritzfon_free_book);
+
+	g_slice_free(struct fritzfon_sync_data, sync_data);
+}
+
+/**
+ * fritzfon_sync_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: fritzfon sync data
+ * @cancellable: a #GCancellable
+ *
+ * Download active phonebook and list of phonebooks in background.
+ */
+static void fritzfon_sync_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	struct fritzfon_sync_data *data = task_data;
+	RmXmlNode *node;
+	gboolean ret;
+
+	if (g_task_return_error_if_cancelled(task)) {
+		return;
+	}
+
+	ret = fritzfon_download_book(data->profile, data->owner, data->name, data->timestamp, &node);
+
+	if (g_cancellable_is_cancelled(cancellable)) {
+		g_clear_pointer(&node, rm_xmlnode_free);
+		g_task_return_error_if_cancelled(task);
+		return;
+	}
+
+	fritzfon_get_books(data->profile, &data->books);
+
+	if (!ret) {
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not download phonebook");
+		return;
+	}
+
+	/* %NULL: unchanged since timestamp */
+	g_task_return_pointer(task, node, (GDestroyNotify)rm_xmlnode_free);
+}
+
+/**
+ * fritzfon_sync_ready_cb:
+ * @source: unused
+ * @result: a #GAsyncResult
+ * @user_data: unused
+ *
+ * Apply downloaded phonebook to the contact list (main context).
+ */
+static void fritzfon_sync_ready_cb(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	struct fritzfon_sync_data *data = g_task_get_task_data(G_TASK(result));
+	g_autoptr(GError) error = NULL;
+	g_autofree gchar *owner = NULL;
+	RmXmlNode *node;
+
+	/* Snapshot has been reset or plugin shut down in the meantime, result is freed with the task */
+	if (g_cancellable_is_cancelled(g_task_get_cancellable(G_TASK(result)))) {
+		return;
+	}
+
+	node = g_task_propagate_pointer(G_TASK(result), &error);
+
+	if (data->books) {
+		g_list_free_full(fritzfon_books, fritzfon_free_book);
+		fritzfon_books = g_steal_pointer(&data->books);
+	}
+
+	if (error) {
+		g_debug("%s(): %s, keeping snapshot", __FUNCTION__, error->message);
+		return;
+	}
+
+	/* Active book switched in the meantime */
+	owner = g_settings_get_string(fritzfon_settings, "book-owner");
+	if (g_strcmp0(owner, data->owner)) {
+		g_clear_pointer(&node, rm_xmlnode_free);
+		return;
+	}
+
+	if (fritzfon_apply_download(data->profile, node)) {
+		rm_object_emit_contacts_changed();
+	}
+}
+
+/**
+ * fritzfon_revalidate:
+ * @profile: a #RmProfile
+ *
+ * Revalidate contact list against the router in background.
+ */
+static void fritzfon_revalidate(RmProfile *profile)
+{
+	struct fritzfon_sync_data *data = g_slice_new0(struct fritzfon_sync_data);
+	GTask *task;
+
+	data->profile = profile;
+	data->owner = g_settings_get_string(fritzfon_settings, "book-owner");
+	data->name = g_settings_get_string(fritzfon_settings, "book-name");
+	data->timestamp = g_strdup(fritzfon_timestamp);
+
+	task = g_task_new(NULL, fritzfon_cancellable, fritzfon_sync_ready_cb, NULL);
+	g_task_set_source_tag(task, fritzfon_revalidate);
+	g_task_set_task_data(task, data, fritzfon_sync_data_free);
+	rm_executor_run_task(task, RM_EXECUTOR_PRIORITY_BACKGROUND, fritzfon_sync_thread);
+	g_object_unref(task);
+}
+
 gboolean fritzfon_plugin_init(RmPlugin *plugin)
 {
-	fritzfon_settings = rm_settings_new_profile("org.tabos.rm.plugins.fritzfon", "fritzfon", (gchar*)rm_profile_get_name(rm_profile_get_active()));
+	RmProfile *profile = rm_profile_get_active();
+
+	fritzfon_settings = rm_settings_new_profile("org.tabos.rm.plugins.fritzfon", "fritzfon", (gchar*)rm_profile_get_name(profile));
+
+	fritzfon_main_context = g_main_context_get_thread_default();
+	fritzfon_image_active = TRUE;
+	fritzfon_cancellable = g_cancellable_new();
+
+	/* Contacts of the last session are available at once, router is asked in background */
+	fritzfon_snapshot_load(profile);
+
+	if (!fritzfon_books) {
+		/* No snapshot, offer at least the active phonebook until the router answers */
+		struct fritzfon_book *book = g_slice_new(struct fritzfon_book);
+
+		book->id = g_settings_get_string(fritzfon_settings, "book-owner");
+		book->name = g_settings_get_string(fritzfon_settings, "book-name");
 
-	fritzfon_get_books();
-	fritzfon_read_book();
+		fritzfon_books = g_list_prepend(fritzfon_books, book);
+	}
 
 	rm_addressbook_register(&fritzfon_book);
 
+	fritzfon_revalidate(profile);
+
 	return TRUE;
 }
 
 gboolean fritzfon_plugin_shutdown(RmPlugin *plugin)
 {
 	rm_addressbook_unregister(&fritzfon_book);
+
+	g_cancellable_cancel(fritzfon_cancellable);
+	g_clear_object(&fritzfon_cancellable);
+
+	/* A running flush must not touch contacts and settings once they are gone */
+	if (fritzfon_edit_cancellable) {
+		g_cancellable_cancel(fritzfon_edit_cancellable);
+		g_clear_object(&fritzfon_edit_cancellable);
+	}
+	fritzfon_edit_running = FALSE;
+
+	/* Writing pending edits now would block unloading on the router */
+	if (fritzfon_edit_flush_id) {
+		g_source_remove(fritzfon_edit_flush_id);
+		fritzfon_edit_flush_id = 0;
+	}
+	if (fritzfon_edits) {
+		g_warning("%s(): Dropping %u contact change(s) not written to the router", __FUNCTION__, g_list_length(fritzfon_edits));
+		g_list_free_full(g_steal_pointer(&fritzfon_edits), fritzfon_edit_free);
+	}
+
+	/* Invalidate image jobs, queued ones are dropped by the workers, wait for running ones */
+	g_atomic_int_inc(&fritzfon_generation);
+	fritzfon_image_active = FALSE;
+	g_mutex_lock(&fritzfon_image_results_mutex);
+	while (fritzfon_image_jobs) {
+		g_cond_wait(&fritzfon_image_cond, &fritzfon_image_results_mutex);
+	}
+	g_mutex_unlock(&fritzfon_image_results_mutex);
+
+	/* Workers are gone, drop images not handed over yet */
+	if (fritzfon_image_apply_id) {
+		g_source_destroy(g_main_context_find_source_by_id(fritzfon_main_context, fritzfon_image_apply_id));
+		fritzfon_image_apply_id = 0;
+	}
+	g_slist_free_full(g_steal_pointer(&fritzfon_image_results), fritzfon_image_job_free);
+
+	if (fritzfon_image_changed_id) {
+		g_source_destroy(g_main_context_find_source_by_id(fritzfon_main_context, fritzfon_image_changed_id));
+		fritzfon_image_changed_id = 0;
+	}
+
+	fritzfon_reset();
+	fritzfon_edits_running = NULL;
+	g_list_free_full(g_steal_pointer(&fritzfon_books), fritzfon_free_book);
 	g_clear_object(&fritzfon_settings);
 
 	return TRUE;
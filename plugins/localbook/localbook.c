@@ -0,0 +1,1295 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <rm/rm.h>
+
+/* Address book reading vCard (*.vcf) and CSV (*.csv) files of a local directory */
+
+#define LOCALBOOK_CSV_HEADER "Name,Company,Type,Number"
+#define LOCALBOOK_RELOAD_DELAY 250
+
+struct localbook_priv {
+	/* Source file of contact */
+	gchar *file;
+	/* Unhandled vCard properties, written back unchanged */
+	GPtrArray *extra;
+};
+
+struct localbook_file {
+	/* Checksum of file content as last read or written, used to skip own changes */
+	gchar *checksum;
+	GPtrArray *contacts;
+};
+
+static GSettings *localbook_settings = NULL;
+static gchar *localbook_directory = NULL;
+/* File name -> struct localbook_file */
+static GHashTable *localbook_files = NULL;
+/* All contacts sorted by name, contacts is the same as list */
+static GPtrArray *localbook_contacts = NULL;
+static GList *contacts = NULL;
+/* Packed E.164 number key -> RmContact */
+static GHashTable *localbook_numbers = NULL;
+/* Protects contacts against lookups from other threads */
+static GMutex localbook_mutex;
+static GFileMonitor *localbook_monitor = NULL;
+/* Files changed on disk, reloaded after LOCALBOOK_RELOAD_DELAY */
+static GHashTable *localbook_pending = NULL;
+static guint localbook_reload_id = 0;
+
+static const gchar *localbook_csv_types[] = {
+	"home",
+	"work",
+	"mobile",
+	"fax_home",
+	"fax_work",
+	"pager",
+	"other",
+};
+
+/**
+ * localbook_priv_free:
+ * @priv: contact private data
+ *
+ * Frees contact private data.
+ */
+static void localbook_priv_free(struct localbook_priv *priv)
+{
+	if (!priv) {
+		return;
+	}
+
+	g_free(priv->file);
+	if (priv->extra) {
+		g_ptr_array_free(priv->extra, TRUE);
+	}
+	g_slice_free(struct localbook_priv, priv);
+}
+
+/**
+ * localbook_contact_new:
+ * @file: source file
+ *
+ * Creates an empty contact belonging to @file.
+ *
+ * Returns: a new #RmContact
+ */
+static RmContact *localbook_contact_new(const gchar *file)
+{
+	RmContact *contact = g_slice_new0(RmContact);
+	struct localbook_priv *priv = g_slice_new0(struct localbook_priv);
+
+	priv->file = g_strdup(file);
+	contact->priv = priv;
+
+	return contact;
+}
+
+/**
+ * localbook_contact_free:
+ * @data: a #RmContact
+ *
+ * Frees contact including private data.
+ */
+static void localbook_contact_free(gpointer data)
+{
+	RmContact *contact = data;
+
+	localbook_priv_free(contact->priv);
+	contact->priv = NULL;
+	rm_contact_free(contact);
+	g_slice_free(RmContact, contact);
+}
+
+/**
+ * localbook_file_free:
+ * @data: a struct localbook_file
+ *
+ * Frees file entry and its contacts.
+ */
+static void localbook_file_free(gpointer data)
+{
+	struct localbook_file *file = data;
+
+	g_free(file->checksum);
+	g_ptr_array_free(file->contacts, TRUE);
+	g_slice_free(struct localbook_file, file);
+}
+
+/**
+ * localbook_file_new:
+ *
+ * Returns: a new empty struct localbook_file
+ */
+static struct localbook_file *localbook_file_new(void)
+{
+	struct localbook_file *file = g_slice_new0(struct localbook_file);
+
+	file->contacts = g_ptr_array_new_with_free_func(localbook_contact_free);
+
+	return file;
+}
+
+/**
+ * localbook_add_number:
+ * @contact: a #RmContact
+ * @type: a #RmPhoneNumberType
+ * @number: phone number
+ *
+ * Append phone number to @contact.
+ */
+static void localbook_add_number(RmContact *contact, RmPhoneNumberType type, const gchar *number)
+{
+	RmPhoneNumber *phone_number;
+
+	if (RM_EMPTY_STRING(number)) {
+		return;
+	}
+
+	phone_number = g_slice_new0(RmPhoneNumber);
+	phone_number->type = type;
+	phone_number->number = g_strdup(number);
+
+	contact->numbers = g_list_append(contact->numbers, phone_number);
+}
+
+/**
+ * localbook_vcard_split:
+ * @value: vCard property value
+ *
+ * Split structured vCard value at unescaped ';' and unescape the components.
+ *
+ * Returns: component array, free with g_strfreev()
+ */
+static gchar **localbook_vcard_split(const gchar *value)
+{
+	GPtrArray *components = g_ptr_array_new();
+	GString *component = g_string_new(NULL);
+	const gchar *ptr;
+
+	for (ptr = value; ; ptr++) {
+		if (*ptr == '\\' && ptr[1]) {
+			ptr++;
+			g_string_append_c(component, (*ptr == 'n' || *ptr == 'N') ? '\n' : *ptr);
+		} else if (*ptr == ';' || !*ptr) {
+			g_ptr_array_add(components, g_string_free(component, FALSE));
+			if (!*ptr) {
+				break;
+			}
+			component = g_string_new(NULL);
+		} else {
+			g_string_append_c(component, *ptr);
+		}
+	}
+
+	g_ptr_array_add(components, NULL);
+
+	return (gchar**)g_ptr_array_free(components, FALSE);
+}
+
+/**
+ * localbook_vcard_escape:
+ * @str: output string
+ * @value: value to escape or %NULL
+ *
+ * Appends @value escaped for vCard text values.
+ */
+static void localbook_vcard_escape(GString *str, const gchar *value)
+{
+	const gchar *ptr;
+
+	for (ptr = value; ptr && *ptr; ptr++) {
+		switch (*ptr) {
+		case '\\':
+		case ',':
+		case ';':
+			g_string_append_c(str, '\\');
+			g_string_append_c(str, *ptr);
+			break;
+		case '\n':
+			g_string_append(str, "\\n");
+			break;
+		case '\r':
+			break;
+		default:
+			g_string_append_c(str, *ptr);
+			break;
+		}
+	}
+}
+
+/**
+ * localbook_vcard_number_type:
+ * @params: upper case property parameters
+ *
+ * Returns: #RmPhoneNumberType of TEL property
+ */
+static RmPhoneNumberType localbook_vcard_number_type(const gchar *params)
+{
+	if (strstr(params, "FAX")) {
+		return strstr(params, "WORK") ? RM_PHONE_NUMBER_TYPE_FAX_WORK : RM_PHONE_NUMBER_TYPE_FAX_HOME;
+	} else if (strstr(params, "CELL")) {
+		return RM_PHONE_NUMBER_TYPE_MOBILE;
+	} else if (strstr(params, "PAGER")) {
+		return RM_PHONE_NUMBER_TYPE_PAGER;
+	} else if (strstr(params, "WORK")) {
+		return RM_PHONE_NUMBER_TYPE_WORK;
+	} else if (strstr(params, "HOME") || !*params || strstr(params, "VOICE")) {
+		return RM_PHONE_NUMBER_TYPE_HOME;
+	}
+
+	return RM_PHONE_NUMBER_TYPE_OTHER;
+}
+
+/**
+ * localbook_vcard_property:
+ * @contact: current #RmContact
+ * @line: unfolded content line
+ *
+ * Parse one vCard content line into @contact.
+ */
+static void localbook_vcard_property(RmContact *contact, const gchar *line)
+{
+	struct localbook_priv *priv = contact->priv;
+	const gchar *value = strchr(line, ':');
+	const gchar *name = line;
+	const gchar *dot;
+	gchar *property;
+	gchar *params;
+	gsize name_len;
+
+	if (!value) {
+		return;
+	}
+
+	/* Skip group prefix, e.g. item1.TEL */
+	dot = memchr(line, '.', value - line);
+	if (dot && !memchr(line, ';', dot - line)) {
+		name = dot + 1;
+	}
+
+	name_len = strcspn(name, ";:");
+	property = g_ascii_strup(name, name_len);
+	params = g_ascii_strup(name + name_len, value - name - name_len);
+	value++;
+
+	if (!strcmp(property, "FN")) {
+		gchar **split = localbook_vcard_split(value);
+
+		g_free(contact->name);
+		contact->name = g_strjoinv(";", split);
+		g_strfreev(split);
+	} else if (!strcmp(property, "ORG")) {
+		gchar **split = localbook_vcard_split(value);
+
+		g_free(contact->company);
+		contact->company = g_strdup(split[0]);
+		g_strfreev(split);
+	} else if (!strcmp(property, "TEL")) {
+		/* vCard 4 uses tel: URIs */
+		if (!g_ascii_strncasecmp(value, "tel:", 4)) {
+			value += 4;
+		}
+		localbook_add_number(contact, localbook_vcard_number_type(params), value);
+	} else if (!strcmp(property, "ADR")) {
+		gchar **split = localbook_vcard_split(value);
+		RmContactAddress *address = g_slice_new0(RmContactAddress);
+
+		address->type = strstr(params, "WORK") ? 1 : 0;
+		if (g_strv_length(split) >= 6) {
+			address->street = g_strdup(split[2]);
+			address->city = g_strdup(split[3]);
+			address->zip = g_strdup(split[5]);
+		}
+		contact->addresses = g_list_append(contact->addresses, address);
+		g_strfreev(split);
+	} else if (strcmp(property, "VERSION") && strcmp(property, "BEGIN") && strcmp(property, "END")) {
+		/* Fall back to structured name, kept as is */
+		if (!strcmp(property, "N") && !contact->name) {
+			gchar **split = localbook_vcard_split(value);
+
+			if (split[0] && split[1]) {
+				contact->name = g_strstrip(g_strdup_printf("%s %s", split[1], split[0]));
+			}
+			g_strfreev(split);
+		}
+
+		if (!priv->extra) {
+			priv->extra = g_ptr_array_new_with_free_func(g_free);
+		}
+		g_ptr_array_add(priv->extra, g_strdup(line));
+	}
+
+	g_free(params);
+	g_free(property);
+}
+
+/**
+ * localbook_vcard_line:
+ * @file: source file
+ * @line: unfolded content line
+ * @current: location of contact being parsed
+ * @list: contacts array
+ *
+ * Handles one logical vCard line.
+ */
+static void localbook_vcard_line(const gchar *file, const gchar *line, RmContact **current, GPtrArray *list)
+{
+	if (!g_ascii_strncasecmp(line, "BEGIN:VCARD", 11)) {
+		g_clear_pointer(current, localbook_contact_free);
+		*current = localbook_contact_new(file);
+	} else if (!g_ascii_strncasecmp(line, "END:VCARD", 9)) {
+		RmContact *contact = *current;
+
+		if (contact) {
+			if (RM_EMPTY_STRING(contact->name)) {
+				g_free(contact->name);
+				contact->name = g_strdup(contact->company ? contact->company : "");
+			}
+			g_ptr_array_add(list, contact);
+			*current = NULL;
+		}
+	} else if (*current) {
+		localbook_vcard_property(*current, line);
+	}
+}
+
+/**
+ * localbook_parse_vcard:
+ * @file: source file
+ * @data: file content
+ * @len: length of @data
+ * @list: contacts array to fill
+ *
+ * Parse vCard data (2.1, 3.0 and 4.0) directly from (mapped) file content.
+ */
+static void localbook_parse_vcard(const gchar *file, const gchar *data, gsize len, GPtrArray *list)
+{
+	const gchar *end = data + len;
+	const gchar *ptr = data;
+	GString *line = g_string_new(NULL);
+	RmContact *current = NULL;
+
+	while (ptr < end) {
+		const gchar *eol = memchr(ptr, '\n', end - ptr);
+		gsize line_len;
+
+		if (!eol) {
+			eol = end;
+		}
+
+		line_len = eol - ptr;
+		if (line_len && ptr[line_len - 1] == '\r') {
+			line_len--;
+		}
+
+		if (line_len && (*ptr == ' ' || *ptr == '\t')) {
+			/* Folded continuation line */
+			g_string_append_len(line, ptr + 1, line_len - 1);
+		} else {
+			if (line->len) {
+				localbook_vcard_line(file, line->str, &current, list);
+			}
+			g_string_assign(line, "");
+			g_string_append_len(line, ptr, line_len);
+		}
+
+		ptr = eol + 1;
+	}
+
+	if (line->len) {
+		localbook_vcard_line(file, line->str, &current, list);
+	}
+
+	g_clear_pointer(&current, localbook_contact_free);
+	g_string_free(line, TRUE);
+}
+
+/* CSV parser state */
+struct localbook_csv_data {
+	const gchar *file;
+	GPtrArray *list;
+};
+
+/**
+ * localbook_parse_csv_line:
+ * @ptr: a struct localbook_csv_data
+ * @split: line fields
+ *
+ * Parse one CSV line (name, company, type, number). Consecutive lines with the same name
+ * form one contact.
+ *
+ * Returns: @ptr
+ */
+static gpointer localbook_parse_csv_line(gpointer ptr, gchar **split)
+{
+	struct localbook_csv_data *data = ptr;
+	RmContact *contact = NULL;
+	RmPhoneNumberType type = RM_PHONE_NUMBER_TYPE_HOME;
+	guint i;
+
+	if (g_strv_length(split) < 4 || RM_EMPTY_STRING(g_strstrip(split[0]))) {
+		return ptr;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(localbook_csv_types); i++) {
+		if (!g_ascii_strcasecmp(g_strstrip(split[2]), localbook_csv_types[i])) {
+			type = i;
+			break;
+		}
+	}
+
+	if (data->list->len) {
+		contact = g_ptr_array_index(data->list, data->list->len - 1);
+		if (g_strcmp0(contact->name, split[0])) {
+			contact = NULL;
+		}
+	}
+
+	if (!contact) {
+		contact = localbook_contact_new(data->file);
+		contact->name = g_strdup(split[0]);
+		contact->company = g_strdup(g_strstrip(split[1]));
+		g_ptr_array_add(data->list, contact);
+	}
+
+	localbook_add_number(contact, type, g_strstrip(split[3]));
+
+	return ptr;
+}
+
+/**
+ * localbook_csv_split_record:
+ * @data: pointer to current position, advanced to the next record
+ * @end: end of data
+ * @sep: field separator
+ *
+ * Split next CSV record into fields. Fields enclosed in double quotes may contain separators,
+ * line breaks and doubled quotes. A quote without closing quote is kept literally and the
+ * record ends at its line break, so a broken field never swallows the rest of the file.
+ *
+ * Returns: new string array or %NULL at end of data
+ */
+static gchar **localbook_csv_split_record(const gchar **data, const gchar *end, gchar sep)
+{
+	const gchar *pos = *data;
+	const gchar *quote = NULL;
+	GPtrArray *fields;
+	GString *field;
+	gboolean start = TRUE;
+
+	if (pos >= end) {
+		return NULL;
+	}
+
+	fields = g_ptr_array_new();
+	field = g_string_new(NULL);
+
+	for (; pos < end; pos++) {
+		if (quote) {
+			if (*pos != '"') {
+				g_string_append_c(field, *pos);
+			} else if (pos + 1 < end && pos[1] == '"') {
+				g_string_append_c(field, '"');
+				pos++;
+			} else {
+				quote = NULL;
+			}
+
+			if (quote && pos + 1 == end) {
+				/* Missing closing quote: restart behind the literal quote */
+				g_string_assign(field, "\"");
+				pos = quote;
+				quote = NULL;
+			}
+		} else if (*pos == '"' && start) {
+			quote = pos;
+			start = FALSE;
+		} else if (*pos == sep) {
+			g_ptr_array_add(fields, g_string_free(field, FALSE));
+			field = g_string_new(NULL);
+			start = TRUE;
+		} else if (*pos == '\n') {
+			pos++;
+			break;
+		} else {
+			g_string_append_c(field, *pos);
+			start = FALSE;
+		}
+	}
+
+	if (quote) {
+		/* Opening quote is the last character */
+		g_string_append_c(field, '"');
+	}
+
+	g_ptr_array_add(fields, g_string_free(field, FALSE));
+	g_ptr_array_add(fields, NULL);
+
+	*data = pos;
+
+	return (gchar**)g_ptr_array_free(fields, FALSE);
+}
+
+/**
+ * localbook_csv_skip_line:
+ * @pos: current position
+ * @end: end of data
+ *
+ * Returns: start of next line or @end
+ */
+static const gchar *localbook_csv_skip_line(const gchar *pos, const gchar *end)
+{
+	const gchar *next = memchr(pos, '\n', end - pos);
+
+	return next ? next + 1 : end;
+}
+
+/**
+ * localbook_parse_csv:
+ * @data: file content
+ * @len: length of @data
+ * @csv_data: a struct localbook_csv_data
+ *
+ * Parse CSV file content with optional "sep=" line and LOCALBOOK_CSV_HEADER. Unlike the
+ * generic rm_csv_parse_data() quoted fields written by localbook_csv_escape() are supported.
+ */
+static void localbook_parse_csv(const gchar *data, gsize len, struct localbook_csv_data *csv_data)
+{
+	const gchar *pos = data;
+	const gchar *end = data + len;
+	gchar sep = ',';
+	gchar **split;
+
+	if (len > 4 && !strncmp(pos, "sep=", 4)) {
+		sep = pos[4];
+		pos = localbook_csv_skip_line(pos, end);
+	}
+
+	if ((gsize)(end - pos) < strlen(LOCALBOOK_CSV_HEADER) || strncmp(pos, LOCALBOOK_CSV_HEADER, strlen(LOCALBOOK_CSV_HEADER))) {
+		g_debug("%s(): Unknown CSV-Header in '%s'", __FUNCTION__, csv_data->file);
+		return;
+	}
+	pos = localbook_csv_skip_line(pos, end);
+
+	while ((split = localbook_csv_split_record(&pos, end, sep)) != NULL) {
+		localbook_parse_csv_line(csv_data, split);
+		g_strfreev(split);
+	}
+}
+
+/**
+ * localbook_is_csv:
+ * @file: file name
+ *
+ * Returns: %TRUE if @file is a CSV file, %FALSE for vCard
+ */
+static gboolean localbook_is_csv(const gchar *file)
+{
+	return g_str_has_suffix(file, ".csv") || g_str_has_suffix(file, ".CSV");
+}
+
+/**
+ * localbook_is_source:
+ * @file: file name
+ *
+ * Returns: %TRUE if @file is handled by this address book
+ */
+static gboolean localbook_is_source(const gchar *file)
+{
+	gchar *lower = g_ascii_strdown(file, -1);
+	gboolean ret = g_str_has_suffix(lower, ".vcf") || g_str_has_suffix(lower, ".vcard") || g_str_has_suffix(lower, ".csv");
+
+	g_free(lower);
+
+	return ret;
+}
+
+/**
+ * localbook_rebuild:
+ *
+ * Rebuild sorted contact array, contact list and number table from all files.
+ * Must be called with localbook_mutex held.
+ */
+static void localbook_rebuild(void)
+{
+	RmNumberPlan *plan = rm_number_plan_get(rm_profile_get_active());
+	GHashTableIter iter;
+	gpointer value;
+	guint i;
+
+	g_ptr_array_set_size(localbook_contacts, 0);
+	g_hash_table_remove_all(localbook_numbers);
+
+	g_hash_table_iter_init(&iter, localbook_files);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct localbook_file *file = value;
+
+		for (i = 0; i < file->contacts->len; i++) {
+			RmContact *contact = g_ptr_array_index(file->contacts, i);
+			GList *list;
+
+			g_ptr_array_add(localbook_contacts, contact);
+
+			for (list = contact->numbers; list != NULL; list = list->next) {
+				RmPhoneNumber *phone_number = list->data;
+				guint64 key = rm_number_key(plan, phone_number->number);
+
+				if (key && !g_hash_table_contains(localbook_numbers, &key)) {
+					guint64 *table_key = g_new(guint64, 1);
+
+					*table_key = key;
+					g_hash_table_insert(localbook_numbers, table_key, contact);
+				}
+			}
+		}
+	}
+
+	rm_number_plan_unref(plan);
+
+	rm_contact_sort_by_name(localbook_contacts);
+
+	g_clear_pointer(&contacts, g_list_free);
+	for (i = localbook_contacts->len; i > 0; i--) {
+		contacts = g_list_prepend(contacts, g_ptr_array_index(localbook_contacts, i - 1));
+	}
+}
+
+/**
+ * localbook_file_retire:
+ * @path: file name
+ * @retired: array collecting replaced file entries
+ *
+ * Take file entry of @path out of the file table without freeing its contacts. They are still
+ * referenced by the address book index and the UI until contacts-changed has been emitted.
+ *
+ * Returns: %TRUE if @path had an entry
+ */
+static gboolean localbook_file_retire(const gchar *path, GPtrArray *retired)
+{
+	gpointer key;
+	gpointer file;
+
+	if (!g_hash_table_lookup_extended(localbook_files, path, &key, &file)) {
+		return FALSE;
+	}
+
+	g_hash_table_steal(localbook_files, path);
+	g_free(key);
+	g_ptr_array_add(retired, file);
+
+	return TRUE;
+}
+
+/**
+ * localbook_file_load:
+ * @path: file name
+ * @retired: array collecting replaced file entries, to be freed after contacts-changed
+ *
+ * (Re-)load contacts of @path. Unchanged files are skipped.
+ * Must be called with localbook_mutex held, localbook_rebuild() has to follow.
+ *
+ * Returns: %TRUE if contacts changed
+ */
+static gboolean localbook_file_load(const gchar *path, GPtrArray *retired)
+{
+	struct localbook_file *file = g_hash_table_lookup(localbook_files, path);
+	GMappedFile *map;
+	GError *error = NULL;
+	const gchar *data;
+	gsize len;
+	gchar *checksum;
+
+	map = g_mapped_file_new(path, FALSE, &error);
+	if (!map) {
+		g_debug("%s(): %s", __FUNCTION__, error->message);
+		g_error_free(error);
+
+		/* File vanished */
+		return localbook_file_retire(path, retired);
+	}
+
+	data = g_mapped_file_get_contents(map);
+	len = g_mapped_file_get_length(map);
+
+	checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (const guchar*)data, len);
+	if (file && !g_strcmp0(file->checksum, checksum)) {
+		g_free(checksum);
+		g_mapped_file_unref(map);
+		return FALSE;
+	}
+
+	file = localbook_file_new();
+	file->checksum = checksum;
+
+	if (localbook_is_csv(path) && data) {
+		struct localbook_csv_data csv_data = { path, file->contacts };
+
+		localbook_parse_csv(data, len, &csv_data);
+	} else if (data && !localbook_is_csv(path)) {
+		localbook_parse_vcard(path, data, len, file->contacts);
+	}
+
+	g_mapped_file_unref(map);
+
+	g_debug("%s(): %s: %d contacts", __FUNCTION__, path, file->contacts->len);
+	localbook_file_retire(path, retired);
+	g_hash_table_insert(localbook_files, g_strdup(path), file);
+
+	return TRUE;
+}
+
+/**
+ * localbook_load:
+ *
+ * Load all contact files of address book directory.
+ */
+static void localbook_load(void)
+{
+	GPtrArray *retired;
+	GDir *dir;
+	const gchar *name;
+
+	dir = g_dir_open(localbook_directory, 0, NULL);
+	if (!dir) {
+		g_debug("%s(): Could not open '%s'", __FUNCTION__, localbook_directory);
+		return;
+	}
+
+	/* Initial load, nothing references previous contacts yet */
+	retired = g_ptr_array_new_with_free_func(localbook_file_free);
+
+	g_mutex_lock(&localbook_mutex);
+	while ((name = g_dir_read_name(dir))) {
+		if (localbook_is_source(name)) {
+			gchar *path = g_build_filename(localbook_directory, name, NULL);
+
+			localbook_file_load(path, retired);
+			g_free(path);
+		}
+	}
+	localbook_rebuild();
+	g_mutex_unlock(&localbook_mutex);
+
+	g_ptr_array_free(retired, TRUE);
+	g_dir_close(dir);
+
+	g_debug("%s(): %d contacts, %d numbers", __FUNCTION__, localbook_contacts->len, g_hash_table_size(localbook_numbers));
+}
+
+/**
+ * localbook_write_vcard:
+ * @str: output string
+ * @contact: a #RmContact
+ *
+ * Append @contact as vCard 3.0.
+ */
+static void localbook_write_vcard(GString *str, RmContact *contact)
+{
+	static const gchar *types[] = { "HOME,VOICE", "WORK,VOICE", "CELL", "HOME,FAX", "WORK,FAX", "PAGER", "VOICE" };
+	struct localbook_priv *priv = contact->priv;
+	gboolean has_n = FALSE;
+	GList *list;
+	guint i;
+
+	g_string_append(str, "BEGIN:VCARD\r\nVERSION:3.0\r\nFN:");
+	localbook_vcard_escape(str, contact->name);
+	g_string_append(str, "\r\n");
+
+	if (!RM_EMPTY_STRING(contact->company)) {
+		g_string_append(str, "ORG:");
+		localbook_vcard_escape(str, contact->company);
+		g_string_append(str, "\r\n");
+	}
+
+	for (list = contact->numbers; list != NULL; list = list->next) {
+		RmPhoneNumber *phone_number = list->data;
+
+		g_string_append_printf(str, "TEL;TYPE=%s:", types[CLAMP(phone_number->type, RM_PHONE_NUMBER_TYPE_HOME, RM_PHONE_NUMBER_TYPE_OTHER)]);
+		localbook_vcard_escape(str, phone_number->number);
+		g_string_append(str, "\r\n");
+	}
+
+	for (list = contact->addresses; list != NULL; list = list->next) {
+		RmContactAddress *address = list->data;
+
+		g_string_append_printf(str, "ADR;TYPE=%s:;;", address->type == 1 ? "WORK" : "HOME");
+		localbook_vcard_escape(str, address->street);
+		g_string_append_c(str, ';');
+		localbook_vcard_escape(str, address->city);
+		g_string_append(str, ";;");
+		localbook_vcard_escape(str, address->zip);
+		g_string_append(str, ";\r\n");
+	}
+
+	for (i = 0; priv && priv->extra && i < priv->extra->len; i++) {
+		const gchar *line = g_ptr_array_index(priv->extra, i);
+
+		if (!g_ascii_strncasecmp(line, "N:", 2) || !g_ascii_strncasecmp(line, "N;", 2)) {
+			has_n = TRUE;
+		}
+		g_string_append_printf(str, "%s\r\n", line);
+	}
+
+	/* N is mandatory in vCard 3.0 */
+	if (!has_n) {
+		g_string_append(str, "N:");
+		localbook_vcard_escape(str, contact->name);
+		g_string_append(str, ";;;;\r\n");
+	}
+
+	g_string_append(str, "END:VCARD\r\n");
+}
+
+/**
+ * localbook_csv_escape:
+ * @str: output string
+ * @value: field value or %NULL
+ *
+ * Append @value as CSV field, quoted if it contains a separator, quote or line break.
+ */
+static void localbook_csv_escape(GString *str, const gchar *value)
+{
+	const gchar *pos;
+
+	if (!value) {
+		return;
+	}
+
+	if (!strpbrk(value, ",\"\r\n")) {
+		g_string_append(str, value);
+		return;
+	}
+
+	g_string_append_c(str, '"');
+	for (pos = value; *pos; pos++) {
+		if (*pos == '"') {
+			g_string_append_c(str, '"');
+		}
+		g_string_append_c(str, *pos);
+	}
+	g_string_append_c(str, '"');
+}
+
+/**
+ * localbook_write_csv:
+ * @str: output string
+ * @contact: a #RmContact
+ *
+ * Append @contact as CSV lines, one per number.
+ */
+static void localbook_write_csv(GString *str, RmContact *contact)
+{
+	GList *list;
+
+	for (list = contact->numbers; list != NULL; list = list->next) {
+		RmPhoneNumber *phone_number = list->data;
+
+		localbook_csv_escape(str, contact->name);
+		g_string_append_c(str, ',');
+		localbook_csv_escape(str, contact->company);
+		g_string_append_printf(str, ",%s,", localbook_csv_types[CLAMP(phone_number->type, RM_PHONE_NUMBER_TYPE_HOME, RM_PHONE_NUMBER_TYPE_OTHER)]);
+		localbook_csv_escape(str, phone_number->number);
+		g_string_append_c(str, '\n');
+	}
+}
+
+/**
+ * localbook_file_write:
+ * @path: file name
+ *
+ * Write all contacts belonging to @path, removing the file if it has no contacts left.
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean localbook_file_write(const gchar *path)
+{
+	struct localbook_file *file;
+	GError *error = NULL;
+	GString *str;
+	gboolean ret;
+	guint i;
+
+	g_mutex_lock(&localbook_mutex);
+
+	file = g_hash_table_lookup(localbook_files, path);
+	if (!file || !file->contacts->len) {
+		g_hash_table_remove(localbook_files, path);
+		g_mutex_unlock(&localbook_mutex);
+
+		return g_unlink(path) == 0;
+	}
+
+	str = g_string_new(localbook_is_csv(path) ? LOCALBOOK_CSV_HEADER "\n" : NULL);
+	for (i = 0; i < file->contacts->len; i++) {
+		RmContact *contact = g_ptr_array_index(file->contacts, i);
+
+		if (localbook_is_csv(path)) {
+			localbook_write_csv(str, contact);
+		} else {
+			localbook_write_vcard(str, contact);
+		}
+	}
+
+	/* Monitor events caused by this write are recognized by the checksum */
+	g_free(file->checksum);
+	file->checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, (const guchar*)str->str, str->len);
+
+	g_mutex_unlock(&localbook_mutex);
+
+	ret = g_file_set_contents(path, str->str, str->len, &error);
+	if (!ret) {
+		g_warning("%s(): Could not write '%s': %s", __FUNCTION__, path, error->message);
+		g_error_free(error);
+	}
+
+	g_string_free(str, TRUE);
+
+	return ret;
+}
+
+/**
+ * localbook_reload_cb:
+ * @user_data: unused
+ *
+ * Reload files changed on disk.
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean localbook_reload_cb(gpointer user_data)
+{
+	GPtrArray *retired = g_ptr_array_new_with_free_func(localbook_file_free);
+	GHashTableIter iter;
+	gpointer key;
+	gboolean changed = FALSE;
+
+	localbook_reload_id = 0;
+
+	g_mutex_lock(&localbook_mutex);
+	g_hash_table_iter_init(&iter, localbook_pending);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		changed |= localbook_file_load(key, retired);
+	}
+	g_hash_table_remove_all(localbook_pending);
+
+	if (changed) {
+		localbook_rebuild();
+	}
+	g_mutex_unlock(&localbook_mutex);
+
+	if (changed) {
+		rm_object_emit_contacts_changed();
+	}
+
+	/* Index and UI have dropped the replaced contacts now */
+	g_ptr_array_free(retired, TRUE);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * localbook_queue_reload:
+ * @file: changed #GFile or %NULL
+ *
+ * Queue reload of @file.
+ */
+static void localbook_queue_reload(GFile *file)
+{
+	gchar *path;
+
+	if (!file) {
+		return;
+	}
+
+	path = g_file_get_path(file);
+	if (!path || !localbook_is_source(path)) {
+		g_free(path);
+		return;
+	}
+
+	g_hash_table_add(localbook_pending, path);
+
+	if (!localbook_reload_id) {
+		localbook_reload_id = g_timeout_add(LOCALBOOK_RELOAD_DELAY, localbook_reload_cb, NULL);
+	}
+}
+
+/**
+ * localbook_changed_cb:
+ * @monitor: a #GFileMonitor
+ * @file: a #GFile
+ * @other_file: a #GFile or %NULL
+ * @event_type: a #GFileMonitorEvent
+ * @user_data: unused
+ *
+ * Directory changed, reload affected files.
+ */
+static void localbook_changed_cb(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
+{
+	switch (event_type) {
+	case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+	case G_FILE_MONITOR_EVENT_CREATED:
+	case G_FILE_MONITOR_EVENT_DELETED:
+	case G_FILE_MONITOR_EVENT_MOVED_IN:
+	case G_FILE_MONITOR_EVENT_MOVED_OUT:
+		localbook_queue_reload(file);
+		break;
+	case G_FILE_MONITOR_EVENT_RENAMED:
+		localbook_queue_reload(file);
+		localbook_queue_reload(other_file);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * localbook_contact_file:
+ * @contact: a #RmContact
+ *
+ * Find the file @contact belongs to. Only contacts held in a file array are owned by this
+ * address book, copies and contacts of other books may carry private data we must not touch.
+ * Must be called with localbook_mutex held.
+ *
+ * Returns: file name of @contact or %NULL if @contact is not a local contact
+ */
+static const gchar *localbook_contact_file(RmContact *contact)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	guint i;
+
+	g_hash_table_iter_init(&iter, localbook_files);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct localbook_file *file = value;
+
+		for (i = 0; i < file->contacts->len; i++) {
+			if (g_ptr_array_index(file->contacts, i) == contact) {
+				return key;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * localbook_lookup:
+ * @number: phone number
+ *
+ * Lookup @number, can be called from any thread.
+ *
+ * Returns: a new #RmContact or %NULL
+ */
+RmContact *localbook_lookup(const gchar *number)
+{
+	RmNumberPlan *plan = rm_number_plan_get(rm_profile_get_active());
+	guint64 key = rm_number_key(plan, number);
+	RmContact *contact = NULL;
+
+	rm_number_plan_unref(plan);
+
+	if (key) {
+		g_mutex_lock(&localbook_mutex);
+		contact = localbook_numbers ? g_hash_table_lookup(localbook_numbers, &key) : NULL;
+		if (contact) {
+			/* The copy outlives reloads, which free the private data of the original */
+			contact = rm_contact_dup(contact);
+			contact->priv = NULL;
+		}
+		g_mutex_unlock(&localbook_mutex);
+	}
+
+	return contact;
+}
+
+GList *localbook_get_contacts(void)
+{
+	return contacts;
+}
+
+GPtrArray *localbook_get_contact_array(void)
+{
+	return localbook_contacts;
+}
+
+gchar *localbook_get_active_book_name(void)
+{
+	return NULL;
+}
+
+gboolean localbook_remove_contact(RmContact *contact)
+{
+	struct localbook_priv *priv;
+	struct localbook_file *file;
+	gchar *path;
+
+	g_mutex_lock(&localbook_mutex);
+	path = g_strdup(localbook_contact_file(contact));
+	if (!path) {
+		g_mutex_unlock(&localbook_mutex);
+		return FALSE;
+	}
+
+	/* Contact is still used by caller, detach it from file array */
+	file = g_hash_table_lookup(localbook_files, path);
+	g_ptr_array_set_free_func(file->contacts, NULL);
+	g_ptr_array_remove(file->contacts, contact);
+	g_ptr_array_set_free_func(file->contacts, localbook_contact_free);
+	localbook_rebuild();
+
+	priv = contact->priv;
+	contact->priv = NULL;
+	g_mutex_unlock(&localbook_mutex);
+
+	localbook_priv_free(priv);
+
+	localbook_file_write(path);
+	g_free(path);
+
+	return TRUE;
+}
+
+gboolean localbook_save_contact(RmContact *contact)
+{
+	struct localbook_priv *priv;
+	gchar *path;
+	gboolean ret;
+
+	g_mutex_lock(&localbook_mutex);
+	path = g_strdup(localbook_contact_file(contact));
+	if (!path) {
+		/* New contact, stored in its own vCard file */
+		gchar *uuid = g_uuid_string_random();
+		gchar *name = g_strdup_printf("%s.vcf", uuid);
+		struct localbook_file *file = localbook_file_new();
+
+		if (contact->priv) {
+			/* Contact of another address book, its private data is not ours: store a copy */
+			contact = rm_contact_dup(contact);
+			contact->priv = NULL;
+		}
+
+		priv = g_slice_new0(struct localbook_priv);
+		priv->file = g_build_filename(localbook_directory, name, NULL);
+		contact->priv = priv;
+
+		g_ptr_array_add(file->contacts, contact);
+		g_hash_table_insert(localbook_files, g_strdup(priv->file), file);
+		path = g_strdup(priv->file);
+
+		g_free(name);
+		g_free(uuid);
+	}
+
+	localbook_rebuild();
+	g_mutex_unlock(&localbook_mutex);
+
+	ret = localbook_file_write(path);
+	g_free(path);
+
+	return ret;
+}
+
+RmAddressBook localbook_book = {
+	"Local",
+	localbook_get_active_book_name,
+	localbook_get_contacts,
+	localbook_remove_contact,
+	localbook_save_contact,
+	NULL,
+	NULL,
+	localbook_get_contact_array,
+	localbook_lookup,
+	FALSE
+};
+
+gboolean localbook_plugin_init(RmPlugin *plugin)
+{
+	RmProfile *profile = rm_profile_get_active();
+	GFile *dir;
+	GError *error = NULL;
+
+	localbook_settings = rm_settings_new_profile("org.tabos.rm.plugins.localbook", "localbook", (gchar*)rm_profile_get_name(profile));
+
+	localbook_directory = g_settings_get_string(localbook_settings, "directory");
+	if (RM_EMPTY_STRING(localbook_directory)) {
+		g_free(localbook_directory);
+		localbook_directory = g_build_filename(rm_get_user_data_dir(), "contacts", NULL);
+	}
+	g_mkdir_with_parents(localbook_directory, 0700);
+
+	localbook_files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, localbook_file_free);
+	localbook_numbers = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+	localbook_pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	localbook_contacts = g_ptr_array_new();
+
+	localbook_load();
+
+	dir = g_file_new_for_path(localbook_directory);
+	localbook_monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+	if (localbook_monitor) {
+		g_signal_connect(localbook_monitor, "changed", G_CALLBACK(localbook_changed_cb), NULL);
+	} else {
+		g_warning("%s(): Could not monitor '%s': %s", __FUNCTION__, localbook_directory, error->message);
+		g_error_free(error);
+	}
+	g_object_unref(dir);
+
+	rm_addressbook_register(&localbook_book);
+
+	return TRUE;
+}
+
+gboolean localbook_plugin_shutdown(RmPlugin *plugin)
+{
+	rm_addressbook_unregister(&localbook_book);
+
+	if (localbook_monitor) {
+		g_file_monitor_cancel(localbook_monitor);
+		g_clear_object(&localbook_monitor);
+	}
+
+	if (localbook_reload_id) {
+		g_source_remove(localbook_reload_id);
+		localbook_reload_id = 0;
+	}
+
+	g_mutex_lock(&localbook_mutex);
+	g_clear_pointer(&contacts, g_list_free);
+	g_clear_pointer(&localbook_contacts, g_ptr_array_unref);
+	g_clear_pointer(&localbook_numbers, g_hash_table_destroy);
+	g_clear_pointer(&localbook_files, g_hash_table_destroy);
+	g_mutex_unlock(&localbook_mutex);
+
+	g_clear_pointer(&localbook_pending, g_hash_table_destroy);
+	g_clear_pointer(&localbook_directory, g_free);
+	g_clear_object(&localbook_settings);
+
+	return TRUE;
+}
+
+RM_PLUGIN(localbook);
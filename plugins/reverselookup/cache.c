@@ -0,0 +1,435 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <rm/rm.h>
+
+#include "cache.h"
+
+/*
+ * Lookup results are kept in a single log file within the user cache directory. Every result is
+ * appended as one line: timestamp, number, name, street, zip and city separated by tabs, with
+ * backslash, tab and newline escaped. An empty name marks a number that could not be found.
+ * Later lines replace earlier lines of the same number. The log is read on first use into an
+ * in-memory index and rewritten once it holds more than twice as many records as live entries.
+ */
+
+typedef struct {
+	gint64 timestamp;
+	gchar *name;
+	gchar *street;
+	gchar *zip;
+	gchar *city;
+} RmLookupCacheEntry;
+
+static GMutex rl_cache_mutex;
+/** Number to #RmLookupCacheEntry, %NULL until first use */
+static GHashTable *rl_cache = NULL;
+static gchar *rl_cache_file = NULL;
+/** Number of records within the log file */
+static guint rl_cache_records = 0;
+
+/**
+ * reverselookup_cache_entry_free:
+ * @data: a #RmLookupCacheEntry
+ *
+ * Free cache entry
+ */
+static void reverselookup_cache_entry_free(gpointer data)
+{
+	RmLookupCacheEntry *entry = data;
+
+	g_free(entry->name);
+	g_free(entry->street);
+	g_free(entry->zip);
+	g_free(entry->city);
+
+	g_slice_free(RmLookupCacheEntry, entry);
+}
+
+/**
+ * reverselookup_cache_entry_expired:
+ * @entry: a #RmLookupCacheEntry
+ * @now: current time in seconds
+ *
+ * Check whether @entry is older than its time to live
+ *
+ * Returns: %TRUE if @entry is expired
+ */
+static gboolean reverselookup_cache_entry_expired(RmLookupCacheEntry *entry, gint64 now)
+{
+	return now - entry->timestamp >= (entry->name ? RL_CACHE_TTL : RL_CACHE_NEGATIVE_TTL);
+}
+
+/**
+ * reverselookup_cache_expired_cb:
+ * @key: number
+ * @value: a #RmLookupCacheEntry
+ * @user_data: pointer to current time
+ *
+ * Hash table foreach remove callback for expired entries
+ *
+ * Returns: %TRUE if entry should be removed
+ */
+static gboolean reverselookup_cache_expired_cb(gpointer key, gpointer value, gpointer user_data)
+{
+	return reverselookup_cache_entry_expired(value, *(gint64*)user_data);
+}
+
+/**
+ * reverselookup_cache_escape:
+ * @str: field string or %NULL
+ * @out: a #GString to append to
+ *
+ * Append @str to @out with backslash, tab and newline escaped
+ */
+static void reverselookup_cache_escape(const gchar *str, GString *out)
+{
+	for (; str && *str; str++) {
+		switch (*str) {
+		case '\\':
+			g_string_append(out, "\\\\");
+			break;
+		case '\t':
+			g_string_append(out, "\\t");
+			break;
+		case '\n':
+			g_string_append(out, "\\n");
+			break;
+		default:
+			g_string_append_c(out, *str);
+			break;
+		}
+	}
+}
+
+/**
+ * reverselookup_cache_format:
+ * @number: number
+ * @entry: a #RmLookupCacheEntry
+ * @out: a #GString to append the record to
+ *
+ * Append log record of @entry to @out
+ */
+static void reverselookup_cache_format(const gchar *number, RmLookupCacheEntry *entry, GString *out)
+{
+	g_string_append_printf(out, "%" G_GINT64_FORMAT "\t", entry->timestamp);
+	reverselookup_cache_escape(number, out);
+	g_string_append_c(out, '\t');
+	reverselookup_cache_escape(entry->name, out);
+	g_string_append_c(out, '\t');
+	reverselookup_cache_escape(entry->street, out);
+	g_string_append_c(out, '\t');
+	reverselookup_cache_escape(entry->zip, out);
+	g_string_append_c(out, '\t');
+	reverselookup_cache_escape(entry->city, out);
+	g_string_append_c(out, '\n');
+}
+
+/**
+ * reverselookup_cache_insert:
+ * @number: number
+ * @contact: a #RmContact or %NULL for a not found number
+ * @timestamp: time of lookup in seconds
+ *
+ * Create cache entry and add it to the index
+ *
+ * Returns: the new #RmLookupCacheEntry
+ */
+static RmLookupCacheEntry *reverselookup_cache_insert(const gchar *number, RmContact *contact, gint64 timestamp)
+{
+	RmLookupCacheEntry *entry = g_slice_new0(RmLookupCacheEntry);
+
+	entry->timestamp = timestamp;
+
+	if (contact && !RM_EMPTY_STRING(contact->name)) {
+		entry->name = g_strdup(contact->name);
+		entry->street = g_strdup(contact->street);
+		entry->zip = g_strdup(contact->zip);
+		entry->city = g_strdup(contact->city);
+	}
+
+	g_hash_table_replace(rl_cache, g_strdup(number), entry);
+
+	return entry;
+}
+
+/**
+ * reverselookup_cache_compact:
+ *
+ * Rewrite log file with live entries only
+ */
+static void reverselookup_cache_compact(void)
+{
+	GString *out = g_string_new(NULL);
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	GError *error = NULL;
+
+	g_hash_table_iter_init(&iter, rl_cache);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		reverselookup_cache_format(key, value, out);
+	}
+
+	if (g_file_set_contents(rl_cache_file, out->str, out->len, &error)) {
+		g_debug("%s(): Compacted %u records to %u", __FUNCTION__, rl_cache_records, g_hash_table_size(rl_cache));
+		rl_cache_records = g_hash_table_size(rl_cache);
+	} else {
+		g_debug("%s(): Could not write cache: %s", __FUNCTION__, error->message);
+		g_error_free(error);
+	}
+
+	g_string_free(out, TRUE);
+}
+
+/**
+ * reverselookup_cache_maybe_compact:
+ *
+ * Compact log file once it is dominated by replaced or expired records
+ */
+static void reverselookup_cache_maybe_compact(void)
+{
+	if (rl_cache_records >= RL_CACHE_COMPACT_MIN && rl_cache_records > 2 * g_hash_table_size(rl_cache)) {
+		reverselookup_cache_compact();
+	}
+}
+
+/**
+ * reverselookup_cache_migrate:
+ * @now: current time in seconds
+ *
+ * Import and remove per number cache files of previous versions
+ *
+ * Returns: %TRUE if entries have been imported
+ */
+static gboolean reverselookup_cache_migrate(gint64 now)
+{
+	gchar *dir_name = g_build_filename(rm_get_user_cache_dir(), "reverselookup", NULL);
+	GDir *dir = g_dir_open(dir_name, 0, NULL);
+	const gchar *file_name;
+	gboolean ret = FALSE;
+
+	if (!dir) {
+		g_free(dir_name);
+		return FALSE;
+	}
+
+	while ((file_name = g_dir_read_name(dir))) {
+		gchar *uri = g_build_filename(dir_name, file_name, NULL);
+		gchar *data = rm_file_load(uri, NULL);
+
+		if (data) {
+			gchar **split = g_strsplit(data, ";", -1);
+
+			if (g_strv_length(split) == 5 && !g_hash_table_contains(rl_cache, split[0])) {
+				RmContact contact = { NULL };
+
+				contact.name = split[1];
+				contact.street = split[2];
+				contact.zip = split[3];
+				contact.city = g_strstrip(split[4]);
+
+				reverselookup_cache_insert(split[0], &contact, now);
+				ret = TRUE;
+			}
+
+			g_strfreev(split);
+			g_free(data);
+		}
+
+		g_unlink(uri);
+		g_free(uri);
+	}
+
+	g_dir_close(dir);
+	g_rmdir(dir_name);
+	g_free(dir_name);
+
+	return ret;
+}
+
+/**
+ * reverselookup_cache_load:
+ *
+ * Read log file into index on first use, must be called with mutex held
+ */
+static void reverselookup_cache_load(void)
+{
+	gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+	gchar *data = NULL;
+
+	if (rl_cache) {
+		return;
+	}
+
+	rl_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, reverselookup_cache_entry_free);
+	rl_cache_file = g_build_filename(rm_get_user_cache_dir(), "reverselookup.log", NULL);
+	rl_cache_records = 0;
+
+	if (g_file_get_contents(rl_cache_file, &data, NULL, NULL)) {
+		gchar **lines = g_strsplit(data, "\n", -1);
+		gint i;
+
+		for (i = 0; lines[i]; i++) {
+			gchar **split = g_strsplit(lines[i], "\t", 6);
+
+			if (g_strv_length(split) == 6) {
+				RmContact contact = { NULL };
+				gint j;
+
+				for (j = 1; j < 6; j++) {
+					gchar *tmp = g_strcompress(split[j]);
+
+					g_free(split[j]);
+					split[j] = tmp;
+				}
+
+				contact.name = split[2];
+				contact.street = split[3];
+				contact.zip = split[4];
+				contact.city = split[5];
+
+				reverselookup_cache_insert(split[1], &contact, g_ascii_strtoll(split[0], NULL, 10));
+				rl_cache_records++;
+			}
+
+			g_strfreev(split);
+		}
+
+		g_strfreev(lines);
+		g_free(data);
+	}
+
+	g_hash_table_foreach_remove(rl_cache, reverselookup_cache_expired_cb, &now);
+
+	if (reverselookup_cache_migrate(now)) {
+		reverselookup_cache_compact();
+	} else {
+		reverselookup_cache_maybe_compact();
+	}
+
+	g_debug("%s(): %u entries (%u records)", __FUNCTION__, g_hash_table_size(rl_cache), rl_cache_records);
+}
+
+/**
+ * reverselookup_cache_lookup:
+ * @number: number
+ * @contact: a #RmContact to fill for found numbers
+ * @found: location to store whether number has been found by last lookup
+ *
+ * Lookup number within cache
+ *
+ * Returns: %TRUE if number is cached and not expired
+ */
+gboolean reverselookup_cache_lookup(const gchar *number, RmContact *contact, gboolean *found)
+{
+	RmLookupCacheEntry *entry;
+
+	g_mutex_lock(&rl_cache_mutex);
+
+	reverselookup_cache_load();
+
+	entry = g_hash_table_lookup(rl_cache, number);
+	if (entry && reverselookup_cache_entry_expired(entry, g_get_real_time() / G_USEC_PER_SEC)) {
+		g_hash_table_remove(rl_cache, number);
+		entry = NULL;
+	}
+
+	if (entry) {
+		*found = entry->name != NULL;
+
+		if (*found) {
+			contact->name = g_strdup(entry->name);
+			contact->street = g_strdup(entry->street);
+			contact->zip = g_strdup(entry->zip);
+			contact->city = g_strdup(entry->city);
+		}
+	}
+
+	g_mutex_unlock(&rl_cache_mutex);
+
+	return entry != NULL;
+}
+
+/**
+ * reverselookup_cache_store:
+ * @number: number
+ * @contact: a #RmContact or %NULL if number could not be found
+ *
+ * Add lookup result to cache and append it to the log file
+ */
+void reverselookup_cache_store(const gchar *number, RmContact *contact)
+{
+	RmLookupCacheEntry *entry;
+	GFileOutputStream *stream;
+	GString *out = g_string_new(NULL);
+	GError *error = NULL;
+	GFile *file;
+
+	g_mutex_lock(&rl_cache_mutex);
+
+	reverselookup_cache_load();
+
+	entry = reverselookup_cache_insert(number, contact, g_get_real_time() / G_USEC_PER_SEC);
+	reverselookup_cache_format(number, entry, out);
+
+	file = g_file_new_for_path(rl_cache_file);
+	stream = g_file_append_to(file, G_FILE_CREATE_PRIVATE, NULL, &error);
+	if (stream) {
+		if (g_output_stream_write_all(G_OUTPUT_STREAM(stream), out->str, out->len, NULL, NULL, &error)) {
+			rl_cache_records++;
+		}
+
+		g_object_unref(stream);
+	}
+	g_object_unref(file);
+
+	if (error) {
+		g_debug("%s(): Could not append to cache: %s", __FUNCTION__, error->message);
+		g_error_free(error);
+	}
+
+	reverselookup_cache_maybe_compact();
+
+	g_mutex_unlock(&rl_cache_mutex);
+
+	g_string_free(out, TRUE);
+}
+
+/**
+ * reverselookup_cache_shutdown:
+ *
+ * Drop in-memory index
+ */
+void reverselookup_cache_shutdown(void)
+{
+	g_mutex_lock(&rl_cache_mutex);
+
+	g_clear_pointer(&rl_cache, g_hash_table_destroy);
+	g_clear_pointer(&rl_cache_file, g_free);
+
+	g_mutex_unlock(&rl_cache_mutex);
+}
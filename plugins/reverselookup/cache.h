@@ -17,18 +17,21 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-#ifndef AREACODES_CSV_H
-#define AREACODES_CSV_H
-
-typedef struct _RmAreaCode {
-	gchar *country;
-	gint skip;
-	GHashTable *table;
-} RmAreaCode;
+#ifndef REVERSELOOKUP_CACHE_H
+#define REVERSELOOKUP_CACHE_H
 
 G_BEGIN_DECLS
 
-GHashTable *csv_parse_global_areacodes_data(gchar *data);
+/** Found entries expire after 30 days */
+#define RL_CACHE_TTL (30 * 24 * 60 * 60)
+/** Not found entries expire after one day */
+#define RL_CACHE_NEGATIVE_TTL (24 * 60 * 60)
+/** Minimum number of log records before compaction is considered */
+#define RL_CACHE_COMPACT_MIN 256
+
+gboolean reverselookup_cache_lookup(const gchar *number, RmContact *contact, gboolean *found);
+void reverselookup_cache_store(const gchar *number, RmContact *contact);
+void reverselookup_cache_shutdown(void);
 
 G_END_DECLS
 
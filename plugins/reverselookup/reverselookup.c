@@ -31,14 +31,14 @@
 #include <libxml/tree.h>
 #include <libxml/parser.h>
 
+#include "cache.h"
+
 //#define RL_DEBUG 1
 
 typedef struct {
 	guint signal_id;
-	GHashTable *table;
 } RmReverseLookupPlugin;
 
-static GHashTable *table = NULL;
 /** Global lookup list */
 static GSList *lookup_list = NULL;
 /** Lookup country code hash table */
@@ -46,218 +46,577 @@ static GHashTable *lookup_table = NULL;
 /** Lookup soup session */
 static SoupSession *rl_session = NULL;
 
+typedef enum {
+	RL_FIELD_NAME,
+	RL_FIELD_STREET,
+	RL_FIELD_ZIP,
+	RL_FIELD_CITY,
+	RL_FIELD_MAX
+} RmLookupField;
+
+/** Extraction rule: text of first element <tag attribute="value"> */
+typedef struct {
+	gchar *tag;
+	gchar *attribute;
+	gchar *value;
+} RmLookupRule;
+
 typedef struct _RmLookupEntry {
 	gboolean prefix;
 	gchar *service;
 	gchar *url;
-	gchar **name;
-	gchar **street;
-	gchar **zip;
-	gchar **city;
+	/* URL split at %NUMBER% */
+	gchar **url_parts;
+	/* Rules per #RmLookupField, unused rules have no tag */
+	RmLookupRule rules[RL_FIELD_MAX];
 	gint zip_len;
+	/* Rate limit, circuit breaker and health counters, guarded by rl_health_mutex */
+	gdouble tokens;
+	gint64 refill_time;
+	guint consecutive_failures;
+	gint64 open_until;
+	RmLookupStats stats;
 } RmLookupEntry;
 
+/** Per service timeout in seconds */
+#define RL_SERVICE_TIMEOUT 5
+/** Global deadline of one lookup across all services in seconds */
+#define RL_DEADLINE 8
+/** Token bucket per service: burst size and seconds to refill one token */
+#define RL_BUCKET_SIZE 5
+#define RL_BUCKET_INTERVAL 6
+/** Consecutive failures opening the circuit breaker of a service */
+#define RL_BREAKER_THRESHOLD 3
+/** Seconds an open circuit breaker skips a service before a trial request is let through */
+#define RL_BREAKER_OPEN_TIME 300
+
+static GMutex rl_health_mutex;
+
+typedef struct {
+	GMainLoop *loop;
+	gchar *number;
+	RmContact *contact;
+	GSList *jobs;
+	guint pending;
+	/* Number of services without a valid response (error, timeout) */
+	guint failed;
+	gboolean found;
+} RmLookupRequest;
+
+typedef struct {
+	RmLookupRequest *request;
+	RmLookupEntry *lookup;
+	SoupMessage *msg;
+	GSource *timeout;
+	gint64 start_time;
+	gboolean timed_out;
+	gboolean done;
+} RmLookupJob;
+
+/** Streaming extraction state */
+typedef struct {
+	RmLookupEntry *lookup;
+	htmlParserCtxtPtr ctxt;
+	/* Captured text per field, %NULL until matching element is found */
+	GString *text[RL_FIELD_MAX];
+	/* Element depth of active captures, -1 if not capturing */
+	gint capture_depth[RL_FIELD_MAX];
+	/* Number of rules not finished yet */
+	guint missing;
+	gint depth;
+} RmLookupScan;
+
 /**
  * reverselookup_replace_number:
- * @url: url string
+ * @lookup: a #RmLookupEntry
  * @full_number: full phone number
  *
- * Repleaces %NUMBER% within @url with @full_number.
+ * Inserts @full_number into the precompiled URL of @lookup (replacing %NUMBER%).
  *
- * Returns: replaced string
+ * Returns: URL string
  */
-static gchar *reverselookup_replace_number(gchar *url, gchar *full_number)
+static gchar *reverselookup_replace_number(RmLookupEntry *lookup, gchar *full_number)
 {
-	GRegex *number = g_regex_new("%NUMBER%", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
-	gchar *out = g_regex_replace_literal(number, url, -1, 0, full_number, 0, NULL);
-
-	g_regex_unref(number);
-
-	return out;
+	return g_strjoinv(full_number, lookup->url_parts);
 }
 
 /**
- * reversellokup_extract_element:
- * @in: input string
- * @a_node: a #xmlNode
- * @out: output string
+ * reverselookup_collapse_spaces:
+ * @str: string to modify in place
  *
- * Extracts a defined xml element of an xmlNode
+ * Collapses runs of spaces into a single space and strips leading/trailing whitespace.
  *
- * Returns: %TRUE if element could be extracted
+ * Returns: @str
  */
-static gboolean reverselookup_extract_element(gchar **in, xmlNode *a_node, gchar **out)
+static gchar *reverselookup_collapse_spaces(gchar *str)
 {
-	xmlNode *cur_node = NULL;
-	gboolean ret = FALSE;
+	gchar *in;
+	gchar *out;
+
+	for (in = out = str; *in; in++) {
+		if (*in == ' ' && in[1] == ' ') {
+			continue;
+		}
 
-	for (cur_node = a_node; cur_node && !ret; cur_node = cur_node->next) {
-		if (cur_node->type == XML_ELEMENT_NODE) {
-			if (!strcmp((gchar*)cur_node->name, in[0])) {
-				gchar *type = (gchar*)xmlGetProp(cur_node, (xmlChar*)in[1]);
+		*out++ = *in;
+	}
+	*out = '\0';
+
+	return g_strstrip(str);
+}
 
-				if (type && !strcmp(type, in[2])) {
-					gchar *tmp;
-					xmlChar *name = xmlNodeListGetString(cur_node->doc, cur_node->children, TRUE);
-					GRegex *whitespace = g_regex_new("[ ]{2,}", G_REGEX_DOTALL | G_REGEX_OPTIMIZE, 0, NULL);
+/**
+ * reverselookup_scan_start_element:
+ * @user_data: a #RmLookupScan
+ * @name: element name
+ * @atts: attribute name/value pairs
+ *
+ * SAX start element handler, starts capturing text of elements matching a rule
+ */
+static void reverselookup_scan_start_element(void *user_data, const xmlChar *name, const xmlChar **atts)
+{
+	RmLookupScan *scan = user_data;
+	gint field;
 
-					tmp = g_regex_replace_literal(whitespace, (gchar*)name, -1, 0, " ", 0, NULL);
+	for (field = 0; field < RL_FIELD_MAX; field++) {
+		RmLookupRule *rule = &scan->lookup->rules[field];
+		gint i;
 
-					*out = g_strdup(g_strstrip(tmp));
-					g_free(tmp);
+		if (!rule->tag || scan->text[field] || g_ascii_strcasecmp((const gchar*)name, rule->tag) || !atts) {
+			continue;
+		}
 
-					xmlFree(name);
-					return TRUE;
-				}
+		for (i = 0; atts[i]; i += 2) {
+			if (!g_ascii_strcasecmp((const gchar*)atts[i], rule->attribute) && atts[i + 1] && !strcmp((const gchar*)atts[i + 1], rule->value)) {
+				scan->text[field] = g_string_new(NULL);
+				scan->capture_depth[field] = scan->depth;
+				break;
 			}
 		}
+	}
+
+	scan->depth++;
+}
+
+/**
+ * reverselookup_scan_end_element:
+ * @user_data: a #RmLookupScan
+ * @name: element name
+ *
+ * SAX end element handler, finishes captures and stops parsing once all rules matched
+ */
+static void reverselookup_scan_end_element(void *user_data, const xmlChar *name)
+{
+	RmLookupScan *scan = user_data;
+	gint field;
+
+	scan->depth--;
+
+	for (field = 0; field < RL_FIELD_MAX; field++) {
+		if (scan->capture_depth[field] == scan->depth) {
+			scan->capture_depth[field] = -1;
 
-		ret = reverselookup_extract_element(in, cur_node->children, out);
+			if (--scan->missing == 0) {
+				xmlStopParser(scan->ctxt);
+			}
+		}
 	}
+}
 
-	return ret;
+/**
+ * reverselookup_scan_characters:
+ * @user_data: a #RmLookupScan
+ * @ch: text
+ * @len: length of @ch
+ *
+ * SAX characters handler, collects direct text content of captured elements
+ */
+static void reverselookup_scan_characters(void *user_data, const xmlChar *ch, int len)
+{
+	RmLookupScan *scan = user_data;
+	gint field;
+
+	for (field = 0; field < RL_FIELD_MAX; field++) {
+		if (scan->capture_depth[field] >= 0 && scan->depth == scan->capture_depth[field] + 1) {
+			g_string_append_len(scan->text[field], (const gchar*)ch, len);
+		}
+	}
 }
 
 /**
- * reverselookup_do_entry:
+ * reverselookup_parse:
  * @lookup: a #RmLookupEntry
  * @number: number to lookup
- * @contact: a #RmContact
+ * @data: response data
+ * @len: length of @data
+ * @contact: a #RmContact to store extracted data into
  *
- * Internal reverse lookup function
+ * Extracts contact data of a service response with a single streaming pass over the HTML data,
+ * which ends as soon as all rules of @lookup have matched.
  *
  * Returns: %TRUE on success, otherwise %FALSE
  */
-static gboolean reverselookup_do_entry(RmLookupEntry *lookup, gchar *number, RmContact *contact)
+static gboolean reverselookup_parse(RmLookupEntry *lookup, gchar *number, const gchar *data, gsize len, RmContact *contact)
 {
-	SoupMessage *msg;
-	const gchar *data;
-	gchar *rl_tmp;
-	RmContact *rl_contact;
-	gboolean result = FALSE;
-	gchar *full_number;
-	gchar *rdata = NULL;
-	gchar *file;
-	gsize len;
+	static const gchar *field_names[RL_FIELD_MAX] = { "name", "street", "zip", "city" };
+	xmlSAXHandler sax;
+	RmLookupScan scan;
+	gchar *fields[RL_FIELD_MAX] = { NULL };
+	gboolean result = TRUE;
+	gint field;
+
+	if (!len) {
+		return FALSE;
+	}
+
+	memset(&sax, 0, sizeof(sax));
+	sax.startElement = reverselookup_scan_start_element;
+	sax.endElement = reverselookup_scan_end_element;
+	sax.characters = reverselookup_scan_characters;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.lookup = lookup;
+	for (field = 0; field < RL_FIELD_MAX; field++) {
+		scan.capture_depth[field] = -1;
+		if (lookup->rules[field].tag) {
+			scan.missing++;
+		}
+	}
+
+	scan.ctxt = htmlCreatePushParserCtxt(&sax, &scan, NULL, 0, lookup->url, XML_CHAR_ENCODING_UTF8);
+	if (!scan.ctxt) {
+		return FALSE;
+	}
 
-	/* get full number according to service preferences */
-	full_number = rm_number_full(number, lookup->prefix);
+	htmlCtxtUseOptions(scan.ctxt, HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
+	htmlParseChunk(scan.ctxt, data, len, 1);
+	htmlFreeParserCtxt(scan.ctxt);
 
+	for (field = 0; field < RL_FIELD_MAX; field++) {
+		if (scan.text[field]) {
+			fields[field] = reverselookup_collapse_spaces(g_string_free(scan.text[field], FALSE));
+		} else if (lookup->rules[field].tag && result) {
 #ifdef RL_DEBUG
-	g_debug("New lookup for '%s'", full_number);
+			gchar *tmp_file = g_strdup_printf("rl-%s-%s.html", lookup->service, number);
+			gchar *rdata = rm_convert_utf8(data, len);
+
+			rm_log_save_data(tmp_file, rdata, len);
+			g_free(rdata);
+			g_free(tmp_file);
 #endif
+			g_debug("%s(): Could not extract %s", __FUNCTION__, field_names[field]);
+			result = FALSE;
+		}
+	}
+
+	if (!result) {
+		for (field = 0; field < RL_FIELD_MAX; field++) {
+			g_free(fields[field]);
+		}
+
+		return FALSE;
+	}
+
+	if (!lookup->rules[RL_FIELD_ZIP].tag && lookup->zip_len && strlen(fields[RL_FIELD_CITY]) > (gsize)lookup->zip_len) {
+		gchar *city = fields[RL_FIELD_CITY];
+
+		fields[RL_FIELD_ZIP] = g_strndup(city, lookup->zip_len);
+		memmove(city, city + lookup->zip_len + 1, strlen(city) - lookup->zip_len);
+	}
+
+	contact->name = fields[RL_FIELD_NAME];
+	contact->street = fields[RL_FIELD_STREET];
+	contact->zip = fields[RL_FIELD_ZIP];
+	contact->city = fields[RL_FIELD_CITY];
 
-	gchar *url = reverselookup_replace_number(lookup->url, full_number);
 #ifdef RL_DEBUG
-	g_debug("URL: %s", url);
+	gchar *tmp_file = g_strdup_printf("rl-found-%s-%s.html", lookup->service, number);
+	gchar *rdata = rm_convert_utf8(data, len);
+
+	rm_log_save_data(tmp_file, rdata, len);
+	g_free(rdata);
+	g_free(tmp_file);
 #endif
-	SoupURI *uri = soup_uri_new(url);
-	msg = soup_message_new_from_uri(SOUP_METHOD_GET, uri);
-	soup_message_headers_append(msg->request_headers, "User-Agent", "Mozilla/5.0 (compatible; MSIE 10.0; Windows NT 6.2; Trident/6.0)");
-
-	soup_session_send_message(rl_session, msg);
-	soup_uri_free(uri);
-	g_free(url);
-	if (msg->status_code != 200) {
-		//g_debug("Service: %s received status code: %d", lookup->service, msg->status_code);
-		g_object_unref(msg);
-		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * reverselookup_health_acquire:
+ * @lookup: a #RmLookupEntry
+ *
+ * Check whether a request may be sent to service @lookup, i.e. it has a token left and its
+ * circuit breaker is closed. After the open time of a tripped breaker one trial request passes.
+ *
+ * Returns: %TRUE if request may be sent
+ */
+static gboolean reverselookup_health_acquire(RmLookupEntry *lookup)
+{
+	gint64 now = g_get_monotonic_time();
+	gboolean ret = FALSE;
+
+	g_mutex_lock(&rl_health_mutex);
+
+	lookup->tokens = MIN(RL_BUCKET_SIZE, lookup->tokens + (gdouble)(now - lookup->refill_time) / (RL_BUCKET_INTERVAL * G_USEC_PER_SEC));
+	lookup->refill_time = now;
+
+	if (lookup->consecutive_failures >= RL_BREAKER_THRESHOLD && now < lookup->open_until) {
+		g_debug("%s(): Service '%s' is unavailable", __FUNCTION__, lookup->service);
+	} else if (lookup->tokens < 1) {
+		g_debug("%s(): Service '%s' is rate limited", __FUNCTION__, lookup->service);
+	} else {
+		if (lookup->consecutive_failures >= RL_BREAKER_THRESHOLD) {
+			/* Trial request, keep breaker open for everyone else meanwhile */
+			lookup->open_until = now + RL_BREAKER_OPEN_TIME * G_USEC_PER_SEC;
+		}
+
+		lookup->tokens -= 1;
+		lookup->stats.requests++;
+		ret = TRUE;
 	}
 
-	data = msg->response_body->data;
-	len = msg->response_body->length;
-	if (!len) {
-		goto end;
+	if (!ret) {
+		lookup->stats.rejected++;
 	}
 
-	rdata = rm_convert_utf8(data, len);
+	g_mutex_unlock(&rl_health_mutex);
+
+	return ret;
+}
 
-	htmlDocPtr html;
-	xmlNodePtr node;
+/**
+ * reverselookup_health_report:
+ * @lookup: a #RmLookupEntry
+ * @success: whether data could be extracted from the response
+ * @latency: response time in microseconds
+ *
+ * Update health counters and circuit breaker of service @lookup
+ */
+static void reverselookup_health_report(RmLookupEntry *lookup, gboolean success, gint64 latency)
+{
+	g_mutex_lock(&rl_health_mutex);
 
-	html = htmlReadMemory(data, len, lookup->url, "utf-8", HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
+	lookup->stats.total_time += latency;
+	lookup->stats.max_time = MAX(lookup->stats.max_time, latency);
 
-	node = xmlDocGetRootElement(html);
+	if (success) {
+		lookup->consecutive_failures = 0;
+	} else {
+		lookup->stats.failures++;
 
-	if (!reverselookup_extract_element(lookup->name, node, &contact->name)) {
-#ifdef RL_DEBUG
-		gchar *tmp_file = g_strdup_printf("rl-%s-%s.html", lookup->service, number);
-		rm_log_save_data(tmp_file, rdata, len);
-		g_free(tmp_file);
-		g_debug("%s(): Could not extract name", __FUNCTION__);
-#endif
-		goto end;
+		if (++lookup->consecutive_failures >= RL_BREAKER_THRESHOLD) {
+			g_debug("%s(): Service '%s' failed %u times, skipping it for %d seconds", __FUNCTION__, lookup->service, lookup->consecutive_failures, RL_BREAKER_OPEN_TIME);
+			lookup->open_until = g_get_monotonic_time() + RL_BREAKER_OPEN_TIME * G_USEC_PER_SEC;
+		}
 	}
 
-	if (!reverselookup_extract_element(lookup->street, node, &contact->street)) {
-#ifdef RL_DEBUG
-		gchar *tmp_file = g_strdup_printf("rl-%s-%s.html", lookup->service, number);
-		rm_log_save_data(tmp_file, rdata, len);
-		g_free(tmp_file);
-		g_debug("%s(): Could not extract street", __FUNCTION__);
-#endif
-		goto end;
+	g_mutex_unlock(&rl_health_mutex);
+}
+
+/**
+ * reverselookup_request_cancel:
+ * @request: a #RmLookupRequest
+ *
+ * Cancels all outstanding service requests of @request
+ */
+static void reverselookup_request_cancel(RmLookupRequest *request)
+{
+	GSList *list;
+
+	for (list = request->jobs; list != NULL; list = list->next) {
+		RmLookupJob *job = list->data;
+
+		if (!job->done) {
+			soup_session_cancel_message(rl_session, job->msg, SOUP_STATUS_CANCELLED);
+		}
 	}
+}
 
-	if (!reverselookup_extract_element(lookup->city, node, &contact->city)) {
-#ifdef RL_DEBUG
-		gchar *tmp_file = g_strdup_printf("rl-%s-%s.html", lookup->service, number);
-		rm_log_save_data(tmp_file, rdata, len);
-		g_free(tmp_file);
-		g_debug("%s(): Could not extract city", __FUNCTION__);
-#endif
-		goto end;
+/**
+ * reverselookup_job_timeout_cb:
+ * @user_data: a #RmLookupJob
+ *
+ * Per service timeout, cancels the service request
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean reverselookup_job_timeout_cb(gpointer user_data)
+{
+	RmLookupJob *job = user_data;
+
+	if (!job->done) {
+		g_debug("%s(): Service '%s' timed out", __FUNCTION__, job->lookup->service);
+		job->timed_out = TRUE;
+		soup_session_cancel_message(rl_session, job->msg, SOUP_STATUS_CANCELLED);
 	}
 
-	if (lookup->zip) {
-		if (!reverselookup_extract_element(lookup->zip, node, &contact->zip)) {
-	#ifdef RL_DEBUG
-			gchar *tmp_file = g_strdup_printf("rl-%s-%s.html", lookup->service, number);
-			rm_log_save_data(tmp_file, rdata, len);
-			g_free(tmp_file);
-			g_debug("%s(): Could not extract zip", __FUNCTION__);
-	#endif
-			goto end;
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * reverselookup_deadline_cb:
+ * @user_data: a #RmLookupRequest
+ *
+ * Global lookup deadline, cancels all outstanding service requests
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean reverselookup_deadline_cb(gpointer user_data)
+{
+	RmLookupRequest *request = user_data;
+
+	g_debug("%s(): Deadline reached for '%s'", __FUNCTION__, request->number);
+	reverselookup_request_cancel(request);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * reverselookup_job_cb:
+ * @session: a #SoupSession
+ * @msg: a #SoupMessage
+ * @user_data: a #RmLookupJob
+ *
+ * Service response callback. The first valid result wins and cancels the remaining services.
+ */
+static void reverselookup_job_cb(SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+	RmLookupJob *job = user_data;
+	RmLookupRequest *request = job->request;
+	gboolean late = request->found;
+	gboolean parsed = FALSE;
+
+	job->done = TRUE;
+	g_source_destroy(job->timeout);
+
+	if (!late && msg->status_code == 200) {
+		parsed = reverselookup_parse(job->lookup, request->number, msg->response_body->data, msg->response_body->length, request->contact);
+	}
+
+	/* Requests cancelled because another service answered first tell nothing about this service,
+	 * neither do answers arriving after that. Only extracted data counts as success, a status of
+	 * 200 alone may be an error or changed page. */
+	if ((msg->status_code != SOUP_STATUS_CANCELLED || job->timed_out) && !(late && msg->status_code == 200)) {
+		reverselookup_health_report(job->lookup, parsed, g_get_monotonic_time() - job->start_time);
+	}
+
+	if (parsed) {
+		g_debug("%s(): Service '%s' found '%s'", __FUNCTION__, job->lookup->service, request->number);
+		request->found = TRUE;
+		reverselookup_request_cancel(request);
+	} else if (!late && msg->status_code != 200) {
+		request->failed++;
+	}
+
+	if (--request->pending == 0) {
+		g_main_loop_quit(request->loop);
+	}
+}
+
+/**
+ * reverselookup_do_services:
+ * @list: list of #RmLookupEntry
+ * @number: number to lookup
+ * @contact: a #RmContact
+ * @definitive: location to store whether every service answered, i.e. a negative result may be cached
+ *
+ * Queries all services of @list concurrently within a private main context, waiting for the
+ * first valid result, for all services to fail or for the global deadline.
+ *
+ * Returns: %TRUE on success, otherwise %FALSE
+ */
+static gboolean reverselookup_do_services(GSList *list, gchar *number, RmContact *contact, gboolean *definitive)
+{
+	RmLookupRequest request = { NULL };
+	GMainContext *context;
+	GSource *deadline;
+	GSList *iter;
+
+	context = g_main_context_new();
+	g_main_context_push_thread_default(context);
+
+	request.loop = g_main_loop_new(context, FALSE);
+	request.number = number;
+	request.contact = contact;
+
+	for (; list != NULL && list->data != NULL; list = list->next) {
+		RmLookupEntry *lookup = list->data;
+		RmLookupJob *job;
+		gchar *full_number;
+		gchar *url;
+		SoupURI *uri;
+
+		/* Skip rate limited and failing services right away */
+		if (!reverselookup_health_acquire(lookup)) {
+			request.failed++;
+			continue;
 		}
-	} else if (lookup->zip_len) {
-		contact->zip = g_strndup(contact->city, lookup->zip_len);
-		memmove(contact->city, contact->city + lookup->zip_len + 1, strlen(contact->city) - lookup->zip_len + 1);
-	}
-
-	rl_contact = g_slice_new0(RmContact);
-	rl_contact->name = g_strdup(contact->name);
-	rl_contact->street = g_strdup(contact->street);
-	rl_contact->zip = g_strdup(contact->zip);
-	rl_contact->city = g_strdup(contact->city);
-	g_hash_table_insert(table, number, rl_contact);
-	result = TRUE;
-
-	rl_tmp = g_strdup_printf("%s;%s;%s;%s;%s\n",
-				 number,
-				 rl_contact->name,
-				 rl_contact->street,
-				 rl_contact->zip,
-				 rl_contact->city);
-
-	file = g_build_filename(rm_get_user_cache_dir(), "reverselookup", number, NULL);
-	rm_file_save(file, rl_tmp, strlen(rl_tmp));
-	g_free(file);
-	g_free(rl_tmp);
+
+		job = g_slice_new0(RmLookupJob);
+
+		/* get full number according to service preferences */
+		full_number = rm_number_full(number, lookup->prefix);
+		url = reverselookup_replace_number(lookup, full_number);
+		g_free(full_number);
 
 #ifdef RL_DEBUG
-	gchar *tmp_file = g_strdup_printf("rl-found-%s-%s.html", lookup->service, number);
-	rm_log_save_data(tmp_file, rdata, len);
-	g_free(tmp_file);
+		g_debug("Using service '%s', URL: %s", lookup->service, url);
 #endif
 
- end:
-	if (rdata) {
-		g_free(rdata);
+		uri = soup_uri_new(url);
+		g_free(url);
+		if (!uri) {
+			/* Not a definitive miss, keep the result out of the cache */
+			g_debug("%s(): Invalid URL for service '%s'", __FUNCTION__, lookup->service);
+			g_slice_free(RmLookupJob, job);
+			request.failed++;
+			continue;
+		}
+
+		job->request = &request;
+		job->lookup = lookup;
+		job->msg = soup_message_new_from_uri(SOUP_METHOD_GET, uri);
+		soup_uri_free(uri);
+		soup_message_headers_append(job->msg->request_headers, "User-Agent", "Mozilla/5.0 (compatible; MSIE 10.0; Windows NT 6.2; Trident/6.0)");
+
+		job->timeout = g_timeout_source_new_seconds(RL_SERVICE_TIMEOUT);
+		g_source_set_callback(job->timeout, reverselookup_job_timeout_cb, job, NULL);
+		g_source_attach(job->timeout, context);
+
+		request.jobs = g_slist_prepend(request.jobs, job);
+		request.pending++;
+
+		job->start_time = g_get_monotonic_time();
+		soup_session_queue_message(rl_session, job->msg, reverselookup_job_cb, job);
+	}
+
+	deadline = g_timeout_source_new_seconds(RL_DEADLINE);
+	g_source_set_callback(deadline, reverselookup_deadline_cb, &request, NULL);
+	g_source_attach(deadline, context);
+
+	if (request.pending) {
+		g_main_loop_run(request.loop);
+	}
+
+	g_source_destroy(deadline);
+	g_source_unref(deadline);
+
+	for (iter = request.jobs; iter != NULL; iter = iter->next) {
+		RmLookupJob *job = iter->data;
+
+		g_source_destroy(job->timeout);
+		g_source_unref(job->timeout);
+		g_slice_free(RmLookupJob, job);
 	}
+	g_slist_free(request.jobs);
 
-	g_object_unref(msg);
+	g_main_loop_unref(request.loop);
+	g_main_context_pop_thread_default(context);
+	g_main_context_unref(context);
 
-	return result;
+	*definitive = !request.failed;
+
+	return request.found;
 }
 
 /**
@@ -328,14 +687,13 @@ static gchar *reverselookup_get_country_code(const gchar *full_number)
  */
 static gboolean reverselookup_do(gchar *number, RmContact *contact)
 {
-	RmLookupEntry *lookup = NULL;
 	GSList *list = NULL;
 	gchar *full_number = NULL;
 	gchar *country_code = NULL;
 	gboolean found = FALSE;
+	gboolean definitive = FALSE;
 	gint international_access_code_len;
 	RmProfile *profile = rm_profile_get_active();
-	RmContact *rl_contact;
 
 	if (!profile) {
 		return FALSE;
@@ -350,17 +708,8 @@ static gboolean reverselookup_do(gchar *number, RmContact *contact)
 	g_debug("Input number '%s'", number);
 #endif
 
-	rl_contact = g_hash_table_lookup(table, number);
-	if (rl_contact) {
-		if (!RM_EMPTY_STRING(rl_contact->name)) {
-			contact->name = g_strdup(rl_contact->name);
-			contact->street = g_strdup(rl_contact->street);
-			contact->zip = g_strdup(rl_contact->zip);
-			contact->city = g_strdup(rl_contact->city);
-			return TRUE;
-		}
-
-		return FALSE;
+	if (reverselookup_cache_lookup(number, contact, &found)) {
+		return found;
 	}
 
 	/* Get full number and extract country code if possible */
@@ -399,27 +748,85 @@ static gboolean reverselookup_do(gchar *number, RmContact *contact)
 
 	g_free(country_code);
 
-	for (; list != NULL && list->data != NULL; list = list->next) {
-		lookup = list->data;
+	found = reverselookup_do_services(list, number, contact, &definitive);
 
-#ifdef RL_DEBUG
-		g_debug("Using service '%s'", lookup->service);
-#endif
+	/* Do not remember numbers as unknown just because a service failed */
+	if (found || definitive) {
+		reverselookup_cache_store(number, found ? contact : NULL);
+	}
 
-		found = reverselookup_do_entry(lookup, number, contact);
-		/* in case we found some valid data, break loop */
-		if (found) {
-			break;
-		}
+	return found;
+}
+
+/**
+ * reverselookup_rule_compile:
+ * @node: a #RmXmlNode of a lookup service
+ * @name: name of rule child node
+ * @rule: a #RmLookupRule to fill
+ *
+ * Compile extraction rule "tag attribute value" of child @name
+ */
+static void reverselookup_rule_compile(RmXmlNode *node, const gchar *name, RmLookupRule *rule)
+{
+	RmXmlNode *child = rm_xmlnode_get_child(node, name);
+	gchar **split;
+	gchar *tmp;
+
+	if (!child) {
+		return;
 	}
 
-	if (!found) {
-		rl_contact = g_slice_new0(RmContact);
+	tmp = rm_xmlnode_get_data(child);
+	if (!tmp) {
+		return;
+	}
+
+	split = g_strsplit(tmp, " ", 3);
 
-		g_hash_table_insert(table, number, rl_contact);
+	if (g_strv_length(split) == 3) {
+		rule->tag = g_strdup(split[0]);
+		rule->attribute = g_strdup(split[1]);
+		rule->value = g_strdup(split[2]);
+	} else {
+		g_debug("%s(): Invalid %s rule '%s'", __FUNCTION__, name, tmp);
 	}
 
-	return found;
+	g_strfreev(split);
+	g_free(tmp);
+}
+
+/**
+ * reverselookup_entry_free:
+ * @data: a #RmLookupEntry
+ *
+ * Frees lookup service including its compiled rules
+ */
+static void reverselookup_entry_free(gpointer data)
+{
+	RmLookupEntry *lookup = data;
+	gint field;
+
+	for (field = 0; field < RL_FIELD_MAX; field++) {
+		g_free(lookup->rules[field].tag);
+		g_free(lookup->rules[field].attribute);
+		g_free(lookup->rules[field].value);
+	}
+
+	g_strfreev(lookup->url_parts);
+	g_free(lookup->url);
+	g_free(lookup->service);
+	g_slice_free(RmLookupEntry, lookup);
+}
+
+/**
+ * reverselookup_list_free:
+ * @data: list of #RmLookupEntry of one country code
+ *
+ * Frees lookup services of a country code
+ */
+static void reverselookup_list_free(gpointer data)
+{
+	g_slist_free_full(data, reverselookup_entry_free);
 }
 
 /**
@@ -435,11 +842,7 @@ static void reverselookup_add(RmXmlNode *node)
 	gchar *service = NULL;
 	gchar *prefix = NULL;
 	gchar *url = NULL;
-	gchar **name = NULL;
-	gchar **street = NULL;
-	gchar **city = NULL;
-	gchar **zip = NULL;
-	gint zip_len = 0;
+	gchar *tmp;
 
 	child = rm_xmlnode_get_child(node, "service");
 	g_assert(child != NULL);
@@ -453,45 +856,29 @@ static void reverselookup_add(RmXmlNode *node)
 	g_assert(child != NULL);
 	url = rm_xmlnode_get_data(child);
 
-	gchar *tmp;
-
-	child = rm_xmlnode_get_child(node, "name");
-	g_assert(child != NULL);
-	tmp = rm_xmlnode_get_data(child);
-	name = g_strsplit(tmp, " ", -1);
+	lookup = g_slice_alloc0(sizeof(RmLookupEntry));
+	g_debug(" o Service: '%s', prefix: %s", service, prefix);
+	lookup->service = service;
+	lookup->prefix = prefix[ 0 ] == '1';
+	lookup->url = url;
+	lookup->url_parts = g_strsplit(url, "%NUMBER%", -1);
+	lookup->tokens = RL_BUCKET_SIZE;
+	lookup->refill_time = g_get_monotonic_time();
+	g_free(prefix);
 
-	child = rm_xmlnode_get_child(node, "street");
-	g_assert(child != NULL);
-	tmp = rm_xmlnode_get_data(child);
-	street = g_strsplit(tmp, " ", -1);
+	reverselookup_rule_compile(node, "name", &lookup->rules[RL_FIELD_NAME]);
+	reverselookup_rule_compile(node, "street", &lookup->rules[RL_FIELD_STREET]);
+	reverselookup_rule_compile(node, "city", &lookup->rules[RL_FIELD_CITY]);
+	reverselookup_rule_compile(node, "zip", &lookup->rules[RL_FIELD_ZIP]);
 
 	child = rm_xmlnode_get_child(node, "city");
-	g_assert(child != NULL);
-	tmp = rm_xmlnode_get_data(child);
-	city = g_strsplit(tmp, " ", -1);
-
-	tmp = (gchar*)rm_xmlnode_get_attrib(child, "zip");
+	tmp = child ? (gchar*)rm_xmlnode_get_attrib(child, "zip") : NULL;
 	if (tmp) {
-		zip_len = atoi(tmp);
+		lookup->zip_len = atoi(tmp);
 	}
 
-	child = rm_xmlnode_get_child(node, "zip");
-
-	if (child) {
-		tmp = rm_xmlnode_get_data(child);
-		zip = g_strsplit(tmp, " ", -1);
-	}
-
-	lookup = g_slice_alloc0(sizeof(RmLookupEntry));
-	g_debug(" o Service: '%s', prefix: %s", service, prefix);
-	lookup->service = service;
-	lookup->prefix = prefix[ 0 ] == '1';
-	lookup->url = url;
-	lookup->name = name;
-	lookup->street = street;
-	lookup->city = city;
-	lookup->zip = zip;
-	lookup->zip_len = zip_len;
+	/* Name, street and city are mandatory */
+	g_assert(lookup->rules[RL_FIELD_NAME].tag && lookup->rules[RL_FIELD_STREET].tag && lookup->rules[RL_FIELD_CITY].tag);
 
 	lookup_list = g_slist_prepend(lookup_list, lookup);
 }
@@ -521,60 +908,71 @@ static void reverselookup_country_code_add(RmXmlNode *node)
 }
 
 /**
- * reverselookup_read_cache:
- * @dir_name: read cache file from @dir_name
+ * reverselookup_get_stats:
+ *
+ * Get health of all services
  *
- * Read cached data (previous lookups with valid data)
+ * Returns: list of new #RmLookupStats
  */
-static void reverselookup_read_cache(gchar *dir_name)
+static GList *reverselookup_get_stats(void)
 {
-#ifndef RL_DEBUG
-	g_autoptr (GDir) dir = NULL;
-	GError *error = NULL;
-	const gchar *file_name;
+	GHashTableIter iter;
+	gpointer value;
+	GList *ret = NULL;
+	gint64 now = g_get_monotonic_time();
 
-	if (!dir_name) {
-		return;
+	if (!lookup_table) {
+		return NULL;
 	}
 
-	dir = g_dir_open(dir_name, 0, &error);
-	if (!dir) {
-		g_debug("Could not open lookup directory");
-		return;
-	}
+	g_mutex_lock(&rl_health_mutex);
 
-	while ((file_name = g_dir_read_name(dir))) {
-		gchar *data;
-		gchar *uri;
-		gchar **split;
-		RmContact *contact;
+	g_hash_table_iter_init(&iter, lookup_table);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		GSList *list;
 
-		uri = g_build_filename(dir_name, file_name, NULL);
-		data = rm_file_load(uri, NULL);
-		g_free(uri);
+		for (list = value; list != NULL; list = list->next) {
+			RmLookupEntry *lookup = list->data;
+			RmLookupStats *stats = g_slice_new(RmLookupStats);
 
-		g_assert(data != NULL);
+			*stats = lookup->stats;
+			stats->service = g_strdup(lookup->service);
+			stats->available = lookup->consecutive_failures < RL_BREAKER_THRESHOLD || now >= lookup->open_until;
 
-		split = g_strsplit(data, ";", -1);
+			ret = g_list_prepend(ret, stats);
+		}
+	}
 
-		contact = g_slice_new0(RmContact);
+	g_mutex_unlock(&rl_health_mutex);
 
-		contact->name = g_strdup(split[1]);
-		contact->street = g_strdup(split[2]);
-		contact->zip = g_strdup(split[3]);
-		contact->city = g_strstrip(g_strdup(split[4]));
+	return g_list_reverse(ret);
+}
 
-		g_hash_table_insert(table, g_strdup(split[0]), contact);
+/**
+ * reverselookup_do_cached:
+ * @number: number to lookup
+ * @contact: a #RmContact
+ *
+ * Reverse lookup within the cache only, never blocks on the network.
+ *
+ * Returns: %TRUE if number is cached, @contact is only filled if it has been found
+ */
+static gboolean reverselookup_do_cached(gchar *number, RmContact *contact)
+{
+	gboolean found = FALSE;
 
-		g_free(data);
-		g_strfreev(split);
+	if (RM_EMPTY_STRING(number) || !isdigit(number[0])) {
+		return FALSE;
 	}
-#endif
+
+	return reverselookup_cache_lookup(number, contact, &found);
 }
 
 RmLookup rl = {
 	"Reverse Lookup",
-	reverselookup_do
+	reverselookup_do,
+	reverselookup_get_stats,
+	reverselookup_do_cached
 };
 
 /**
@@ -593,9 +991,6 @@ static gboolean reverselookup_plugin_init(RmPlugin *plugin)
 
 	plugin->priv = reverselookup_plugin;
 
-	reverselookup_plugin->table = g_hash_table_new(g_str_hash, g_str_equal);
-	table = g_hash_table_new(g_str_hash, g_str_equal);
-
 	file = g_build_filename(g_get_home_dir(), "lookup.xml", NULL);
 	if (!g_file_test(file, G_FILE_TEST_EXISTS)) {
 		g_free(file);
@@ -607,27 +1002,25 @@ static gboolean reverselookup_plugin_init(RmPlugin *plugin)
 	if (!node) {
 		g_debug("Could not read %s", file);
 		g_free(file);
+
+		g_slice_free(RmReverseLookupPlugin, reverselookup_plugin);
+		plugin->priv = NULL;
 		return FALSE;
 	}
 	g_debug("ReverseLookup: '%s'", file);
 	g_free(file);
 
 	/* Create new lookup hash table */
-	lookup_table = g_hash_table_new(NULL, NULL);
+	lookup_table = g_hash_table_new_full(NULL, NULL, NULL, reverselookup_list_free);
 
 	for (child = rm_xmlnode_get_child(node, "country"); child != NULL; child = rm_xmlnode_get_next_twin(child)) {
 		/* Add new country code lists to hash table */
 		reverselookup_country_code_add(child);
 	}
 
-	file = g_build_filename(rm_get_user_cache_dir(), "reverselookup", NULL);
-	g_mkdir_with_parents(file, 0770);
-	reverselookup_read_cache(file);
-	g_free(file);
-
 	rm_xmlnode_free(node);
 
-	rl_session = soup_session_new();
+	rl_session = soup_session_new_with_options(SOUP_SESSION_TIMEOUT, RL_SERVICE_TIMEOUT, SOUP_SESSION_USE_THREAD_CONTEXT, TRUE, NULL);
 
 	rm_lookup_register(&rl);
 
@@ -652,6 +1045,17 @@ static gboolean reverselookup_plugin_shutdown(RmPlugin *plugin)
 	}
 
 	rm_lookup_unregister(&rl);
+	reverselookup_cache_shutdown();
+
+	soup_session_abort(rl_session);
+	g_clear_object(&rl_session);
+
+	/* Lists of all country codes including compiled rules */
+	g_clear_pointer(&lookup_table, g_hash_table_destroy);
+	lookup_list = NULL;
+
+	g_slice_free(RmReverseLookupPlugin, reverselookup_plugin);
+	plugin->priv = NULL;
 
 	return TRUE;
 }
@@ -24,7 +24,9 @@
 
 #include <rm/rmaction.h>
 #include <rm/rmcallentry.h>
+#include <rm/rmcoalesce.h>
 #include <rm/rmcsv.h>
+#include <rm/rmexecutor.h>
 #include <rm/rmfaxserver.h>
 #include <rm/rmfilter.h>
 #include <rm/rmjournal.h>
@@ -45,6 +47,7 @@
 #include <rm/rmplugins.h>
 #include <rm/rmrouterinfo.h>
 #include <rm/rmstring.h>
+#include <rm/rmtrie.h>
 #include <rm/rmaudio.h>
 #include <rm/rmcontact.h>
 #include <rm/rmfax.h>
@@ -29,6 +29,9 @@
 #include <rm/rmstring.h>
 #include <rm/rmcallentry.h>
 #include <rm/rmnumber.h>
+#include <rm/rmtrie.h>
+#include <rm/rmcoalesce.h>
+#include <rm/rmexecutor.h>
 #include <rm/rmmain.h>
 
 /**
@@ -42,6 +45,21 @@
 static guint rm_addressbook_contact_process_id = 0;
 static guint rm_addressbook_contacts_changed_id = 0;
 static GHashTable *rm_addressbook_table = NULL;
+static GMutex rm_addressbook_table_mutex;
+/** In-flight number resolutions */
+static RmCoalesce *rm_addressbook_coalesce = NULL;
+/** Completion indices, per address book */
+static GHashTable *rm_addressbook_indices = NULL;
+/** Contact generation, indices built for an older generation are outdated */
+static guint rm_addressbook_generation = 0;
+/** Protects rm_addressbook_indices and rm_addressbook_generation */
+static GMutex rm_addressbook_indices_mutex;
+/** Lookup statistics, per address book */
+static GHashTable *rm_addressbook_stats = NULL;
+static GMutex rm_addressbook_stats_mutex;
+
+/** Maximum time a federated lookup waits for higher priority address books */
+#define RM_ADDRESSBOOK_LOOKUP_TIMEOUT (2 * G_TIME_SPAN_SECOND)
 
 /** Internal address book list */
 static GList *rm_addressbook_plugins = NULL;
@@ -86,6 +104,75 @@ GList *rm_addressbook_get_contacts(RmAddressBook *book)
 	return NULL;
 }
 
+/**
+ * rm_addressbook_get_n_contacts:
+ * @book: a #RmAddressBook
+ *
+ * Get number of contacts within address book.
+ *
+ * Returns: number of contacts
+ */
+guint rm_addressbook_get_n_contacts(RmAddressBook *book)
+{
+	if (!book) {
+		return 0;
+	}
+
+	if (book->get_contact_array) {
+		GPtrArray *array = book->get_contact_array();
+
+		return array ? array->len : 0;
+	}
+
+	return g_list_length(book->get_contacts());
+}
+
+/**
+ * rm_addressbook_get_nth_contact:
+ * @book: a #RmAddressBook
+ * @position: position of contact
+ *
+ * Get contact at @position of the sorted contact list, e.g. for list models. Constant time
+ * in case the address book plugin provides an indexed contact array.
+ *
+ * Returns: a #RmContact or %NULL if @position is out of range
+ */
+RmContact *rm_addressbook_get_nth_contact(RmAddressBook *book, guint position)
+{
+	if (!book) {
+		return NULL;
+	}
+
+	if (book->get_contact_array) {
+		GPtrArray *array = book->get_contact_array();
+
+		return array && position < array->len ? g_ptr_array_index(array, position) : NULL;
+	}
+
+	return g_list_nth_data(book->get_contacts(), position);
+}
+
+/**
+ * rm_addressbook_invalidate:
+ *
+ * Contacts have changed: drop cached caller ids and mark all indices as outdated.
+ */
+static void rm_addressbook_invalidate(void)
+{
+	g_mutex_lock(&rm_addressbook_table_mutex);
+	if (rm_addressbook_table) {
+		g_hash_table_remove_all(rm_addressbook_table);
+	}
+	g_mutex_unlock(&rm_addressbook_table_mutex);
+
+	g_mutex_lock(&rm_addressbook_indices_mutex);
+	rm_addressbook_generation++;
+	if (rm_addressbook_indices) {
+		g_hash_table_remove_all(rm_addressbook_indices);
+	}
+	g_mutex_unlock(&rm_addressbook_indices_mutex);
+}
+
 /**
  * rm_addressbook_remove_contact:
  * @book: a #RmAddressBook
@@ -98,7 +185,11 @@ GList *rm_addressbook_get_contacts(RmAddressBook *book)
 gboolean rm_addressbook_remove_contact(RmAddressBook *book, RmContact *contact)
 {
 	if (book && book->remove_contact) {
-		return book->remove_contact(contact);
+		gboolean ret = book->remove_contact(contact);
+
+		rm_addressbook_invalidate();
+
+		return ret;
 	}
 
 	return FALSE;
@@ -116,7 +207,11 @@ gboolean rm_addressbook_remove_contact(RmAddressBook *book, RmContact *contact)
 gboolean rm_addressbook_save_contact(RmAddressBook *book, RmContact *contact)
 {
 	if (book && book->save_contact) {
-		return book->save_contact(contact);
+		gboolean ret = book->save_contact(contact);
+
+		rm_addressbook_invalidate();
+
+		return ret;
 	}
 
 	return FALSE;
@@ -140,29 +235,103 @@ gboolean rm_addressbook_can_save(RmAddressBook *book)
 }
 
 /**
- * rm_address_book_number_in_contact:
- * @a: a #RmContact
- * @b: a number
+ * rm_addressbook_contact_free:
+ * @data: a #RmContact
+ *
+ * Frees contact data and the contact itself.
+ */
+static void rm_addressbook_contact_free(gpointer data)
+{
+	rm_contact_free(data);
+	g_slice_free(RmContact, data);
+}
+
+/**
+ * rm_addressbook_lookup_flight:
+ * @number: number to lookup
+ * @user_data: list of #RmAddressBook
  *
- * Checks if number @b is within contact @a.
+ * Coalesced address book lookup.
  *
- * Returns: 0 if present, -1 otherwise
+ * Returns: a new #RmContact, or %NULL if number has not been found
  */
-static gint rm_addressbook_number_in_contact(gconstpointer a, gconstpointer b)
+static gpointer rm_addressbook_lookup_flight(const gchar *number, gpointer user_data)
 {
-	RmContact *contact = (RmContact*)a;
-	gchar *number = (gchar*)b;
-	GList *list;
+	return rm_addressbook_lookup(user_data, number);
+}
 
-	for (list = contact->numbers; list != NULL; list = list->next) {
-		RmPhoneNumber *phone_number = list->data;
+/**
+ * rm_addressbook_resolve:
+ * @number: number to lookup
+ *
+ * Lookup @number within the address books of the active profile. Results (including misses) are
+ * cached by normalized number and concurrent resolutions of one number share a single address
+ * book walk.
+ *
+ * Returns: a new #RmContact (free with rm_contact_free() and g_slice_free()), or %NULL if not found
+ */
+RmContact *rm_addressbook_resolve(const gchar *number)
+{
+	RmProfile *profile = rm_profile_get_active();
+	RmNumberPlan *plan;
+	RmContact *tmp_contact;
+	RmContact *contact = NULL;
+	GList *books;
+	gchar *flight_key;
+	guint64 key;
 
-		if (g_strcmp0(phone_number->number, number) == 0) {
-			return 0;
+	if (RM_EMPTY_STRING(number) || !profile || !rm_addressbook_table) {
+		return NULL;
+	}
+
+	/* Cache is keyed by normalized number, so different spellings share one entry */
+	plan = rm_number_plan_get(profile);
+	key = rm_number_key(plan, number);
+	rm_number_plan_unref(plan);
+
+	g_mutex_lock(&rm_addressbook_table_mutex);
+	tmp_contact = key ? g_hash_table_lookup(rm_addressbook_table, &key) : NULL;
+	if (tmp_contact) {
+		/* An empty name marks a previous lookup without result */
+		if (!RM_EMPTY_STRING(tmp_contact->name)) {
+			contact = rm_contact_dup(tmp_contact);
 		}
+
+		g_mutex_unlock(&rm_addressbook_table_mutex);
+		return contact;
 	}
+	g_mutex_unlock(&rm_addressbook_table_mutex);
 
-	return -1;
+	books = rm_profile_get_addressbooks(profile);
+	if (!books) {
+		return NULL;
+	}
+
+	/* Concurrent resolutions of one number share a single address book walk */
+	flight_key = key ? g_strdup_printf("%" G_GUINT64_FORMAT, key) : g_strdup(number);
+	tmp_contact = rm_coalesce_run(rm_addressbook_coalesce, flight_key, rm_addressbook_lookup_flight, books);
+	g_free(flight_key);
+	g_list_free(books);
+
+	if (tmp_contact) {
+		contact = rm_contact_dup(tmp_contact);
+	} else {
+		/* We have found no entry, mark it in rm_addressbook_table to speedup further lookup */
+		tmp_contact = g_slice_new0(RmContact);
+	}
+
+	if (key) {
+		guint64 *table_key = g_new(guint64, 1);
+
+		*table_key = key;
+		g_mutex_lock(&rm_addressbook_table_mutex);
+		g_hash_table_insert(rm_addressbook_table, table_key, tmp_contact);
+		g_mutex_unlock(&rm_addressbook_table_mutex);
+	} else {
+		rm_addressbook_contact_free(tmp_contact);
+	}
+
+	return contact;
 }
 
 /**
@@ -175,73 +344,860 @@ static gint rm_addressbook_number_in_contact(gconstpointer a, gconstpointer b)
  */
 static void rm_addressbook_contact_process_cb(RmObject *obj, RmContact *contact, gpointer user_data)
 {
-	RmAddressBook *book = rm_profile_get_addressbook(rm_profile_get_active());
 	RmContact *tmp_contact;
-	GList *contacts;
 	gchar *number = contact->number;
 
-	if (RM_EMPTY_STRING(contact->number)) {
-		/* Contact number is not present, abort */
+	tmp_contact = rm_addressbook_resolve(number);
+	if (!tmp_contact) {
 		return;
 	}
 
-	contacts = rm_addressbook_get_contacts(book);
-	if (!contacts) {
+	/* Keep the number as passed in, rm_contact_copy() replaced it with a copy */
+	rm_contact_copy(tmp_contact, contact);
+	g_free(contact->number);
+	contact->number = number;
+
+	rm_contact_free(tmp_contact);
+	g_slice_free(RmContact, tmp_contact);
+}
+
+/**
+ * rm_addressbook_contacts_changed_cb:
+ * @obj: a #RmObject
+ * @user_data: user data
+ *
+ * Contacts have changed (new, deleted contacts or new address book). Clear address book hash table.
+ */
+static void rm_addressbook_contacts_changed_cb(RmObject *obj, gpointer user_data)
+{
+	rm_addressbook_invalidate();
+}
+
+/**
+ * RmAddressBookIndex:
+ *
+ * Completion index of one address book: case-folded name tokens and normalized numbers. Entries
+ * point to contacts owned by the address book, which frees them within the main context, so
+ * indices are only used there. They are refcounted, so a completion can keep using one while it
+ * is replaced.
+ */
+typedef struct {
+	gint ref_count;
+	/* Contact generation the index has been built for */
+	guint generation;
+	guint n_contacts;
+	RmTrie *names;
+	RmTrie *numbers;
+} RmAddressBookIndex;
+
+typedef struct {
+	RmContact *contact;
+	/* Position within sorted contact list */
+	guint position;
+	/* Name token number, 0 for the first token of the name */
+	guint token;
+	/* Number of characters the match is longer than the query */
+	guint depth;
+} RmAddressBookMatch;
+
+typedef struct {
+	/* RmContact -> RmAddressBookMatch */
+	GHashTable *matches;
+	/* Additional query tokens each match must contain */
+	gchar **filter;
+	guint limit;
+	guint stop_depth;
+} RmAddressBookCompletion;
+
+/**
+ * rm_addressbook_index_unref:
+ * @data: a #RmAddressBookIndex
+ *
+ * Drops a reference of completion index, frees it once the last reference is gone.
+ */
+static void rm_addressbook_index_unref(gpointer data)
+{
+	RmAddressBookIndex *index = data;
+
+	if (!g_atomic_int_dec_and_test(&index->ref_count)) {
 		return;
 	}
 
-	tmp_contact = g_hash_table_lookup(rm_addressbook_table, contact->number);
-	if (tmp_contact) {
-		if (!RM_EMPTY_STRING(tmp_contact->name)) {
-			rm_contact_copy(tmp_contact, contact);
-		} else {
-			/* Previous lookup done but no result found */
-			return;
+	rm_trie_free(index->names);
+	rm_trie_free(index->numbers);
+	g_slice_free(RmAddressBookIndex, index);
+}
+
+/**
+ * rm_addressbook_tokenize:
+ * @text: input text
+ *
+ * Split @text into case-folded alphanumeric tokens.
+ *
+ * Returns: %NULL terminated token array, free with g_strfreev()
+ */
+static gchar **rm_addressbook_tokenize(const gchar *text)
+{
+	GPtrArray *tokens = g_ptr_array_new();
+
+	if (!RM_EMPTY_STRING(text)) {
+		gchar *folded = g_utf8_casefold(text, -1);
+		gchar *start = NULL;
+		gchar *ptr;
+
+		for (ptr = folded; ; ptr = g_utf8_next_char(ptr)) {
+			gunichar c = g_utf8_get_char(ptr);
+
+			if (c && g_unichar_isalnum(c)) {
+				if (!start) {
+					start = ptr;
+				}
+				continue;
+			}
+
+			if (start) {
+				g_ptr_array_add(tokens, g_strndup(start, ptr - start));
+				start = NULL;
+			}
+
+			if (!c) {
+				break;
+			}
+		}
+
+		g_free(folded);
+	}
+
+	g_ptr_array_add(tokens, NULL);
+
+	return (gchar**)g_ptr_array_free(tokens, FALSE);
+}
+
+/**
+ * rm_addressbook_index_insert:
+ * @trie: a #RmTrie
+ * @key: index key
+ * @contact: a #RmContact
+ * @position: position of @contact
+ * @token: token number
+ *
+ * Adds @contact under @key to @trie.
+ */
+static void rm_addressbook_index_insert(RmTrie *trie, const gchar *key, RmContact *contact, guint position, guint token)
+{
+	RmAddressBookMatch *entry = g_new0(RmAddressBookMatch, 1);
+
+	entry->contact = contact;
+	entry->position = position;
+	entry->token = token;
+
+	rm_trie_insert(trie, key, entry);
+}
+
+/**
+ * rm_addressbook_index_new:
+ * @book: a #RmAddressBook
+ *
+ * Build completion index for @book.
+ *
+ * Returns: a new #RmAddressBookIndex
+ */
+static RmAddressBookIndex *rm_addressbook_index_new(RmAddressBook *book)
+{
+	RmAddressBookIndex *index = g_slice_new0(RmAddressBookIndex);
+	GPtrArray *numbers = g_ptr_array_new();
+	GList *contacts;
+	GArray *owners = g_array_new(FALSE, TRUE, sizeof(RmAddressBookMatch));
+	gchar **full_numbers;
+	GList *list;
+	guint position = 0;
+	guint i;
+
+	contacts = rm_addressbook_get_contacts(book);
+	index->ref_count = 1;
+	index->n_contacts = g_list_length(contacts);
+	index->names = rm_trie_new(g_free);
+	index->numbers = rm_trie_new(g_free);
+
+	for (list = contacts; list != NULL; list = list->next, position++) {
+		RmContact *contact = list->data;
+		gchar **tokens = rm_addressbook_tokenize(contact->name);
+		GList *number_list;
+
+		for (i = 0; tokens[i]; i++) {
+			rm_addressbook_index_insert(index->names, tokens[i], contact, position, i);
+		}
+		g_strfreev(tokens);
+
+		for (number_list = contact->numbers; number_list != NULL; number_list = number_list->next) {
+			RmPhoneNumber *phone_number = number_list->data;
+			RmAddressBookMatch owner = { contact, position, 0, 0 };
+
+			g_ptr_array_add(numbers, phone_number->number);
+			g_array_append_val(owners, owner);
+		}
+	}
+
+	/* Normalize all numbers of the book in one go */
+	full_numbers = rm_number_full_many((const gchar * const *)numbers->pdata, numbers->len, FALSE);
+	for (i = 0; i < numbers->len; i++) {
+		RmAddressBookMatch *owner = &g_array_index(owners, RmAddressBookMatch, i);
+
+		if (!RM_EMPTY_STRING(full_numbers[i])) {
+			rm_addressbook_index_insert(index->numbers, full_numbers[i], owner->contact, owner->position, 0);
+		}
+	}
+	g_free(full_numbers);
+	g_ptr_array_free(numbers, TRUE);
+	g_array_free(owners, TRUE);
+
+	g_debug("%s(): %d contacts, %d name nodes, %d number nodes", __FUNCTION__, index->n_contacts, rm_trie_get_n_nodes(index->names), rm_trie_get_n_nodes(index->numbers));
+
+	return index;
+}
+
+/**
+ * rm_addressbook_index_get:
+ * @book: a #RmAddressBook
+ *
+ * Get completion index of @book, (re-)building it if contacts have changed since it was built.
+ * Must be called within the main context, like the address book functions it reads contacts from.
+ *
+ * Returns: a #RmAddressBookIndex, release with rm_addressbook_index_unref()
+ */
+static RmAddressBookIndex *rm_addressbook_index_get(RmAddressBook *book)
+{
+	RmAddressBookIndex *index;
+	guint generation;
+
+	g_mutex_lock(&rm_addressbook_indices_mutex);
+	index = rm_addressbook_indices ? g_hash_table_lookup(rm_addressbook_indices, book) : NULL;
+	generation = rm_addressbook_generation;
+	if (index && index->generation == generation) {
+		g_atomic_int_inc(&index->ref_count);
+		g_mutex_unlock(&rm_addressbook_indices_mutex);
+
+		return index;
+	}
+	g_mutex_unlock(&rm_addressbook_indices_mutex);
+
+	/* Build without holding the lock, other books stay available meanwhile */
+	index = rm_addressbook_index_new(book);
+	index->generation = generation;
+
+	g_mutex_lock(&rm_addressbook_indices_mutex);
+	/* Contacts may have changed while building, keep such an index to this caller */
+	if (rm_addressbook_indices && generation == rm_addressbook_generation) {
+		g_atomic_int_inc(&index->ref_count);
+		g_hash_table_replace(rm_addressbook_indices, book, index);
+	}
+	g_mutex_unlock(&rm_addressbook_indices_mutex);
+
+	return index;
+}
+
+/**
+ * rm_addressbook_tokens_match:
+ * @contact: a #RmContact
+ * @filter: query tokens
+ *
+ * Checks whether each token of @filter is a prefix of a name token of @contact.
+ *
+ * Returns: %TRUE if all tokens match
+ */
+static gboolean rm_addressbook_tokens_match(RmContact *contact, gchar **filter)
+{
+	gchar **tokens = rm_addressbook_tokenize(contact->name);
+	gboolean ret = TRUE;
+	guint i;
+
+	for (i = 0; ret && filter[i]; i++) {
+		guint j;
+
+		ret = FALSE;
+		for (j = 0; tokens[j]; j++) {
+			if (g_str_has_prefix(tokens[j], filter[i])) {
+				ret = TRUE;
+				break;
+			}
+		}
+	}
+
+	g_strfreev(tokens);
+
+	return ret;
+}
+
+/**
+ * rm_addressbook_match_compare:
+ * @a: pointer to a #RmAddressBookMatch
+ * @b: pointer to a #RmAddressBookMatch
+ *
+ * Ranks matches: shorter completions first, then matches on the first name token, then
+ * address book order.
+ *
+ * Returns: sort order
+ */
+static gint rm_addressbook_match_compare(gconstpointer a, gconstpointer b)
+{
+	const RmAddressBookMatch *match_a = *(RmAddressBookMatch**)a;
+	const RmAddressBookMatch *match_b = *(RmAddressBookMatch**)b;
+
+	if (match_a->depth != match_b->depth) {
+		return match_a->depth < match_b->depth ? -1 : 1;
+	}
+
+	if ((match_a->token > 0) != (match_b->token > 0)) {
+		return match_a->token > 0 ? 1 : -1;
+	}
+
+	if (match_a->position != match_b->position) {
+		return match_a->position < match_b->position ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * rm_addressbook_complete_cb:
+ * @values: #RmAddressBookMatch entries stored at visited key
+ * @depth: completion length
+ * @user_data: a #RmAddressBookCompletion
+ *
+ * Collects matches of a prefix walk. Once the limit has been reached the current depth is
+ * finished, as deeper keys can't rank better.
+ *
+ * Returns: %TRUE to continue walk
+ */
+static gboolean rm_addressbook_complete_cb(GPtrArray *values, guint depth, gpointer user_data)
+{
+	RmAddressBookCompletion *completion = user_data;
+	guint i;
+
+	if (depth > completion->stop_depth) {
+		return FALSE;
+	}
+
+	for (i = 0; i < values->len; i++) {
+		RmAddressBookMatch *entry = g_ptr_array_index(values, i);
+		RmAddressBookMatch *match = g_hash_table_lookup(completion->matches, entry->contact);
+
+		if (match) {
+			/* Shallower matches are visited first, only prefer first token within same depth */
+			if (match->depth == depth && match->token > 0 && entry->token == 0) {
+				match->token = 0;
+			}
+			continue;
+		}
+
+		if (completion->filter && !rm_addressbook_tokens_match(entry->contact, completion->filter)) {
+			continue;
+		}
+
+		match = g_slice_new(RmAddressBookMatch);
+		*match = *entry;
+		match->depth = depth;
+		g_hash_table_insert(completion->matches, entry->contact, match);
+	}
+
+	if (completion->limit && completion->stop_depth == G_MAXUINT && g_hash_table_size(completion->matches) >= completion->limit) {
+		completion->stop_depth = depth;
+	}
+
+	return TRUE;
+}
+
+/**
+ * rm_addressbook_match_free:
+ * @data: a #RmAddressBookMatch
+ *
+ * Frees match.
+ */
+static void rm_addressbook_match_free(gpointer data)
+{
+	g_slice_free(RmAddressBookMatch, data);
+}
+
+/**
+ * rm_addressbook_is_number:
+ * @text: query text
+ *
+ * Checks whether @text looks like a (partial) phone number.
+ *
+ * Returns: %TRUE if @text is a number query
+ */
+static gboolean rm_addressbook_is_number(const gchar *text)
+{
+	gboolean digit = FALSE;
+
+	for (; *text; text++) {
+		if (g_ascii_isdigit(*text)) {
+			digit = TRUE;
+		} else if (!strchr("+*#-/() ", *text)) {
+			return FALSE;
+		}
+	}
+
+	return digit;
+}
+
+/**
+ * rm_addressbook_complete:
+ * @book: a #RmAddressBook
+ * @prefix: text typed so far, either a (partial) name or number
+ * @limit: maximum number of results, 0 for no limit
+ *
+ * Complete @prefix against contact names and numbers of @book, e.g. for search-as-you-type.
+ * Each word of @prefix must be the beginning of a word of the contact name (case insensitive),
+ * numbers are normalized before matching. Uses a prefix index which is built on first use and
+ * dropped on contacts-changed or when a contact is saved or removed.
+ *
+ * Must be called within the main context: the index and the result refer to contacts owned by
+ * @book, which are only valid until the address book changes them there.
+ *
+ * Returns: (transfer container): ranked list of #RmContact owned by @book, free with g_list_free()
+ */
+GList *rm_addressbook_complete(RmAddressBook *book, const gchar *prefix, guint limit)
+{
+	RmAddressBookCompletion completion;
+	RmAddressBookIndex *index;
+	GHashTableIter iter;
+	GPtrArray *matches;
+	GList *list = NULL;
+	gpointer value;
+	guint i;
+
+	if (!book || RM_EMPTY_STRING(prefix) || !rm_addressbook_indices) {
+		return NULL;
+	}
+
+	index = rm_addressbook_index_get(book);
+
+	completion.matches = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, rm_addressbook_match_free);
+	completion.filter = NULL;
+	completion.limit = limit;
+	completion.stop_depth = G_MAXUINT;
+
+	if (rm_addressbook_is_number(prefix)) {
+		gchar *number = rm_number_canonize(prefix);
+		RmProfile *profile = rm_profile_get_active();
+
+		/* Queries in international format of the own country are indexed as national numbers */
+		if (profile && g_str_has_prefix(number, "00")) {
+			gchar *country_code = rm_router_get_country_code(profile);
+
+			if (!RM_EMPTY_STRING(country_code) && g_str_has_prefix(number + 2, country_code)) {
+				gchar *tmp = g_strconcat("0", number + 2 + strlen(country_code), NULL);
+
+				g_free(number);
+				number = tmp;
+			}
+			g_free(country_code);
 		}
+
+		rm_trie_foreach_prefix(index->numbers, number, rm_addressbook_complete_cb, &completion);
+		g_free(number);
 	} else {
-		GList *list;
-		gchar *full_number = rm_number_full(contact->number, FALSE);
+		gchar **tokens = rm_addressbook_tokenize(prefix);
+		guint longest = 0;
 
-		list = g_list_find_custom(contacts, full_number, rm_addressbook_number_in_contact);
-		if (list) {
-			tmp_contact = list->data;
+		if (!tokens[0]) {
+			g_strfreev(tokens);
+			g_hash_table_destroy(completion.matches);
+			rm_addressbook_index_unref(index);
+			return NULL;
+		}
 
-			g_hash_table_insert(rm_addressbook_table, g_strdup(contact->number), rm_contact_dup(tmp_contact));
+		/* Walk the most selective token, use the others as filter */
+		for (i = 1; tokens[i]; i++) {
+			if (strlen(tokens[i]) > strlen(tokens[longest])) {
+				longest = i;
+			}
+		}
 
-			rm_contact_copy(tmp_contact, contact);
-		} else {
-			/* We have found no entry, mark it in rm_addressbook_table to speedup further lookup */
-			tmp_contact = g_malloc0(sizeof(RmContact));
-			g_hash_table_insert(rm_addressbook_table, g_strdup(contact->number), tmp_contact);
+		if (tokens[1]) {
+			completion.filter = tokens;
 		}
 
-		g_free(full_number);
+		rm_trie_foreach_prefix(index->names, tokens[longest], rm_addressbook_complete_cb, &completion);
+		g_strfreev(tokens);
 	}
 
-	contact->number = number;
+	matches = g_ptr_array_sized_new(g_hash_table_size(completion.matches));
+	g_hash_table_iter_init(&iter, completion.matches);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		g_ptr_array_add(matches, value);
+	}
+	g_ptr_array_sort(matches, rm_addressbook_match_compare);
+
+	for (i = matches->len; i > 0; i--) {
+		RmAddressBookMatch *match = g_ptr_array_index(matches, i - 1);
+
+		if (!limit || i <= limit) {
+			list = g_list_prepend(list, match->contact);
+		}
+	}
+
+	g_ptr_array_free(matches, TRUE);
+	g_hash_table_destroy(completion.matches);
+	rm_addressbook_index_unref(index);
+
+	return list;
 }
 
 /**
- * rm_addressbook_contacts_changed_cb:
- * @obj: a #RmObject
- * @user_data: user data
+ * RmAddressBookFederation:
  *
- * Contacts have changed (new, deleted contacts or new address book). Clear address book hash table.
+ * State of one federated lookup, shared between caller and lookup threads.
  */
-static void rm_addressbook_contacts_changed_cb(RmObject *obj, gpointer user_data)
+typedef struct {
+	gint ref_count;
+	GMutex mutex;
+	GCond cond;
+	gchar *number;
+	guint n_books;
+	RmAddressBook **books;
+	/* Per address book result (owned) and completion state */
+	RmContact **results;
+	gboolean *done;
+} RmAddressBookFederation;
+
+typedef struct {
+	RmAddressBookFederation *federation;
+	guint position;
+} RmAddressBookQuery;
+
+/**
+ * rm_addressbook_federation_unref:
+ * @federation: a #RmAddressBookFederation
+ *
+ * Drops a reference, frees @federation once the last lookup thread has finished.
+ */
+static void rm_addressbook_federation_unref(RmAddressBookFederation *federation)
+{
+	guint i;
+
+	if (!g_atomic_int_dec_and_test(&federation->ref_count)) {
+		return;
+	}
+
+	for (i = 0; i < federation->n_books; i++) {
+		if (federation->results[i]) {
+			rm_addressbook_contact_free(federation->results[i]);
+		}
+	}
+
+	g_free(federation->results);
+	g_free(federation->done);
+	g_free(federation->books);
+	g_free(federation->number);
+	g_mutex_clear(&federation->mutex);
+	g_cond_clear(&federation->cond);
+	g_slice_free(RmAddressBookFederation, federation);
+}
+
+/**
+ * rm_addressbook_query_free:
+ * @data: a #RmAddressBookQuery
+ *
+ * Frees lookup thread data.
+ */
+static void rm_addressbook_query_free(gpointer data)
 {
-	g_hash_table_remove_all(rm_addressbook_table);
+	RmAddressBookQuery *query = data;
+
+	rm_addressbook_federation_unref(query->federation);
+	g_slice_free(RmAddressBookQuery, query);
 }
 
 /**
- * rm_addressbook_table_free:
- * @data: a #RmContact
+ * rm_addressbook_stats_add:
+ * @book: a #RmAddressBook
+ * @hit: whether lookup was successful
+ * @time: lookup time in microseconds
  *
- * Frees contact data.
+ * Account a number lookup of @book.
  */
-static void rm_addressbook_table_free(void *data)
+static void rm_addressbook_stats_add(RmAddressBook *book, gboolean hit, gint64 time)
 {
-	rm_contact_free(data);
+	RmAddressBookStats *stats;
+
+	g_mutex_lock(&rm_addressbook_stats_mutex);
+
+	if (!rm_addressbook_stats) {
+		rm_addressbook_stats = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	}
+
+	stats = g_hash_table_lookup(rm_addressbook_stats, book);
+	if (!stats) {
+		stats = g_new0(RmAddressBookStats, 1);
+		g_hash_table_insert(rm_addressbook_stats, book, stats);
+	}
+
+	stats->queries++;
+	if (hit) {
+		stats->hits++;
+	}
+	stats->total_time += time;
+	stats->max_time = MAX(stats->max_time, time);
+
+	g_mutex_unlock(&rm_addressbook_stats_mutex);
+}
+
+/**
+ * rm_addressbook_get_stats:
+ * @book: a #RmAddressBook
+ * @stats: location to store statistics
+ *
+ * Get number lookup statistics of @book.
+ *
+ * Returns: %TRUE if @book has been queried before, %FALSE otherwise
+ */
+gboolean rm_addressbook_get_stats(RmAddressBook *book, RmAddressBookStats *stats)
+{
+	RmAddressBookStats *book_stats;
+
+	g_mutex_lock(&rm_addressbook_stats_mutex);
+
+	book_stats = rm_addressbook_stats ? g_hash_table_lookup(rm_addressbook_stats, book) : NULL;
+	if (book_stats) {
+		*stats = *book_stats;
+	}
+
+	g_mutex_unlock(&rm_addressbook_stats_mutex);
+
+	return book_stats != NULL;
+}
+
+/**
+ * rm_addressbook_lookup_local:
+ * @book: a #RmAddressBook
+ * @number: normalized number
+ *
+ * Lookup @number within the in-memory contacts of @book using the number index.
+ *
+ * Returns: a new #RmContact or %NULL
+ */
+static RmContact *rm_addressbook_lookup_local(RmAddressBook *book, const gchar *number)
+{
+	gint64 start = g_get_monotonic_time();
+	RmAddressBookIndex *index = rm_addressbook_index_get(book);
+	GPtrArray *values = rm_trie_lookup(index->numbers, number);
+	RmContact *contact = NULL;
+
+	if (values && values->len) {
+		RmAddressBookMatch *entry = g_ptr_array_index(values, 0);
+
+		contact = rm_contact_dup(entry->contact);
+	}
+	rm_addressbook_index_unref(index);
+
+	rm_addressbook_stats_add(book, contact != NULL, g_get_monotonic_time() - start);
+
+	return contact;
+}
+
+/**
+ * rm_addressbook_lookup_blocks:
+ * @book: a #RmAddressBook
+ *
+ * Checks whether @book has to be queried in a worker thread.
+ *
+ * Returns: %TRUE if @book provides a blocking lookup function
+ */
+static inline gboolean rm_addressbook_lookup_blocks(RmAddressBook *book)
+{
+	return book->lookup && book->lookup_blocks;
+}
+
+/**
+ * rm_addressbook_lookup_direct:
+ * @book: a #RmAddressBook
+ * @number: normalized number
+ *
+ * Lookup @number within a non-blocking address book in the calling thread.
+ *
+ * Returns: a new #RmContact or %NULL
+ */
+static RmContact *rm_addressbook_lookup_direct(RmAddressBook *book, const gchar *number)
+{
+	gint64 start;
+	RmContact *contact;
+
+	if (!book->lookup) {
+		return rm_addressbook_lookup_local(book, number);
+	}
+
+	start = g_get_monotonic_time();
+	contact = book->lookup(number);
+	rm_addressbook_stats_add(book, contact != NULL, g_get_monotonic_time() - start);
+
+	return contact;
+}
+
+/**
+ * rm_addressbook_lookup_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: a #RmAddressBookQuery
+ * @cancellable: unused
+ *
+ * Runs the blocking lookup of one address book and reports its result.
+ */
+static void rm_addressbook_lookup_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	RmAddressBookQuery *query = task_data;
+	RmAddressBookFederation *federation = query->federation;
+	RmAddressBook *book = federation->books[query->position];
+	gint64 start = g_get_monotonic_time();
+	RmContact *contact;
+
+	contact = book->lookup(federation->number);
+	rm_addressbook_stats_add(book, contact != NULL, g_get_monotonic_time() - start);
+
+	g_mutex_lock(&federation->mutex);
+	federation->results[query->position] = contact;
+	federation->done[query->position] = TRUE;
+	g_cond_broadcast(&federation->cond);
+	g_mutex_unlock(&federation->mutex);
+
+	g_task_return_boolean(task, contact != NULL);
+}
+
+/**
+ * rm_addressbook_lookup:
+ * @books: list of #RmAddressBook, highest priority first
+ * @number: number to lookup
+ *
+ * Federated number lookup. Address books declaring a blocking lookup function are queried in
+ * parallel, all others are looked up directly in the calling thread. The result
+ * of the highest priority address book with a hit is returned as soon as all higher priority
+ * address books have answered, without waiting for lower priority ones. Higher priority address
+ * books are waited for at most RM_ADDRESSBOOK_LOOKUP_TIMEOUT.
+ *
+ * Returns: a new #RmContact or %NULL if no address book knows @number
+ */
+RmContact *rm_addressbook_lookup(GList *books, const gchar *number)
+{
+	RmAddressBookFederation *federation;
+	RmContact *contact = NULL;
+	gchar *full_number;
+	gint64 end_time;
+	GList *list;
+	guint i;
+
+	if (!books || RM_EMPTY_STRING(number) || !rm_addressbook_indices) {
+		return NULL;
+	}
+
+	full_number = rm_number_full(number, FALSE);
+
+	/* Leading non-blocking address books answer immediately, no need to start any thread */
+	for (list = books; list != NULL && !rm_addressbook_lookup_blocks(list->data); list = list->next) {
+		contact = rm_addressbook_lookup_direct(list->data, full_number);
+
+		if (contact) {
+			g_free(full_number);
+			return contact;
+		}
+	}
+
+	if (!list) {
+		g_free(full_number);
+		return NULL;
+	}
+
+	federation = g_slice_new0(RmAddressBookFederation);
+	federation->ref_count = 1;
+	g_mutex_init(&federation->mutex);
+	g_cond_init(&federation->cond);
+	federation->number = full_number;
+	federation->n_books = g_list_length(list);
+	federation->books = g_new0(RmAddressBook*, federation->n_books);
+	federation->results = g_new0(RmContact*, federation->n_books);
+	federation->done = g_new0(gboolean, federation->n_books);
+
+	for (i = 0; list != NULL; list = list->next, i++) {
+		RmAddressBook *book = list->data;
+		RmAddressBookQuery *query;
+		GTask *task;
+
+		federation->books[i] = book;
+
+		if (!rm_addressbook_lookup_blocks(book)) {
+			continue;
+		}
+
+		query = g_slice_new(RmAddressBookQuery);
+		query->federation = federation;
+		query->position = i;
+		g_atomic_int_inc(&federation->ref_count);
+
+		task = g_task_new(NULL, NULL, NULL, NULL);
+		g_task_set_source_tag(task, rm_addressbook_lookup);
+		g_task_set_task_data(task, query, rm_addressbook_query_free);
+		rm_executor_run_task(task, RM_EXECUTOR_PRIORITY_NORMAL, rm_addressbook_lookup_thread);
+		g_object_unref(task);
+	}
+
+	/* Resolve remaining non-blocking address books while the others are running */
+	for (i = 0; i < federation->n_books; i++) {
+		if (!rm_addressbook_lookup_blocks(federation->books[i])) {
+			RmContact *local = rm_addressbook_lookup_direct(federation->books[i], full_number);
+
+			g_mutex_lock(&federation->mutex);
+			federation->results[i] = local;
+			federation->done[i] = TRUE;
+			g_mutex_unlock(&federation->mutex);
+		}
+	}
+
+	end_time = g_get_monotonic_time() + RM_ADDRESSBOOK_LOOKUP_TIMEOUT;
+
+	g_mutex_lock(&federation->mutex);
+	while (TRUE) {
+		gboolean pending = FALSE;
+
+		for (i = 0; i < federation->n_books; i++) {
+			if (!federation->done[i]) {
+				pending = TRUE;
+				break;
+			}
+
+			if (federation->results[i]) {
+				break;
+			}
+		}
+
+		if (i < federation->n_books && !pending) {
+			/* Authoritative: all higher priority address books have answered without a hit */
+			contact = federation->results[i];
+			federation->results[i] = NULL;
+			break;
+		}
+
+		if (!pending) {
+			break;
+		}
+
+		if (!g_cond_wait_until(&federation->cond, &federation->mutex, end_time)) {
+			/* Use best available result, slow address books are not waited for */
+			for (i = 0; i < federation->n_books; i++) {
+				if (federation->results[i]) {
+					contact = federation->results[i];
+					federation->results[i] = NULL;
+					g_debug("%s(): Timeout, using result of '%s'", __FUNCTION__, federation->books[i]->name);
+					break;
+				}
+			}
+			break;
+		}
+	}
+	g_mutex_unlock(&federation->mutex);
+
+	rm_addressbook_federation_unref(federation);
+
+	return contact;
 }
 
 /**
@@ -255,7 +1211,11 @@ void rm_addressbook_register(RmAddressBook *book)
 	rm_addressbook_plugins = g_list_prepend(rm_addressbook_plugins, book);
 
 	if (!rm_addressbook_contact_process_id) {
-		rm_addressbook_table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, rm_addressbook_table_free);
+		rm_addressbook_table = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, rm_addressbook_contact_free);
+		g_mutex_lock(&rm_addressbook_indices_mutex);
+		rm_addressbook_indices = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, rm_addressbook_index_unref);
+		g_mutex_unlock(&rm_addressbook_indices_mutex);
+		rm_addressbook_coalesce = rm_coalesce_new((GBoxedCopyFunc)rm_contact_dup, rm_addressbook_contact_free);
 		rm_addressbook_contact_process_id = g_signal_connect(G_OBJECT(rm_object), "contact-process", G_CALLBACK(rm_addressbook_contact_process_cb), NULL);
 		rm_addressbook_contacts_changed_id = g_signal_connect(G_OBJECT(rm_object), "contacts-changed", G_CALLBACK(rm_addressbook_contacts_changed_cb), NULL);
 	}
@@ -271,11 +1231,27 @@ void rm_addressbook_unregister(RmAddressBook *book)
 {
 	rm_addressbook_plugins = g_list_remove(rm_addressbook_plugins, book);
 
+	g_mutex_lock(&rm_addressbook_indices_mutex);
+	if (rm_addressbook_indices) {
+		g_hash_table_remove(rm_addressbook_indices, book);
+	}
+	g_mutex_unlock(&rm_addressbook_indices_mutex);
+
+	g_mutex_lock(&rm_addressbook_stats_mutex);
+	if (rm_addressbook_stats) {
+		g_hash_table_remove(rm_addressbook_stats, book);
+	}
+	g_mutex_unlock(&rm_addressbook_stats_mutex);
+
 	if (g_list_length(rm_addressbook_plugins) < 1) {
 		g_signal_handler_disconnect(G_OBJECT(rm_object), rm_addressbook_contact_process_id);
 		g_signal_handler_disconnect(G_OBJECT(rm_object), rm_addressbook_contacts_changed_id);
 		g_hash_table_destroy(rm_addressbook_table);
 		rm_addressbook_table = NULL;
+		g_mutex_lock(&rm_addressbook_indices_mutex);
+		g_clear_pointer(&rm_addressbook_indices, g_hash_table_destroy);
+		g_mutex_unlock(&rm_addressbook_indices_mutex);
+		g_clear_pointer(&rm_addressbook_coalesce, rm_coalesce_free);
 	}
 }
 
@@ -32,6 +32,11 @@ G_BEGIN_DECLS
  * RmAddressBook:
  *
  * The #RmAddressBook-struct contains only private fileds and should not be directly accessed.
+ *
+ * ABI note: @get_contact_array, @lookup and @lookup_blocks have been appended to the structure.
+ * Out-of-tree address book plugins built against the previous layout must be rebuilt, otherwise
+ * librm reads past the end of their #RmAddressBook. Plugins only need to be recompiled, unset
+ * optional members are zero-initialized by designated or partial initializers.
  */
 typedef struct {
 	/*< private >*/
@@ -43,10 +48,38 @@ typedef struct {
 	gboolean (*save_contact)(RmContact *contact);
 	gchar **(*get_sub_books)(void);
 	gboolean (*set_sub_book)(gchar *name);
+	/* Optional: sorted contacts for indexed access */
+	GPtrArray *(*get_contact_array)(void);
+	/* Optional: thread-safe number lookup returning a new contact */
+	RmContact *(*lookup)(const gchar *number);
+	/* Set if lookup may block (network, disk), it is then run within a worker thread */
+	gboolean lookup_blocks;
 } RmAddressBook;
 
+/**
+ * RmAddressBookStats:
+ * @queries: number of number lookups
+ * @hits: number of successful lookups
+ * @total_time: accumulated lookup time in microseconds
+ * @max_time: slowest lookup in microseconds
+ *
+ * Number lookup statistics of an address book.
+ */
+typedef struct {
+	guint queries;
+	guint hits;
+	gint64 total_time;
+	gint64 max_time;
+} RmAddressBookStats;
+
 RmAddressBook *rm_addressbook_get(gchar *name);
 GList *rm_addressbook_get_contacts(RmAddressBook *book);
+guint rm_addressbook_get_n_contacts(RmAddressBook *book);
+RmContact *rm_addressbook_get_nth_contact(RmAddressBook *book, guint position);
+GList *rm_addressbook_complete(RmAddressBook *book, const gchar *prefix, guint limit);
+RmContact *rm_addressbook_lookup(GList *books, const gchar *number);
+RmContact *rm_addressbook_resolve(const gchar *number);
+gboolean rm_addressbook_get_stats(RmAddressBook *book, RmAddressBookStats *stats);
 gboolean rm_addressbook_remove_contact(RmAddressBook *book, RmContact *contact);
 gboolean rm_addressbook_save_contact(RmAddressBook *book, RmContact *contact);
 gboolean rm_addressbook_can_save(RmAddressBook *book);
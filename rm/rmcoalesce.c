@@ -0,0 +1,169 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <glib.h>
+
+#include <rm/rmcoalesce.h>
+
+/**
+ * SECTION:rmcoalesce
+ * @title: RmCoalesce
+ * @short_description: Coalescing of concurrent operations
+ *
+ * Concurrent callers of rm_coalesce_run() with the same key share one in-flight operation: the
+ * first caller runs it, all others wait for it and receive a copy of its result.
+ */
+
+typedef struct {
+	gint ref_count;
+	gboolean done;
+	gpointer result;
+	GCond cond;
+} RmCoalesceFlight;
+
+struct _RmCoalesce {
+	GMutex mutex;
+	/* Key to in-flight #RmCoalesceFlight */
+	GHashTable *flights;
+	GBoxedCopyFunc copy_func;
+	GDestroyNotify free_func;
+};
+
+/**
+ * rm_coalesce_new:
+ * @copy_func: function to copy results for waiting callers
+ * @free_func: function to free results
+ *
+ * Creates a new coalescing group.
+ *
+ * Returns: a new #RmCoalesce
+ */
+RmCoalesce *rm_coalesce_new(GBoxedCopyFunc copy_func, GDestroyNotify free_func)
+{
+	RmCoalesce *coalesce = g_slice_new0(RmCoalesce);
+
+	g_mutex_init(&coalesce->mutex);
+	coalesce->flights = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	coalesce->copy_func = copy_func;
+	coalesce->free_func = free_func;
+
+	return coalesce;
+}
+
+/**
+ * rm_coalesce_free:
+ * @coalesce: a #RmCoalesce
+ *
+ * Frees @coalesce, no operation may be in flight.
+ */
+void rm_coalesce_free(RmCoalesce *coalesce)
+{
+	if (!coalesce) {
+		return;
+	}
+
+	g_warn_if_fail(g_hash_table_size(coalesce->flights) == 0);
+
+	g_hash_table_destroy(coalesce->flights);
+	g_mutex_clear(&coalesce->mutex);
+	g_slice_free(RmCoalesce, coalesce);
+}
+
+/**
+ * rm_coalesce_flight_unref:
+ * @coalesce: a #RmCoalesce
+ * @flight: a #RmCoalesceFlight
+ *
+ * Drop reference of @flight, must be called with mutex held.
+ */
+static void rm_coalesce_flight_unref(RmCoalesce *coalesce, RmCoalesceFlight *flight)
+{
+	if (--flight->ref_count) {
+		return;
+	}
+
+	if (flight->result) {
+		coalesce->free_func(flight->result);
+	}
+
+	g_cond_clear(&flight->cond);
+	g_slice_free(RmCoalesceFlight, flight);
+}
+
+/**
+ * rm_coalesce_run:
+ * @coalesce: a #RmCoalesce
+ * @key: key of operation, e.g. a phone number
+ * @func: operation to run
+ * @user_data: user data passed to @func
+ *
+ * Runs @func for @key unless the same operation is already in flight. In that case the caller
+ * blocks until it is finished and receives a copy of its result.
+ *
+ * Returns: result of operation (owned by caller) or %NULL
+ */
+gpointer rm_coalesce_run(RmCoalesce *coalesce, const gchar *key, RmCoalesceFunc func, gpointer user_data)
+{
+	RmCoalesceFlight *flight;
+	gpointer result;
+
+	g_mutex_lock(&coalesce->mutex);
+
+	flight = g_hash_table_lookup(coalesce->flights, key);
+	if (flight) {
+		flight->ref_count++;
+
+		while (!flight->done) {
+			g_cond_wait(&flight->cond, &coalesce->mutex);
+		}
+
+		result = flight->result ? coalesce->copy_func(flight->result) : NULL;
+		rm_coalesce_flight_unref(coalesce, flight);
+
+		g_mutex_unlock(&coalesce->mutex);
+
+		g_debug("%s(): Shared result for '%s'", __FUNCTION__, key);
+
+		return result;
+	}
+
+	flight = g_slice_new0(RmCoalesceFlight);
+	flight->ref_count = 1;
+	g_cond_init(&flight->cond);
+	g_hash_table_insert(coalesce->flights, g_strdup(key), flight);
+
+	g_mutex_unlock(&coalesce->mutex);
+
+	result = func(key, user_data);
+
+	g_mutex_lock(&coalesce->mutex);
+
+	/* Keep a copy for waiting callers only, late callers start a new operation */
+	g_hash_table_remove(coalesce->flights, key);
+	if (flight->ref_count > 1 && result) {
+		flight->result = coalesce->copy_func(result);
+	}
+	flight->done = TRUE;
+	g_cond_broadcast(&flight->cond);
+	rm_coalesce_flight_unref(coalesce, flight);
+
+	g_mutex_unlock(&coalesce->mutex);
+
+	return result;
+}
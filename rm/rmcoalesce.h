@@ -0,0 +1,54 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RM_COALESCE_H__
+#define __RM_COALESCE_H__
+
+#if !defined (__RM_H_INSIDE__) && !defined(RM_COMPILATION)
+#error "Only <rm/rm.h> can be included directly."
+#endif
+
+#include <glib.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * RmCoalesce:
+ *
+ * The #RmCoalesce-struct contains only private fileds and should not be directly accessed.
+ */
+typedef struct _RmCoalesce RmCoalesce;
+
+/**
+ * RmCoalesceFunc:
+ * @key: key of operation
+ * @user_data: user data
+ *
+ * Returns: result of operation (owned by caller) or %NULL
+ */
+typedef gpointer (*RmCoalesceFunc)(const gchar *key, gpointer user_data);
+
+RmCoalesce *rm_coalesce_new(GBoxedCopyFunc copy_func, GDestroyNotify free_func);
+void rm_coalesce_free(RmCoalesce *coalesce);
+gpointer rm_coalesce_run(RmCoalesce *coalesce, const gchar *key, RmCoalesceFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif
@@ -17,8 +17,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 
 #include <glib.h>
 
@@ -194,21 +194,93 @@ RmContact *rm_contact_dup(RmContact *src)
 	return dst;
 }
 
+/**
+ * rm_contact_name_fold:
+ * @contact: a #RmContact
+ *
+ * Case-fold name of @contact, the base of all name comparisons.
+ *
+ * Returns: new case-folded name, "" for contacts without name
+ */
+static gchar *rm_contact_name_fold(RmContact *contact)
+{
+	return g_utf8_casefold(contact->name ? contact->name : "", -1);
+}
+
 /**
  * rm_contact_name_compare:
  * @a: pointer to first #RmContact
  * @b: pointer to second #RmContact
  *
- * Compares two contacts based on contacts name.
+ * Compares two contacts case insensitive by name, using the same order as rm_contact_sort_by_name().
  *
- * Returns: return values of #strcasecmp
+ * Returns: return values of #g_utf8_collate
  */
 gint rm_contact_name_compare(gconstpointer a, gconstpointer b)
 {
-	RmContact *contact_a = (RmContact*)a;
-	RmContact *contact_b = (RmContact*)b;
+	g_autofree gchar *folded_a = rm_contact_name_fold((RmContact*)a);
+	g_autofree gchar *folded_b = rm_contact_name_fold((RmContact*)b);
+
+	return g_utf8_collate(folded_a, folded_b);
+}
+
+/** Contact together with its precomputed collation key */
+typedef struct {
+	gchar *key;
+	RmContact *contact;
+} RmContactSortEntry;
+
+/**
+ * rm_contact_sort_entry_compare:
+ * @a: pointer to first #RmContactSortEntry
+ * @b: pointer to second #RmContactSortEntry
+ *
+ * Compares two sort entries by collation key.
+ *
+ * Returns: return values of #strcmp
+ */
+static int rm_contact_sort_entry_compare(const void *a, const void *b)
+{
+	const RmContactSortEntry *entry_a = a;
+	const RmContactSortEntry *entry_b = b;
+
+	return strcmp(entry_a->key, entry_b->key);
+}
+
+/**
+ * rm_contact_sort_by_name:
+ * @contacts: a #GPtrArray of #RmContact
+ *
+ * Sorts contacts case insensitive by name in the order of rm_contact_name_compare(), but computes
+ * the collation key of each name only once.
+ */
+void rm_contact_sort_by_name(GPtrArray *contacts)
+{
+	RmContactSortEntry *entries;
+	guint i;
+
+	if (!contacts || contacts->len < 2) {
+		return;
+	}
+
+	entries = g_new(RmContactSortEntry, contacts->len);
+
+	for (i = 0; i < contacts->len; i++) {
+		RmContact *contact = g_ptr_array_index(contacts, i);
+		g_autofree gchar *folded = rm_contact_name_fold(contact);
+
+		entries[i].key = g_utf8_collate_key(folded, -1);
+		entries[i].contact = contact;
+	}
+
+	qsort(entries, contacts->len, sizeof(RmContactSortEntry), rm_contact_sort_entry_compare);
+
+	for (i = 0; i < contacts->len; i++) {
+		contacts->pdata[i] = entries[i].contact;
+		g_free(entries[i].key);
+	}
 
-	return strcasecmp(contact_a->name, contact_b->name);
+	g_free(entries);
 }
 
 /**
@@ -85,6 +85,7 @@ G_DECLARE_FINAL_TYPE(RmContact, rm_contact, RM, CONTACT, GObject)
 void rm_contact_copy(RmContact *src, RmContact *dst);
 RmContact *rm_contact_dup(RmContact *src);
 gint rm_contact_name_compare(gconstpointer a, gconstpointer b);
+void rm_contact_sort_by_name(GPtrArray *contacts);
 RmContact *rm_contact_find_by_number(gchar *number);
 void rm_contact_free(RmContact *contact);
 void rm_contact_set_image_from_file(RmContact *contact, gchar *file);
@@ -0,0 +1,285 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <glib.h>
+
+#include <rm/rmexecutor.h>
+
+/**
+ * SECTION:rmexecutor
+ * @title: RmExecutor
+ * @short_description: Shared worker pool for background jobs
+ *
+ * Library wide worker pool. Jobs are queued into priority classes, each class runs on its own
+ * #GThreadPool with a fixed concurrency limit. A burst of calls therefore cannot spawn an
+ * unbounded number of threads and background work cannot starve interactive jobs.
+ *
+ * Streams lasting as long as a call or a playback (audio input, fax transfer, voice box playback)
+ * would block a worker for minutes, so they have a class of their own and the other classes are
+ * kept for short jobs.
+ */
+
+/** Concurrency limits of interactive, normal, background and stream class */
+static const guint rm_executor_max_threads[RM_EXECUTOR_PRIORITY_MAX] = { 8, 4, 2, 4 };
+
+struct _RmExecutorJob {
+	gint ref_count;
+	gchar *name;
+	RmExecutorPriority priority;
+	RmExecutorFunc func;
+	gpointer user_data;
+	gint64 queue_time;
+	gboolean done;
+};
+
+typedef struct {
+	GTask *task;
+	GTaskThreadFunc func;
+} RmExecutorTask;
+
+/** Protects pools, statistics and jobs */
+static GMutex rm_executor_mutex;
+/** Signalled whenever a job is done */
+static GCond rm_executor_cond;
+static GThreadPool *rm_executor_pools[RM_EXECUTOR_PRIORITY_MAX];
+static RmExecutorStats rm_executor_stats[RM_EXECUTOR_PRIORITY_MAX];
+
+/**
+ * rm_executor_job_unref:
+ * @job: a #RmExecutorJob
+ *
+ * Drop reference of @job, must be called with mutex held.
+ */
+static void rm_executor_job_unref(RmExecutorJob *job)
+{
+	if (--job->ref_count) {
+		return;
+	}
+
+	g_free(job->name);
+	g_slice_free(RmExecutorJob, job);
+}
+
+/**
+ * rm_executor_worker:
+ * @data: a #RmExecutorJob
+ * @user_data: unused
+ *
+ * Runs a job on a pool thread and updates the statistics of its class.
+ */
+static void rm_executor_worker(gpointer data, gpointer user_data)
+{
+	RmExecutorJob *job = data;
+	RmExecutorStats *stats = &rm_executor_stats[job->priority];
+	gint64 wait_time = g_get_monotonic_time() - job->queue_time;
+
+	g_mutex_lock(&rm_executor_mutex);
+	stats->queued--;
+	stats->running++;
+	stats->total_wait_time += wait_time;
+	stats->max_wait_time = MAX(stats->max_wait_time, wait_time);
+	g_mutex_unlock(&rm_executor_mutex);
+
+	job->func(job->user_data);
+
+	g_mutex_lock(&rm_executor_mutex);
+	stats->running--;
+	stats->completed++;
+	job->done = TRUE;
+	g_cond_broadcast(&rm_executor_cond);
+	rm_executor_job_unref(job);
+	g_mutex_unlock(&rm_executor_mutex);
+}
+
+/**
+ * rm_executor_submit:
+ * @priority: a #RmExecutorPriority
+ * @name: job name for debugging
+ * @func: job function
+ * @user_data: user data passed to @func
+ *
+ * Queues @func within the pool of @priority. The returned handle must be passed to
+ * rm_executor_job_wait(), use rm_executor_run() for jobs nobody waits for.
+ *
+ * Returns: a #RmExecutorJob
+ */
+RmExecutorJob *rm_executor_submit(RmExecutorPriority priority, const gchar *name, RmExecutorFunc func, gpointer user_data)
+{
+	RmExecutorStats *stats;
+	RmExecutorJob *job;
+
+	g_return_val_if_fail(priority < RM_EXECUTOR_PRIORITY_MAX, NULL);
+	g_return_val_if_fail(func != NULL, NULL);
+
+	job = g_slice_new0(RmExecutorJob);
+	/* One reference for the handle, one for the worker */
+	job->ref_count = 2;
+	job->name = g_strdup(name);
+	job->priority = priority;
+	job->func = func;
+	job->user_data = user_data;
+	job->queue_time = g_get_monotonic_time();
+
+	g_mutex_lock(&rm_executor_mutex);
+
+	if (!rm_executor_pools[priority]) {
+		/* Shared (non-exclusive) pools never fail to be created */
+		rm_executor_pools[priority] = g_thread_pool_new(rm_executor_worker, NULL, rm_executor_max_threads[priority], FALSE, NULL);
+	}
+
+	stats = &rm_executor_stats[priority];
+	stats->max_threads = rm_executor_max_threads[priority];
+	stats->queued++;
+	stats->max_queued = MAX(stats->max_queued, stats->queued);
+
+	if (stats->running >= stats->max_threads) {
+		g_debug("%s(): '%s' has to wait, %u job(s) queued", __FUNCTION__, name, stats->queued);
+	}
+
+	g_thread_pool_push(rm_executor_pools[priority], job, NULL);
+
+	g_mutex_unlock(&rm_executor_mutex);
+
+	return job;
+}
+
+/**
+ * rm_executor_run:
+ * @priority: a #RmExecutorPriority
+ * @name: job name for debugging
+ * @func: job function
+ * @user_data: user data passed to @func
+ *
+ * Queues @func within the pool of @priority, fire and forget.
+ */
+void rm_executor_run(RmExecutorPriority priority, const gchar *name, RmExecutorFunc func, gpointer user_data)
+{
+	RmExecutorJob *job = rm_executor_submit(priority, name, func, user_data);
+
+	if (!job) {
+		return;
+	}
+
+	g_mutex_lock(&rm_executor_mutex);
+	rm_executor_job_unref(job);
+	g_mutex_unlock(&rm_executor_mutex);
+}
+
+/**
+ * rm_executor_job_wait:
+ * @job: a #RmExecutorJob
+ *
+ * Blocks until @job is finished and releases the handle, similar to g_thread_join().
+ */
+void rm_executor_job_wait(RmExecutorJob *job)
+{
+	g_mutex_lock(&rm_executor_mutex);
+
+	while (!job->done) {
+		g_cond_wait(&rm_executor_cond, &rm_executor_mutex);
+	}
+
+	rm_executor_job_unref(job);
+
+	g_mutex_unlock(&rm_executor_mutex);
+}
+
+/**
+ * rm_executor_task_func:
+ * @data: a #RmExecutorTask
+ *
+ * Runs a #GTaskThreadFunc the way g_task_run_in_thread() would.
+ */
+static void rm_executor_task_func(gpointer data)
+{
+	RmExecutorTask *executor_task = data;
+	GTask *task = executor_task->task;
+
+	executor_task->func(task, g_task_get_source_object(task), g_task_get_task_data(task), g_task_get_cancellable(task));
+
+	g_object_unref(task);
+	g_slice_free(RmExecutorTask, executor_task);
+}
+
+/**
+ * rm_executor_run_task:
+ * @task: a #GTask
+ * @priority: a #RmExecutorPriority
+ * @func: a #GTaskThreadFunc
+ *
+ * Replacement for g_task_run_in_thread() which runs @func within the pool of @priority.
+ * The task is referenced until @func returns.
+ */
+void rm_executor_run_task(GTask *task, RmExecutorPriority priority, GTaskThreadFunc func)
+{
+	RmExecutorTask *executor_task = g_slice_new0(RmExecutorTask);
+
+	executor_task->task = g_object_ref(task);
+	executor_task->func = func;
+
+	rm_executor_run(priority, "task", rm_executor_task_func, executor_task);
+}
+
+/**
+ * rm_executor_get_stats:
+ * @priority: a #RmExecutorPriority
+ * @stats: a #RmExecutorStats to store metrics to
+ *
+ * Get queue metrics of priority class @priority.
+ *
+ * Returns: %TRUE on success, %FALSE on invalid priority
+ */
+gboolean rm_executor_get_stats(RmExecutorPriority priority, RmExecutorStats *stats)
+{
+	if (priority >= RM_EXECUTOR_PRIORITY_MAX || !stats) {
+		return FALSE;
+	}
+
+	g_mutex_lock(&rm_executor_mutex);
+	*stats = rm_executor_stats[priority];
+	stats->max_threads = rm_executor_max_threads[priority];
+	g_mutex_unlock(&rm_executor_mutex);
+
+	return TRUE;
+}
+
+/**
+ * rm_executor_shutdown:
+ *
+ * Finishes all queued jobs and frees the worker pools. Streams are stopped by their owners, so
+ * they are not waited for.
+ */
+void rm_executor_shutdown(void)
+{
+	gint priority;
+
+	for (priority = 0; priority < RM_EXECUTOR_PRIORITY_MAX; priority++) {
+		GThreadPool *pool;
+
+		g_mutex_lock(&rm_executor_mutex);
+		pool = rm_executor_pools[priority];
+		rm_executor_pools[priority] = NULL;
+		g_mutex_unlock(&rm_executor_mutex);
+
+		if (pool) {
+			/* Workers need the mutex, so wait outside of it */
+			g_thread_pool_free(pool, FALSE, priority != RM_EXECUTOR_PRIORITY_STREAM);
+		}
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RM_EXECUTOR_H__
+#define __RM_EXECUTOR_H__
+
+#if !defined (__RM_H_INSIDE__) && !defined(RM_COMPILATION)
+#error "Only <rm/rm.h> can be included directly."
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * RmExecutorPriority:
+ * @RM_EXECUTOR_PRIORITY_INTERACTIVE: short jobs the user is waiting for (e.g. caller lookup)
+ * @RM_EXECUTOR_PRIORITY_NORMAL: regular short jobs
+ * @RM_EXECUTOR_PRIORITY_BACKGROUND: jobs nobody is waiting for (e.g. incoming print jobs)
+ * @RM_EXECUTOR_PRIORITY_STREAM: streams lasting a whole call or playback (e.g. audio input, fax transfer)
+ * @RM_EXECUTOR_PRIORITY_MAX: number of priority classes
+ *
+ * Priority classes of the worker pool, each class has its own concurrency limit.
+ */
+typedef enum {
+	RM_EXECUTOR_PRIORITY_INTERACTIVE,
+	RM_EXECUTOR_PRIORITY_NORMAL,
+	RM_EXECUTOR_PRIORITY_BACKGROUND,
+	RM_EXECUTOR_PRIORITY_STREAM,
+	RM_EXECUTOR_PRIORITY_MAX
+} RmExecutorPriority;
+
+/**
+ * RmExecutorJob:
+ *
+ * The #RmExecutorJob-struct contains only private fileds and should not be directly accessed.
+ */
+typedef struct _RmExecutorJob RmExecutorJob;
+
+/**
+ * RmExecutorFunc:
+ * @user_data: user data
+ *
+ * Job function, runs on a worker thread.
+ */
+typedef void (*RmExecutorFunc)(gpointer user_data);
+
+/**
+ * RmExecutorStats:
+ * @max_threads: concurrency limit
+ * @queued: number of jobs waiting for a worker
+ * @running: number of jobs currently running
+ * @max_queued: highest number of waiting jobs seen
+ * @completed: number of finished jobs
+ * @total_wait_time: accumulated time jobs waited for a worker in microseconds
+ * @max_wait_time: longest time a job waited for a worker in microseconds
+ *
+ * Queue metrics of one priority class.
+ */
+typedef struct {
+	guint max_threads;
+	guint queued;
+	guint running;
+	guint max_queued;
+	guint completed;
+	gint64 total_wait_time;
+	gint64 max_wait_time;
+} RmExecutorStats;
+
+void rm_executor_run(RmExecutorPriority priority, const gchar *name, RmExecutorFunc func, gpointer user_data);
+RmExecutorJob *rm_executor_submit(RmExecutorPriority priority, const gchar *name, RmExecutorFunc func, gpointer user_data);
+void rm_executor_job_wait(RmExecutorJob *job);
+void rm_executor_run_task(GTask *task, RmExecutorPriority priority, GTaskThreadFunc func);
+gboolean rm_executor_get_stats(RmExecutorPriority priority, RmExecutorStats *stats);
+void rm_executor_shutdown(void);
+
+G_END_DECLS
+
+#endif
@@ -30,6 +30,7 @@
 #include <rmobjectemit.h>
 #include <rmfaxserver.h>
 #include <rmmain.h>
+#include <rmexecutor.h>
 
 /**
  * SECTION:rmfaxserver
@@ -42,6 +43,8 @@
  */
 
 #define BUFFER_LENGTH 1024
+/** Seconds a print client may stay silent before its job is dropped */
+#define RECEIVE_TIMEOUT 30
 
 static GMainContext *main_context = NULL;
 
@@ -64,65 +67,95 @@ void rm_faxserver_emit_fax_process (char *file)
 }
 
 /**
- * rm_faxserver_thread:
- * @data: a #GSocket
+ * rm_faxserver_receive:
+ * @data: an accepted #GSocket
  *
- * Server thread which accepts new data as fax files
- *
- * Returns: %NULL
+ * Worker job which receives one print job and stores it as fax file
  */
-gpointer rm_faxserver_thread(gpointer data)
+static void rm_faxserver_receive(gpointer data)
 {
-	GSocket *server = data;
-	GSocket *sock;
+	GSocket *sock = data;
 	GError *error = NULL;
-	gsize len;
+	gssize len;
 	g_autofree char *file_name = NULL;
 	char buffer[BUFFER_LENGTH];
 	ssize_t write_result;
 	ssize_t written;
+	int file_id;
+
+	file_name = g_build_filename(rm_get_user_cache_dir(), "fax-XXXXXX", NULL);
+	file_id = g_mkstemp(file_name);
+
+	if (file_id == -1) {
+		g_warning("%s(): Can't open temporary file '%s'", __FUNCTION__, file_name);
+		g_socket_close(sock, NULL);
+		g_object_unref(sock);
+		return;
+	}
 
-	while (TRUE) {
-		sock = g_socket_accept(server, NULL, &error);
-		g_assert_no_error(error);
+	g_debug("%s(): file: %s (%d)", __FUNCTION__, file_name, file_id);
 
-		file_name = g_build_filename(rm_get_user_cache_dir(), "fax-XXXXXX", NULL);
-		int file_id = g_mkstemp(file_name);
+	do {
+		len = g_socket_receive(sock, buffer, BUFFER_LENGTH, NULL, &error);
 
-		if (file_id == -1) {
-			g_warning("%s(): Can't open temporary file '%s'", __FUNCTION__, file_name);
-			g_free(file_name);
-			continue;
+		if (len > 0) {
+			written = 0;
+			do {
+				write_result = write(file_id, buffer + written, len - written);
+				if (write_result > 0) {
+					written += write_result;
+				}
+			} while (len != written && (write_result != -1 || errno == EINTR));
 		}
+	} while (len > 0);
 
-		g_debug("%s(): file: %s (%d)", __FUNCTION__, file_name, file_id);
+	g_close(file_id, NULL);
 
-		do {
-			len = g_socket_receive(sock, buffer, BUFFER_LENGTH, NULL, &error);
+	if (len == 0) {
+		g_debug("%s(): Print job received on socket (%s)", __FUNCTION__, file_name);
 
-			if (len > 0) {
-				written = 0;
-				do {
-					write_result = write(file_id, buffer + written, len);
-					if (write_result > 0) {
-						written += write_result;
-					}
-				} while (len != written && (write_result != -1 || errno == EINTR));
-			}
-		} while (len > 0);
+		rm_faxserver_emit_fax_process(file_name);
+	} else {
+		g_warning("%s(): %s", __FUNCTION__, error ? error->message : "receive failed");
+		g_clear_error(&error);
+		g_unlink(file_name);
+	}
 
-		if (len == 0) {
-			g_close(file_id, &error);
-			g_debug("%s(): Print job received on socket (%s)", __FUNCTION__, file_name);
+	g_socket_close(sock, NULL);
+	g_object_unref(sock);
+}
 
-			rm_faxserver_emit_fax_process (g_steal_pointer (&file_name));
+/**
+ * rm_faxserver_accept_cb:
+ * @server: listening #GSocket
+ * @condition: a #GIOCondition
+ * @user_data: unused
+ *
+ * Accepts new connections within the main loop and hands them to the worker pool
+ *
+ * Returns: %G_SOURCE_CONTINUE
+ */
+static gboolean rm_faxserver_accept_cb(GSocket *server, GIOCondition condition, gpointer user_data)
+{
+	GSocket *sock;
+	GError *error = NULL;
+
+	sock = g_socket_accept(server, NULL, &error);
+	if (!sock) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+			g_warning("%s(): %s", __FUNCTION__, error->message);
 		}
+		g_error_free(error);
 
-		g_socket_close(sock, &error);
-		g_assert_no_error(error);
+		return G_SOURCE_CONTINUE;
 	}
 
-	return NULL;
+	/* Accepted sockets are blocking, but a stalled client must not keep a worker (and shutdown) forever */
+	g_socket_set_blocking(sock, TRUE);
+	g_socket_set_timeout(sock, RECEIVE_TIMEOUT);
+	rm_executor_run(RM_EXECUTOR_PRIORITY_BACKGROUND, "faxserver", rm_faxserver_receive, sock);
+
+	return G_SOURCE_CONTINUE;
 }
 
 /**
@@ -138,6 +171,7 @@ gboolean rm_faxserver_init(void)
 	GInetAddress *inet_address = NULL;
 	GSocketAddress *sock_address = NULL;
 	GError *fax_error = NULL;
+	GSource *source;
 
 	socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, &fax_error);
 	if (socket == NULL) {
@@ -172,7 +206,13 @@ gboolean rm_faxserver_init(void)
 	g_debug("%s(): Fax Server running on port 9100", __FUNCTION__);
 
 	main_context = g_main_context_default ();
-	g_thread_new("printserver", rm_faxserver_thread, socket);
+
+	/* No listener thread, connections are accepted within the main loop */
+	g_socket_set_blocking(socket, FALSE);
+	source = g_socket_create_source(socket, G_IO_IN, NULL);
+	g_source_set_callback(source, (GSourceFunc)rm_faxserver_accept_cb, socket, g_object_unref);
+	g_source_attach(source, main_context);
+	g_source_unref(source);
 
 	return TRUE;
 }
@@ -17,16 +17,15 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-/**
- * TODO:
- *  - Asynchronous lookup
- */
-
 #include <string.h>
 
 #include <glib.h>
 
 #include <rm/rmlookup.h>
+#include <rm/rmcoalesce.h>
+#include <rm/rmexecutor.h>
+#include <rm/rmaddressbook.h>
+#include <rm/rmstring.h>
 
 /**
  * SECTION:rmlookup
@@ -39,6 +38,8 @@
 
 /** Lookup function list */
 static GSList *rm_lookup_plugins = NULL;
+/** In-flight lookups, concurrent lookups of one number share a single search */
+static RmCoalesce *rm_lookup_coalesce = NULL;
 
 /**
  * rm_lookup_get:
@@ -68,23 +69,204 @@ RmLookup *rm_lookup_get(gchar *name)
 	return NULL;
 }
 
+/**
+ * rm_lookup_contact_free:
+ * @data: a #RmContact
+ *
+ * Free contact and its data.
+ */
+static void rm_lookup_contact_free(gpointer data)
+{
+	rm_contact_free(data);
+	g_slice_free(RmContact, data);
+}
+
+/**
+ * rm_lookup_search_plugins:
+ * @number: number to lookup
+ * @user_data: unused
+ *
+ * Ask all registered lookup plugins until one finds the number.
+ *
+ * Returns: a new #RmContact, or %NULL if number has not been found
+ */
+static gpointer rm_lookup_search_plugins(const gchar *number, gpointer user_data)
+{
+	RmContact *contact = g_slice_new0(RmContact);
+	GSList *list;
+
+	for (list = rm_lookup_plugins; list != NULL; list = list->next) {
+		RmLookup *lookup = list->data;
+
+		if (lookup->search((gchar*)number, contact)) {
+			return contact;
+		}
+	}
+
+	rm_lookup_contact_free(contact);
+
+	return NULL;
+}
+
 /**
  * rm_lookup_search:
  * @number: number to lookup
  * @contact: a #RmContact to store data to
  *
- * Lookup number and return name/address/zip/city
+ * Lookup number and return name/address/zip/city. Concurrent lookups of the same number are
+ * coalesced into a single search.
  *
  * Returns: %TRUE is lookup data has been found, otherwise %FALSE
  */
 gboolean rm_lookup_search(gchar *number, RmContact *contact)
+{
+	RmContact *result;
+
+	if (!number) {
+		return FALSE;
+	}
+
+	if (g_once_init_enter(&rm_lookup_coalesce)) {
+		g_once_init_leave(&rm_lookup_coalesce, rm_coalesce_new((GBoxedCopyFunc)rm_contact_dup, rm_lookup_contact_free));
+	}
+
+	result = rm_coalesce_run(rm_lookup_coalesce, number, rm_lookup_search_plugins, NULL);
+	if (!result) {
+		return FALSE;
+	}
+
+	contact->name = g_steal_pointer(&result->name);
+	contact->street = g_steal_pointer(&result->street);
+	contact->zip = g_steal_pointer(&result->zip);
+	contact->city = g_steal_pointer(&result->city);
+
+	rm_lookup_contact_free(result);
+
+	return TRUE;
+}
+
+/**
+ * RmLookupSearchData:
+ * @number: number to lookup
+ * @partial_func: function called for partial results or %NULL
+ * @partial_data: user data for @partial_func
+ * @city: city of the area code as known by the caller, or %NULL
+ *
+ * Task data of rm_lookup_search_async().
+ */
+typedef struct {
+	gchar *number;
+	RmLookupPartialFunc partial_func;
+	gpointer partial_data;
+	gchar *city;
+} RmLookupSearchData;
+
+/**
+ * RmLookupPartial:
+ * @task: the #GTask of the search
+ * @tier: tier which produced @contact
+ * @contact: copy of the result so far
+ *
+ * Partial result on its way to the caller's main context.
+ */
+typedef struct {
+	GTask *task;
+	RmLookupTier tier;
+	RmContact *contact;
+} RmLookupPartial;
+
+/**
+ * rm_lookup_search_data_free:
+ * @data: a #RmLookupSearchData
+ *
+ * Frees task data of rm_lookup_search_async().
+ */
+static void rm_lookup_search_data_free(gpointer data)
+{
+	RmLookupSearchData *search_data = data;
+
+	g_free(search_data->number);
+	g_free(search_data->city);
+	g_slice_free(RmLookupSearchData, search_data);
+}
+
+/**
+ * rm_lookup_partial_free:
+ * @data: a #RmLookupPartial
+ *
+ * Frees a partial result.
+ */
+static void rm_lookup_partial_free(gpointer data)
+{
+	RmLookupPartial *partial = data;
+
+	rm_lookup_contact_free(partial->contact);
+	g_object_unref(partial->task);
+	g_slice_free(RmLookupPartial, partial);
+}
+
+/**
+ * rm_lookup_partial_dispatch:
+ * @data: a #RmLookupPartial
+ *
+ * Hands a partial result to the caller unless the search has been cancelled meanwhile.
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean rm_lookup_partial_dispatch(gpointer data)
+{
+	RmLookupPartial *partial = data;
+	RmLookupSearchData *search_data = g_task_get_task_data(partial->task);
+
+	if (!g_cancellable_is_cancelled(g_task_get_cancellable(partial->task))) {
+		search_data->partial_func(partial->tier, partial->contact, search_data->partial_data);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * rm_lookup_search_report:
+ * @task: a #GTask
+ * @tier: tier which produced @contact
+ * @contact: result so far
+ *
+ * Queues a copy of @contact for the partial result function of @task.
+ */
+static void rm_lookup_search_report(GTask *task, RmLookupTier tier, RmContact *contact)
+{
+	RmLookupSearchData *search_data = g_task_get_task_data(task);
+	RmLookupPartial *partial;
+
+	if (!search_data->partial_func) {
+		return;
+	}
+
+	partial = g_slice_new0(RmLookupPartial);
+	partial->task = g_object_ref(task);
+	partial->tier = tier;
+	partial->contact = rm_contact_dup(contact);
+
+	g_main_context_invoke_full(g_task_get_context(task), G_PRIORITY_DEFAULT, rm_lookup_partial_dispatch, partial, rm_lookup_partial_free);
+}
+
+/**
+ * rm_lookup_search_cached:
+ * @number: number to lookup
+ * @contact: a #RmContact to store data to
+ *
+ * Ask the lookup plugins for previous results, without touching the network.
+ *
+ * Returns: %TRUE if a plugin knows @number, @contact has a name if it has been found
+ */
+static gboolean rm_lookup_search_cached(gchar *number, RmContact *contact)
 {
 	GSList *list;
 
 	for (list = rm_lookup_plugins; list != NULL; list = list->next) {
 		RmLookup *lookup = list->data;
 
-		if (lookup->search(number, contact)) {
+		if (lookup->search_cached && lookup->search_cached(number, contact)) {
 			return TRUE;
 		}
 	}
@@ -92,6 +274,182 @@ gboolean rm_lookup_search(gchar *number, RmContact *contact)
 	return FALSE;
 }
 
+/**
+ * rm_lookup_search_thread:
+ * @task: a #GTask
+ * @source_object: unused
+ * @task_data: a #RmLookupSearchData
+ * @cancellable: a #GCancellable
+ *
+ * Resolves number tier by tier: cache, address books, area code, online services.
+ */
+static void rm_lookup_search_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	RmLookupSearchData *search_data = task_data;
+	RmContact *contact = g_slice_new0(RmContact);
+	RmContact *result;
+	RmContact online = {0};
+
+	/* Cached online results are as good as a fresh online lookup */
+	if (rm_lookup_search_cached(search_data->number, contact)) {
+		if (!RM_EMPTY_STRING(contact->name)) {
+			rm_lookup_search_report(task, RM_LOOKUP_TIER_CACHE, contact);
+			goto done;
+		}
+
+		/* Known as not found, area code is still of interest */
+		g_clear_pointer(&contact->city, g_free);
+	}
+
+	if (g_task_return_error_if_cancelled(task)) {
+		rm_lookup_contact_free(contact);
+		return;
+	}
+
+	/* Local address books */
+	result = rm_addressbook_resolve(search_data->number);
+	if (result) {
+		rm_lookup_contact_free(contact);
+		contact = result;
+
+		rm_lookup_search_report(task, RM_LOOKUP_TIER_ADDRESSBOOK, contact);
+		goto done;
+	}
+
+	if (g_task_return_error_if_cancelled(task)) {
+		rm_lookup_contact_free(contact);
+		return;
+	}
+
+	/* Area code, already resolved by the caller */
+	if (search_data->city) {
+		contact->city = g_strdup(search_data->city);
+		rm_lookup_search_report(task, RM_LOOKUP_TIER_AREACODE, contact);
+	}
+
+	if (g_task_return_error_if_cancelled(task)) {
+		rm_lookup_contact_free(contact);
+		return;
+	}
+
+	/* Online services */
+	if (rm_lookup_search(search_data->number, &online)) {
+		g_free(contact->name);
+		contact->name = g_steal_pointer(&online.name);
+		contact->street = g_steal_pointer(&online.street);
+		contact->zip = g_steal_pointer(&online.zip);
+
+		if (!RM_EMPTY_STRING(online.city)) {
+			g_free(contact->city);
+			contact->city = g_steal_pointer(&online.city);
+		}
+
+		rm_lookup_search_report(task, RM_LOOKUP_TIER_ONLINE, contact);
+	}
+	rm_contact_free(&online);
+
+done:
+	if (RM_EMPTY_STRING(contact->name) && RM_EMPTY_STRING(contact->city)) {
+		rm_lookup_contact_free(contact);
+		g_task_return_pointer(task, NULL, NULL);
+		return;
+	}
+
+	g_free(contact->number);
+	contact->number = g_strdup(search_data->number);
+
+	g_task_return_pointer(task, contact, rm_lookup_contact_free);
+}
+
+/**
+ * rm_lookup_search_async:
+ * @number: number to lookup
+ * @city: city of the area code of @number or %NULL
+ * @cancellable: a #GCancellable or %NULL
+ * @partial_func: function called as soon as a tier has provided data, or %NULL
+ * @partial_data: user data for @partial_func
+ * @callback: a #GAsyncReadyCallback called once the lookup is complete
+ * @user_data: user data for @callback
+ *
+ * Asynchronously lookup number on the shared worker pool. Tiers are asked from cheapest to most expensive (see
+ * #RmLookupTier) and @partial_func reports each result on the way, e.g. to show the city at once
+ * and the name once the online services answered. Area code plugins are not thread safe, so the
+ * area code tier just reports @city as resolved by the caller (e.g. by rm_contact_find_by_number()).
+ * Complete with rm_lookup_search_finish().
+ */
+void rm_lookup_search_async(const gchar *number, const gchar *city, GCancellable *cancellable, RmLookupPartialFunc partial_func, gpointer partial_data, GAsyncReadyCallback callback, gpointer user_data)
+{
+	RmLookupSearchData *search_data;
+	GTask *task;
+
+	task = g_task_new(NULL, cancellable, callback, user_data);
+	g_task_set_source_tag(task, rm_lookup_search_async);
+
+	if (RM_EMPTY_STRING(number)) {
+		g_task_return_pointer(task, NULL, NULL);
+		g_object_unref(task);
+		return;
+	}
+
+	search_data = g_slice_new0(RmLookupSearchData);
+	search_data->number = g_strdup(number);
+	search_data->partial_func = partial_func;
+	search_data->partial_data = partial_data;
+
+	search_data->city = RM_EMPTY_STRING(city) ? NULL : g_strdup(city);
+
+	g_task_set_task_data(task, search_data, rm_lookup_search_data_free);
+	/* Callers wait for the result to show it, e.g. within a call notification */
+	rm_executor_run_task(task, RM_EXECUTOR_PRIORITY_INTERACTIVE, rm_lookup_search_thread);
+	g_object_unref(task);
+}
+
+/**
+ * rm_lookup_search_finish:
+ * @result: a #GAsyncResult
+ * @error: a #GError or %NULL
+ *
+ * Finishes rm_lookup_search_async().
+ *
+ * Returns: a new #RmContact with name/address/zip/city (free with rm_contact_free() and g_slice_free()),
+ * or %NULL if nothing has been found or on error
+ */
+RmContact *rm_lookup_search_finish(GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/**
+ * rm_lookup_get_stats:
+ * @lookup: a #RmLookup
+ *
+ * Get health of the services used by @lookup.
+ *
+ * Returns: list of #RmLookupStats, free with g_list_free_full() and rm_lookup_stats_free()
+ */
+GList *rm_lookup_get_stats(RmLookup *lookup)
+{
+	if (!lookup || !lookup->get_stats) {
+		return NULL;
+	}
+
+	return lookup->get_stats();
+}
+
+/**
+ * rm_lookup_stats_free:
+ * @stats: a #RmLookupStats
+ *
+ * Frees a #RmLookupStats.
+ */
+void rm_lookup_stats_free(RmLookupStats *stats)
+{
+	g_free(stats->service);
+	g_slice_free(RmLookupStats, stats);
+}
+
 /**
  * rm_lookup_register:
  * @lookup: a #RmLookup
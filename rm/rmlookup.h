@@ -24,6 +24,8 @@
 #error "Only <rm/rm.h> can be included directly."
 #endif
 
+#include <gio/gio.h>
+
 #include <rm/rmcontact.h>
 
 G_BEGIN_DECLS
@@ -37,10 +39,67 @@ typedef struct {
 	/*< private >*/
 	gchar *name;
 	gboolean (*search)(gchar *number, RmContact *contact);
+	/* Optional: per service health, list of new #RmLookupStats */
+	GList *(*get_stats)(void);
+	/* Optional: non-blocking lookup of previous results, %TRUE if @number is known (found or not) */
+	gboolean (*search_cached)(gchar *number, RmContact *contact);
 } RmLookup;
 
+/**
+ * RmLookupTier:
+ * @RM_LOOKUP_TIER_CACHE: cached results of online services
+ * @RM_LOOKUP_TIER_ADDRESSBOOK: address books of the active profile
+ * @RM_LOOKUP_TIER_AREACODE: area code, provides the city only
+ * @RM_LOOKUP_TIER_ONLINE: online lookup services
+ *
+ * Sources asked by rm_lookup_search_async(), in order.
+ */
+typedef enum {
+	RM_LOOKUP_TIER_CACHE,
+	RM_LOOKUP_TIER_ADDRESSBOOK,
+	RM_LOOKUP_TIER_AREACODE,
+	RM_LOOKUP_TIER_ONLINE
+} RmLookupTier;
+
+/**
+ * RmLookupPartialFunc:
+ * @tier: the #RmLookupTier which produced @contact
+ * @contact: result found so far, only valid during the call
+ * @user_data: user data
+ *
+ * Called within the thread-default main context of the caller of rm_lookup_search_async()
+ * each time a tier provided data.
+ */
+typedef void (*RmLookupPartialFunc)(RmLookupTier tier, RmContact *contact, gpointer user_data);
+
+/**
+ * RmLookupStats:
+ * @service: service name
+ * @requests: number of requests sent
+ * @failures: number of failed requests (errors, timeouts, non-200 responses)
+ * @rejected: number of requests skipped due to rate limit or open circuit breaker
+ * @total_time: accumulated response time in microseconds
+ * @max_time: slowest response in microseconds
+ * @available: whether service currently accepts requests
+ *
+ * Health of a lookup service.
+ */
+typedef struct {
+	gchar *service;
+	guint requests;
+	guint failures;
+	guint rejected;
+	gint64 total_time;
+	gint64 max_time;
+	gboolean available;
+} RmLookupStats;
+
 RmLookup *rm_lookup_get(gchar *name);
 gboolean rm_lookup_search(gchar *number, RmContact *contact);
+void rm_lookup_search_async(const gchar *number, const gchar *city, GCancellable *cancellable, RmLookupPartialFunc partial_func, gpointer partial_data, GAsyncReadyCallback callback, gpointer user_data);
+RmContact *rm_lookup_search_finish(GAsyncResult *result, GError **error);
+GList *rm_lookup_get_stats(RmLookup *lookup);
+void rm_lookup_stats_free(RmLookupStats *stats);
 gboolean rm_lookup_register(RmLookup *lookup);
 gboolean rm_lookup_unregister(RmLookup *lookup);
 
@@ -38,6 +38,7 @@
 #include <rm/rmphone.h>
 #include <rm/rmfaxserver.h>
 #include <rm/rmaction.h>
+#include <rm/rmexecutor.h>
 #include <rm/rmpassword.h>
 #include <rm/rmlog.h>
 
@@ -350,6 +351,7 @@ gboolean rm_init(GError **error)
  * - Profile
  * - Router
  * - Plugins
+ * - Worker pool
  * - Network
  * - AppObject
  * - Log
@@ -371,6 +373,9 @@ void rm_shutdown(void)
 	/* Shutdown plugins */
 	rm_plugins_shutdown();
 
+	/* Finish pending jobs */
+	rm_executor_shutdown();
+
 	/* Shutdown network */
 	rm_network_shutdown();
 
@@ -57,9 +57,45 @@
  */
 SoupSession *rm_soup_session = NULL;
 
-static gchar *auth_header = NULL;
+/** Parallel connections to the router, allows several TR-064 actions in flight */
+#define RM_NETWORK_MAX_CONNS_PER_HOST 6
+
+/** Nonces older than this are refreshed by a new challenge instead of risking a rejected request */
+#define RM_NETWORK_TR64_NONCE_LIFETIME (60 * G_USEC_PER_SEC)
+
+/** Attempts of a rejected authenticated action, repeated while the shared nonce keeps changing */
+#define RM_NETWORK_TR64_MAX_ATTEMPTS 3
+
+/**
+ * RmNetworkTr64Auth:
+ *
+ * Digest state of the last authenticated TR-064 exchange.
+ */
+typedef struct {
+	gchar *host;
+	gchar *user;
+	gchar *nonce;
+	gchar *realm;
+	/* Monotonic time the nonce has been received */
+	gint64 time;
+} RmNetworkTr64Auth;
+
+static RmNetworkTr64Auth tr64_auth;
+static GMutex tr64_auth_mutex;
 static gint tr64_security_port = 0;
 
+/**
+ * rm_network_tr64_error_quark:
+ *
+ * TR-064 SOAP fault error quark.
+ *
+ * Returns: error quark
+ */
+GQuark rm_network_tr64_error_quark(void)
+{
+	return g_quark_from_static_string("rm-network-tr64-error-quark");
+}
+
 /**
  * md5_simple:
  * @input: input string
@@ -107,171 +143,806 @@ static gchar *rm_network_tr64_create_response(gchar *nonce, gchar *realm, gchar
 }
 
 /**
- * rm_network_tr64_request:
+ * rm_network_tr64_auth_clear:
+ *
+ * Forget current nonce, must be called with tr64_auth_mutex held.
+ */
+static void rm_network_tr64_auth_clear(void)
+{
+	g_clear_pointer(&tr64_auth.host, g_free);
+	g_clear_pointer(&tr64_auth.user, g_free);
+	g_clear_pointer(&tr64_auth.nonce, g_free);
+	g_clear_pointer(&tr64_auth.realm, g_free);
+	tr64_auth.time = 0;
+}
+
+/**
+ * rm_network_tr64_auth_header:
+ * @profile: a #RmProfile
+ * @host: router host
+ * @user: router user
+ * @used_nonce: location to store the nonce of the header (%NULL for a challenge request)
+ *
+ * Create SOAP authentication header. The last nonce is reused as long as it is fresh, otherwise a
+ * new challenge is requested.
+ *
+ * Returns: ClientAuth header for a known nonce, InitChallenge header otherwise
+ */
+static gchar *rm_network_tr64_auth_header(RmProfile *profile, const gchar *host, const gchar *user, gchar **used_nonce)
+{
+	g_autofree gchar *nonce = NULL;
+	g_autofree gchar *realm = NULL;
+	g_autofree gchar *password = NULL;
+	g_autofree gchar *response = NULL;
+
+	g_mutex_lock(&tr64_auth_mutex);
+	if (tr64_auth.nonce && !g_strcmp0(tr64_auth.host, host) && !g_strcmp0(tr64_auth.user, user) &&
+	    g_get_monotonic_time() - tr64_auth.time < RM_NETWORK_TR64_NONCE_LIFETIME) {
+		nonce = g_strdup(tr64_auth.nonce);
+		realm = g_strdup(tr64_auth.realm);
+	}
+	g_mutex_unlock(&tr64_auth_mutex);
+
+	g_free(*used_nonce);
+	*used_nonce = g_strdup(nonce);
+
+	if (!nonce) {
+		return g_markup_printf_escaped(SOUP_MSG_HEADER_START
+		                              "<h:InitChallenge xmlns:h='http://soap-authentication.org/digest/2001/10/' s:mustUnderstand='1'>"
+		                              "<UserID>%s</UserID>"
+		                              "</h:InitChallenge>"
+		                              SOUP_MSG_HEADER_END,
+		                              user);
+	}
+
+	password = rm_router_get_login_password(profile);
+	response = rm_network_tr64_create_response(nonce, realm, (gchar*)user, password);
+
+	return g_markup_printf_escaped(SOUP_MSG_HEADER_START
+	                              "<h:ClientAuth xmlns:h='http://soap-authentication.org/digest/2001/10/' s:mustUnderstand='1'>"
+	                              "<Nonce>%s</Nonce>"
+	                              "<Auth>%s</Auth>"
+	                              "<UserID>%s</UserID>"
+	                              "<Realm>%s</Realm>"
+	                              "</h:ClientAuth>"
+	                              SOUP_MSG_HEADER_END,
+	                              nonce, response, user, realm);
+}
+
+/**
+ * rm_network_tr64_auth_update:
+ * @msg: a #SoupMessage
+ * @host: router host
+ * @user: router user
+ *
+ * Store the challenge of a response: a NextChallenge on success or a new Challenge in case the
+ * nonce was missing or stale.
+ *
+ * Returns: %TRUE if response contained a new nonce
+ */
+static gboolean rm_network_tr64_auth_update(SoupMessage *msg, const gchar *host, const gchar *user)
+{
+	gchar *nonce;
+	gchar *realm;
+
+	if (!msg->response_body->data) {
+		return FALSE;
+	}
+
+	nonce = rm_utils_xml_extract_tag(msg->response_body->data, "Nonce");
+	realm = rm_utils_xml_extract_tag(msg->response_body->data, "Realm");
+	if (RM_EMPTY_STRING(nonce) || RM_EMPTY_STRING(realm)) {
+		g_free(nonce);
+		g_free(realm);
+		return FALSE;
+	}
+
+	g_mutex_lock(&tr64_auth_mutex);
+	rm_network_tr64_auth_clear();
+	tr64_auth.host = g_strdup(host);
+	tr64_auth.user = g_strdup(user);
+	tr64_auth.nonce = nonce;
+	tr64_auth.realm = realm;
+	tr64_auth.time = g_get_monotonic_time();
+	g_mutex_unlock(&tr64_auth_mutex);
+
+	return TRUE;
+}
+
+/**
+ * rm_network_tr64_auth_changed:
+ * @nonce: nonce used by a rejected attempt or %NULL
+ *
+ * Checks whether a concurrent request has stored a different nonce since @nonce has been used.
+ *
+ * Returns: %TRUE if shared nonce differs from @nonce
+ */
+static gboolean rm_network_tr64_auth_changed(const gchar *nonce)
+{
+	gboolean changed;
+
+	g_mutex_lock(&tr64_auth_mutex);
+	changed = g_strcmp0(tr64_auth.nonce, nonce) != 0;
+	g_mutex_unlock(&tr64_auth_mutex);
+
+	return changed;
+}
+
+/**
+ * rm_network_tr64_auth_reject:
+ * @nonce: nonce used by a rejected attempt
+ *
+ * Forget shared nonce, but only if it is still @nonce. A fresh nonce another request has received
+ * in the meantime is kept.
+ */
+static void rm_network_tr64_auth_reject(const gchar *nonce)
+{
+	g_mutex_lock(&tr64_auth_mutex);
+	if (nonce && !g_strcmp0(tr64_auth.nonce, nonce)) {
+		rm_network_tr64_auth_clear();
+	}
+	g_mutex_unlock(&tr64_auth_mutex);
+}
+
+/**
+ * RmNetworkTr64Template:
+ *
+ * Precompiled soap body of one action: static text parts with argument slots in between.
+ * Templates are created on first use and stay valid until rm_network_shutdown().
+ */
+typedef struct {
+	/* SoapAction header value */
+	gchar *soap_action;
+	/* n_args + 1 static parts, parts[i] precedes argument slot i */
+	gchar **parts;
+	guint n_args;
+	/* Length of all static parts, used to preallocate rendering buffers */
+	gsize static_len;
+} RmNetworkTr64Template;
+
+/** Compiled templates keyed by service, action and argument names */
+static GHashTable *tr64_templates = NULL;
+static GMutex tr64_templates_mutex;
+
+/**
+ * rm_network_tr64_template_free:
+ * @data: a #RmNetworkTr64Template
+ *
+ * Frees a template.
+ */
+static void rm_network_tr64_template_free(gpointer data)
+{
+	RmNetworkTr64Template *template = data;
+
+	g_free(template->soap_action);
+	g_strfreev(template->parts);
+	g_slice_free(RmNetworkTr64Template, template);
+}
+
+/**
+ * rm_network_tr64_template_compile:
+ * @service: soap service
+ * @action: soap action
+ * @names: argument names
+ *
+ * Compile soap body of @action with an argument slot for each of @names.
+ *
+ * Returns: a new #RmNetworkTr64Template
+ */
+static RmNetworkTr64Template *rm_network_tr64_template_compile(const gchar *service, const gchar *action, GPtrArray *names)
+{
+	RmNetworkTr64Template *template = g_slice_new0(RmNetworkTr64Template);
+	GString *part = g_string_new(NULL);
+	guint i;
+
+	template->soap_action = g_strdup_printf("%s#%s", service, action);
+	template->n_args = names->len;
+	template->parts = g_new0(gchar*, names->len + 2);
+
+	g_string_printf(part, SOUP_MSG_BODY_START "<u:%s xmlns:u='%s'>", action, service);
+	for (i = 0; i < names->len; i++) {
+		const gchar *name = g_ptr_array_index(names, i);
+
+		g_string_append_printf(part, "<%s>", name);
+		template->static_len += part->len;
+		template->parts[i] = g_strdup(part->str);
+		g_string_printf(part, "</%s>", name);
+	}
+	g_string_append_printf(part, "</u:%s>" SOUP_MSG_BODY_END SOUP_MSG_END, action);
+	template->static_len += part->len;
+	template->parts[i] = g_string_free(part, FALSE);
+
+	return template;
+}
+
+/**
+ * rm_network_tr64_template_get:
+ * @service: soap service
+ * @action: soap action
+ * @names: argument names
+ *
+ * Lookup compiled template, compile it on first use.
+ *
+ * Returns: a #RmNetworkTr64Template owned by the template cache
+ */
+static RmNetworkTr64Template *rm_network_tr64_template_get(const gchar *service, const gchar *action, GPtrArray *names)
+{
+	RmNetworkTr64Template *template;
+	GString *key = g_string_new(service);
+	guint i;
+
+	g_string_append_c(key, '#');
+	g_string_append(key, action);
+	for (i = 0; i < names->len; i++) {
+		g_string_append_c(key, '#');
+		g_string_append(key, g_ptr_array_index(names, i));
+	}
+
+	g_mutex_lock(&tr64_templates_mutex);
+
+	if (!tr64_templates) {
+		tr64_templates = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, rm_network_tr64_template_free);
+	}
+
+	template = g_hash_table_lookup(tr64_templates, key->str);
+	if (!template) {
+		template = rm_network_tr64_template_compile(service, action, names);
+		g_hash_table_insert(tr64_templates, g_string_free(key, FALSE), template);
+	} else {
+		g_string_free(key, TRUE);
+	}
+
+	g_mutex_unlock(&tr64_templates_mutex);
+
+	return template;
+}
+
+/**
+ * rm_network_xml_escape_append:
+ * @string: a #GString
+ * @text: text to append
+ *
+ * Append @text to @string with XML special characters replaced by entities.
+ */
+static void rm_network_xml_escape_append(GString *string, const gchar *text)
+{
+	const gchar *start = text;
+	const gchar *ptr;
+
+	for (ptr = text; *ptr; ptr++) {
+		const gchar *entity;
+
+		switch (*ptr) {
+		case '&':
+			entity = "&amp;";
+			break;
+		case '<':
+			entity = "&lt;";
+			break;
+		case '>':
+			entity = "&gt;";
+			break;
+		case '"':
+			entity = "&quot;";
+			break;
+		case '\'':
+			entity = "&apos;";
+			break;
+		default:
+			continue;
+		}
+
+		g_string_append_len(string, start, ptr - start);
+		g_string_append(string, entity);
+		start = ptr + 1;
+	}
+
+	g_string_append_len(string, start, ptr - start);
+}
+
+/**
+ * rm_network_tr64_template_render:
+ * @template: a #RmNetworkTr64Template
+ * @values: argument values, one per slot
+ *
+ * Render soap body, argument values are escaped.
+ *
+ * Returns: a new #SoupBuffer holding the body
+ */
+static SoupBuffer *rm_network_tr64_template_render(RmNetworkTr64Template *template, GPtrArray *values)
+{
+	GString *body;
+	gsize size = template->static_len;
+	gsize len;
+	guint i;
+
+	for (i = 0; i < template->n_args; i++) {
+		const gchar *value = g_ptr_array_index(values, i);
+
+		size += value ? strlen(value) : 0;
+	}
+
+	/* Leave some room for entities */
+	body = g_string_sized_new(size + size / 8 + 1);
+
+	for (i = 0; i < template->n_args; i++) {
+		const gchar *value = g_ptr_array_index(values, i);
+
+		g_string_append(body, template->parts[i]);
+		if (value) {
+			rm_network_xml_escape_append(body, value);
+		}
+	}
+	g_string_append(body, template->parts[i]);
+
+	len = body->len;
+
+	return soup_buffer_new(SOUP_MEMORY_TAKE, g_string_free(body, FALSE), len);
+}
+
+/**
+ * RmNetworkTr64Request:
+ *
+ * A TR-064 action including its authentication progress, shared by the synchronous and
+ * asynchronous request functions.
+ */
+typedef struct {
+	RmProfile *profile;
+	gboolean auth;
+	SoupURI *uri;
+	gchar *host;
+	gchar *user;
+	RmNetworkTr64Template *template;
+	/* Rendered soap body, shared by all attempts */
+	SoupBuffer *body;
+	gint attempt;
+	/* Nonce used by the last attempt, %NULL for a challenge request */
+	gchar *nonce;
+	/* Message in flight (async only) */
+	SoupMessage *msg;
+	GSource *cancel_source;
+} RmNetworkTr64Request;
+
+/**
+ * rm_network_tr64_request_new:
  * @profile: a #RmProfile
  * @auth: authentication required flag
  * @control: upnp control
  * @action: soap action
  * @service: soap service
+ * @args: %NULL terminated list of argument name/value pairs
  *
- * Send a tr64 soap request
+ * Prepare a TR-064 action
  *
- * Returns: #SoupMessage as a result of tr64 send request
+ * Returns: a new #RmNetworkTr64Request
  */
-SoupMessage *rm_network_tr64_request(RmProfile *profile, gboolean auth, gchar *control, gchar *action, gchar *service, ...)
+static RmNetworkTr64Request *rm_network_tr64_request_new(RmProfile *profile, gboolean auth, const gchar *control, const gchar *action, const gchar *service, va_list args)
 {
-	SoupMessage *msg;
-	SoupMessageHeaders *headers;
-	GString *request = g_string_new(SOUP_MSG_START);
-	SoupURI *uri;
-	gchar *status;
-	gint port;
-	g_autofree gchar *login_user = rm_router_get_login_user(profile);
-	g_autofree gchar *host = rm_router_get_host(profile);
+	RmNetworkTr64Request *request = g_slice_new0(RmNetworkTr64Request);
+	GPtrArray *names = g_ptr_array_new();
+	GPtrArray *values = g_ptr_array_new();
 	g_autofree gchar *url = NULL;
+	gchar *key;
 
-	if (RM_EMPTY_STRING(login_user)) {
-		login_user = g_strdup("admin");
+	request->profile = profile;
+	request->auth = auth;
+	request->host = rm_router_get_host(profile);
+	request->user = rm_router_get_login_user(profile);
+
+	if (RM_EMPTY_STRING(request->user)) {
+		g_free(request->user);
+		request->user = g_strdup("admin");
 	}
 
 	if (!auth) {
-		url = g_strdup_printf("http://%s/upnp/control/%s", host, control);
-		port = 49000;
+		url = g_strdup_printf("http://%s/upnp/control/%s", request->host, control);
 	} else {
-		url = g_strdup_printf("https://%s/upnp/control/%s", host, control);
-		port = tr64_security_port;
-
-		if (!auth_header) {
-			g_string_append_printf(request, SOUP_MSG_HEADER_START "<h:InitChallenge xmlns:h=\"http://soap-authentication.org/digest/2001/10/\" s:mustUnderstand=\"1\">\
-			        <UserID>%s</UserID></h:InitChallenge>" SOUP_MSG_HEADER_END, login_user);
-		} else {
-			g_string_append(request, auth_header);
-		}
+		url = g_strdup_printf("https://%s/upnp/control/%s", request->host, control);
 	}
 
-	uri = soup_uri_new(url);
-	soup_uri_set_port(uri, port);
-	msg = soup_message_new_from_uri(SOUP_METHOD_POST, uri);
+	request->uri = soup_uri_new(url);
+	soup_uri_set_port(request->uri, auth ? tr64_security_port : 49000);
 
-	g_string_append_printf(request, SOUP_MSG_BODY_START "<u:%s xmlns:u='%s'>", action, service);
+	while ((key = va_arg(args, char *)) != NULL) {
+		g_ptr_array_add(names, key);
+		g_ptr_array_add(values, va_arg(args, char *));
+	}
 
-	va_list arg;
-	gchar *key;
+	request->template = rm_network_tr64_template_get(service, action, names);
+	request->body = rm_network_tr64_template_render(request->template, values);
+
+	g_ptr_array_free(names, TRUE);
+	g_ptr_array_free(values, TRUE);
+
+	return request;
+}
+
+/**
+ * rm_network_tr64_request_free:
+ * @data: a #RmNetworkTr64Request
+ *
+ * Frees a TR-064 action
+ */
+static void rm_network_tr64_request_free(gpointer data)
+{
+	RmNetworkTr64Request *request = data;
 
-	va_start(arg, service);
-	while ((key = va_arg(arg, char *)) != NULL) {
-		gchar *val = va_arg(arg, char *);
-		g_string_append_printf(request, "<%s>%s</%s>", key, val, key);
+	if (request->cancel_source) {
+		g_source_destroy(request->cancel_source);
+		g_source_unref(request->cancel_source);
 	}
-	va_end(arg);
-	g_string_append_printf(request, "</u:%s>" SOUP_MSG_BODY_END SOUP_MSG_END, action);
 
-#ifdef FIRMWARE_TR64_DEBUG
-	g_debug("%s(): SoupRequest: %s", __FUNCTION__, request->str);
-#endif
+	soup_uri_free(request->uri);
+	g_free(request->host);
+	g_free(request->user);
+	g_free(request->nonce);
+	soup_buffer_free(request->body);
+	g_slice_free(RmNetworkTr64Request, request);
+}
 
-	soup_message_set_request(msg, "text/xml; charset=\"utf-8\"", SOUP_MEMORY_STATIC, request->str, request->len);
-	headers = msg->request_headers;
-	gchar *header = g_strdup_printf("%s#%s", service, action);
-	soup_message_headers_append(headers, "SoapAction", header);
-
-	soup_session_send_message(rm_soup_session, msg);
-	g_string_free(request, TRUE);
-
-	if (msg->status_code != SOUP_STATUS_OK) {
-		g_autofree char *error_code = NULL;
-		g_autofree char *error_description = NULL;
-
-		g_debug("%s(): Received status code: %d (%s)", __FUNCTION__, msg->status_code, soup_status_get_phrase(msg->status_code));
-		if (msg->response_body->data) {
-			rm_log_save_data("tr64-request-error1.xml", msg->response_body->data, -1);
-			error_code = rm_utils_xml_extract_tag(msg->response_body->data, "errorCode");
-			error_description = rm_utils_xml_extract_tag(msg->response_body->data, "errorDescription");
-			if (error_code) {
-				g_warning ("%s(): errorCode = %s", __FUNCTION__, error_code);
-			}
-			if (error_description) {
-				g_warning ("%s(): errorDescription = %s", __FUNCTION__, error_description);
-			}
-		}
-		g_object_unref(msg);
+/**
+ * rm_network_tr64_request_message:
+ * @request: a #RmNetworkTr64Request
+ *
+ * Create soap message for next attempt of @request
+ *
+ * Returns: a new #SoupMessage
+ */
+static SoupMessage *rm_network_tr64_request_message(RmNetworkTr64Request *request)
+{
+	SoupMessage *msg = soup_message_new_from_uri(SOUP_METHOD_POST, request->uri);
+
+	soup_message_headers_replace(msg->request_headers, "Content-Type", "text/xml; charset=\"utf-8\"");
+	soup_message_headers_append(msg->request_headers, "SoapAction", request->template->soap_action);
 
-		return NULL;
+	/* Static start, per attempt authentication header (owned by the message) and shared body */
+	soup_message_body_append(msg->request_body, SOUP_MEMORY_STATIC, SOUP_MSG_START, strlen(SOUP_MSG_START));
+	if (request->auth) {
+		gchar *header = rm_network_tr64_auth_header(request->profile, request->host, request->user, &request->nonce);
+
+#ifdef FIRMWARE_TR64_DEBUG
+		g_debug("%s(): SoupRequest header: %s", __FUNCTION__, header);
+#endif
+		soup_message_body_append(msg->request_body, SOUP_MEMORY_TAKE, header, strlen(header));
 	}
-	rm_log_save_data("tr64-request-ok-1.xml", msg->response_body->data, msg->response_body->length);
+	soup_message_body_append_buffer(msg->request_body, request->body);
 
-	status = rm_utils_xml_extract_tag(msg->response_body->data, "Status");
-	if (status && !strcmp(status, "Unauthenticated")) {
 #ifdef FIRMWARE_TR64_DEBUG
-		g_debug("%s(): Login required", __FUNCTION__);
+	g_debug("%s(): SoupRequest body: %.*s", __FUNCTION__, (gint)request->body->length, request->body->data);
 #endif
-		gchar *nonce = rm_utils_xml_extract_tag(msg->response_body->data, "Nonce");
-		gchar *realm = rm_utils_xml_extract_tag(msg->response_body->data, "Realm");
-		gchar *response;
-		gchar *new_auth_header = NULL;
-
-		response = rm_network_tr64_create_response(nonce, realm, login_user, rm_router_get_login_password(profile));
-
-		request = g_string_new(SOUP_MSG_START);
-
-		new_auth_header = g_strdup_printf(
-				       SOUP_MSG_HEADER_START
-				       "<h:ClientAuth xmlns:h='http://soap-authentication.org/digest/2001/10/' s:mustUnderstand='1'>"
-				       "<Nonce>%s</Nonce>"
-				       "<Auth>%s</Auth>"
-				       "<UserID>%s</UserID>"
-				       "<Realm>%s</Realm>"
-				       "</h:ClientAuth>"
-				       SOUP_MSG_HEADER_END,
-				       nonce, response, login_user, realm);
-
-		g_string_append(request, new_auth_header);
-		g_string_append_printf(request, SOUP_MSG_BODY_START "<u:%s xmlns:u='%s'>", action, service);
-
-		va_list arg;
-		gchar *key;
-
-		va_start(arg, service);
-		while ((key = va_arg(arg, char *)) != NULL) {
-			gchar *val = va_arg(arg, char *);
-			g_string_append_printf(request, "<%s>%s</%s>", key, val, key);
-		}
-		va_end(arg);
-		g_string_append_printf(request, "</u:%s>" SOUP_MSG_BODY_END SOUP_MSG_END, action);
 
-		g_object_unref(msg);
-		msg = soup_message_new_from_uri(SOUP_METHOD_POST, uri);
+	return msg;
+}
+
+/**
+ * rm_network_tr64_request_check:
+ * @request: a #RmNetworkTr64Request
+ * @msg: response of last attempt
+ * @retry: location to store whether @request has to be sent again
+ *
+ * Evaluate response: store the router's challenge and decide whether the action succeeded
+ * or has to be repeated with a new nonce. Only a rejected authentication is repeated, a fault
+ * of the action itself is final as the action may already have had an effect.
+ *
+ * A rejected first attempt is repeated with the router's new challenge. Later rejections are
+ * only repeated if a concurrent request has replaced the shared nonce in the meantime, otherwise
+ * the credentials are wrong and the nonce this request used is forgotten.
+ *
+ * Returns: %TRUE if action succeeded
+ */
+static gboolean rm_network_tr64_request_check(RmNetworkTr64Request *request, SoupMessage *msg, gboolean *retry)
+{
+	g_autofree gchar *status = NULL;
+	gboolean changed;
+
+	*retry = FALSE;
+
+	if (!request->auth) {
+		return msg->status_code == SOUP_STATUS_OK;
+	}
+
+	status = msg->response_body->data ? rm_utils_xml_extract_tag(msg->response_body->data, "Status") : NULL;
+
+	if (g_strcmp0(status, "Unauthenticated")) {
+		/* Successful answers and faults both carry the next challenge */
+		rm_network_tr64_auth_update(msg, request->host, request->user);
+
+		return msg->status_code == SOUP_STATUS_OK;
+	}
+
+	request->attempt++;
+
+	/* Check before storing our own challenge, which would always differ */
+	changed = rm_network_tr64_auth_changed(request->nonce);
+	if (!changed && request->attempt == 1) {
+		changed = rm_network_tr64_auth_update(msg, request->host, request->user);
+	}
+
+	if (!changed || request->attempt >= RM_NETWORK_TR64_MAX_ATTEMPTS) {
+		/* Rejected although the nonce was fresh, credentials are wrong */
+		rm_network_tr64_auth_reject(request->nonce);
+
+		return FALSE;
+	}
 
 #ifdef FIRMWARE_TR64_DEBUG
-		g_debug("%s(): SoupRequest (auth): %s", __FUNCTION__, request->str);
+	g_debug("%s(): Login required", __FUNCTION__);
 #endif
+	*retry = TRUE;
+
+	return FALSE;
+}
+
+/**
+ * rm_network_tr64_request_error:
+ * @request: a #RmNetworkTr64Request
+ * @msg: a failed #SoupMessage
+ *
+ * Convert a failed action into an error. SOAP faults are reported within #RM_NETWORK_TR64_ERROR
+ * using the UPnP error code of the router, everything else as #RM_ERROR_ROUTER.
+ *
+ * Returns: a new #GError
+ */
+static GError *rm_network_tr64_request_error(RmNetworkTr64Request *request, SoupMessage *msg)
+{
+	g_autofree gchar *error_code = NULL;
+	g_autofree gchar *error_description = NULL;
+
+	g_debug("%s(): Received status code: %d (%s)", __FUNCTION__, msg->status_code, soup_status_get_phrase(msg->status_code));
+	if (msg->response_body->data) {
+		rm_log_save_data("tr64-request-error.xml", msg->response_body->data, -1);
+		error_code = rm_utils_xml_extract_tag(msg->response_body->data, "errorCode");
+		error_description = rm_utils_xml_extract_tag(msg->response_body->data, "errorDescription");
+	}
 
-		soup_message_set_request(msg, "text/xml; charset=\"utf-8\"", SOUP_MEMORY_STATIC, request->str, request->len);
-		headers = msg->request_headers;
-		gchar *header = g_strdup_printf("%s#%s", service, action);
-		soup_message_headers_append(headers, "SoapAction", header);
+	if (!RM_EMPTY_STRING(error_code)) {
+		return g_error_new(RM_NETWORK_TR64_ERROR, atoi(error_code), "%s failed: %s (%s)", request->template->soap_action, error_code, error_description ? error_description : "");
+	}
 
+	return g_error_new(RM_ERROR, RM_ERROR_ROUTER, "%s failed: %d (%s)", request->template->soap_action, msg->status_code, soup_status_get_phrase(msg->status_code));
+}
+
+/**
+ * rm_network_tr64_request_valist:
+ * @profile: a #RmProfile
+ * @auth: authentication required flag
+ * @control: upnp control
+ * @action: soap action
+ * @service: soap service
+ * @error: a #GError or %NULL
+ * @args: %NULL terminated list of argument name/value pairs
+ *
+ * Send a tr64 soap request and wait for its result.
+ *
+ * Returns: #SoupMessage as a result of tr64 send request, or %NULL on error
+ */
+static SoupMessage *rm_network_tr64_request_valist(RmProfile *profile, gboolean auth, const gchar *control, const gchar *action, const gchar *service, GError **error, va_list args)
+{
+	RmNetworkTr64Request *request;
+	SoupMessage *msg;
+	gboolean retry;
+
+	request = rm_network_tr64_request_new(profile, auth, control, action, service, args);
+
+	while (TRUE) {
+		msg = rm_network_tr64_request_message(request);
 		soup_session_send_message(rm_soup_session, msg);
-		g_string_free(request, TRUE);
 
-		if (msg->status_code != SOUP_STATUS_OK) {
-			g_debug("%s(): Received status code: %d", __FUNCTION__, msg->status_code);
-			rm_log_save_data("tr64-request-error2.xml", msg->response_body->data, -1);
-			g_object_unref(msg)
-;
-			auth_header = NULL;
+		if (rm_network_tr64_request_check(request, msg, &retry)) {
+			break;
+		}
 
-			return NULL;
+		if (!retry) {
+			g_propagate_error(error, rm_network_tr64_request_error(request, msg));
+			g_clear_object(&msg);
+			break;
 		}
 
-		auth_header = new_auth_header;
+		g_object_unref(msg);
+	}
+
+	rm_network_tr64_request_free(request);
+
+	if (msg) {
+		rm_log_save_data("tr64-request-ok.xml", msg->response_body->data, msg->response_body->length);
+	}
+
+	return msg;
+}
+
+/**
+ * rm_network_tr64_request:
+ * @profile: a #RmProfile
+ * @auth: authentication required flag
+ * @control: upnp control
+ * @action: soap action
+ * @service: soap service
+ *
+ * Send a tr64 soap request. Authenticated requests reuse the nonce of the previous exchange, so
+ * usually a single round trip is needed. A missing or stale nonce is replaced by the challenge
+ * of the router's answer and the request is sent once more. Argument values are plain text, they
+ * are XML escaped when the soap body is built.
+ *
+ * Returns: #SoupMessage as a result of tr64 send request
+ */
+SoupMessage *rm_network_tr64_request(RmProfile *profile, gboolean auth, gchar *control, gchar *action, gchar *service, ...)
+{
+	g_autoptr(GError) error = NULL;
+	SoupMessage *msg;
+	va_list args;
+
+	va_start(args, service);
+	msg = rm_network_tr64_request_valist(profile, auth, control, action, service, &error, args);
+	va_end(args);
 
-		rm_log_save_data("tr64-request-ok-2.xml", msg->response_body->data, msg->response_body->length);
+	if (!msg) {
+		g_warning("%s(): %s", __FUNCTION__, error->message);
 	}
 
 	return msg;
 }
 
+/**
+ * rm_network_tr64_request_full:
+ * @profile: a #RmProfile
+ * @auth: authentication required flag
+ * @control: upnp control
+ * @action: soap action
+ * @service: soap service
+ * @error: a #GError or %NULL
+ * @...: %NULL terminated list of argument name/value pairs
+ *
+ * Like rm_network_tr64_request(), but reports why the action failed instead of logging it. A SOAP
+ * fault of the router is set as #RM_NETWORK_TR64_ERROR with the UPnP error code, e.g.
+ * %RM_NETWORK_TR64_ERROR_INVALID_ACTION for actions unknown to the firmware.
+ *
+ * Returns: #SoupMessage as a result of tr64 send request, or %NULL on error
+ */
+SoupMessage *rm_network_tr64_request_full(RmProfile *profile, gboolean auth, gchar *control, gchar *action, gchar *service, GError **error, ...)
+{
+	SoupMessage *msg;
+	va_list args;
+
+	va_start(args, error);
+	msg = rm_network_tr64_request_valist(profile, auth, control, action, service, error, args);
+	va_end(args);
+
+	return msg;
+}
+
+static void rm_network_tr64_request_queue(GTask *task);
+
+/**
+ * rm_network_tr64_request_cb:
+ * @session: a #SoupSession
+ * @msg: a #SoupMessage
+ * @user_data: a #GTask
+ *
+ * Response of an asynchronous action attempt
+ */
+static void rm_network_tr64_request_cb(SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+	GTask *task = user_data;
+	RmNetworkTr64Request *request = g_task_get_task_data(task);
+	gboolean retry;
+
+	request->msg = NULL;
+
+	if (g_task_return_error_if_cancelled(task)) {
+		g_object_unref(task);
+		return;
+	}
+
+	if (rm_network_tr64_request_check(request, msg, &retry)) {
+		rm_log_save_data("tr64-request-ok.xml", msg->response_body->data, msg->response_body->length);
+		g_task_return_pointer(task, g_object_ref(msg), g_object_unref);
+		g_object_unref(task);
+		return;
+	}
+
+	if (retry) {
+		rm_network_tr64_request_queue(task);
+		return;
+	}
+
+	g_task_return_error(task, rm_network_tr64_request_error(request, msg));
+	g_object_unref(task);
+}
+
+/**
+ * rm_network_tr64_request_cancelled_cb:
+ * @cancellable: a #GCancellable
+ * @user_data: a #GTask
+ *
+ * Cancel message in flight, runs in the context of the task.
+ *
+ * Returns: %G_SOURCE_REMOVE
+ */
+static gboolean rm_network_tr64_request_cancelled_cb(GCancellable *cancellable, gpointer user_data)
+{
+	RmNetworkTr64Request *request = g_task_get_task_data(user_data);
+
+	if (request->msg) {
+		soup_session_cancel_message(rm_soup_session, request->msg, SOUP_STATUS_CANCELLED);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * rm_network_tr64_request_queue:
+ * @task: a #GTask
+ *
+ * Queue next attempt of the action of @task, the session takes over the reference of @task
+ * until the response arrives.
+ */
+static void rm_network_tr64_request_queue(GTask *task)
+{
+	RmNetworkTr64Request *request = g_task_get_task_data(task);
+
+	request->msg = rm_network_tr64_request_message(request);
+	soup_session_queue_message(rm_soup_session, request->msg, rm_network_tr64_request_cb, task);
+}
+
+/**
+ * rm_network_tr64_request_async:
+ * @profile: a #RmProfile
+ * @auth: authentication required flag
+ * @control: upnp control
+ * @action: soap action
+ * @service: soap service
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback
+ * @user_data: user data for @callback
+ * @...: %NULL terminated list of argument name/value pairs
+ *
+ * Asynchronous version of rm_network_tr64_request_full() sharing its nonce handling. Any number of
+ * actions may be in flight at once. Complete with rm_network_tr64_request_finish().
+ */
+void rm_network_tr64_request_async(RmProfile *profile, gboolean auth, gchar *control, gchar *action, gchar *service, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data, ...)
+{
+	RmNetworkTr64Request *request;
+	GTask *task;
+	va_list args;
+
+	va_start(args, user_data);
+	request = rm_network_tr64_request_new(profile, auth, control, action, service, args);
+	va_end(args);
+
+	task = g_task_new(NULL, cancellable, callback, user_data);
+	g_task_set_source_tag(task, rm_network_tr64_request_async);
+	g_task_set_task_data(task, request, rm_network_tr64_request_free);
+
+	if (g_task_return_error_if_cancelled(task)) {
+		g_object_unref(task);
+		return;
+	}
+
+	if (cancellable) {
+		request->cancel_source = g_cancellable_source_new(cancellable);
+		g_source_set_callback(request->cancel_source, (GSourceFunc)rm_network_tr64_request_cancelled_cb, task, NULL);
+		g_source_attach(request->cancel_source, g_task_get_context(task));
+	}
+
+	rm_network_tr64_request_queue(task);
+}
+
+/**
+ * rm_network_tr64_request_finish:
+ * @result: a #GAsyncResult
+ * @error: a #GError or %NULL
+ *
+ * Finishes rm_network_tr64_request_async().
+ *
+ * Returns: #SoupMessage as a result of tr64 request (free with g_object_unref()), or %NULL on error
+ */
+SoupMessage *rm_network_tr64_request_finish(GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
 /**
  * rm_network_tr64_get_security_port:
  * @profile: a #RmProfile
@@ -436,7 +1107,7 @@ gboolean rm_network_init(void)
 
 	/* NULL for directory is not sufficient on Windows platform, therefore set user cache dir */
 	cache = soup_cache_new(rm_get_user_cache_dir(), SOUP_CACHE_SINGLE_USER);
-	rm_soup_session = soup_session_new_with_options(SOUP_SESSION_TIMEOUT, 5, SOUP_SESSION_USE_THREAD_CONTEXT, TRUE, SOUP_SESSION_ADD_FEATURE, cache, SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+	rm_soup_session = soup_session_new_with_options(SOUP_SESSION_TIMEOUT, 5, SOUP_SESSION_USE_THREAD_CONTEXT, TRUE, SOUP_SESSION_MAX_CONNS_PER_HOST, RM_NETWORK_MAX_CONNS_PER_HOST, SOUP_SESSION_ADD_FEATURE, cache, SOUP_SESSION_SSL_STRICT, FALSE, NULL);
 	soup_cache_load(cache);
 
 	g_signal_connect(rm_soup_session, "authenticate", G_CALLBACK(rm_network_authenticate_cb), rm_soup_session);
@@ -451,5 +1122,13 @@ gboolean rm_network_init(void)
  */
 void rm_network_shutdown(void)
 {
+	g_mutex_lock(&tr64_auth_mutex);
+	rm_network_tr64_auth_clear();
+	g_mutex_unlock(&tr64_auth_mutex);
+
+	g_mutex_lock(&tr64_templates_mutex);
+	g_clear_pointer(&tr64_templates, g_hash_table_destroy);
+	g_mutex_unlock(&tr64_templates_mutex);
+
 	g_clear_object(&rm_soup_session);
 }
@@ -45,12 +45,40 @@ typedef struct {
 	gchar *password;
 } RmAuthData;
 
+/**
+ * RM_NETWORK_TR64_ERROR:
+ *
+ * Error domain of TR-064 SOAP faults, error codes are the UPnP error codes of the router.
+ */
+#define RM_NETWORK_TR64_ERROR rm_network_tr64_error_quark()
+
+/**
+ * RmNetworkTr64Error:
+ * @RM_NETWORK_TR64_ERROR_INVALID_ACTION: action is not known by the router
+ * @RM_NETWORK_TR64_ERROR_INVALID_ARGS: arguments are not valid for the action
+ * @RM_NETWORK_TR64_ERROR_ACTION_FAILED: router failed to execute the action
+ * @RM_NETWORK_TR64_ERROR_ARRAY_INDEX_INVALID: index is beyond the end of a list
+ *
+ * Common UPnP error codes of TR-064 SOAP faults.
+ */
+typedef enum {
+	RM_NETWORK_TR64_ERROR_INVALID_ACTION = 401,
+	RM_NETWORK_TR64_ERROR_INVALID_ARGS = 402,
+	RM_NETWORK_TR64_ERROR_ACTION_FAILED = 501,
+	RM_NETWORK_TR64_ERROR_ARRAY_INDEX_INVALID = 713,
+} RmNetworkTr64Error;
+
 extern SoupSession *rm_soup_session;
 
+GQuark rm_network_tr64_error_quark(void);
+
 gboolean rm_network_init(void);
 void rm_network_shutdown(void);
 void rm_network_authenticate(gboolean auth_set, RmAuthData *auth_data);
 SoupMessage *rm_network_tr64_request(RmProfile *profile, gboolean auth, gchar *control, gchar *action, gchar *service, ...);
+SoupMessage *rm_network_tr64_request_full(RmProfile *profile, gboolean auth, gchar *control, gchar *action, gchar *service, GError **error, ...);
+void rm_network_tr64_request_async(RmProfile *profile, gboolean auth, gchar *control, gchar *action, gchar *service, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data, ...);
+SoupMessage *rm_network_tr64_request_finish(GAsyncResult *result, GError **error);
 gboolean rm_network_tr64_available(RmProfile *profile);
 gint rm_network_tr64_get_port(void);
 
@@ -48,6 +48,8 @@ static gint rm_notification_signal_id = 0;
 /** Keeping track of all open notification messages */
 static GList *rm_notification_messages = NULL;
 static RmVoxPlayback *vox = NULL;
+/** Reverse lookups of open connections, connection -> #GCancellable */
+static GHashTable *rm_notification_lookups = NULL;
 
 /**
  * rm_notification_play_ringtone:
@@ -191,30 +193,59 @@ RmNotification *rm_notification_get(gchar *name)
 }
 
 /**
- * rm_notification_reverse_lookup_thread:
- * @data: a #RmConnection
- *
- * Reverse lookup of connection data and notification redraw
+ * rm_notification_reverse_lookup_partial_cb:
+ * @tier: a #RmLookupTier
+ * @contact: a #RmContact
+ * @user_data: a #RmConnection, valid until its lookup is cancelled on disconnect
  *
- * Returns: %NULL
+ * Redraw notification as soon as a lookup tier provided a name
  */
-static gpointer rm_notification_reverse_lookup_thread(gpointer data)
+static void rm_notification_reverse_lookup_partial_cb(RmLookupTier tier, RmContact *contact, gpointer user_data)
 {
-	RmConnection *connection = data;
-	RmContact contact;
-	gchar *number;
+	RmConnection *connection = user_data;
+	RmNotificationMessage *message;
 
-	number = connection->remote_number;
+	if (RM_EMPTY_STRING(contact->name)) {
+		/* City has already been shown */
+		return;
+	}
 
-	if (rm_lookup_search(number, &contact)) {
-		RmNotificationMessage *message = rm_notification_message_get(connection);
+	message = rm_notification_message_get(connection);
+	if (message) {
+		rm_notification_update_message(message, contact);
+	}
+}
 
-		if (message) {
-			rm_notification_update_message(message, &contact);
-		}
+/**
+ * rm_notification_reverse_lookup_cb:
+ * @source: unused
+ * @result: a #GAsyncResult
+ * @user_data: a #RmConnection
+ *
+ * Reverse lookup finished, results have been shown by rm_notification_reverse_lookup_partial_cb()
+ */
+static void rm_notification_reverse_lookup_cb(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	RmContact *contact = rm_lookup_search_finish(result, NULL);
+
+	if (contact) {
+		rm_contact_free(contact);
+		g_slice_free(RmContact, contact);
 	}
+}
 
-	return NULL;
+/**
+ * rm_notification_lookup_cancel:
+ * @data: a #GCancellable
+ *
+ * Cancels a reverse lookup, its connection is gone.
+ */
+static void rm_notification_lookup_cancel(gpointer data)
+{
+	GCancellable *cancellable = data;
+
+	g_cancellable_cancel(cancellable);
+	g_object_unref(cancellable);
 }
 
 /**
@@ -235,6 +266,11 @@ static void rm_notification_connection_changed_cb(RmObject *obj, gint event, RmC
 	gint count;
 	gboolean found = FALSE;
 
+	/* Connection is freed after disconnect, its lookup must not report to it anymore */
+	if (event & RM_CONNECTION_TYPE_DISCONNECT) {
+		g_hash_table_remove(rm_notification_lookups, connection);
+	}
+
 	/* Return if no profile is active */
 	if (!profile) {
 		return;
@@ -329,7 +365,10 @@ static void rm_notification_connection_changed_cb(RmObject *obj, gint event, RmC
 
 	/* In case no name is given, try a reverse lookup for the remote number */
 	if (RM_EMPTY_STRING(contact->name)) {
-		g_thread_new("rmnotification reverse lookup", rm_notification_reverse_lookup_thread, connection);
+		GCancellable *cancellable = g_cancellable_new();
+
+		g_hash_table_replace(rm_notification_lookups, connection, cancellable);
+		rm_lookup_search_async(connection->remote_number, contact->city, cancellable, rm_notification_reverse_lookup_partial_cb, connection, rm_notification_reverse_lookup_cb, NULL);
 	}
 }
 
@@ -362,6 +401,8 @@ void rm_notification_unregister(RmNotification *notification)
  */
 void rm_notification_init(void)
 {
+	rm_notification_lookups = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, rm_notification_lookup_cancel);
+
 	/* Connect to "connection-changed" signal */
 	rm_notification_signal_id = g_signal_connect(G_OBJECT(rm_object), "connection-changed", G_CALLBACK(rm_notification_connection_changed_cb), NULL);
 }
@@ -377,6 +418,8 @@ void rm_notification_shutdown(void)
 		g_signal_handler_disconnect(G_OBJECT(rm_object), rm_notification_signal_id);
 		rm_notification_signal_id = 0;
 	}
+
+	g_clear_pointer(&rm_notification_lookups, g_hash_table_destroy);
 }
 
 /**
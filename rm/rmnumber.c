@@ -24,9 +24,12 @@
 #include <glib.h>
 
 #include <rm/rmnumber.h>
+#include <rm/rmtrie.h>
 #include <rm/rmstring.h>
 #include <rm/rmprofile.h>
 #include <rm/rmrouter.h>
+#include <rm/rmcsv.h>
+#include <rm/rmmain.h>
 
 /**
  * SECTION:rmnumber
@@ -36,13 +39,13 @@
  * Phone number manipulation functions
  */
 
-/** Call-by-call number table */
-RmCallByCallEntry rm_call_by_call_table[] = {
-	{ "49", "0100", 6 },
-	{ "49", "010", 5 },
-	{ "31", "16", 4 },
-	{ "", "", 0 },
-};
+/**
+ * Call-by-call table, the user config directory may contain an updated copy. The built-in table
+ * is a stub covering only the carrier selection prefixes of a few countries (DE 010xx/0100xx,
+ * CH, ES and NL); numbers of other countries keep their carrier prefix.
+ */
+#define RM_NUMBER_CALL_BY_CALL_FILE "callbycall.csv"
+#define RM_NUMBER_CALL_BY_CALL_HEADER "Country Code,Prefix,Length"
 
 /**
  * rm_number_scramble:
@@ -81,34 +84,417 @@ gchar *rm_number_scramble(const gchar *number)
 	return scramble;
 }
 
+struct _RmNumberPlan {
+	gint ref_count;
+	gchar *international_access_code;
+	gsize international_access_code_len;
+	gchar *national_prefix;
+	gsize national_prefix_len;
+	gchar *country_code;
+	gsize country_code_len;
+	gchar *area_code;
+	gsize area_code_len;
+	/* Call-by-call prefixes of own country, values are total prefix lengths */
+	RmTrie *call_by_call;
+};
+
+/** Numbering plans, per profile settings */
+static GHashTable *rm_number_plans = NULL;
+static GMutex rm_number_plans_mutex;
+
+/** Stack buffer size used for canonized numbers, longer numbers are allocated */
+#define RM_NUMBER_BUFFER_SIZE 64
+
+/** Parser state while loading the call-by-call table */
+typedef struct {
+	const gchar *country_code;
+	RmTrie *trie;
+} RmNumberCallByCallData;
+
+/**
+ * rm_number_call_by_call_parse:
+ * @ptr: a #RmNumberCallByCallData
+ * @split: line fields (country code, prefix, total prefix length)
+ *
+ * Adds call-by-call entries of the requested country to the prefix tree.
+ *
+ * Returns: @ptr
+ */
+static gpointer rm_number_call_by_call_parse(gpointer ptr, gchar **split)
+{
+	RmNumberCallByCallData *data = ptr;
+	const gchar *prefix;
+	gint length;
+
+	if (g_strv_length(split) < 3 || strcmp(g_strstrip(split[0]), data->country_code)) {
+		return ptr;
+	}
+
+	prefix = g_strstrip(split[1]);
+	length = atoi(g_strstrip(split[2]));
+
+	if (RM_EMPTY_STRING(prefix) || length < (gint)strlen(prefix)) {
+		g_debug("%s(): Invalid call-by-call entry '%s'", __FUNCTION__, prefix);
+		return ptr;
+	}
+
+	rm_trie_insert(data->trie, prefix, GINT_TO_POINTER(length));
+
+	return ptr;
+}
+
+/**
+ * rm_number_call_by_call_load:
+ * @country_code: own country code
+ *
+ * Load call-by-call prefixes of @country_code. A table within the user config directory takes
+ * precedence over the built-in one.
+ *
+ * Returns: a new #RmTrie mapping prefixes to total call-by-call prefix length
+ */
+static RmTrie *rm_number_call_by_call_load(const gchar *country_code)
+{
+	RmNumberCallByCallData data = { country_code, rm_trie_new(NULL) };
+	gchar *file;
+	gchar *content = NULL;
+
+	if (RM_EMPTY_STRING(country_code)) {
+		return data.trie;
+	}
+
+	file = rm_get_user_config_dir() ? g_build_filename(rm_get_user_config_dir(), RM_NUMBER_CALL_BY_CALL_FILE, NULL) : NULL;
+	if (!file || !g_file_get_contents(file, &content, NULL, NULL)) {
+		GBytes *bytes = g_resources_lookup_data("/org/tabos/rm/data/" RM_NUMBER_CALL_BY_CALL_FILE, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+
+		if (bytes) {
+			gsize len;
+			gconstpointer ptr = g_bytes_get_data(bytes, &len);
+
+			content = g_strndup(ptr, len);
+			g_bytes_unref(bytes);
+		}
+	}
+	g_free(file);
+
+	if (content) {
+		rm_csv_parse_data(content, RM_NUMBER_CALL_BY_CALL_HEADER, rm_number_call_by_call_parse, &data);
+		g_free(content);
+	}
+
+	return data.trie;
+}
+
+/**
+ * rm_number_plan_new_full:
+ * @international_access_code: international access code, e.g. "00"
+ * @national_prefix: national access code, e.g. "0"
+ * @country_code: own country code, e.g. "49"
+ * @area_code: own area code without national prefix
+ *
+ * Compile numbering plan of the given codes, including the call-by-call prefixes of
+ * @country_code. Meant for callers without a profile (e.g. tests), use rm_number_plan_get()
+ * otherwise.
+ *
+ * Returns: a new #RmNumberPlan, release with rm_number_plan_unref()
+ */
+RmNumberPlan *rm_number_plan_new_full(const gchar *international_access_code, const gchar *national_prefix, const gchar *country_code, const gchar *area_code)
+{
+	RmNumberPlan *plan = g_slice_new0(RmNumberPlan);
+
+	plan->ref_count = 1;
+	plan->international_access_code = g_strdup(international_access_code ? international_access_code : "");
+	plan->international_access_code_len = strlen(plan->international_access_code);
+	plan->national_prefix = g_strdup(national_prefix ? national_prefix : "");
+	plan->national_prefix_len = strlen(plan->national_prefix);
+	plan->country_code = g_strdup(country_code ? country_code : "");
+	plan->country_code_len = strlen(plan->country_code);
+	plan->area_code = g_strdup(area_code ? area_code : "");
+	plan->area_code_len = strlen(plan->area_code);
+
+	plan->call_by_call = rm_number_call_by_call_load(plan->country_code);
+
+	return plan;
+}
+
+/**
+ * rm_number_plan_new:
+ * @profile: a #RmProfile
+ *
+ * Compile numbering plan of @profile.
+ *
+ * Returns: a new #RmNumberPlan
+ */
+static RmNumberPlan *rm_number_plan_new(RmProfile *profile)
+{
+	g_autofree gchar *international_access_code = g_settings_get_string(profile->settings, "international-access-code");
+	g_autofree gchar *national_prefix = g_settings_get_string(profile->settings, "national-access-code");
+	g_autofree gchar *country_code = g_settings_get_string(profile->settings, "country-code");
+	g_autofree gchar *area_code = g_settings_get_string(profile->settings, "area-code");
+
+	g_debug("%s(): %s: country %s, area %s", __FUNCTION__, profile->name, country_code, area_code);
+
+	return rm_number_plan_new_full(international_access_code, national_prefix, country_code, area_code);
+}
+
+/**
+ * rm_number_plan_ref:
+ * @plan: a #RmNumberPlan
+ *
+ * Increase reference count of @plan.
+ *
+ * Returns: @plan
+ */
+RmNumberPlan *rm_number_plan_ref(RmNumberPlan *plan)
+{
+	g_atomic_int_inc(&plan->ref_count);
+
+	return plan;
+}
+
+/**
+ * rm_number_plan_unref:
+ * @plan: a #RmNumberPlan
+ *
+ * Decrease reference count of @plan, frees it when it drops to zero.
+ */
+void rm_number_plan_unref(RmNumberPlan *plan)
+{
+	if (!plan || !g_atomic_int_dec_and_test(&plan->ref_count)) {
+		return;
+	}
+
+	g_free(plan->international_access_code);
+	g_free(plan->national_prefix);
+	g_free(plan->country_code);
+	g_free(plan->area_code);
+	rm_trie_free(plan->call_by_call);
+	g_slice_free(RmNumberPlan, plan);
+}
+
+/**
+ * rm_number_plan_invalidate:
+ * @settings: profile settings
+ *
+ * Drop cached numbering plan of @settings, it is compiled again on next use.
+ */
+static void rm_number_plan_invalidate(gpointer settings)
+{
+	g_mutex_lock(&rm_number_plans_mutex);
+	if (rm_number_plans) {
+		g_hash_table_remove(rm_number_plans, settings);
+	}
+	g_mutex_unlock(&rm_number_plans_mutex);
+}
+
+/**
+ * rm_number_plan_changed_cb:
+ * @settings: profile settings
+ * @key: changed key
+ * @user_data: unused
+ *
+ * Invalidate numbering plan in case one of its settings has changed.
+ */
+static void rm_number_plan_changed_cb(GSettings *settings, const gchar *key, gpointer user_data)
+{
+	if (!strcmp(key, "international-access-code") || !strcmp(key, "national-access-code") || !strcmp(key, "country-code") || !strcmp(key, "area-code")) {
+		rm_number_plan_invalidate(settings);
+	}
+}
+
+/**
+ * rm_number_plan_settings_finalized:
+ * @data: unused
+ * @settings: finalized profile settings
+ *
+ * Profile has been removed, drop its numbering plan.
+ */
+static void rm_number_plan_settings_finalized(gpointer data, GObject *settings)
+{
+	rm_number_plan_invalidate(settings);
+}
+
+/**
+ * rm_number_plan_get:
+ * @profile: a #RmProfile
+ *
+ * Get compiled numbering plan (access codes, prefixes and call-by-call entries) of @profile.
+ * Plans are cached and rebuilt once the underlying settings change. Can be called from any thread.
+ *
+ * Returns: a #RmNumberPlan, release with rm_number_plan_unref(), or %NULL if @profile is not set
+ */
+RmNumberPlan *rm_number_plan_get(RmProfile *profile)
+{
+	RmNumberPlan *plan;
+
+	if (!profile || !profile->settings) {
+		return NULL;
+	}
+
+	g_mutex_lock(&rm_number_plans_mutex);
+
+	if (!rm_number_plans) {
+		rm_number_plans = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)rm_number_plan_unref);
+	}
+
+	plan = g_hash_table_lookup(rm_number_plans, profile->settings);
+	if (!plan) {
+		/* Connect before reading, GSettings only notifies about keys read afterwards */
+		if (!g_object_get_data(G_OBJECT(profile->settings), "rm-number-plan")) {
+			g_object_set_data(G_OBJECT(profile->settings), "rm-number-plan", GINT_TO_POINTER(TRUE));
+			g_signal_connect(profile->settings, "changed", G_CALLBACK(rm_number_plan_changed_cb), NULL);
+			g_object_weak_ref(G_OBJECT(profile->settings), rm_number_plan_settings_finalized, NULL);
+		}
+
+		plan = rm_number_plan_new(profile);
+		g_hash_table_insert(rm_number_plans, profile->settings, plan);
+	}
+
+	rm_number_plan_ref(plan);
+
+	g_mutex_unlock(&rm_number_plans_mutex);
+
+	return plan;
+}
+
+/**
+ * rm_number_plan_call_by_call_length:
+ * @plan: a #RmNumberPlan or %NULL
+ * @number: input number string
+ *
+ * Returns: length of call-by-call prefix, may exceed the length of @number (e.g. for "010" with
+ * prefix "010xx")
+ */
+static gint rm_number_plan_call_by_call_length(RmNumberPlan *plan, const gchar *number)
+{
+	GPtrArray *values;
+
+	if (!plan) {
+		return 0;
+	}
+
+	values = rm_trie_longest_prefix(plan->call_by_call, number, NULL);
+
+	return values ? GPOINTER_TO_INT(g_ptr_array_index(values, 0)) : 0;
+}
+
 /**
  * rm_call_by_call_prefix_length:
  * @number: input number string
  *
  * Get call-by-call prefix length
  *
- * Returns: length of call-by-call prefix
+ * Returns: length of call-by-call prefix, 0 if @number is not longer than the prefix
  */
 gint rm_call_by_call_prefix_length(const gchar *number)
 {
-	gchar *my_country_code = rm_router_get_country_code(rm_profile_get_active());
-	RmCallByCallEntry *entry;
+	RmNumberPlan *plan = rm_number_plan_get(rm_profile_get_active());
+	gint len = rm_number_plan_call_by_call_length(plan, number);
 
-	if (RM_EMPTY_STRING(my_country_code)) {
-		g_free(my_country_code);
-		return 0;
-	}
+	rm_number_plan_unref(plan);
 
-	for (entry = rm_call_by_call_table; strlen(entry->country_code); entry++) {
-		if (!strcmp(my_country_code, entry->country_code) && !strncmp(number, entry->prefix, strlen(entry->prefix))) {
-			g_free(my_country_code);
-			return entry->prefix_length;
+	/* Incomplete prefix, nothing to strip */
+	return (gsize)len < strlen(number) ? len : 0;
+}
+
+/**
+ * rm_number_is_eight_digits:
+ * @block: eight bytes of input
+ *
+ * Checks eight characters at once whether they are all ASCII digits (SWAR).
+ *
+ * Returns: %TRUE if all eight characters are digits
+ */
+static inline gboolean rm_number_is_eight_digits(const gchar *block)
+{
+	guint64 val;
+
+	memcpy(&val, block, sizeof(val));
+
+	return ((val & G_GUINT64_CONSTANT(0xF0F0F0F0F0F0F0F0)) | (((val + G_GUINT64_CONSTANT(0x0606060606060606)) & G_GUINT64_CONSTANT(0xF0F0F0F0F0F0F0F0)) >> 4)) == G_GUINT64_CONSTANT(0x3333333333333333);
+}
+
+/**
+ * rm_number_canonize_to:
+ * @plan: a #RmNumberPlan or %NULL
+ * @number: input number
+ * @len: length of @number
+ * @out: output buffer, large enough for rm_number_canonize_bound()
+ *
+ * Canonize number (valid chars: 0123456789#*), replacing '+' by the international access code.
+ * Runs of digits are copied eight bytes at a time.
+ *
+ * Returns: length of canonized number
+ */
+static gsize rm_number_canonize_to(RmNumberPlan *plan, const gchar *number, gsize len, gchar *out)
+{
+	const gchar *end = number + len;
+	const gchar *ptr = number;
+	gsize out_len = 0;
+
+	while (ptr < end) {
+		if (end - ptr >= 8 && rm_number_is_eight_digits(ptr)) {
+			memcpy(out + out_len, ptr, 8);
+			out_len += 8;
+			ptr += 8;
+			continue;
 		}
+
+		if (g_ascii_isdigit(*ptr) || *ptr == '*' || *ptr == '#') {
+			out[out_len++] = *ptr;
+		} else if (*ptr == '+' && plan) {
+			memcpy(out + out_len, plan->international_access_code, plan->international_access_code_len);
+			out_len += plan->international_access_code_len;
+		}
+		ptr++;
 	}
+	out[out_len] = '\0';
 
-	g_free(my_country_code);
+	return out_len;
+}
 
-	return 0;
+/**
+ * rm_number_canonize_bound:
+ * @plan: a #RmNumberPlan or %NULL
+ * @len: input number length
+ *
+ * Returns: buffer size sufficient to canonize a number of @len characters
+ */
+static inline gsize rm_number_canonize_bound(RmNumberPlan *plan, gsize len)
+{
+	return len * (plan ? MAX(plan->international_access_code_len, 1) : 1) + 1;
+}
+
+/**
+ * rm_number_plan_bound:
+ * @plan: a #RmNumberPlan
+ * @len: input number length
+ *
+ * Returns: buffer size sufficient to format a number of @len characters
+ */
+static inline gsize rm_number_plan_bound(RmNumberPlan *plan, gsize len)
+{
+	return rm_number_canonize_bound(plan, len) + MAX(plan->international_access_code_len, 1) + plan->national_prefix_len + plan->country_code_len + plan->area_code_len;
+}
+
+/**
+ * rm_number_plan_canonize:
+ * @plan: a #RmNumberPlan or %NULL
+ * @number: input number
+ * @buffer: output buffer or %NULL
+ * @size: size of @buffer
+ *
+ * Canonize number (valid chars: 0123456789#*), replacing '+' by the international access code.
+ *
+ * Returns: canonized number, either @buffer or a newly allocated string if it does not fit
+ */
+static gchar *rm_number_plan_canonize(RmNumberPlan *plan, const gchar *number, gchar *buffer, gsize size)
+{
+	gsize len = strlen(number);
+	gchar *out = rm_number_canonize_bound(plan, len) <= size ? buffer : g_malloc(rm_number_canonize_bound(plan, len));
+
+	rm_number_canonize_to(plan, number, len, out);
+
+	return out;
 }
 
 /**
@@ -121,76 +507,72 @@ gint rm_call_by_call_prefix_length(const gchar *number)
  */
 gchar *rm_number_canonize(const gchar *number)
 {
-	GString *new_number;
-
-	new_number = g_string_sized_new(strlen(number));
-	while (*number) {
-		if (isdigit(*number) || *number == '*' || *number == '#') {
-			g_string_append_c(new_number, *number);
-		} else if (*number == '+') {
-			g_string_append(new_number, rm_router_get_international_access_code(rm_profile_get_active()));
-		}
+	RmNumberPlan *plan = rm_number_plan_get(rm_profile_get_active());
+	gchar *canonized = rm_number_plan_canonize(plan, number, NULL, 0);
 
-		number++;
-	}
+	rm_number_plan_unref(plan);
 
-	return g_string_free(new_number, FALSE);
+	return canonized;
 }
 
 /**
- * rm_number_format:
- * @profile: a #RmProfile
+ * rm_number_append:
+ * @out: output buffer
+ * @len: current length of @out, updated
+ * @str: string to append
+ * @str_len: length of @str
+ */
+static inline void rm_number_append(gchar *out, gsize *len, const gchar *str, gsize str_len)
+{
+	memcpy(out + *len, str, str_len);
+	*len += str_len;
+}
+
+/**
+ * rm_number_plan_format_to:
+ * @plan: a #RmNumberPlan
  * @number: input number
  * @output_format: selected number output format
+ * @out: output buffer of at least rm_number_plan_bound() bytes
  *
- * Format number according to phone standard.
+ * Format number according to phone standard using a compiled numbering plan.
  *
- * Returns: real number
+ * Returns: length of formatted number
  */
-gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats output_format)
+static gsize rm_number_plan_format_to(RmNumberPlan *plan, const gchar *number, RmNumberFormats output_format, gchar *out)
 {
+	gchar buffer[RM_NUMBER_BUFFER_SIZE];
 	gchar *tmp;
 	gchar *canonized;
-	gchar *international_access_code;
-	gchar *national_prefix;
-	gchar *my_country_code;
-	gchar *my_area_code;
 	gint number_format = RM_NUMBER_FORMAT_UNKNOWN;
-	const gchar *my_prefix;
-	gchar *result = NULL;
-
-	if (!profile)
-		return g_strdup(number);
+	gsize len = 0;
 
 	/* Check for internal sip numbers first */
 	if (strchr(number, '@')) {
-		return g_strdup(number);
+		rm_number_append(out, &len, number, strlen(number));
+		out[len] = '\0';
+		return len;
 	}
 
-	canonized = tmp = rm_number_canonize(number);
-
-	international_access_code = rm_router_get_international_access_code(profile);
-	national_prefix = rm_router_get_national_prefix(profile);
-	my_country_code = rm_router_get_country_code(profile);
-	my_area_code = rm_router_get_area_code(profile);
+	canonized = tmp = rm_number_plan_canonize(plan, number, buffer, sizeof(buffer));
 
 	/* we only need to check for international prefix, as rm_number_canonize() already replaced '+'
 	 * Example of the following:
 	 *    tmp = 00494012345678  with international_access_code 00 and my_country_code 49
 	 *    number_format = NUMBER_FORMAT_UNKNOWN
 	 */
-	if (!strncmp(tmp, international_access_code, strlen(international_access_code))) {
+	if (!strncmp(tmp, plan->international_access_code, plan->international_access_code_len)) {
 		/* International format number */
-		tmp += strlen(international_access_code);
+		tmp += plan->international_access_code_len;
 		number_format = RM_NUMBER_FORMAT_INTERNATIONAL;
 
 		/* Example:
 		 * tmp = 494012345678
 		 * number_format = NUMBER_FORMAT_INTERNATIONAL
 		 */
-		if (!strncmp(tmp, my_country_code, strlen(my_country_code))) {
+		if (!strncmp(tmp, plan->country_code, plan->country_code_len)) {
 			/* national number */
-			tmp = tmp + strlen(my_country_code);
+			tmp = tmp + plan->country_code_len;
 			number_format = RM_NUMBER_FORMAT_NATIONAL;
 
 			/* Example:
@@ -200,8 +582,8 @@ gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats
 		}
 	} else {
 		/* not an international format, test for national or local format */
-		if (!RM_EMPTY_STRING(national_prefix) && !strncmp(tmp, national_prefix, strlen(national_prefix))) {
-			tmp = tmp + strlen(national_prefix);
+		if (plan->national_prefix_len && !strncmp(tmp, plan->national_prefix, plan->national_prefix_len)) {
+			tmp = tmp + plan->national_prefix_len;
 			number_format = RM_NUMBER_FORMAT_NATIONAL;
 
 			/* Example:
@@ -219,9 +601,9 @@ gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats
 		}
 	}
 
-	if ((number_format == RM_NUMBER_FORMAT_NATIONAL) && (!strncmp(tmp, my_area_code, strlen(my_area_code)))) {
+	if ((number_format == RM_NUMBER_FORMAT_NATIONAL) && (!strncmp(tmp, plan->area_code, plan->area_code_len))) {
 		/* local number */
-		tmp = tmp + strlen(my_area_code);
+		tmp = tmp + plan->area_code_len;
 		number_format = RM_NUMBER_FORMAT_LOCAL;
 
 		/* Example:
@@ -238,17 +620,16 @@ gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats
 		/* national number format */
 		switch (number_format) {
 		case RM_NUMBER_FORMAT_LOCAL:
-			if (output_format == RM_NUMBER_FORMAT_LOCAL) {
-				result = g_strdup(tmp);
-			} else {
-				result = g_strconcat(national_prefix, my_area_code, tmp, NULL);
+			if (output_format != RM_NUMBER_FORMAT_LOCAL) {
+				rm_number_append(out, &len, plan->national_prefix, plan->national_prefix_len);
+				rm_number_append(out, &len, plan->area_code, plan->area_code_len);
 			}
 			break;
 		case RM_NUMBER_FORMAT_NATIONAL:
-			result = g_strconcat(national_prefix, tmp, NULL);
+			rm_number_append(out, &len, plan->national_prefix, plan->national_prefix_len);
 			break;
 		case RM_NUMBER_FORMAT_INTERNATIONAL:
-			result = g_strconcat(international_access_code, tmp, NULL);
+			rm_number_append(out, &len, plan->international_access_code, plan->international_access_code_len);
 			break;
 		}
 		break;
@@ -256,16 +637,21 @@ gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats
 	/* international prefix + international format */
 	case RM_NUMBER_FORMAT_INTERNATIONAL_PLUS:
 		/* international format prefixed by a + */
-		my_prefix = (output_format == RM_NUMBER_FORMAT_INTERNATIONAL_PLUS) ? "+" : international_access_code;
+		if (output_format == RM_NUMBER_FORMAT_INTERNATIONAL_PLUS) {
+			rm_number_append(out, &len, "+", 1);
+		} else {
+			rm_number_append(out, &len, plan->international_access_code, plan->international_access_code_len);
+		}
+
 		switch (number_format) {
 		case RM_NUMBER_FORMAT_LOCAL:
-			result = g_strconcat(my_prefix, my_country_code, my_area_code, tmp, NULL);
+			rm_number_append(out, &len, plan->country_code, plan->country_code_len);
+			rm_number_append(out, &len, plan->area_code, plan->area_code_len);
 			break;
 		case RM_NUMBER_FORMAT_NATIONAL:
-			result = g_strconcat(my_prefix, my_country_code, tmp, NULL);
+			rm_number_append(out, &len, plan->country_code, plan->country_code_len);
 			break;
 		case RM_NUMBER_FORMAT_INTERNATIONAL:
-			result = g_strconcat(my_prefix, tmp, NULL);
 			break;
 		}
 		break;
@@ -274,13 +660,87 @@ gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats
 		break;
 	}
 
-	g_free(international_access_code);
-	g_free(national_prefix);
-	g_free(my_country_code);
-	g_free(my_area_code);
+	rm_number_append(out, &len, tmp, strlen(tmp));
+	out[len] = '\0';
+
+	if (canonized != buffer) {
+		g_free(canonized);
+	}
+
+	return len;
+}
+
+/**
+ * rm_number_plan_full_to:
+ * @plan: a #RmNumberPlan
+ * @number: input phone number
+ * @country_code_prefix: whether we want a international or national phone number format
+ * @out: output buffer of at least rm_number_plan_bound() bytes
+ *
+ * Returns: length of canonized and formatted phone number
+ */
+static gsize rm_number_plan_full_to(RmNumberPlan *plan, const gchar *number, gboolean country_code_prefix, gchar *out)
+{
+	gchar buffer[RM_NUMBER_BUFFER_SIZE];
+	gchar *canonized;
+	const gchar *tmp;
+	gsize cbc_len;
+	gsize len = 0;
+
+	/* Skip numbers with leading '*' or '#' and internal sip numbers */
+	if (number[0] == '*' || number[0] == '#' || strchr(number, '@')) {
+		rm_number_append(out, &len, number, strlen(number));
+		out[len] = '\0';
+		return len;
+	}
+
+	canonized = rm_number_plan_canonize(plan, number, buffer, sizeof(buffer));
+
+	/* Remove call-by-call (carrier preselect) prefix, unless there is nothing behind it */
+	cbc_len = rm_number_plan_call_by_call_length(plan, canonized);
+	tmp = cbc_len < strlen(canonized) ? canonized + cbc_len : canonized;
+
+	/* Check if it is an international number */
+	if (!strncmp(tmp, "00", 2)) {
+		if (!country_code_prefix && plan->country_code_len && !strncmp(tmp + 2, plan->country_code, plan->country_code_len)) {
+			rm_number_append(out, &len, "0", 1);
+			tmp += 2 + plan->country_code_len;
+		}
+
+		rm_number_append(out, &len, tmp, strlen(tmp));
+		out[len] = '\0';
+	} else {
+		len = rm_number_plan_format_to(plan, tmp, country_code_prefix ? RM_NUMBER_FORMAT_INTERNATIONAL : RM_NUMBER_FORMAT_NATIONAL, out);
+	}
 
-	g_free(canonized);
-	g_assert(result != NULL);
+	if (canonized != buffer) {
+		g_free(canonized);
+	}
+
+	return len;
+}
+
+/**
+ * rm_number_format:
+ * @profile: a #RmProfile
+ * @number: input number
+ * @output_format: selected number output format
+ *
+ * Format number according to phone standard.
+ *
+ * Returns: real number
+ */
+gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats output_format)
+{
+	RmNumberPlan *plan = rm_number_plan_get(profile);
+	gchar *result;
+
+	if (!plan)
+		return g_strdup(number);
+
+	result = g_malloc(rm_number_plan_bound(plan, strlen(number)));
+	rm_number_plan_format_to(plan, number, output_format, result);
+	rm_number_plan_unref(plan);
 
 	return result;
 }
@@ -296,7 +756,8 @@ gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats
  */
 gchar *rm_number_full(const gchar *number, gboolean country_code_prefix)
 {
-	RmProfile *profile = rm_profile_get_active();;
+	RmNumberPlan *plan;
+	gchar *result;
 
 	if (RM_EMPTY_STRING(number)) {
 		return NULL;
@@ -307,30 +768,225 @@ gchar *rm_number_full(const gchar *number, gboolean country_code_prefix)
 		return g_strdup(number);
 	}
 
-	if (!profile)
+	plan = rm_number_plan_get(rm_profile_get_active());
+	if (!plan)
 		return g_strdup(number);
 
-	/* Remove call-by-call (carrier preselect) prefix */
-	number += rm_call_by_call_prefix_length(number);
+	result = g_malloc(rm_number_plan_bound(plan, strlen(number)));
+	rm_number_plan_full_to(plan, number, country_code_prefix, result);
+	rm_number_plan_unref(plan);
 
-	/* Check if it is an international number */
-	if (!strncmp(number, "00", 2)) {
-		gchar *out;
-		gchar *my_country_code;
+	return result;
+}
+
+/**
+ * rm_number_full_many:
+ * @numbers: phone numbers
+ * @n_numbers: number of entries in @numbers
+ * @country_code_prefix: whether we want a international or national phone number format
+ *
+ * Batch version of rm_number_full(): normalizes all @numbers using one numbering plan lookup.
+ * The returned pointer array and all strings are stored in one contiguous block.
+ *
+ * Returns: array of @n_numbers normalized numbers (%NULL for empty input), free with g_free()
+ */
+gchar **rm_number_full_many(const gchar * const *numbers, gsize n_numbers, gboolean country_code_prefix)
+{
+	RmNumberPlan *plan = rm_number_plan_get(rm_profile_get_active());
+	gsize size = n_numbers * sizeof(gchar*);
+	gchar **result;
+	gchar *arena;
+	gsize i;
+
+	for (i = 0; i < n_numbers; i++) {
+		if (!RM_EMPTY_STRING(numbers[i])) {
+			gsize len = strlen(numbers[i]);
 
-		if (country_code_prefix) {
-			return g_strdup(number);
+			size += plan ? rm_number_plan_bound(plan, len) : len + 1;
+		}
+	}
+
+	result = g_malloc(size);
+	arena = (gchar*)(result + n_numbers);
+
+	for (i = 0; i < n_numbers; i++) {
+		const gchar *number = numbers[i];
+		gsize len;
+
+		if (RM_EMPTY_STRING(number)) {
+			result[i] = NULL;
+			continue;
 		}
 
-		my_country_code = rm_router_get_country_code(profile);
-		if (!strncmp(number + 2, my_country_code, strlen(my_country_code))) {
-			out = g_strdup_printf("0%s", number + 4);
+		if (plan) {
+			len = rm_number_plan_full_to(plan, number, country_code_prefix, arena);
 		} else {
-			out = g_strdup(number);
+			len = strlen(number);
+			memcpy(arena, number, len + 1);
 		}
 
-		return out;
+		result[i] = arena;
+		arena += len + 1;
 	}
 
-	return rm_number_format(profile, number, country_code_prefix ? RM_NUMBER_FORMAT_INTERNATIONAL : RM_NUMBER_FORMAT_NATIONAL);
+	rm_number_plan_unref(plan);
+
+	return result;
+}
+
+/**
+ * rm_number_e164:
+ * @plan: a #RmNumberPlan
+ * @number: input phone number
+ * @buffer: output buffer
+ * @size: size of @buffer, RM_NUMBER_E164_SIZE is sufficient
+ *
+ * Normalize @number into E.164 digits (country code followed by national number, without any
+ * access code) without allocating memory. Call-by-call prefixes are removed, national and local
+ * numbers are completed using the numbering plan.
+ *
+ * Returns: number of digits written to @buffer, 0 if @number can't be represented (e.g. service
+ * codes containing '*' or '#', SIP addresses or more than 15 digits)
+ */
+gsize rm_number_e164(RmNumberPlan *plan, const gchar *number, gchar *buffer, gsize size)
+{
+	gchar canonized[RM_NUMBER_BUFFER_SIZE];
+	const gchar *country_code = "";
+	const gchar *area_code = "";
+	gsize country_code_len = 0;
+	gsize area_code_len = 0;
+	const gchar *tmp;
+	const gchar *ptr;
+	gsize tmp_len;
+	gsize cbc_len;
+	gsize len = 0;
+
+	if (!plan || RM_EMPTY_STRING(number)) {
+		return 0;
+	}
+
+	for (ptr = number; *ptr; ptr++) {
+		if (g_ascii_isdigit(*ptr)) {
+			if (len + 1 >= sizeof(canonized)) {
+				return 0;
+			}
+			canonized[len++] = *ptr;
+		} else if (*ptr == '+') {
+			if (len + plan->international_access_code_len >= sizeof(canonized)) {
+				return 0;
+			}
+			memcpy(canonized + len, plan->international_access_code, plan->international_access_code_len);
+			len += plan->international_access_code_len;
+		} else if (*ptr == '*' || *ptr == '#' || *ptr == '@') {
+			return 0;
+		}
+	}
+	canonized[len] = '\0';
+
+	/* Call-by-call prefix (or a part of it) without a number behind */
+	cbc_len = rm_number_plan_call_by_call_length(plan, canonized);
+	if (cbc_len && cbc_len >= len) {
+		return 0;
+	}
+
+	tmp = canonized + cbc_len;
+
+	if (plan->international_access_code_len && !strncmp(tmp, plan->international_access_code, plan->international_access_code_len)) {
+		/* International number */
+		tmp += plan->international_access_code_len;
+	} else if (plan->national_prefix_len && !strncmp(tmp, plan->national_prefix, plan->national_prefix_len)) {
+		/* National number */
+		tmp += plan->national_prefix_len;
+		country_code = plan->country_code;
+		country_code_len = plan->country_code_len;
+	} else {
+		/* Local number */
+		country_code = plan->country_code;
+		country_code_len = plan->country_code_len;
+		area_code = plan->area_code;
+		area_code_len = plan->area_code_len;
+	}
+
+	tmp_len = strlen(tmp);
+	len = country_code_len + area_code_len + tmp_len;
+	if (!tmp_len || len >= RM_NUMBER_E164_SIZE || len >= size) {
+		return 0;
+	}
+
+	memcpy(buffer, country_code, country_code_len);
+	memcpy(buffer + country_code_len, area_code, area_code_len);
+	memcpy(buffer + country_code_len + area_code_len, tmp, tmp_len);
+	buffer[len] = '\0';
+
+	return len;
+}
+
+/**
+ * rm_number_pack:
+ * @digits: digit string
+ * @len: number of digits (1-15)
+ *
+ * Pack digits into a 64-bit key: four bits per digit with the first digit most significant,
+ * digit count in the upper four bits. Equal numbers give equal keys and keys of different
+ * numbers differ, so they can be used as hash table keys (see g_int64_hash()).
+ *
+ * Returns: packed key or 0 if @digits is not a valid digit string
+ */
+guint64 rm_number_pack(const gchar *digits, gsize len)
+{
+	guint64 key = 0;
+	gsize i;
+
+	if (!len || len > RM_NUMBER_E164_SIZE - 1) {
+		return 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (!g_ascii_isdigit(digits[i])) {
+			return 0;
+		}
+		key = (key << 4) | (guint64)(digits[i] - '0');
+	}
+
+	return ((guint64)len << 60) | key;
+}
+
+/**
+ * rm_number_unpack:
+ * @key: key returned by rm_number_pack()
+ * @buffer: output buffer of at least RM_NUMBER_E164_SIZE bytes
+ *
+ * Convert a packed key back into its digits.
+ *
+ * Returns: number of digits written
+ */
+gsize rm_number_unpack(guint64 key, gchar *buffer)
+{
+	gsize len = key >> 60;
+	gsize i;
+
+	for (i = len; i > 0; i--) {
+		buffer[i - 1] = '0' + (key & 0xF);
+		key >>= 4;
+	}
+	buffer[len] = '\0';
+
+	return len;
+}
+
+/**
+ * rm_number_key:
+ * @plan: a #RmNumberPlan or %NULL
+ * @number: input phone number
+ *
+ * Normalize @number to E.164 and pack it into a 64-bit key without allocating memory.
+ *
+ * Returns: packed key or 0 if @number can't be represented
+ */
+guint64 rm_number_key(RmNumberPlan *plan, const gchar *number)
+{
+	gchar buffer[RM_NUMBER_E164_SIZE];
+	gsize len = rm_number_e164(plan, number, buffer, sizeof(buffer));
+
+	return len ? rm_number_pack(buffer, len) : 0;
 }
@@ -48,22 +48,35 @@ typedef enum rm_number_formats {
 } RmNumberFormats;
 
 /**
- * RmCallByCallEntry:
+ * RmNumberPlan:
  *
- * The #RmCallByCallEntry-struct contains only private fileds and should not be directly accessed.
+ * The #RmNumberPlan-struct contains only private fileds and should not be directly accessed.
  */
-typedef struct {
-	/*< private >*/
-	gchar *country_code;
-	gchar *prefix;
-	gint prefix_length;
-} RmCallByCallEntry;
+typedef struct _RmNumberPlan RmNumberPlan;
 
+RmNumberPlan *rm_number_plan_get(RmProfile *profile);
+RmNumberPlan *rm_number_plan_new_full(const gchar *international_access_code, const gchar *national_prefix, const gchar *country_code, const gchar *area_code);
+RmNumberPlan *rm_number_plan_ref(RmNumberPlan *plan);
+void rm_number_plan_unref(RmNumberPlan *plan);
+gint rm_call_by_call_prefix_length(const gchar *number);
 gchar *rm_number_scramble(const gchar *number);
 gchar *rm_number_full(const gchar *number, gboolean country_code_prefix);
+gchar **rm_number_full_many(const gchar * const *numbers, gsize n_numbers, gboolean country_code_prefix);
 gchar *rm_number_format(RmProfile *profile, const gchar *number, RmNumberFormats output_format);
 gchar *rm_number_canonize(const gchar *number);
 
+/**
+ * RM_NUMBER_E164_SIZE:
+ *
+ * Buffer size needed for an E.164 number (15 digits) including the terminating nul byte.
+ */
+#define RM_NUMBER_E164_SIZE 16
+
+gsize rm_number_e164(RmNumberPlan *plan, const gchar *number, gchar *buffer, gsize size);
+guint64 rm_number_pack(const gchar *digits, gsize len);
+gsize rm_number_unpack(guint64 key, gchar *buffer);
+guint64 rm_number_key(RmNumberPlan *plan, const gchar *number);
+
 G_END_DECLS
 
 #endif
@@ -451,6 +451,51 @@ void rm_profile_set_addressbook(RmProfile *profile, RmAddressBook *book)
 	g_settings_set_string(profile->settings, "address-book-plugin", rm_addressbook_get_name(book));
 }
 
+/**
+ * rm_profile_get_addressbooks:
+ * @profile: a #RmProfile
+ *
+ * Get all address books used for number lookups in priority order: the preferred address book
+ * first, followed by the additional address books in configured order.
+ *
+ * Returns: list of #RmAddressBook, free with g_list_free()
+ */
+GList *rm_profile_get_addressbooks(RmProfile *profile)
+{
+	RmAddressBook *book = rm_profile_get_addressbook(profile);
+	gchar **names = g_settings_get_strv(profile->settings, "address-book-plugins");
+	GList *books = NULL;
+	gint i;
+
+	if (book) {
+		books = g_list_append(books, book);
+	}
+
+	for (i = 0; names[i]; i++) {
+		book = rm_addressbook_get(names[i]);
+
+		if (book && !g_list_find(books, book)) {
+			books = g_list_append(books, book);
+		}
+	}
+
+	g_strfreev(names);
+
+	return books;
+}
+
+/**
+ * rm_profile_set_addressbooks:
+ * @profile: a #RmProfile
+ * @names: names of additional address books, highest priority first
+ *
+ * Sets additional address books queried for number lookups.
+ */
+void rm_profile_set_addressbooks(RmProfile *profile, const gchar * const *names)
+{
+	g_settings_set_strv(profile->settings, "address-book-plugins", names);
+}
+
 /**
  * rm_profile_get_audio:
  * @profile: a #RmProfile
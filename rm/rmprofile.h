@@ -69,6 +69,8 @@ void rm_profile_set_login_user(RmProfile *profile, const gchar *user);
 void rm_profile_set_login_password(RmProfile *profile, const gchar *password);
 RmAddressBook *rm_profile_get_addressbook(RmProfile *profile);
 void rm_profile_set_addressbook(RmProfile *profile, RmAddressBook *book);
+GList *rm_profile_get_addressbooks(RmProfile *profile);
+void rm_profile_set_addressbooks(RmProfile *profile, const gchar * const *names);
 RmAudio *rm_profile_get_audio(RmProfile *profile);
 gchar *rm_profile_get_audio_ringtone(RmProfile *profile);
 RmNotification *rm_profile_get_notification(RmProfile *profile);
@@ -0,0 +1,315 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <rm/rmtrie.h>
+
+/**
+ * SECTION:rmtrie
+ * @title: RmTrie
+ * @short_description: Byte-wise prefix tree
+ *
+ * A compact prefix tree keyed by byte strings (e.g. case-folded UTF-8 tokens or number digits).
+ * Each key can carry several values, prefix walks are done breadth first so that shorter
+ * (closer) completions are reported first.
+ */
+
+typedef struct _RmTrieNode RmTrieNode;
+
+struct _RmTrieNode {
+	/* Sorted child key bytes, parallel to children */
+	guchar *keys;
+	RmTrieNode **children;
+	guint n_children;
+	GPtrArray *values;
+};
+
+struct _RmTrie {
+	RmTrieNode *root;
+	GDestroyNotify value_free;
+	guint n_nodes;
+};
+
+/**
+ * rm_trie_node_free:
+ * @trie: a #RmTrie
+ * @node: a #RmTrieNode
+ *
+ * Frees @node and all of its children.
+ */
+static void rm_trie_node_free(RmTrie *trie, RmTrieNode *node)
+{
+	guint i;
+
+	for (i = 0; i < node->n_children; i++) {
+		rm_trie_node_free(trie, node->children[i]);
+	}
+
+	if (node->values) {
+		if (trie->value_free) {
+			g_ptr_array_foreach(node->values, (GFunc)trie->value_free, NULL);
+		}
+		g_ptr_array_free(node->values, TRUE);
+	}
+
+	g_free(node->keys);
+	g_free(node->children);
+	g_slice_free(RmTrieNode, node);
+}
+
+/**
+ * rm_trie_node_find:
+ * @node: a #RmTrieNode
+ * @key: key byte
+ * @position: location for insert position or %NULL
+ *
+ * Binary search for child @key within @node.
+ *
+ * Returns: child node or %NULL if not present
+ */
+static RmTrieNode *rm_trie_node_find(RmTrieNode *node, guchar key, guint *position)
+{
+	guint low = 0;
+	guint high = node->n_children;
+
+	while (low < high) {
+		guint mid = (low + high) / 2;
+
+		if (node->keys[mid] == key) {
+			return node->children[mid];
+		} else if (node->keys[mid] < key) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	if (position) {
+		*position = low;
+	}
+
+	return NULL;
+}
+
+/**
+ * rm_trie_node_get:
+ * @trie: a #RmTrie
+ * @key: key string
+ * @create: whether missing nodes should be created
+ *
+ * Walks down the tree along @key.
+ *
+ * Returns: node of @key or %NULL if not present and @create is %FALSE
+ */
+static RmTrieNode *rm_trie_node_get(RmTrie *trie, const gchar *key, gboolean create)
+{
+	RmTrieNode *node = trie->root;
+	const guchar *ptr;
+
+	for (ptr = (const guchar*)key; *ptr; ptr++) {
+		RmTrieNode *child;
+		guint position;
+
+		child = rm_trie_node_find(node, *ptr, &position);
+		if (!child) {
+			if (!create) {
+				return NULL;
+			}
+
+			child = g_slice_new0(RmTrieNode);
+			trie->n_nodes++;
+
+			node->keys = g_renew(guchar, node->keys, node->n_children + 1);
+			node->children = g_renew(RmTrieNode*, node->children, node->n_children + 1);
+			memmove(node->keys + position + 1, node->keys + position, node->n_children - position);
+			memmove(node->children + position + 1, node->children + position, (node->n_children - position) * sizeof(RmTrieNode*));
+			node->keys[position] = *ptr;
+			node->children[position] = child;
+			node->n_children++;
+		}
+
+		node = child;
+	}
+
+	return node;
+}
+
+/**
+ * rm_trie_new:
+ * @value_free: function to free values or %NULL
+ *
+ * Creates a new empty prefix tree.
+ *
+ * Returns: a new #RmTrie
+ */
+RmTrie *rm_trie_new(GDestroyNotify value_free)
+{
+	RmTrie *trie = g_slice_new0(RmTrie);
+
+	trie->root = g_slice_new0(RmTrieNode);
+	trie->value_free = value_free;
+	trie->n_nodes = 1;
+
+	return trie;
+}
+
+/**
+ * rm_trie_free:
+ * @trie: a #RmTrie
+ *
+ * Frees @trie and all stored values.
+ */
+void rm_trie_free(RmTrie *trie)
+{
+	if (!trie) {
+		return;
+	}
+
+	rm_trie_node_free(trie, trie->root);
+	g_slice_free(RmTrie, trie);
+}
+
+/**
+ * rm_trie_insert:
+ * @trie: a #RmTrie
+ * @key: key string
+ * @value: value to store
+ *
+ * Adds @value to the values of @key. Existing values are kept.
+ */
+void rm_trie_insert(RmTrie *trie, const gchar *key, gpointer value)
+{
+	RmTrieNode *node = rm_trie_node_get(trie, key, TRUE);
+
+	if (!node->values) {
+		node->values = g_ptr_array_sized_new(1);
+	}
+
+	g_ptr_array_add(node->values, value);
+}
+
+/**
+ * rm_trie_lookup:
+ * @trie: a #RmTrie
+ * @key: key string
+ *
+ * Exact match lookup.
+ *
+ * Returns: values stored for @key (owned by @trie) or %NULL
+ */
+GPtrArray *rm_trie_lookup(RmTrie *trie, const gchar *key)
+{
+	RmTrieNode *node = rm_trie_node_get(trie, key, FALSE);
+
+	return node ? node->values : NULL;
+}
+
+/**
+ * rm_trie_longest_prefix:
+ * @trie: a #RmTrie
+ * @key: key string
+ * @length: location to store length of matched key or %NULL
+ *
+ * Finds the longest key with values which is a prefix of @key, e.g. to detect number prefixes.
+ * Runs in O(length of @key).
+ *
+ * Returns: values of the longest matching key (owned by @trie) or %NULL
+ */
+GPtrArray *rm_trie_longest_prefix(RmTrie *trie, const gchar *key, gsize *length)
+{
+	RmTrieNode *node = trie->root;
+	GPtrArray *values = NULL;
+	const guchar *ptr;
+	gsize len = 0;
+
+	for (ptr = (const guchar*)key; *ptr; ptr++) {
+		node = rm_trie_node_find(node, *ptr, NULL);
+		if (!node) {
+			break;
+		}
+
+		if (node->values && node->values->len) {
+			values = node->values;
+			len = ptr - (const guchar*)key + 1;
+		}
+	}
+
+	if (length) {
+		*length = len;
+	}
+
+	return values;
+}
+
+/**
+ * rm_trie_foreach_prefix:
+ * @trie: a #RmTrie
+ * @prefix: key prefix
+ * @func: function called for each key starting with @prefix
+ * @user_data: user data passed to @func
+ *
+ * Walks all keys starting with @prefix breadth first, i.e. ordered by key length. Within one
+ * length keys are visited in byte order. The walk stops as soon as @func returns %FALSE.
+ */
+void rm_trie_foreach_prefix(RmTrie *trie, const gchar *prefix, RmTrieFunc func, gpointer user_data)
+{
+	RmTrieNode *node = rm_trie_node_get(trie, prefix, FALSE);
+	GQueue queue = G_QUEUE_INIT;
+	GQueue depths = G_QUEUE_INIT;
+
+	if (!node) {
+		return;
+	}
+
+	g_queue_push_tail(&queue, node);
+	g_queue_push_tail(&depths, GUINT_TO_POINTER(0));
+
+	while ((node = g_queue_pop_head(&queue))) {
+		guint depth = GPOINTER_TO_UINT(g_queue_pop_head(&depths));
+		guint i;
+
+		if (node->values && node->values->len && !func(node->values, depth, user_data)) {
+			break;
+		}
+
+		for (i = 0; i < node->n_children; i++) {
+			g_queue_push_tail(&queue, node->children[i]);
+			g_queue_push_tail(&depths, GUINT_TO_POINTER(depth + 1));
+		}
+	}
+
+	g_queue_clear(&queue);
+	g_queue_clear(&depths);
+}
+
+/**
+ * rm_trie_get_n_nodes:
+ * @trie: a #RmTrie
+ *
+ * Get number of nodes, e.g. for memory statistics.
+ *
+ * Returns: number of nodes
+ */
+guint rm_trie_get_n_nodes(RmTrie *trie)
+{
+	return trie ? trie->n_nodes : 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * The rm project
+ * Copyright (c) 2012-2017 Jan-Michael Brummer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __RM_TRIE_H__
+#define __RM_TRIE_H__
+
+#if !defined (__RM_H_INSIDE__) && !defined(RM_COMPILATION)
+#error "Only <rm/rm.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * RmTrie:
+ *
+ * The #RmTrie-struct contains only private fileds and should not be directly accessed.
+ */
+typedef struct _RmTrie RmTrie;
+
+/**
+ * RmTrieFunc:
+ * @values: values stored at the visited key
+ * @depth: number of bytes the visited key is longer than the prefix
+ * @user_data: user data
+ *
+ * Returns: %TRUE to continue the walk, %FALSE to stop it
+ */
+typedef gboolean (*RmTrieFunc)(GPtrArray *values, guint depth, gpointer user_data);
+
+RmTrie *rm_trie_new(GDestroyNotify value_free);
+void rm_trie_free(RmTrie *trie);
+void rm_trie_insert(RmTrie *trie, const gchar *key, gpointer value);
+GPtrArray *rm_trie_lookup(RmTrie *trie, const gchar *key);
+GPtrArray *rm_trie_longest_prefix(RmTrie *trie, const gchar *key, gsize *length);
+void rm_trie_foreach_prefix(RmTrie *trie, const gchar *prefix, RmTrieFunc func, gpointer user_data);
+guint rm_trie_get_n_nodes(RmTrie *trie);
+
+G_END_DECLS
+
+#endif
@@ -32,6 +32,7 @@
 #include <rm/rmmain.h>
 #include <rm/rmprofile.h>
 #include <rm/rmfile.h>
+#include <rm/rmexecutor.h>
 
 //#define VOX_DEBUG 1
 
@@ -42,8 +43,8 @@ typedef struct _RmVoxPlayback {
 	gchar *data;
 	/** Length of vox data */
 	gsize len;
-	/** Pointer to thread structure */
-	GThread *thread;
+	/** Playback stream job */
+	RmExecutorJob *job;
 	/** Speex structure */
 	gpointer speex;
 	/** audio device */
@@ -52,7 +53,7 @@ typedef struct _RmVoxPlayback {
 	gboolean ringtone;
 	/** audio private data */
 	gpointer audio_priv;
-	/** cancellable object for playback thread */
+	/** cancellable object for playback job */
 	GCancellable *cancel;
 	/** pause state (pause/playing) */
 	gboolean pause;
@@ -86,11 +87,9 @@ typedef struct _RmVoxPlayback {
  * rm_vox_playback_thread:
  * @user_data audio private pointer:
  *
- * Main playback thread
- *
- * Returns: %NULL
+ * Main playback job
  */
-static gpointer rm_vox_playback_thread(gpointer user_data)
+static void rm_vox_playback_thread(gpointer user_data)
 {
 	RmVoxPlayback *playback = user_data;
 	spx_int32_t frame_size;
@@ -104,12 +103,10 @@ static gpointer rm_vox_playback_thread(gpointer user_data)
 	playback->audio_priv = rm_audio_open(playback->audio, NULL);
 	if (!playback->audio_priv) {
 		g_debug("%s(): Could not open audio device", __FUNCTION__);
-		g_slice_free(RmVoxPlayback, playback);
 
 		//g_set_error(error, RM_ERROR, RM_ERROR_AUDIO, "%s", "Could not open audio device");
 
-
-		return NULL;
+		return;
 	}
 
 	speex_bits_init(&bits);
@@ -141,7 +138,7 @@ static gpointer rm_vox_playback_thread(gpointer user_data)
 
 	max_cnt = playback->cnt;
 	if (!max_cnt) {
-		return NULL;
+		return;
 	}
 
 	playback->offset = 0;
@@ -199,21 +196,16 @@ static gpointer rm_vox_playback_thread(gpointer user_data)
 #endif
 
 	speex_bits_destroy(&bits);
-	playback->thread = NULL;
 	rm_audio_close(playback->audio, playback->audio_priv);
-
-	return NULL;
 }
 
 /**
  * rm_vox_sf_playback_thread:
  * @user_data audio private pointer:
  *
- * Main playback thread
- *
- * Returns: %NULL
+ * Main playback job
  */
-static gpointer rm_vox_sf_playback_thread(gpointer user_data)
+static void rm_vox_sf_playback_thread(gpointer user_data)
 {
 	RmVoxPlayback *playback = user_data;
 	gint num_read;
@@ -223,9 +215,7 @@ static gpointer rm_vox_sf_playback_thread(gpointer user_data)
 	playback->audio_priv = rm_audio_open(playback->audio, playback->ringtone ? rm_profile_get_audio_ringtone(rm_profile_get_active()) : NULL);
 	if (!playback->audio_priv) {
 		g_debug("%s(): Could not open audio device", __FUNCTION__);
-		g_slice_free(RmVoxPlayback, playback);
-
-		return NULL;
+		return;
 	}
 
 	playback->offset = 0;
@@ -254,10 +244,7 @@ static gpointer rm_vox_sf_playback_thread(gpointer user_data)
 		playback->seconds = (gfloat)((gfloat)(playback->cnt) / (gfloat)8000);
 	}
 
-	playback->thread = NULL;
 	rm_audio_close(playback->audio, playback->audio_priv);
-
-	return NULL;
 }
 
 /**
@@ -274,10 +261,10 @@ gboolean rm_vox_play(RmVoxPlayback *playback)
 		return FALSE;
 	}
 
-	/* Pause music, cancel cancellable and join thread */
-	if (playback->thread) {
+	/* Pause music, cancel cancellable and wait for playback job */
+	if (playback->job) {
 		g_cancellable_cancel(playback->cancel);
-		g_thread_join(playback->thread);
+		rm_executor_job_wait(g_steal_pointer(&playback->job));
 	}
 
 	g_cancellable_reset(playback->cancel);
@@ -286,16 +273,16 @@ gboolean rm_vox_play(RmVoxPlayback *playback)
 	playback->fraction = 0;
 	playback->seconds = 0;
 
-	/* Start playback thread */
+	/* Start playback job */
 	playback->pause = FALSE;
 
 	if (playback->speex) {
-		playback->thread = g_thread_new("play vox", rm_vox_playback_thread, playback);
+		playback->job = rm_executor_submit(RM_EXECUTOR_PRIORITY_STREAM, "play vox", rm_vox_playback_thread, playback);
 	} else {
-		playback->thread = g_thread_new("play vox", rm_vox_sf_playback_thread, playback);
+		playback->job = rm_executor_submit(RM_EXECUTOR_PRIORITY_STREAM, "play vox", rm_vox_sf_playback_thread, playback);
 	}
 
-	return playback->thread != NULL;
+	return playback->job != NULL;
 }
 
 /**
@@ -333,12 +320,12 @@ gboolean rm_vox_shutdown(RmVoxPlayback *playback)
 		return FALSE;
 	}
 
-	/* Pause music, cancel cancellable and join thread */
+	/* Pause music, cancel cancellable and wait for playback job */
 	playback->pause = TRUE;
 
-	if (playback->thread) {
+	if (playback->job) {
 		g_cancellable_cancel(playback->cancel);
-		g_thread_join(playback->thread);
+		rm_executor_job_wait(g_steal_pointer(&playback->job));
 	}
 
 	if (playback->speex) {
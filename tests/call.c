@@ -3,7 +3,7 @@
 #include <string.h>
 
 #include <glib.h>
-#include <rm/rmcall.h>
+#include <rm/rm.h>
 
 static void test_scramble_call(void)
 {
@@ -45,6 +45,130 @@ static void test_rm_call_full_number(void)
 	g_assert_cmpstr(rm_number_full(number, FALSE), ==, "040123456");
 }
 
+/* German numbering plan with area code 30, call-by-call prefixes 010xx and 0100xx of built-in table */
+static RmNumberPlan *test_plan_new(void)
+{
+	return rm_number_plan_new_full("00", "0", "49", "30");
+}
+
+static void test_rm_number_e164(void)
+{
+	RmNumberPlan *plan = test_plan_new();
+	gchar buffer[RM_NUMBER_E164_SIZE];
+
+	/* Local, national and international numbers */
+	g_assert_cmpuint(rm_number_e164(plan, "123456", buffer, sizeof(buffer)), ==, 10);
+	g_assert_cmpstr(buffer, ==, "4930123456");
+	g_assert_cmpuint(rm_number_e164(plan, "030 / 123456", buffer, sizeof(buffer)), ==, 10);
+	g_assert_cmpstr(buffer, ==, "4930123456");
+	g_assert_cmpuint(rm_number_e164(plan, "+44 20 1234", buffer, sizeof(buffer)), ==, 8);
+	g_assert_cmpstr(buffer, ==, "44201234");
+	g_assert_cmpuint(rm_number_e164(plan, "00442012345", buffer, sizeof(buffer)), ==, 9);
+	g_assert_cmpstr(buffer, ==, "442012345");
+
+	/* Call-by-call prefix is removed */
+	g_assert_cmpuint(rm_number_e164(plan, "01013040123", buffer, sizeof(buffer)), ==, 7);
+	g_assert_cmpstr(buffer, ==, "4940123");
+	g_assert_cmpuint(rm_number_e164(plan, "010012040123", buffer, sizeof(buffer)), ==, 7);
+	g_assert_cmpstr(buffer, ==, "4940123");
+
+	/* Call-by-call prefix without a number behind */
+	g_assert_cmpuint(rm_number_e164(plan, "010", buffer, sizeof(buffer)), ==, 0);
+	g_assert_cmpuint(rm_number_e164(plan, "0101", buffer, sizeof(buffer)), ==, 0);
+	g_assert_cmpuint(rm_number_e164(plan, "01013", buffer, sizeof(buffer)), ==, 0);
+
+	/* 15 digits fit, 16 don't */
+	g_assert_cmpuint(rm_number_e164(plan, "+123456789012345", buffer, sizeof(buffer)), ==, 15);
+	g_assert_cmpstr(buffer, ==, "123456789012345");
+	g_assert_cmpuint(rm_number_e164(plan, "+1234567890123456", buffer, sizeof(buffer)), ==, 0);
+	g_assert_cmpuint(rm_number_e164(plan, "+123456789012345", buffer, 8), ==, 0);
+
+	/* Service codes and SIP addresses */
+	g_assert_cmpuint(rm_number_e164(plan, "*21#", buffer, sizeof(buffer)), ==, 0);
+	g_assert_cmpuint(rm_number_e164(plan, "#31#030123", buffer, sizeof(buffer)), ==, 0);
+	g_assert_cmpuint(rm_number_e164(plan, "123@sip.example.com", buffer, sizeof(buffer)), ==, 0);
+
+	/* Invalid arguments */
+	g_assert_cmpuint(rm_number_e164(plan, "", buffer, sizeof(buffer)), ==, 0);
+	g_assert_cmpuint(rm_number_e164(plan, "00", buffer, sizeof(buffer)), ==, 0);
+	g_assert_cmpuint(rm_number_e164(NULL, "030123456", buffer, sizeof(buffer)), ==, 0);
+
+	rm_number_plan_unref(plan);
+}
+
+static void test_rm_number_pack(void)
+{
+	gchar buffer[RM_NUMBER_E164_SIZE];
+	guint64 key;
+
+	/* Round trip */
+	key = rm_number_pack("123456789012345", 15);
+	g_assert_cmpuint(key, !=, 0);
+	g_assert_cmpuint(rm_number_unpack(key, buffer), ==, 15);
+	g_assert_cmpstr(buffer, ==, "123456789012345");
+
+	key = rm_number_pack("0", 1);
+	g_assert_cmpuint(rm_number_unpack(key, buffer), ==, 1);
+	g_assert_cmpstr(buffer, ==, "0");
+
+	/* Leading zeros are significant */
+	g_assert_cmpuint(rm_number_pack("007", 3), !=, rm_number_pack("7", 1));
+
+	/* Only @len digits are packed */
+	g_assert_cmpuint(rm_number_pack("4930123", 4), ==, rm_number_pack("4930", 4));
+
+	/* Invalid input */
+	g_assert_cmpuint(rm_number_pack("", 0), ==, 0);
+	g_assert_cmpuint(rm_number_pack("1234567890123456", 16), ==, 0);
+	g_assert_cmpuint(rm_number_pack("12*4", 4), ==, 0);
+	g_assert_cmpuint(rm_number_pack("+49", 3), ==, 0);
+}
+
+static void test_rm_number_key(void)
+{
+	RmNumberPlan *plan = test_plan_new();
+	gchar buffer[RM_NUMBER_E164_SIZE];
+	guint64 key = rm_number_key(plan, "030 123456");
+
+	/* All notations of one number give the same key */
+	g_assert_cmpuint(key, !=, 0);
+	g_assert_cmpuint(rm_number_key(plan, "123456"), ==, key);
+	g_assert_cmpuint(rm_number_key(plan, "+49 30 123456"), ==, key);
+	g_assert_cmpuint(rm_number_key(plan, "0049-30-123456"), ==, key);
+	g_assert_cmpuint(rm_number_key(plan, "01013030123456"), ==, key);
+	g_assert_cmpuint(rm_number_key(plan, "030123457"), !=, key);
+
+	g_assert_cmpuint(rm_number_unpack(key, buffer), ==, 10);
+	g_assert_cmpstr(buffer, ==, "4930123456");
+
+	/* Numbers without E.164 representation */
+	g_assert_cmpuint(rm_number_key(plan, "**610"), ==, 0);
+	g_assert_cmpuint(rm_number_key(plan, "user@sip.example.com"), ==, 0);
+	g_assert_cmpuint(rm_number_key(plan, ""), ==, 0);
+	g_assert_cmpuint(rm_number_key(NULL, "030123456"), ==, 0);
+
+	rm_number_plan_unref(plan);
+}
+
+static void test_rm_number_full_many(void)
+{
+	const gchar *numbers[] = { "030123456", "", NULL, "*21#", "+4940123" };
+	gchar **result;
+
+	/* Without active profile numbers are copied unchanged */
+	result = rm_number_full_many(numbers, G_N_ELEMENTS(numbers), FALSE);
+	g_assert_cmpstr(result[0], ==, "030123456");
+	g_assert_null(result[1]);
+	g_assert_null(result[2]);
+	g_assert_cmpstr(result[3], ==, "*21#");
+	g_assert_cmpstr(result[4], ==, "+4940123");
+	g_free(result);
+
+	/* Empty batch */
+	result = rm_number_full_many(NULL, 0, FALSE);
+	g_free(result);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
@@ -52,6 +176,10 @@ int main(int argc, char **argv)
 	g_test_add_func("/call/scramble", test_scramble_call);
 	g_test_add_func("/call/canonize", test_rm_call_canonize_number);
 	//g_test_add("/call/fullnumber", NULL, test_rm_call_full_number);
+	g_test_add_func("/number/e164", test_rm_number_e164);
+	g_test_add_func("/number/pack", test_rm_number_pack);
+	g_test_add_func("/number/key", test_rm_number_key);
+	g_test_add_func("/number/full_many", test_rm_number_full_many);
 
 	return g_test_run();
 }
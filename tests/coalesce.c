@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <rm/rm.h>
+
+#define TEST_COALESCE_THREADS 4
+
+typedef struct {
+	RmCoalesce *coalesce;
+	gint calls;
+	/* Set once the first operation may finish */
+	gint released;
+} coalesce_fixture;
+
+static gpointer test_coalesce_func(const gchar *key, gpointer user_data)
+{
+	coalesce_fixture *cf = user_data;
+
+	g_atomic_int_inc(&cf->calls);
+
+	while (!g_atomic_int_get(&cf->released)) {
+		g_usleep(1000);
+	}
+
+	return g_strconcat("result-", key, NULL);
+}
+
+static void test_coalesce_init(coalesce_fixture *cf, gconstpointer user_data)
+{
+	cf->coalesce = rm_coalesce_new((GBoxedCopyFunc)g_strdup, g_free);
+	cf->calls = 0;
+	cf->released = 0;
+}
+
+static void test_coalesce_shutdown(coalesce_fixture *cf, gconstpointer user_data)
+{
+	rm_coalesce_free(cf->coalesce);
+}
+
+static void test_coalesce_sequential(coalesce_fixture *cf, gconstpointer user_data)
+{
+	gchar *result;
+
+	cf->released = 1;
+
+	/* Finished operations are not cached, late callers run their own */
+	result = rm_coalesce_run(cf->coalesce, "030123", test_coalesce_func, cf);
+	g_assert_cmpstr(result, ==, "result-030123");
+	g_free(result);
+
+	result = rm_coalesce_run(cf->coalesce, "030123", test_coalesce_func, cf);
+	g_assert_cmpstr(result, ==, "result-030123");
+	g_free(result);
+
+	g_assert_cmpint(cf->calls, ==, 2);
+}
+
+static gpointer test_coalesce_thread(gpointer data)
+{
+	coalesce_fixture *cf = data;
+
+	return rm_coalesce_run(cf->coalesce, "030123", test_coalesce_func, cf);
+}
+
+static void test_coalesce_concurrent(coalesce_fixture *cf, gconstpointer user_data)
+{
+	GThread *threads[TEST_COALESCE_THREADS];
+	gint i;
+
+	for (i = 0; i < TEST_COALESCE_THREADS; i++) {
+		threads[i] = g_thread_new("coalesce", test_coalesce_thread, cf);
+	}
+
+	/* Give all threads time to join the first operation */
+	while (!g_atomic_int_get(&cf->calls)) {
+		g_usleep(1000);
+	}
+	g_usleep(100 * 1000);
+	g_atomic_int_set(&cf->released, 1);
+
+	/* Every caller owns its copy of the single result */
+	for (i = 0; i < TEST_COALESCE_THREADS; i++) {
+		gchar *result = g_thread_join(threads[i]);
+
+		g_assert_cmpstr(result, ==, "result-030123");
+		g_free(result);
+	}
+
+	g_assert_cmpint(cf->calls, ==, 1);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/coalesce/sequential", coalesce_fixture, NULL, test_coalesce_init, test_coalesce_sequential, test_coalesce_shutdown);
+	g_test_add("/coalesce/concurrent", coalesce_fixture, NULL, test_coalesce_init, test_coalesce_concurrent, test_coalesce_shutdown);
+
+	return g_test_run();
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <rm/rm.h>
+
+static gint test_trie_freed;
+
+static void test_trie_value_free(gpointer data)
+{
+	test_trie_freed++;
+}
+
+static void test_rm_trie_lookup(void)
+{
+	RmTrie *trie = rm_trie_new(test_trie_value_free);
+	GPtrArray *values;
+
+	rm_trie_insert(trie, "anna", GINT_TO_POINTER(1));
+	rm_trie_insert(trie, "anna", GINT_TO_POINTER(2));
+	rm_trie_insert(trie, "andreas", GINT_TO_POINTER(3));
+
+	/* Several values per key, kept in insert order */
+	values = rm_trie_lookup(trie, "anna");
+	g_assert_nonnull(values);
+	g_assert_cmpuint(values->len, ==, 2);
+	g_assert_cmpint(GPOINTER_TO_INT(g_ptr_array_index(values, 0)), ==, 1);
+	g_assert_cmpint(GPOINTER_TO_INT(g_ptr_array_index(values, 1)), ==, 2);
+
+	/* Inner nodes and unknown keys carry no values */
+	g_assert_null(rm_trie_lookup(trie, "an"));
+	g_assert_null(rm_trie_lookup(trie, "bert"));
+
+	/* Root, shared "an" and one node per remaining byte */
+	g_assert_cmpuint(rm_trie_get_n_nodes(trie), ==, 1 + 2 + 2 + 5);
+
+	test_trie_freed = 0;
+	rm_trie_free(trie);
+	g_assert_cmpint(test_trie_freed, ==, 3);
+}
+
+static void test_rm_trie_longest_prefix(void)
+{
+	RmTrie *trie = rm_trie_new(NULL);
+	GPtrArray *values;
+	gsize length;
+
+	rm_trie_insert(trie, "0", GINT_TO_POINTER(1));
+	rm_trie_insert(trie, "010", GINT_TO_POINTER(3));
+	rm_trie_insert(trie, "01013", GINT_TO_POINTER(5));
+
+	values = rm_trie_longest_prefix(trie, "01013123", &length);
+	g_assert_nonnull(values);
+	g_assert_cmpint(GPOINTER_TO_INT(g_ptr_array_index(values, 0)), ==, 5);
+	g_assert_cmpuint(length, ==, 5);
+
+	/* Falls back to shorter key if the longer one doesn't match completely */
+	values = rm_trie_longest_prefix(trie, "01019", &length);
+	g_assert_nonnull(values);
+	g_assert_cmpint(GPOINTER_TO_INT(g_ptr_array_index(values, 0)), ==, 3);
+	g_assert_cmpuint(length, ==, 3);
+
+	/* Exact match */
+	values = rm_trie_longest_prefix(trie, "0", &length);
+	g_assert_nonnull(values);
+	g_assert_cmpuint(length, ==, 1);
+
+	/* No match */
+	g_assert_null(rm_trie_longest_prefix(trie, "9010", &length));
+	g_assert_cmpuint(length, ==, 0);
+	g_assert_null(rm_trie_longest_prefix(trie, "", &length));
+	g_assert_cmpuint(length, ==, 0);
+	g_assert_null(rm_trie_longest_prefix(trie, "1", NULL));
+
+	rm_trie_free(trie);
+}
+
+static gboolean test_trie_collect(GPtrArray *values, guint depth, gpointer user_data)
+{
+	GString *str = user_data;
+
+	g_string_append_printf(str, "%d:%u ", GPOINTER_TO_INT(g_ptr_array_index(values, 0)), depth);
+
+	/* Stop after three keys */
+	return str->len < 12;
+}
+
+static void test_rm_trie_foreach_prefix(void)
+{
+	RmTrie *trie = rm_trie_new(NULL);
+	GString *str = g_string_new(NULL);
+
+	rm_trie_insert(trie, "abcd", GINT_TO_POINTER(4));
+	rm_trie_insert(trie, "ab", GINT_TO_POINTER(2));
+	rm_trie_insert(trie, "abd", GINT_TO_POINTER(6));
+	rm_trie_insert(trie, "abc", GINT_TO_POINTER(3));
+	rm_trie_insert(trie, "b", GINT_TO_POINTER(9));
+
+	/* Breadth first, byte order within one length, stops once callback returns FALSE */
+	rm_trie_foreach_prefix(trie, "ab", test_trie_collect, str);
+	g_assert_cmpstr(str->str, ==, "2:0 3:1 6:1 ");
+
+	/* Unknown prefix */
+	g_string_truncate(str, 0);
+	rm_trie_foreach_prefix(trie, "x", test_trie_collect, str);
+	g_assert_cmpstr(str->str, ==, "");
+
+	g_string_free(str, TRUE);
+	rm_trie_free(trie);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/trie/lookup", test_rm_trie_lookup);
+	g_test_add_func("/trie/longest_prefix", test_rm_trie_longest_prefix);
+	g_test_add_func("/trie/foreach_prefix", test_rm_trie_foreach_prefix);
+
+	return g_test_run();
+}